@@ -76,6 +76,24 @@ if __name__ == "__main__":
         s.sock.shutdown(0)
         s.sock.close()
 
+    elif (sys.argv[1] == 'T'):
+        # software trace: T start|stop|<file> <host>; convert the file with tools/sw_trace_json
+        s = mysocket()
+        s.connect(sys.argv[3], 64)
+        s.mysend(pack("<H", 0xFF77))
+        s.mysend(pack("<H", 1))
+        if sys.argv[2] == 'start':
+            s.mysend(pack("B", 1))
+        elif sys.argv[2] == 'stop':
+            s.mysend(pack("B", 0))
+        else:
+            s.mysend(pack("B", 2))
+            size = unpack("<L", s.myreceive(4))[0]
+            with open(sys.argv[2], "wb") as f:
+                f.write(s.myreceive(size))
+        s.sock.shutdown(0)
+        s.sock.close()
+
     elif (sys.argv[1] == 'i'):
         with open(sys.argv[2], "rb") as f:
             bytes = f.read(200000) # max 200K 
@@ -28,7 +28,7 @@ your application. */
 
 /* Hook function related definitions. */
 #define configUSE_IDLE_HOOK                     0
-#define configUSE_TICK_HOOK                     0
+#define configUSE_TICK_HOOK                     1
 #define configCHECK_FOR_STACK_OVERFLOW          0
 #define configUSE_MALLOC_FAILED_HOOK            0
 
@@ -81,7 +81,8 @@ void vAssertCalled( const char* fileName, uint16_t lineNo );
 
 #include "profiler.h"
 #define traceTASK_SWITCHED_OUT(x)  PROFILER_TASK = 0;
-#define traceTASK_SWITCHED_IN(x)   PROFILER_TASK = pxCurrentTCB->uxTCBNumber;
+#define traceTASK_SWITCHED_IN(x)   do { PROFILER_TASK = pxCurrentTCB->uxTCBNumber; \
+                                        sw_trace_task_switched_in(pxCurrentTCB->uxTCBNumber, pxCurrentTCB->pcTaskName); } while(0);
 //#define traceTASK_SWITCHED_IN(x)   do { PROFILER_TASK = pxCurrentTCB->uxTCBNumber; outbyte(0x40 + (pxCurrentTCB->uxTCBNumber)); } while(0);
 
 #endif /* FREERTOS_CONFIG_H */
@@ -11,6 +11,7 @@ extern "C" {
 	#include "itu.h"
 	#include "xmodem.h"
     #include "small_printf.h"
+    #include "lz_image.h"
 }
 
 #define APPLICATION_RUN_ADDRESS 0x10000
@@ -109,9 +110,15 @@ int init_fat_on_sd(void)
     return init_fat();
 }
 
+static uint32_t read_from_file(void *context, void *buffer, uint32_t length)
+{
+    uint32_t bytes_read = 0;
+    f_read((FIL *)context, buffer, length, &bytes_read);
+    return bytes_read;
+}
+
 FRESULT try_loading(const char *filename, uint32_t run_address)
 {
-    uint16_t dummy;
     FIL file;
     FRESULT res = fs_open(&fs, filename, FA_READ, &file);
 
@@ -119,9 +126,22 @@ FRESULT try_loading(const char *filename, uint32_t run_address)
     if(res != FR_OK) {
         return res;
     }
+
+    // The image is either raw, or packed by lzpack; the first bytes tell which.
+    uint8_t *dest = (uint8_t *)run_address;
     uint32_t bytes_read = 0;
-    res = f_read(&file, (void *)run_address, APPLICATION_MAX_LENGTH, &bytes_read);
-    printf("Bytes read: %d (0x%6x)\n", bytes_read, bytes_read);
+    lz_image_header_t header;
+    res = f_read(&file, dest, LZ_IMAGE_HEADER_SIZE, &bytes_read);
+    if ((res == FR_OK) && (bytes_read == LZ_IMAGE_HEADER_SIZE) && (lz_image_header(dest, &header) == LZ_IMAGE_OK)) {
+        int lz = lz_image_load(&header, read_from_file, &file, dest, APPLICATION_MAX_LENGTH);
+        printf("Packed image: %d -> %d bytes, result = %d\n", header.packed, header.length, lz);
+        bytes_read = (lz == LZ_IMAGE_OK) ? header.length : 0;
+    } else if (res == FR_OK) {
+        uint32_t rest = 0;
+        res = f_read(&file, dest + bytes_read, APPLICATION_MAX_LENGTH - bytes_read, &rest);
+        bytes_read += rest;
+        printf("Bytes read: %d (0x%6x)\n", bytes_read, bytes_read);
+    }
     
     f_close(&file);
 
@@ -133,6 +153,19 @@ FRESULT try_loading(const char *filename, uint32_t run_address)
     return FR_INVALID_OBJECT;
 }
 
+typedef struct {
+    Flash *flash;
+    int address;
+} t_flash_reader;
+
+static uint32_t read_from_flash(void *context, void *buffer, uint32_t length)
+{
+    t_flash_reader *reader = (t_flash_reader *)context;
+    reader->flash->read_dev_addr(reader->address, length, buffer);
+    reader->address += length;
+    return length;
+}
+
 int try_flash(void)
 {
 	Flash *flash = get_flash();
@@ -148,7 +181,20 @@ int try_flash(void)
     
     printf("Application length = %08x, version %s\n", length, version);
     if(length != 0xFFFFFFFF) {
-        flash->read_dev_addr(image_addr.device_addr+16, length, (void *)APPLICATION_RUN_ADDRESS); // we should use flash->read_image here
+        // A packed image is decompressed while it is read, so only the packed bytes come from the flash
+        lz_image_header_t header;
+        uint8_t *dest = (uint8_t *)APPLICATION_RUN_ADDRESS;
+        flash->read_dev_addr(image_addr.device_addr+16, LZ_IMAGE_HEADER_SIZE, dest);
+        if (lz_image_header(dest, &header) == LZ_IMAGE_OK) {
+            t_flash_reader reader = { flash, image_addr.device_addr + 16 + LZ_IMAGE_HEADER_SIZE };
+            int lz = lz_image_load(&header, read_from_flash, &reader, dest, APPLICATION_MAX_LENGTH);
+            printf("Packed image: %d -> %d bytes, result = %d\n", header.packed, header.length, lz);
+            if (lz != LZ_IMAGE_OK) {
+                return 0;
+            }
+        } else {
+            flash->read_dev_addr(image_addr.device_addr+16, length, (void *)APPLICATION_RUN_ADDRESS); // we should use flash->read_image here
+        }
 
         jump_run(APPLICATION_RUN_ADDRESS);
         return 1;
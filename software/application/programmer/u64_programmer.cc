@@ -192,6 +192,7 @@ Screen *screen;
 extern "C" {
     static void screen_outbyte(int c) {
         screen->output(c);
+        screen->sync();
     }
 }
 
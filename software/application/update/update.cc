@@ -14,6 +14,7 @@ extern "C" {
 #include "c64.h"
 #include "overlay.h"
 #include "flash.h"
+#include "flash_delta.h"
 #include "screen.h"
 #include "keyboard.h"
 #include "sd_card.h"
@@ -178,39 +179,24 @@ bool need_update(int id, char *version, char *descr)
     return (strcmp(version, current)!=0);
 }
 
-bool my_memcmp(void *a, void *b, int len)
+static void flash_progress(void *context, int page)
 {
-    uint32_t *pula = (uint32_t *)a;
-    uint32_t *pulb = (uint32_t *)b;
-    len >>= 2;
-    while(len--) {
-        if(*pula != *pulb) {
-            console_print(screen, "ERR: %p: %8x, %p %8x.\n", pula, *pula, pulb, *pulb);
-            return false;
-        }
-        pula++;
-        pulb++;
-    }
-    return true;
+    console_print(screen, "Programming %d  \r", page);
 }
 
-static int last_sector = -1;	
-
 bool flash_buffer(int id, void *buffer, void *buf_end, char *version, char *descr)
 {
     int length = (int)buf_end - (int)buffer;
 	t_flash_address image_address;
 	flash->get_image_addresses(id, &image_address);
 	int address = image_address.start;
-    int page_size = flash->get_page_size();
-    int page = address / page_size;
-    char *p;
-    char *verify_buffer = new char[page_size]; // is never freed, but the hell we care!
+    uint8_t *p;
+    uint8_t *bin = NULL;
 
     //console_print(screen, "            \n");
     if(image_address.has_header) {
         console_print(screen, "Flashing  \033\027%s\033\037,\n  version \033\027%s\033\037..\n", descr, version);
-        uint8_t *bin = new uint8_t[length+16];
+        bin = new uint8_t[length+16];
         uint32_t *pul;
         pul = (uint32_t *)bin;
         *(pul++) = (uint32_t)length;
@@ -218,54 +204,27 @@ bool flash_buffer(int id, void *buffer, void *buf_end, char *version, char *desc
         strcpy((char*)pul, version);
         memcpy(bin+16, buffer, length);
         length+=16;
-        p = (char *)bin;
+        p = bin;
     }
     else {
         console_print(screen, "Flashing  \033\027%s\033\037..\n", descr);
-        p = (char *)buffer;
+        p = (uint8_t *)buffer;
     }    
-    
-	bool do_erase = flash->need_erase();
-	int sector;
-    while(length > 0) {
-		if (do_erase) {
-			sector = flash->page_to_sector(page);
-			if (sector != last_sector) {
-				last_sector = sector;
-				// console_print(screen, "Erasing     %d   \r", sector);
-				if(!flash->erase_sector(sector)) {
-			        // user_interface->popup("Erasing failed...", BUTTON_CANCEL);
-			        return false;
-				}
-			}
-		}
-        console_print(screen, "Programming %d  \r", page);
-        int retry = 3;
-        while(retry > 0) {
-            retry --;
-            if(!flash->write_page(page, p)) {
-                console_print(screen, "Programming error on page %d.\n", page);
-                continue;    
-            }
-            flash->read_page(page, verify_buffer);
-            if(!my_memcmp(verify_buffer, p, page_size)) {
-                console_print(screen, "Verify failed on page %d. Retry %d.\n", page, retry);
-                console_print(screen, "%p %p %d\n", verify_buffer, p, page_size);
-                dump_hex(verify_buffer, 32);
-                dump_hex(p, 32);
-                continue;
-            }
-            retry = -2;
-        }
-        if(retry != -2) {                
-            //user_interface->popup("Programming failed...", BUTTON_CANCEL);
-            return false;
-        }
-        page ++;
-        p += page_size;
-        length -= page_size;
-    }
 
+    // Sectors that already hold the right data are not erased or programmed again
+    FlashDeltaWriter writer(flash);
+    writer.set_progress(flash_progress, NULL);
+    int ret = writer.write(address, p, length);
+    if (bin) {
+        delete[] bin;
+    }
+    if (ret) {
+        console_print(screen, "Programming failed (%d).\n", ret);
+        //user_interface->popup("Programming failed...", BUTTON_CANCEL);
+        return false;
+    }
+    console_print(screen, "%d sectors unchanged, %d erased, %d pages written. CRC = %8x\n",
+            writer.stats.sectors_skipped, writer.stats.sectors_erased, writer.stats.pages_written, writer.get_crc());
     return true;    
 }
 
@@ -286,7 +245,6 @@ bool program_flash(bool do_update1, bool do_update2, bool do_roms)
 	uint8_t *roms;
 	
 	flash->protect_disable();
-	last_sector = -1;
     int fpga_type = (getFpgaCapabilities() & CAPAB_FPGA_TYPE) >> FPGA_TYPE_SHIFT;
 	if(do_update1) {
         bool ok;
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h> // C library
 #include "mystring.h" // my class definition
+#include "pool.h"
 extern "C" {
     #include "small_printf.h"
 }
@@ -18,7 +19,7 @@ mstring :: mstring(const char *k)
 //    printf("Create mstring from char*. Source = %s\n", k);
     alloc = 1+strlen(k);
     temporary = 0;
-    cp = new char[alloc];
+    cp = pool_alloc_string(alloc);
     strcpy(cp, k);
 }
 
@@ -27,7 +28,7 @@ mstring :: mstring(mstring &ref)
 //    printf("Creating mstring from reference. (source: %s)\n", ref.cp);
     alloc = ref.alloc;
     temporary = 0;
-    cp = new char[alloc];
+    cp = pool_alloc_string(alloc);
     strcpy(cp, ref.cp);
 }
 
@@ -35,7 +36,7 @@ mstring :: ~mstring()
 {
 //    printf("Deleting mstring %s (this=%p)\n", cp, this);
     if(cp)
-        delete[] cp;
+        pool_free_string(cp, alloc);
 }
 
 const char *mstring :: c_str(void)
@@ -63,9 +64,9 @@ mstring& mstring :: operator=(const char *rhs)
     int n = strlen(rhs);
     if((n+1) > alloc) {    
         if(cp) {
-            delete[] cp;
+            pool_free_string(cp, alloc);
         }
-        cp = new char[n+1];
+        cp = pool_alloc_string(n+1);
         alloc = n+1;
     }
     strcpy(cp, rhs);
@@ -78,9 +79,9 @@ mstring& mstring :: operator=(mstring &rhs)
     if(this != &rhs) {
         if((rhs.length()+1) > alloc) {
             if (cp) {
-                delete[] cp;
+                pool_free_string(cp, alloc);
             }
-            cp = new char[rhs.alloc];
+            cp = pool_alloc_string(rhs.alloc);
             alloc = rhs.alloc;
         }
         strcpy(cp, rhs.cp);
@@ -94,18 +95,18 @@ mstring& mstring :: operator+=(const char rhs)
 {
     int n = length() + 2;
     if(n > alloc) { // doesnt fit
-        char *new_cp = new char[n];
-        alloc = n;
+        char *new_cp = pool_alloc_string(n);
         if (cp) {
             strcpy(new_cp, cp);
             new_cp[n-2] = rhs;
             new_cp[n-1] = 0;
-            delete[] cp;
+            pool_free_string(cp, alloc);
         } else {
             new_cp[n-2] = rhs;
             new_cp[n-1] = 0;
         }
         cp = new_cp;
+        alloc = n;
     } else { // fits
         cp[n-2] = rhs;
         cp[n-1] = 0;
@@ -118,16 +119,16 @@ mstring& mstring :: operator+=(const char *rhs)
     int n = length() + strlen(rhs) + 1;
 //    printf("New n = %d.\n", n);
     if(n > alloc) { // doesnt fit
-        char *new_cp = new char[n];
-        alloc = n;
+        char *new_cp = pool_alloc_string(n);
         if (cp) {
             strcpy(new_cp, cp);
             strcat(new_cp, rhs);
-            delete[] cp;
+            pool_free_string(cp, alloc);
         } else {
             strcpy(new_cp, rhs);
         }
         cp = new_cp;
+        alloc = n;
 //        printf("%s\n", new_cp);
     } else { // fits
 //        printf("Fits!");
@@ -140,16 +141,16 @@ mstring& mstring :: operator+=(mstring &rhs)
 {
     int n = length() + rhs.length() + 1;
     if(n > alloc) { // doesnt fit
-        char *new_cp = new char[n];
-        alloc = n;
+        char *new_cp = pool_alloc_string(n);
         if (cp) {
             strcpy(new_cp, cp);
             strcat(new_cp, rhs.cp);
-            delete[] cp;
+            pool_free_string(cp, alloc);
         } else {
             strcpy(new_cp, rhs.cp);
         }
         cp = new_cp;
+        alloc = n;
     } else { // fits
         strcat(cp, rhs.cp);
     }
@@ -0,0 +1,245 @@
+#include <string.h>
+#include "pool.h"
+#include "memory.h"
+#include "file_info.h"
+#include "action.h"
+extern "C" {
+    #include "small_printf.h"
+}
+
+struct pool_slab_t {
+    pool_slab_t *next;
+    void        *free_list;   // blocks given back
+    uint8_t     *blocks;
+    uint16_t     used;
+    uint16_t     fresh;       // blocks handed out at least once; the ones after it never were
+    uint32_t     map[1];      // one bit per block in use; as many words as the slab needs
+};
+
+FixedPool *FixedPool :: first_pool;
+
+// The pools of the hot objects. Sizes are in blocks per slab.
+FixedPool file_info_pool("FileInfo", sizeof(FileInfo), 64);
+FixedPool action_pool("Action", sizeof(Action), 32);
+
+static FixedPool string8("String 8", 8, 128);
+static FixedPool string16("String 16", 16, 128);
+static FixedPool string24("String 24", 24, 64);
+static FixedPool string32("String 32", 32, 64);
+static FixedPool string48("String 48", 48, 32);
+static FixedPool string64("String 64", 64, 32);
+static FixedPool string96("String 96", 96, 16);
+static FixedPool string128("String 128", 128, 16);
+
+static FixedPool *const string_pools[] = { &string8, &string16, &string24, &string32,
+                                           &string48, &string64, &string96, &string128 };
+
+// Size class for (size - 1) / 8
+static const uint8_t string_class[POOL_MAX_STRING / 8] = { 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7 };
+
+FixedPool :: FixedPool(const char *name, int block_size, int per_slab)
+{
+    // The slabs and the counters are not touched; see pool.h
+    this->name = name;
+    if (block_size < (int)sizeof(void *)) {
+        block_size = sizeof(void *); // room for the link of the free list
+    }
+    this->block_size = (block_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    this->per_slab = per_slab;
+    next_pool = first_pool;
+    first_pool = this;
+}
+
+FixedPool :: ~FixedPool()
+{
+    FixedPool **pp = &first_pool;
+    while (*pp && (*pp != this)) {
+        pp = &(*pp)->next_pool;
+    }
+    if (*pp) {
+        *pp = next_pool;
+    }
+    // Slabs with objects in them are left alone; the objects may still be in use
+    if (leaks(true)) {
+        return;
+    }
+    while (slabs) {
+        pool_slab_t *s = slabs;
+        slabs = s->next;
+        delete[] (uint8_t *)s;
+    }
+}
+
+pool_slab_t *FixedPool :: new_slab(void)
+{
+    int words = (per_slab + 31) / 32;
+    size_t header = (sizeof(pool_slab_t) + (words - 1) * sizeof(uint32_t) + 7) & ~7;
+    uint8_t *mem = new uint8_t[header + per_slab * block_size];
+    if (!mem) {
+        return NULL;
+    }
+    pool_slab_t *s = (pool_slab_t *)mem;
+    memset(s, 0, header);
+    s->blocks = mem + header;
+    s->next = slabs;
+    slabs = s;
+    slab_count++;
+    empty_slabs++;
+    return s;
+}
+
+void FixedPool :: remove_slab(pool_slab_t *s)
+{
+    pool_slab_t **ps = &slabs;
+    while (*ps != s) {
+        ps = &(*ps)->next;
+    }
+    *ps = s->next;
+    if (current == s) {
+        current = slabs;
+    }
+    slab_count--;
+    delete[] (uint8_t *)s;
+}
+
+pool_slab_t *FixedPool :: slab_of(void *p)
+{
+    uint8_t *b = (uint8_t *)p;
+    uint32_t span = (uint32_t)per_slab * block_size;
+    if (current && (b >= current->blocks) && (b < current->blocks + span)) {
+        return current;
+    }
+    for (pool_slab_t *s = slabs; s; s = s->next) {
+        if ((b >= s->blocks) && (b < s->blocks + span)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+void *FixedPool :: alloc(size_t size)
+{
+    mem_lock();
+    pool_slab_t *s = current;
+    if ((size <= block_size) && (!s || (s->used == per_slab))) {
+        for (s = slabs; s && (s->used == per_slab); s = s->next)
+            ;
+        if (!s) {
+            s = new_slab();
+        }
+    }
+    if ((size > block_size) || !s) {
+        heap_allocs++;
+        mem_unlock();
+        return new uint8_t[size];
+    }
+
+    void *p;
+    if (s->free_list) {
+        p = s->free_list;
+        s->free_list = *(void **)p;
+    } else {
+        p = s->blocks + s->fresh++ * block_size;
+    }
+    int i = ((uint8_t *)p - s->blocks) / block_size;
+    s->map[i >> 5] |= (1 << (i & 31));
+    if (!s->used++) {
+        empty_slabs--;
+    }
+    current = s;
+    allocs++;
+    if (++live > peak) {
+        peak = live;
+    }
+    mem_unlock();
+    return p;
+}
+
+void FixedPool :: release(void *p)
+{
+    if (!p) {
+        return;
+    }
+    mem_lock();
+    pool_slab_t *s = slab_of(p);
+    if (!s) {
+        mem_unlock();
+        delete[] (uint8_t *)p;
+        return;
+    }
+    int i = ((uint8_t *)p - s->blocks) / block_size;
+    if (!(s->map[i >> 5] & (1 << (i & 31)))) {
+        mem_unlock();
+        printf("Pool %s: %p freed twice.\n", name, p);
+        return;
+    }
+    s->map[i >> 5] &= ~(1 << (i & 31));
+    *(void **)p = s->free_list;
+    s->free_list = p;
+    frees++;
+    live--;
+    current = s;
+    if (!--s->used) {
+        if (empty_slabs) {
+            remove_slab(s);
+        } else {
+            empty_slabs++;
+        }
+    }
+    mem_unlock();
+}
+
+int FixedPool :: leaks(bool report)
+{
+    int count = 0;
+    for (pool_slab_t *s = slabs; s; s = s->next) {
+        for (int i = 0; i < s->fresh; i++) {
+            if (s->map[i >> 5] & (1 << (i & 31))) {
+                if (report && (count < 16)) {
+                    printf("Pool %s: %p not freed\n", name, s->blocks + i * block_size);
+                }
+                count++;
+            }
+        }
+    }
+    if (report && count) {
+        printf("Pool %s: %d objects not freed.\n", name, count);
+    }
+    return count;
+}
+
+void FixedPool :: dump(void)
+{
+    printf("%-10s %4d %7d %7d %5d %9d %6d\n", name, block_size, live, peak, slab_count, allocs, heap_allocs);
+}
+
+void FixedPool :: dump_all(void)
+{
+    printf("Pool       size    live    peak slabs    allocs   heap\n");
+    for (FixedPool *p = first_pool; p; p = p->next_pool) {
+        p->dump();
+    }
+}
+
+char *pool_alloc_string(int size)
+{
+    if (size > POOL_MAX_STRING) {
+        return new char[size];
+    }
+    if (size < 1) {
+        size = 1;
+    }
+    return (char *)string_pools[string_class[(size - 1) >> 3]]->alloc(size);
+}
+
+void pool_free_string(char *p, int size)
+{
+    if (size > POOL_MAX_STRING) {
+        delete[] p;
+        return;
+    }
+    if (size < 1) {
+        size = 1;
+    }
+    string_pools[string_class[(size - 1) >> 3]]->release(p);
+}
@@ -0,0 +1,65 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Object pools for the small objects that come and go by the thousand: the FileInfo
+// entries of a directory listing, the Actions of every menu, and the name and path
+// strings. A pool hands out blocks of one size from slabs that it takes from the heap,
+// so the heap sees one allocation per slab instead of one per object, and the objects
+// of one listing lie together instead of spread over the holes of the heap.
+//
+// Pools are globals. The constructor only sets the block size and leaves the slabs and
+// the counters alone, which are zero before any constructor has run; so objects that
+// static constructors allocated before the pool was constructed stay valid. Until then,
+// alloc() takes the object from the heap, and release() gives it back there.
+
+struct pool_slab_t;
+
+class FixedPool
+{
+    const char  *name;
+    uint16_t     block_size;
+    uint16_t     per_slab;
+    pool_slab_t *slabs;
+    pool_slab_t *current;     // where the last block came from, or went to
+    FixedPool   *next_pool;   // all constructed pools, for dump_all()
+    static FixedPool *first_pool;
+
+    pool_slab_t *new_slab(void);
+    pool_slab_t *slab_of(void *p);
+    void remove_slab(pool_slab_t *s);
+public:
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t live;
+    uint32_t peak;
+    uint32_t slab_count;
+    uint32_t empty_slabs;     // at most one is kept, so that a pool does not flip a slab in and out
+    uint32_t heap_allocs;     // did not come from a slab: too large, or no slab could be allocated
+
+    FixedPool(const char *name, int block_size, int per_slab);
+    ~FixedPool();
+
+    void *alloc(size_t size);
+    void  release(void *p);   // also takes back what alloc() got from the heap
+    bool  owns(void *p) { return slab_of(p) != NULL; }
+    int   leaks(bool report); // objects still allocated; the destructor reports them
+    int   get_block_size(void) { return block_size; }
+
+    void  dump(void);
+    static void dump_all(void);
+};
+
+extern FixedPool file_info_pool;
+extern FixedPool action_pool;
+
+// Strings in size classes up to POOL_MAX_STRING bytes; longer ones come from the heap.
+// The size must be given on free as well: mstring and FileInfo both know it.
+#define POOL_MAX_STRING 128
+
+char *pool_alloc_string(int size);
+void  pool_free_string(char *p, int size);
+
+#endif
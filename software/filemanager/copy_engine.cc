@@ -0,0 +1,400 @@
+/*
+ * copy_engine.cc
+ *
+ * The reader task gets requests through a queue, reads them in order, and passes them
+ * back through a second queue. With two buffers, the calling task writes one while the
+ * reader fills the other. Without the OS, when the task could not be created, or when
+ * source and destination are on the same file system, the read is done on the spot, and
+ * the copy is sequential as before.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "copy_engine.h"
+#include "filemanager.h"
+#ifdef OS
+#include "task.h"
+#endif
+extern "C" {
+    #include "small_printf.h"
+}
+
+CopyEngine :: CopyEngine(FileManager *fm)
+{
+    this->fm = fm;
+    for (int i = 0; i < COPY_BUFFERS; i++) {
+        buffers[i] = NULL;
+    }
+    buffer_size = 0;
+    ready_head = 0;
+    ready_count = 0;
+    progress = NULL;
+    context = NULL;
+    verify = false;
+    cancelled = false;
+    total = 0;
+    done = 0;
+#ifdef OS
+    to_reader = NULL;
+    from_reader = NULL;
+    reader = false;
+    overlap = false;
+#endif
+}
+
+CopyEngine :: ~CopyEngine()
+{
+#ifdef OS
+    if (reader) {
+        // the reader gives the NULL back just before it deletes itself
+        copy_request_t *r = NULL;
+        xQueueSend(to_reader, &r, portMAX_DELAY);
+        xQueueReceive(from_reader, &r, portMAX_DELAY);
+    }
+    if (to_reader) {
+        vQueueDelete(to_reader);
+    }
+    if (from_reader) {
+        vQueueDelete(from_reader);
+    }
+#endif
+    for (int i = 0; i < COPY_BUFFERS; i++) {
+        free(buffers[i]);
+    }
+}
+
+bool CopyEngine :: allocate_buffers(void)
+{
+    if (buffer_size) {
+        return true;
+    }
+    // as large as the heap allows; a small buffer is still better than no copy at all
+    for (uint32_t size = COPY_MAX_BLOCK; size >= COPY_MIN_BLOCK; size >>= 1) {
+        int i;
+        for (i = 0; i < COPY_BUFFERS; i++) {
+            if (!(buffers[i] = (uint8_t *)malloc(size))) {
+                break;
+            }
+        }
+        if (i == COPY_BUFFERS) {
+            buffer_size = size;
+            break;
+        }
+        while (i > 0) {
+            free(buffers[--i]);
+            buffers[i] = NULL;
+        }
+    }
+    if (!buffer_size) {
+        return false;
+    }
+    for (int i = 0; i < COPY_BUFFERS; i++) {
+        requests[i].buffer = buffers[i];
+    }
+#ifdef OS
+    to_reader = xQueueCreate(COPY_BUFFERS + 1, sizeof(copy_request_t *));
+    from_reader = xQueueCreate(COPY_BUFFERS + 1, sizeof(copy_request_t *));
+    if (to_reader && from_reader) {
+        reader = (xTaskCreate(CopyEngine :: reader_task, "Copy Reader", configMINIMAL_STACK_SIZE, this,
+                uxTaskPriorityGet(NULL), NULL) == pdPASS);
+    }
+    if (!reader) {
+        printf("Copy: no reader task, copying without overlap.\n");
+    }
+#endif
+    return true;
+}
+
+// Some file systems return less than asked before the end of the file, so the buffer is
+// filled with as many reads as it takes. Anything short of full is the end of the file.
+static FRESULT read_full(File *f, uint8_t *buffer, uint32_t length, uint32_t *transferred)
+{
+    FRESULT res = FR_OK;
+    *transferred = 0;
+    while (*transferred < length) {
+        uint32_t part = 0;
+        res = f->read(buffer + *transferred, length - *transferred, &part);
+        if ((res != FR_OK) || !part) {
+            break;
+        }
+        *transferred += part;
+    }
+    return res;
+}
+
+#ifdef OS
+void CopyEngine :: reader_task(void *a)
+{
+    CopyEngine *engine = (CopyEngine *)a;
+    copy_request_t *r;
+
+    while (1) {
+        xQueueReceive(engine->to_reader, &r, portMAX_DELAY);
+        if (!r) {
+            break;
+        }
+        r->result = read_full(r->file, r->buffer, r->length, &r->transferred);
+        xQueueSend(engine->from_reader, &r, portMAX_DELAY);
+    }
+    xQueueSend(engine->from_reader, &r, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+#endif
+
+void CopyEngine :: start_read(copy_request_t *r, File *f, uint32_t length)
+{
+    r->file = f;
+    r->length = length;
+    r->transferred = 0;
+#ifdef OS
+    if (overlap) {
+        xQueueSend(to_reader, &r, portMAX_DELAY);
+        return;
+    }
+#endif
+    r->result = read_full(f, r->buffer, length, &r->transferred);
+    ready[(ready_head + ready_count++) % COPY_BUFFERS] = r;
+}
+
+copy_request_t *CopyEngine :: wait_read(void)
+{
+    copy_request_t *r;
+#ifdef OS
+    if (overlap) {
+        xQueueReceive(from_reader, &r, portMAX_DELAY);
+        return r;
+    }
+#endif
+    r = ready[ready_head];
+    ready_head = (ready_head + 1) % COPY_BUFFERS;
+    ready_count--;
+    return r;
+}
+
+bool CopyEngine :: report(uint32_t bytes)
+{
+    done += bytes;
+    if (progress && !progress(context, done, get_total())) {
+        cancelled = true;
+    }
+    return !cancelled;
+}
+
+FRESULT CopyEngine :: copy_file(Path *sp, const char *filename, Path *dp, const char *dest_name)
+{
+    File *fi = 0;
+    File *fo = 0;
+    FRESULT ret = fm->fopen(sp, filename, FA_READ, &fi);
+    if (ret != FR_OK) {
+        printf("Cannot open input file %s\n", filename);
+        return ret;
+    }
+    ret = fm->fopen(dp, dest_name, FA_CREATE_NEW | FA_WRITE, &fo);
+    if (ret != FR_OK) {
+        printf("Cannot open output file %s\n", dest_name);
+        fm->fclose(fi);
+        return ret;
+    }
+    if (!allocate_buffers()) {
+        fm->fclose(fo);
+        fm->fclose(fi);
+        fm->delete_file(dp, dest_name);
+        return FR_NO_MEMORY;
+    }
+
+#ifdef OS
+    // File systems other than FAT do not lock themselves, so the reader only gets the
+    // source when the destination is somewhere else.
+    overlap = reader && (fi->get_file_system() != fo->get_file_system());
+#endif
+
+    // Small files should not wait for a large read, so the size of the reads grows from
+    // COPY_MIN_BLOCK up to the buffer size.
+    uint32_t block = (buffer_size < COPY_MIN_BLOCK) ? buffer_size : COPY_MIN_BLOCK;
+    int in_flight = 0;
+    bool eof = false;
+    for (int i = 0; i < COPY_BUFFERS; i++) {
+        start_read(&requests[i], fi, block);
+        in_flight++;
+        block = (block * 2 > buffer_size) ? buffer_size : block * 2;
+    }
+    while (in_flight) {
+        copy_request_t *r = wait_read();
+        in_flight--;
+        if ((ret != FR_OK) || eof) {
+            continue; // just collect what is still underway
+        }
+        if (r->result != FR_OK) {
+            ret = r->result;
+            continue;
+        }
+        if (r->transferred < r->length) {
+            eof = true;
+            if (!r->transferred) {
+                continue;
+            }
+        }
+        uint32_t written = 0;
+        ret = fo->write(r->buffer, r->transferred, &written);
+        if ((ret == FR_OK) && (written != r->transferred)) {
+            ret = FR_DISK_FULL;
+        }
+        if ((ret == FR_OK) && !report(written)) {
+            ret = FR_ABORTED;
+        }
+        if ((ret == FR_OK) && !eof) {
+            start_read(r, fi, block);
+            in_flight++;
+            block = (block * 2 > buffer_size) ? buffer_size : block * 2;
+        }
+    }
+    fm->fclose(fo);
+    fm->fclose(fi);
+
+    if ((ret == FR_OK) && verify) {
+        ret = verify_file(sp, filename, dp, dest_name);
+    }
+    // A partial copy is not left behind; a copy that differs is, so that it can be looked at
+    if ((ret != FR_OK) && (ret != FR_VERIFY_FAILED)) {
+        fm->delete_file(dp, dest_name);
+    }
+    return ret;
+}
+
+FRESULT CopyEngine :: verify_file(Path *sp, const char *filename, Path *dp, const char *dest_name)
+{
+    File *fi = 0;
+    File *fo = 0;
+    FRESULT ret = fm->fopen(sp, filename, FA_READ, &fi);
+    if (ret != FR_OK) {
+        return ret;
+    }
+    ret = fm->fopen(dp, dest_name, FA_READ, &fo);
+    if (ret != FR_OK) {
+        fm->fclose(fi);
+        return ret;
+    }
+
+    // The source is read by the reader task, the copy by this one, at the same time
+    uint32_t offset = 0;
+    while (ret == FR_OK) {
+        start_read(&requests[0], fi, buffer_size);
+        uint32_t transferred = 0;
+        FRESULT res = read_full(fo, buffers[1], buffer_size, &transferred);
+        copy_request_t *r = wait_read();
+        if (r->result != FR_OK) {
+            ret = r->result;
+        } else if (res != FR_OK) {
+            ret = res;
+        } else if ((r->transferred != transferred) || memcmp(r->buffer, buffers[1], transferred)) {
+            printf("Verify of %s failed near offset %u.\n", dest_name, offset);
+            ret = FR_VERIFY_FAILED;
+        } else if (!report(transferred)) {
+            ret = FR_ABORTED;
+        } else if (transferred < buffer_size) {
+            break;
+        }
+        offset += transferred;
+    }
+    fm->fclose(fo);
+    fm->fclose(fi);
+    return ret;
+}
+
+FRESULT CopyEngine :: copy_entry(const char *path, const char *filename, const char *dest)
+{
+    printf("Copying %s to %s\n", filename, dest);
+    FileInfo *info = new FileInfo(INFO_SIZE); // not on the stack; we may recurse deeply
+
+    Path *sp = fm->get_new_path("copy source");
+    sp->cd(path);
+    Path *dp = fm->get_new_path("copy destination");
+    dp->cd(dest);
+
+    FRESULT ret = fm->fstat(sp, filename, *info);
+    if (ret != FR_OK) {
+        printf("Could not stat %s (%s)\n", filename, FileSystem :: get_error_string(ret));
+    } else if (info->attrib & AM_DIR) {
+        // create a new directory in our destination path
+        ret = fm->create_dir(dp, filename);
+        if (ret == FR_OK) {
+            IndexedList<FileInfo *> *dirlist = new IndexedList<FileInfo *>(16, NULL);
+            sp->cd(filename);
+            ret = fm->get_directory(sp, *dirlist, NULL);
+            if (ret == FR_OK) {
+                dp->cd(filename);
+                // the first error is the one that is returned; the rest is still copied
+                for (int i = 0; (i < dirlist->get_elements()) && !cancelled; i++) {
+                    FRESULT res = copy_entry(sp->get_path(), (*dirlist)[i]->lfname, dp->get_path());
+                    if (ret == FR_OK) {
+                        ret = res;
+                    }
+                }
+            }
+            for (int i = 0; i < dirlist->get_elements(); i++) {
+                delete (*dirlist)[i];
+            }
+            delete dirlist;
+        }
+    } else if ((info->attrib & AM_VOL) == 0) { // it is a file!
+        char dest_name[100];
+        strncpy(dest_name, filename, 100);
+        dest_name[99] = 0;
+        // This may look odd, but files inside a D64 for instance, do not have the extension in the filename anymore
+        // so we add it here.
+        set_extension(dest_name, info->extension, 100);
+        ret = copy_file(sp, filename, dp, dest_name);
+    }
+    if (cancelled) {
+        ret = FR_ABORTED;
+    }
+    fm->release_path(dp);
+    fm->release_path(sp);
+    delete info;
+    return ret;
+}
+
+FRESULT CopyEngine :: copy(const char *path, const char *filename, const char *dest)
+{
+    if (cancelled) {
+        return FR_ABORTED;
+    }
+    return copy_entry(path, filename, dest);
+}
+
+FRESULT CopyEngine :: measure_entry(Path *path, const char *filename, FileInfo *info)
+{
+    FRESULT ret = fm->fstat(path, filename, *info);
+    if (ret != FR_OK) {
+        return ret;
+    }
+    if (!(info->attrib & AM_DIR)) {
+        if (!(info->attrib & AM_VOL)) {
+            total += info->size;
+        }
+        return FR_OK;
+    }
+    IndexedList<FileInfo *> *dirlist = new IndexedList<FileInfo *>(16, NULL);
+    path->cd(filename);
+    ret = fm->get_directory(path, *dirlist, NULL);
+    for (int i = 0; i < dirlist->get_elements(); i++) {
+        if (ret == FR_OK) {
+            ret = measure_entry(path, (*dirlist)[i]->lfname, info);
+        }
+        delete (*dirlist)[i];
+    }
+    delete dirlist;
+    path->cd("..");
+    return ret;
+}
+
+FRESULT CopyEngine :: measure(const char *path, const char *filename)
+{
+    FileInfo *info = new FileInfo(INFO_SIZE);
+    Path *p = fm->get_new_path("copy measure");
+    p->cd(path);
+    FRESULT ret = measure_entry(p, filename, info);
+    fm->release_path(p);
+    delete info;
+    return ret;
+}
@@ -0,0 +1,91 @@
+/*
+ * copy_engine.h
+ *
+ * Copies files and directory trees between any two places the FileManager knows.
+ * In the OS builds, a reader task reads the next block of the source while the
+ * calling task writes the current one to the destination, so that copying between
+ * two devices takes about as long as the slower of the two, instead of the sum.
+ */
+
+#ifndef FILEMANAGER_COPY_ENGINE_H_
+#define FILEMANAGER_COPY_ENGINE_H_
+
+#include <stdint.h>
+#include "fs_errors_flags.h"
+#ifdef OS
+#include "FreeRTOS.h"
+#include "queue.h"
+#endif
+
+class FileManager;
+class FileInfo;
+class File;
+class Path;
+
+#define COPY_BUFFERS     2           // one being read, one being written
+#define COPY_MAX_BLOCK   (128*1024)  // largest transfer, when the memory is there
+#define COPY_MIN_BLOCK   (8*1024)    // first transfer of each file; doubles with every next one
+
+// Called after every block. 'done' and 'total' are in bytes; the verify pass counts too.
+// Returning false cancels the copy.
+typedef bool (*copy_progress_t)(void *context, uint64_t done, uint64_t total);
+
+struct copy_request_t {
+    File     *file;
+    uint8_t  *buffer;
+    uint32_t  length;
+    uint32_t  transferred;
+    FRESULT   result;
+};
+
+class CopyEngine
+{
+    FileManager *fm;
+    uint8_t  *buffers[COPY_BUFFERS];
+    uint32_t  buffer_size;
+    copy_request_t requests[COPY_BUFFERS];
+    copy_request_t *ready[COPY_BUFFERS]; // reads done in the calling task, when there is no reader task
+    int       ready_head;
+    int       ready_count;
+#ifdef OS
+    QueueHandle_t to_reader;
+    QueueHandle_t from_reader;
+    bool      reader;
+    bool      overlap;  // reads of the current file go to the reader task
+    static void reader_task(void *a);
+#endif
+    copy_progress_t progress;
+    void     *context;
+    bool      verify;
+    bool      cancelled;
+    uint64_t  total;   // as measured; the verify pass reads it all a second time
+    uint64_t  done;
+
+    bool allocate_buffers(void);
+    void start_read(copy_request_t *r, File *f, uint32_t length);
+    copy_request_t *wait_read(void);
+    bool report(uint32_t bytes);
+
+    FRESULT measure_entry(Path *path, const char *filename, FileInfo *info);
+    FRESULT copy_entry(const char *path, const char *filename, const char *dest);
+    FRESULT copy_file(Path *sp, const char *filename, Path *dp, const char *dest_name);
+    FRESULT verify_file(Path *sp, const char *filename, Path *dp, const char *dest_name);
+public:
+    CopyEngine(FileManager *fm);
+    ~CopyEngine();
+
+    void set_progress(copy_progress_t func, void *context) { progress = func; this->context = context; }
+    void set_verify(bool on) { verify = on; }
+    void cancel(void)        { cancelled = true; }
+
+    // Adds the size of a file or a tree to the total, for the progress
+    FRESULT measure(const char *path, const char *filename);
+    // Copies file or directory 'filename' in 'path' into directory 'dest'
+    FRESULT copy(const char *path, const char *filename, const char *dest);
+
+    uint64_t get_total(void) { return verify ? 2 * total : total; }
+    uint64_t get_done(void)  { return done; }
+    uint32_t get_block_size(void) { return buffer_size; }
+};
+
+#endif /* FILEMANAGER_COPY_ENGINE_H_ */
@@ -33,6 +33,8 @@ const char *FilePartition :: get_type_string(uint8_t typ)
         case 0x0C: return "FAT32";
         case 0x82: return "Swap";
         case 0x83: return "Linux";
+        case 0xEE: return "GPT";
+        case 0xEF: return "EFI";
         default: return "??";
     }
     return "";
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include "path.h"
 #include "filemanager.h"
+#include "copy_engine.h"
 #include "embedded_fs.h"
 #include "file_device.h"
 #include <cctype>
@@ -687,83 +688,8 @@ FRESULT FileManager :: create_dir(Path *path, const char *name)
 
 FRESULT FileManager :: fcopy(const char *path, const char *filename, const char *dest)
 {
-	printf("Copying %s to %s\n", filename, dest);
-	FileInfo *info = new FileInfo(INFO_SIZE); // I do not use the stack here for the whole structure, because
-	// we might recurse deeply. Our stack is maybe small.
-
-	Path *sp = get_new_path("copy source");
-	sp->cd(path);
-	Path *dp = get_new_path("copy destination");
-	dp->cd(dest);
-
-	FRESULT ret = FR_OK;
-	if ((ret = fstat(sp, filename, *info)) == FR_OK) {
-		if (info->attrib & AM_DIR) {
-			// create a new directory in our destination path
-			FRESULT dir_create_result = create_dir(dp, filename);
-			if (dir_create_result == FR_OK) {
-				IndexedList<FileInfo *> *dirlist = new IndexedList<FileInfo *>(16, NULL);
-				sp->cd(filename);
-				FRESULT get_dir_result = get_directory(sp, *dirlist, NULL);
-				if (get_dir_result == FR_OK) {
-					dp->cd(filename);
-					for (int i=0;i<dirlist->get_elements();i++) {
-						FileInfo *el = (*dirlist)[i];
-						ret = fcopy(sp->get_path(), el->lfname, dp->get_path());
-					}
-				} else {
-					ret = get_dir_result;
-				}
-				delete dirlist;
-			} else {
-				ret = dir_create_result;
-			}
-			release_path(dp);
-		} else if ((info->attrib & AM_VOL) == 0) { // it is a file!
-			File *fi = 0;
-			ret = fopen(sp, filename, FA_READ, &fi);
-			if (fi) {
-				File *fo = 0;
-	            char dest_name[100];
-	            strncpy(dest_name, filename, 100);
-	            // This may look odd, but files inside a D64 for instance, do not have the extension in the filename anymore
-	            // so we add it here.
-	            set_extension(dest_name, info->extension, 100);
-	            ret = fopen(dp, dest_name, FA_CREATE_NEW | FA_WRITE, &fo);
-				if (fo) {
-					uint8_t *buffer = new uint8_t[32768];
-					uint32_t transferred, written;
-					do {
-						FRESULT frd_result = fi->read(buffer, 32768, &transferred);
-						if (frd_result == FR_OK) {
-							FRESULT fwr_result = fo->write(buffer, transferred, &written);
-							if (fwr_result != FR_OK) {
-								ret = fwr_result;
-								break;
-							}
-						} else {
-							ret = frd_result;
-							break;
-						}
-					} while(transferred > 0);
-
-					delete[] buffer;
-					fclose(fo);
-					fclose(fi);
-				} else { // no output file
-					printf("Cannot open output file %s\n", filename);
-					fclose(fi);
-				}
-			} else {
-				printf("Cannot open input file %s\n", filename);
-			}
-		} // is file?
-	} else {
-		printf("Could not stat %s (%s)\n", filename, FileSystem :: get_error_string(ret));
-	}
-	release_path(sp);
-	delete info;
-	return ret;
+	CopyEngine engine(this);
+	return engine.copy(path, filename, dest);
 }
 
 /* some handy functions */
@@ -1,11 +1,30 @@
 
+#include <string.h>
 #include "disk.h"
+#include "crc32.h"
     
 extern "C" {
     #include "small_printf.h"
 	#include "dump_hex.h"
 }
 
+// Partition type GUIDs, as they are stored: the first three fields are little endian
+static const uint8_t gpt_basic_data[16] = { 0xA2, 0xA0, 0xD0, 0xEB, 0xE5, 0xB9, 0x33, 0x44, 0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7 };
+static const uint8_t gpt_efi_system[16] = { 0x28, 0x73, 0x2A, 0xC1, 0x1F, 0xF8, 0xD2, 0x11, 0xBA, 0x4B, 0x00, 0xA0, 0xC9, 0x3E, 0xC9, 0x3B };
+static const uint8_t gpt_linux_data[16] = { 0xAF, 0x3D, 0xC6, 0x0F, 0x83, 0x84, 0x72, 0x47, 0x8E, 0x79, 0x3D, 0x69, 0xD8, 0x47, 0x7D, 0xE4 };
+static const uint8_t gpt_linux_swap[16] = { 0x6D, 0xFD, 0x57, 0x06, 0xAB, 0xA4, 0xC4, 0x43, 0x84, 0xE5, 0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F };
+
+// The MBR type that a GPT partition gets; other GUIDs become GPT_Protective
+static const struct {
+    const uint8_t *guid;
+    uint8_t type;
+} gpt_types[] = {
+    { gpt_basic_data, 0x0C },
+    { gpt_efi_system, 0xEF },
+    { gpt_linux_data, 0x83 },
+    { gpt_linux_swap, 0x82 },
+};
+
 Disk::Disk(BlockDevice *b, int sec = 512)
 {
     dev = b;
@@ -94,8 +113,18 @@ int Disk::Init(bool isFloppy)
     lba = 0L;
     p_count = 0;        
 
-    // walk through partition tables
+    // A protective MBR means that the partitions are in the GUID partition table.
+    // When neither copy of it can be read, the MBR is all there is.
     tbl = &buf[MBR_PTable];
+    for(int p=0;p<4;p++) {
+        if(tbl[16*p + 4] == GPT_Protective) {
+            if(read_gpt(&prt_list) >= 0)
+                return p_count;
+            break;
+        }
+    }
+
+    // walk through partition tables
 //    dump_hex(tbl, 66);
 
     for(int p=0;p<4;p++) {
@@ -154,3 +183,91 @@ int Disk :: read_ebr(Partition ***prt_list, uint32_t lba)
     delete local_buf;
     return 0;
 }
+
+// Reads and checks the GPT header in sector 'lba', and the partition entries it points to.
+// The entries are returned when both CRCs are right.
+uint8_t *Disk :: read_gpt_entries(uint32_t lba, uint32_t *count, uint32_t *entry_size)
+{
+    uint8_t *local_buf = new uint8_t[sector_size];
+    uint8_t *table = NULL;
+
+    if((dev->read(local_buf, lba, 1) != RES_OK) || memcmp(local_buf, "EFI PART", 8)) {
+        delete[] local_buf;
+        return NULL;
+    }
+    uint32_t header_size = LD_DWORD(&local_buf[GPT_HeaderSize]);
+    uint32_t crc = LD_DWORD(&local_buf[GPT_HeaderCRC]);
+    memset(&local_buf[GPT_HeaderCRC], 0, 4);
+    if((header_size < 92) || (header_size > (uint32_t)sector_size) || (crc32_update(0, local_buf, header_size) != crc)) {
+        printf("GPT header in sector %d is damaged.\n", lba);
+        delete[] local_buf;
+        return NULL;
+    }
+
+    uint32_t entries = LD_DWORD(&local_buf[GPT_EntriesLBA]);
+    *count = LD_DWORD(&local_buf[GPT_EntryCount]);
+    *entry_size = LD_DWORD(&local_buf[GPT_EntrySize]);
+    crc = LD_DWORD(&local_buf[GPT_EntriesCRC]);
+    bool valid = (LD_DWORD(&local_buf[GPT_MyLBA]) == lba) && !LD_DWORD(&local_buf[GPT_MyLBA + 4]) &&
+                 !LD_DWORD(&local_buf[GPT_EntriesLBA + 4]) && (*count > 0) && (*count <= GPT_MAX_ENTRIES) &&
+                 (*entry_size >= 128) && !(*entry_size & 7) && (*entry_size <= (uint32_t)sector_size);
+    delete[] local_buf;
+    if(!valid) {
+        return NULL;
+    }
+
+    // all of it in one read
+    uint32_t bytes = *count * *entry_size;
+    uint32_t sectors = (bytes + sector_size - 1) / sector_size;
+    table = new uint8_t[sectors * sector_size];
+    if((dev->read(table, entries, sectors) != RES_OK) || (crc32_update(0, table, bytes) != crc)) {
+        printf("GPT partition entries of header in sector %d are damaged.\n", lba);
+        delete[] table;
+        return NULL;
+    }
+    return table;
+}
+
+int Disk :: read_gpt(Partition ***prt_list)
+{
+    static const uint8_t unused[16] = { 0 };
+    uint32_t count, entry_size, sectors;
+    Partition *prt;
+
+    uint8_t *table = read_gpt_entries(1, &count, &entry_size);
+    if(!table) {
+        // the backup is in the last sector of the disk
+        if((dev->ioctl(GET_SECTOR_COUNT, &sectors) == RES_OK) && (sectors > 2)) {
+            table = read_gpt_entries(sectors - 1, &count, &entry_size);
+        }
+        if(!table) {
+            return -5; // no usable GPT
+        }
+        printf("Using the backup GPT.\n");
+    }
+
+    uint8_t *entry = table;
+    for(uint32_t i=0; i < count; i++, entry += entry_size) {
+        if(!memcmp(entry, unused, 16)) {
+            continue;
+        }
+        uint32_t first = LD_DWORD(&entry[32]);
+        uint32_t last  = LD_DWORD(&entry[40]);
+        if(LD_DWORD(&entry[36]) || LD_DWORD(&entry[44]) || (last < first)) {
+            printf("GPT partition %d is beyond 32 bit sector numbers.\n", i + 1);
+            continue;
+        }
+        uint8_t type = GPT_Protective;
+        for(int t=0; t < int(sizeof(gpt_types) / sizeof(gpt_types[0])); t++) {
+            if(!memcmp(entry, gpt_types[t].guid, 16)) {
+                type = gpt_types[t].type;
+            }
+        }
+        prt = new Partition(dev, first, last - first + 1, type);
+        **prt_list = prt;
+        *prt_list = &prt->next_partition;
+        p_count ++;
+    }
+    delete[] table;
+    return p_count;
+}
@@ -9,6 +9,16 @@
 #define BS_FilSysType32		82
 #define MBR_PTable			446
 
+#define GPT_Protective      0xEE    // MBR partition type that covers a GPT disk
+#define GPT_HeaderSize      12
+#define GPT_HeaderCRC       16
+#define GPT_MyLBA           24
+#define GPT_EntriesLBA      72
+#define GPT_EntryCount      80
+#define GPT_EntrySize       84
+#define GPT_EntriesCRC      88
+#define GPT_MAX_ENTRIES     256     // 128 is what every tool writes
+
 class Disk
 {
     BlockDevice     *dev;
@@ -17,6 +27,8 @@ class Disk
     int              p_count;
     
     int read_ebr(Partition ***prt_list, uint32_t lba);
+    int read_gpt(Partition ***prt_list);
+    uint8_t *read_gpt_entries(uint32_t lba, uint32_t *count, uint32_t *entry_size);
     
 public:
     Partition       *partition_list;
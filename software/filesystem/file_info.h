@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "indexed_list.h"
+#include "pool.h"
 
 /* File attribute bits for directory entry */
 
@@ -68,7 +69,7 @@ public:
     	init();
 		lfsize = namesize;
 	    if (namesize) {
-	        lfname = new char[namesize];
+	        lfname = pool_alloc_string(namesize);
 			lfname[0] = '\0';
 		}
     }
@@ -77,14 +78,15 @@ public:
     {
     	init();
 		lfsize = strlen(name)+1;
-        lfname = new char[lfsize];
+        lfname = pool_alloc_string(lfsize);
         strcpy(lfname, name);
     }
 
+    // The copy only gets room for the name; copies are what directory listings keep
     FileInfo(FileInfo &i)
     {
-    	lfsize = i.lfsize;
-    	lfname = new char[lfsize];
+    	lfsize = (i.lfname) ? strlen(i.lfname)+1 : 0;
+    	lfname = (lfsize) ? pool_alloc_string(lfsize) : 0;
     	copyfrom(&i);
     }
 
@@ -96,7 +98,7 @@ public:
         date = i->date;
         time = i->time;
 		lfsize = strlen(new_name)+1;
-        lfname = new char[lfsize];
+        lfname = pool_alloc_string(lfsize);
         strcpy(lfname, new_name);
         attrib = i->attrib;
         extension[0] = 0;
@@ -107,7 +109,15 @@ public:
 	~FileInfo()
 	{
 		if(lfname)
-	        delete[] lfname;
+	        pool_free_string(lfname, lfsize);
+    }
+
+    static void *operator new(size_t size) {
+        return file_info_pool.alloc(size);
+    }
+
+    static void operator delete(void *p) {
+        file_info_pool.release(p);
     }
 
 	void copyfrom(FileInfo *i) {
@@ -66,6 +66,10 @@ const char *FileSystem :: get_error_string(FRESULT res)
 			return "DISK IS FULL";
 		case FR_DIR_NOT_EMPTY:
 			return "DIRECTORY NOT EMPTY";
+		case FR_ABORTED:
+			return "ABORTED";
+		case FR_VERIFY_FAILED:
+			return "VERIFY FAILED";
 		default:
 			return "UNKNOWN ERROR";
 	}
@@ -18,10 +18,22 @@ FileSystem_ISO9660 :: FileSystem_ISO9660(Partition *p) : FileSystem(p)
     last_read_sector = 0;
     root_dir_sector = 0;
     root_dir_size = 0;
+    dir_buffer = NULL;
+    if(sector_buffer) {
+        dir_buffer = new uint8_t[ISO_DIR_SECTORS * sector_size];
+    }
+    dir_buffer_sector = 0;
+    dir_buffer_count = 0;
+    path_table = NULL;
+    path_entries = 0;
+    path_names = NULL;
 }
 
 FileSystem_ISO9660 :: ~FileSystem_ISO9660()
 {
+    clear_path_table();
+    if(dir_buffer)
+        delete[] dir_buffer;
     if(sector_buffer)
         delete sector_buffer;
 }
@@ -38,6 +50,218 @@ void FileSystem_ISO9660 :: get_dir_record(void *p)
     uint8_t ident_len = dir_record.actual.identifier_length;
     dir_record.identifier[ident_len] = 0;
 }
+
+// Returns the given sector of a directory that has 'remaining' bytes from there on. The
+// rest of the directory is read along, up to ISO_DIR_SECTORS, in the same request.
+uint8_t *FileSystem_ISO9660 :: get_dir_sector(uint32_t sector, int remaining)
+{
+    if((sector >= dir_buffer_sector) && (sector < dir_buffer_sector + dir_buffer_count)) {
+        return &dir_buffer[(sector - dir_buffer_sector) * sector_size];
+    }
+    int count = (remaining + sector_size - 1) / sector_size;
+    if(count > ISO_DIR_SECTORS)
+        count = ISO_DIR_SECTORS;
+    if(count < 1)
+        count = 1;
+    dir_buffer_count = 0;
+    if(prt->read(dir_buffer, sector, count)) {
+        return NULL;
+    }
+    dir_buffer_sector = sector;
+    dir_buffer_count = count;
+    return dir_buffer;
+}
+
+void FileSystem_ISO9660 :: clear_path_table(void)
+{
+    if(path_table)
+        delete[] path_table;
+    if(path_names)
+        delete[] path_names;
+    path_table = NULL;
+    path_names = NULL;
+    path_entries = 0;
+}
+
+// Reads the path table of the volume descriptor that is in use, in the byte order of
+// this CPU, like the fields of t_iso9660_volume_descriptor.
+bool FileSystem_ISO9660 :: read_path_table(uint32_t sector, uint32_t length)
+{
+    clear_path_table();
+    if((!length) || (length > ISO_MAX_PATH_TABLE)) {
+        return false;
+    }
+    uint32_t sectors = (length + sector_size - 1) / sector_size;
+    uint8_t *raw = new uint8_t[sectors * sector_size];
+    if(prt->read(raw, sector, sectors)) {
+        delete[] raw;
+        return false;
+    }
+
+    // entry: name length, extended attribute length, sector (4), parent (2), name, padding to even
+    int count = 0;
+    for(uint32_t pos = 0; (pos + 8 < length) && raw[pos]; pos += 8 + raw[pos] + (raw[pos] & 1)) {
+        count++;
+    }
+    if(count > 65535)
+        count = 0;
+    path_table = new t_iso_path_entry[count];
+    path_names = new char[length]; // the names are never longer than their entries
+
+    bool ok = (count > 0);
+    uint32_t pos = 0;
+    uint32_t name_pos = 0;
+    for(int i = 0; ok && (i < count); i++) {
+        int len = raw[pos];
+        uint16_t parent;
+        t_iso_path_entry *e = &path_table[i];
+        memcpy(&e->sector, &raw[pos + 2], 4);
+        memcpy(&parent, &raw[pos + 6], 2);
+        e->size = 0;
+        e->name = name_pos;
+        e->parent = parent - 1;
+        // a parent comes before its children, and the table is sorted on parent
+        if((parent < 1) || (parent > i + 1) || (i && (e->parent < path_table[i-1].parent))) {
+            ok = false;
+        }
+        // like dir_read: of the 16-bit Joliet characters, only the low byte is taken
+        for(int j = (joliet)?1:0; j < len; j += (joliet)?2:1) {
+            path_names[name_pos++] = (char)raw[pos + 8 + j];
+        }
+        path_names[name_pos++] = 0;
+        pos += 8 + len + (len & 1);
+    }
+    delete[] raw;
+    if(!ok) {
+        printf("ISO9660: Path table not usable.\n");
+        clear_path_table();
+        return false;
+    }
+    path_entries = count;
+    printf("ISO9660: Path table with %d directories.\n", count);
+    return true;
+}
+
+// Returns the index of the subdirectory 'name' of directory 'parent', or -1
+int FileSystem_ISO9660 :: find_directory(int parent, const char *name)
+{
+    // first entry with this parent
+    int low = 0, high = path_entries;
+    while(low < high) {
+        int mid = (low + high) / 2;
+        if(path_table[mid].parent < parent)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    for(int i = low; (i < path_entries) && (path_table[i].parent == parent); i++) {
+        if((i != parent) && pattern_match(name, &path_names[path_table[i].name])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the index of the subdirectory of 'parent' that starts at 'sector', or -1
+int FileSystem_ISO9660 :: find_directory(int parent, uint32_t sector)
+{
+    for(int i = 0; i < path_entries; i++) {
+        if((i != parent) && (path_table[i].parent == parent) && (path_table[i].sector == sector)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Fills in what dir_read would give for this directory
+void FileSystem_ISO9660 :: get_directory_info(int index, FileInfo *info)
+{
+    t_iso_path_entry *e = &path_table[index];
+    if(!e->size) {
+        // the path table has no sizes; the '.' entry of the directory itself has it
+        uint8_t *buf = get_dir_sector(e->sector, sector_size);
+        if(buf) {
+            get_dir_record(buf);
+            e->size = dir_record.actual.file_size;
+        }
+    }
+    info->fs      = this;
+    info->cluster = e->sector;
+    info->size    = e->size;
+    info->attrib  = AM_DIR;
+    const char *name = &path_names[e->name];
+    int len = strlen(name);
+    if(len >= info->lfsize)
+        len = info->lfsize - 1;
+    memcpy(info->lfname, name, len);
+    info->lfname[len] = 0;
+
+    info->extension[0] = 0;
+    const char *dot = strrchr(name, '.');
+    if(dot) {
+        for(int i=0;i<3;i++) {
+            info->extension[i] = (dot[1+i]) ? toupper(dot[1+i]) : 0;
+            if(!dot[1+i])
+                break;
+        }
+    }
+    info->extension[3] = 0;
+}
+
+// Directories are looked up in the path table; only the last element of the path, when
+// it is a file, or a name with wildcards, needs the directory itself to be read.
+PathStatus_t FileSystem_ISO9660 :: walk_path(PathInfo& pathInfo)
+{
+    if(!path_entries) {
+        return FileSystem :: walk_path(pathInfo);
+    }
+    pathInfo.enterFileSystem(this);
+
+    FileInfo info(128);
+    Directory *dir;
+    FileInfo *ninf;
+    mstring workdir;
+    int node = 0; // the root; -1 when the current directory is not in the path table
+
+    while(pathInfo.hasMore()) {
+        const char *name = pathInfo.workPath.getElement(pathInfo.index);
+        int child = -1;
+        if((node >= 0) && !strpbrk(name, "*?")) {
+            child = find_directory(node, name);
+        }
+        if(child >= 0) {
+            ninf = pathInfo.getNewInfoPointer();
+            get_directory_info(child, ninf);
+            pathInfo.replace(ninf->lfname);
+            pathInfo.index++;
+            node = child;
+            continue;
+        }
+
+        // as FileSystem :: walk_path, for this one level
+        dir_open(pathInfo.getPathFromLastFS(workdir), &dir, pathInfo.getLastInfo());
+        while(1) {
+            if(dir_read(dir, &info) != FR_OK) {
+                dir_close(dir);
+                pathInfo.index ++; // we will still return something, even if it doesn't exist (for file create)
+                return (pathInfo.hasMore()) ? e_DirNotFound : e_EntryNotFound;
+            }
+            if(pattern_match(name, info.lfname)) {
+                break;
+            }
+        }
+        dir_close(dir);
+        pathInfo.replace(info.lfname);
+        pathInfo.index++;
+        ninf = pathInfo.getNewInfoPointer();
+        ninf->copyfrom(&info);
+        if(!(info.attrib & AM_DIR)) {
+            return (pathInfo.hasMore()) ? e_TerminatedOnFile : e_EntryFound;
+        }
+        node = (node >= 0) ? find_directory(node, info.cluster) : -1;
+    }
+    return e_EntryFound;
+}
     
 FileSystem* FileSystem_ISO9660 :: test(Partition *p)        // check if file system is present on this partition
 {
@@ -100,6 +324,9 @@ bool    FileSystem_ISO9660 :: init(void)              // Initialize file system
     root_dir_size   = dir_record.actual.file_size;
     printf("Root directory located at sector %d. (length = %d)\n", root_dir_sector, root_dir_size);
     initialized = true;
+    dir_buffer_count = 0;
+    uint32_t path_table_sector = volume->first_path_table_sector;
+    uint32_t path_table_length = volume->path_table_length;
 
     // attempt Joliet
     do {
@@ -107,9 +334,11 @@ bool    FileSystem_ISO9660 :: init(void)              // Initialize file system
         DRESULT status = prt->read(sector_buffer, first_sector, 1);
         last_read_sector = first_sector;
         if(status) {
+            read_path_table(path_table_sector, path_table_length);
             return true; // accept ISO9660 only, eventhough this is very weird
         }
         if((volume->key[0] == 0xFF) || (volume->key[0] == 0x00)) {
+            read_path_table(path_table_sector, path_table_length);
             return true; // accept ISO9660 only. no Joliet information found
         }
         if(volume->key[0] == 0x02)
@@ -123,7 +352,7 @@ bool    FileSystem_ISO9660 :: init(void)              // Initialize file system
     root_dir_sector = dir_record.actual.sector;
     root_dir_size   = dir_record.actual.file_size;
     printf("Joliet directory located at sector %d. (length = %d)\n", root_dir_sector, root_dir_size);
-    
+    read_path_table(volume->first_path_table_sector, volume->path_table_length);
     return true;
 }
 
@@ -164,12 +393,11 @@ try_next:
 		return FR_NO_FILE;
 	}
 
-	if(last_read_sector != handle->sector) {
-        DRESULT status = prt->read(sector_buffer, handle->sector, 1);
-        //dump_hex(sector_buffer, sector_size);
-        last_read_sector = handle->sector;
-    }
-	get_dir_record(&sector_buffer[handle->offset]);
+	uint8_t *buf = get_dir_sector(handle->sector, handle->remaining);
+	if(!buf) {
+		return FR_DISK_ERR;
+	}
+	get_dir_record(&buf[handle->offset]);
 
     if((!dir_record.actual.record_length)||(handle->offset >= sector_size)) {
         // lets try the following sector, in case offset != 0
@@ -302,14 +530,17 @@ FRESULT FileSystem_ISO9660 :: file_read(File *f, void *buffer, uint32_t len, uin
     DSTATUS res; 
     while(len) {
         if((sect_offset == 0) && (len >= sector_size)) { // optimized read, directly to buffer
-            res = prt->read(dest, sect, 1);
-//            printf("ISO9660: Read sector direct: %d.\n", sect);
+            // files are contiguous, so all whole sectors go in one request
+            uint32_t count = len / sector_size;
+            res = prt->read(dest, sect, count);
+//            printf("ISO9660: Read %d sectors direct: %d.\n", count, sect);
             if(!res) { // ok
-                sect ++;
-                dest += sector_size;
-                len -= sector_size;
-                handle->offset += sector_size;
-                *transferred += sector_size;
+                uint32_t bytes = count * sector_size;
+                sect += count;
+                dest += bytes;
+                len -= bytes;
+                handle->offset += bytes;
+                *transferred += bytes;
             } else {
                 return FR_DISK_ERR;
             }
@@ -205,6 +205,19 @@ struct t_iso_handle {
     int   offset;
 };
 
+// One directory of the path table. The path table lists all directories of the volume,
+// each with the number of its parent, sorted on parent; so the subdirectories of any
+// directory are found together, without reading a single directory sector.
+struct t_iso_path_entry {
+    uint32_t sector;
+    uint32_t size;      // of the directory itself; 0 until it was needed once
+    uint32_t name;      // offset in path_names
+    uint16_t parent;    // index of the parent in the table; the root is 0 and its own parent
+};
+
+#define ISO_DIR_SECTORS       8            // directory sectors read at once
+#define ISO_MAX_PATH_TABLE    (256*1024)   // larger path tables are not cached; lookups then read the directories
+
 class FileSystem_ISO9660 : public FileSystem 
 {
 protected:
@@ -217,14 +230,30 @@ protected:
     t_aligned_directory_record dir_record;
     bool initialized;
     bool joliet;
-    
+
+    uint8_t *dir_buffer;        // ISO_DIR_SECTORS of the directory that is being read
+    uint32_t dir_buffer_sector;
+    int      dir_buffer_count;
+
+    t_iso_path_entry *path_table;
+    int      path_entries;
+    char    *path_names;
+
     void get_dir_record(void *);
+    uint8_t *get_dir_sector(uint32_t sector, int remaining);
+    void clear_path_table(void);
+    bool read_path_table(uint32_t sector, uint32_t length);
+    int  find_directory(int parent, const char *name);
+    int  find_directory(int parent, uint32_t sector);
+    void get_directory_info(int index, FileInfo *info);
 public:
     FileSystem_ISO9660(Partition *p);
     ~FileSystem_ISO9660();
 
     static FileSystem* test(Partition *p);        // check if file system is present on this partition
     bool    init(void);              // Initialize file system
+    PathStatus_t walk_path(PathInfo& pathInfo);
+    int     get_path_entries(void) { return path_entries; }
     
     // functions for reading directories
     FRESULT dir_open(const char *path, Directory **dir, FileInfo *inf = 0); // Opens directory (creates dir object, NULL = root)
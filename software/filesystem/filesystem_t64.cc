@@ -15,11 +15,25 @@
 FileSystemT64 :: FileSystemT64(File *f) : FileSystem(0)
 {
 	t64_file = f;
+	index_result = FR_NOT_READY;
+	entries = NULL;
+	by_name = NULL;
+	entry_count = 0;
+	volume_name[0] = 0;
+	buffer = NULL;
+	buffer_offset = 0;
+	buffer_valid = 0;
+	file_pos = 0xFFFFFFFF; // not known
 }
 
 FileSystemT64 :: ~FileSystemT64()
 {
-
+	if (entries)
+		delete[] entries;
+	if (by_name)
+		delete[] by_name;
+	if (buffer)
+		delete[] buffer;
 }
 
 // Get number of free sectors on the file system
@@ -35,6 +49,227 @@ FRESULT FileSystemT64 :: sync(void)
     return t64_file->sync();
 }
 
+// Same comb sort as IndexedList, on a list of entry numbers
+static void sort_entries(uint16_t *order, int count, int (*compare)(const t64_entry *, int, int), const t64_entry *entries)
+{
+	int swaps, gap = count - 1;
+	if (count < 2)
+		return;
+	do {
+		if (gap > 1) {
+			gap = (10 * gap) / 13;
+			if ((gap == 10) || (gap == 9))
+				gap = 11;
+		}
+		swaps = 0;
+		for (int i = 0; (i + gap) < count; i++) {
+			if (compare(entries, order[i], order[i + gap]) > 0) {
+				uint16_t t = order[i];
+				order[i] = order[i + gap];
+				order[i + gap] = t;
+				swaps++;
+			}
+		}
+	} while (swaps || (gap > 1));
+}
+
+static int compare_offset(const t64_entry *entries, int a, int b)
+{
+	if (entries[a].offset != entries[b].offset)
+		return (entries[a].offset > entries[b].offset) ? 1 : -1;
+	return a - b;
+}
+
+// Duplicate names stay in the order of the directory, so that the first one is found first
+static int compare_name(const t64_entry *entries, int a, int b)
+{
+	int by_name = strcasecmp(entries[a].name, entries[b].name);
+	return (by_name) ? by_name : a - b;
+}
+
+/*
+ * Reads the whole directory of the archive in one go, and keeps what is needed of it.
+ * Many archives have a wrong 'used' count, or an end address that was never filled in
+ * properly (C3C6 is what some converters write for every file). So the entries are not
+ * trusted: the data of each file is cut off where the next file starts or where the
+ * archive ends, and when the end address is the known wrong one, the length is taken
+ * from there as well.
+ */
+FRESULT FileSystemT64 :: openT64File()
+{
+	if (index_result != FR_NOT_READY)
+		return index_result;
+
+	uint8_t header[64];
+	uint32_t bytes_read;
+	uint32_t archive_size = t64_file->get_size();
+
+	index_result = FR_NO_FILESYSTEM;
+	buffer = new uint8_t[T64_BUFFER_SIZE];
+	FRESULT fres = read_archive(0, header, 64, &bytes_read);
+	if (fres != FR_OK)
+		return index_result = fres;
+
+	if ((bytes_read != 64) || (header[0] != 0x43) || (header[1] != 0x36) || (header[2] != 0x34)) {
+		printf("Not a valid T64 file.\n");
+		return index_result;
+	}
+	memcpy(volume_name, &header[40], 24);
+	volume_name[24] = 0;
+
+	int slots = LD_WORD(&header[34]);
+	int used  = LD_WORD(&header[36]);
+	if (slots < used)
+		slots = used;
+	if (slots > int((archive_size - 64) / 32))
+		slots = (archive_size - 64) / 32;
+	if (slots > T64_MAX_ENTRIES)
+		slots = T64_MAX_ENTRIES;
+
+	uint8_t *dir = new uint8_t[32 * slots + 1];
+	uint16_t *end_addresses = new uint16_t[slots + 1];
+	entries = new t64_entry[slots + 1];
+	by_name = new uint16_t[slots + 1];
+	fres = read_archive(64, dir, 32 * slots, &bytes_read);
+	if (fres != FR_OK) {
+		delete[] dir;
+		delete[] end_addresses;
+		return index_result = fres;
+	}
+
+	entry_count = 0;
+	for(int i=0; i < slots; i++) { // the used count is often wrong; all entries are looked at
+		uint8_t *rec = &dir[32 * i];
+		if (!rec[0])
+			continue; // free entry
+		t64_entry *e = &entries[entry_count];
+		e->offset = LD_DWORD(&rec[8]);
+		if ((e->offset < 64) || (e->offset >= archive_size))
+			continue; // not in the archive
+
+		int v = 0;
+		for(int s=0;s<16;s++) {
+			uint8_t c = rec[16+s];
+			if (c == '/') {
+				c = '!';
+			} else if (c & 0x80) {
+				c = ' ';
+			}
+			e->name[s] = c;
+			if ((c != ' ') && (c != 0))
+				v = s + 1; // eui: no trailing spaces please
+		}
+		e->name[v] = 0;
+		if (!v) {
+			strcpy(e->name, "- Invalid name -");
+		}
+		e->start = LD_WORD(&rec[2]);
+		end_addresses[entry_count] = LD_WORD(&rec[4]);
+		by_name[entry_count] = entry_count;
+		entry_count++;
+	}
+	delete[] dir;
+
+	validate_lengths(archive_size, end_addresses);
+	delete[] end_addresses;
+
+	sort_entries(by_name, entry_count, compare_name, entries);
+	return index_result = FR_OK;
+}
+
+void FileSystemT64 :: validate_lengths(uint32_t archive_size, const uint16_t *end_addresses)
+{
+	// by_name is not sorted on name yet; here it puts the entries in the order of their data
+	sort_entries(by_name, entry_count, compare_offset, entries);
+	for(int i=0; i < entry_count; i++) {
+		t64_entry *e = &entries[by_name[i]];
+		uint32_t limit = archive_size;
+		for(int j=i+1; j < entry_count; j++) {
+			if (entries[by_name[j]].offset > e->offset) {
+				limit = entries[by_name[j]].offset;
+				break;
+			}
+		}
+		uint32_t available = limit - e->offset;
+		uint16_t stop = end_addresses[by_name[i]];
+		uint32_t length = (stop > e->start) ? stop - e->start : 65536 - e->start;
+		if ((length > available) || (stop == 0xC3C6))
+			length = available;
+		if (length > 65536U - e->start)
+			length = 65536U - e->start;
+		e->length = length;
+	}
+}
+
+int FileSystemT64 :: find_entry(const char *name)
+{
+	if (strpbrk(name, "*?")) {
+		for(int i=0; i < entry_count; i++) {
+			if (pattern_match(name, entries[i].name))
+				return i;
+		}
+		return -1;
+	}
+	// first of the equal names, which is the first one in the directory
+	int low = 0, high = entry_count;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (strcasecmp(entries[by_name[mid]].name, name) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if ((low < entry_count) && !strcasecmp(entries[by_name[low]].name, name))
+		return by_name[low];
+	return -1;
+}
+
+/*
+ * Small reads are served from a window of the archive, so that a load in blocks of
+ * 254 bytes does not become as many reads on the medium. Larger ones go straight to
+ * the file. The file position is remembered, as all files of the archive share it.
+ */
+FRESULT FileSystemT64 :: read_archive(uint32_t offset, uint8_t *dest, uint32_t len, uint32_t *transferred)
+{
+	FRESULT fres = FR_OK;
+	uint32_t bytes_read;
+	*transferred = 0;
+
+	while (len) {
+		if ((offset >= buffer_offset) && (offset < buffer_offset + buffer_valid)) {
+			uint32_t now = buffer_offset + buffer_valid - offset;
+			if (now > len)
+				now = len;
+			memcpy(dest, buffer + (offset - buffer_offset), now);
+			dest += now;
+			offset += now;
+			len -= now;
+			*transferred += now;
+			continue;
+		}
+		if (file_pos != offset) {
+			fres = t64_file->seek(offset);
+			if (fres != FR_OK)
+				break;
+			file_pos = offset;
+		}
+		if (len >= T64_BUFFER_SIZE) {
+			fres = t64_file->read(dest, len, &bytes_read);
+			file_pos += bytes_read;
+			*transferred += bytes_read;
+			break;
+		}
+		buffer_valid = 0;
+		fres = t64_file->read(buffer, T64_BUFFER_SIZE, &bytes_read);
+		file_pos += bytes_read;
+		if ((fres != FR_OK) || !bytes_read)
+			break;
+		buffer_offset = offset;
+		buffer_valid = bytes_read;
+	}
+	return fres;
+}
+
 FRESULT FileSystemT64 :: dir_open(const char *path, Directory **dir, FileInfo *inf) // Opens directory (creates dir object, NULL = root)
 {
 	// Block anything invalid
@@ -54,6 +289,10 @@ FRESULT FileSystemT64 :: dir_open(const char *path, Directory **dir, FileInfo *i
 		}
 	}
 
+	FRESULT fres = openT64File();
+	if (fres != FR_OK)
+		return fres;
+
 	*dir = new Directory(this, 0); // use handle as index in dir. reset to 0
     return FR_OK;
 }
@@ -67,11 +306,7 @@ void FileSystemT64 :: dir_close(Directory *d)
 // reads next entry from dir
 FRESULT FileSystemT64 :: dir_read(Directory *d, FileInfo *f)
 {
-    uint32_t idx = (uint32_t)d->handle;
-	uint8_t read_buf[32], c;
-	uint8_t *p;
-	FRESULT fres;
-	uint32_t bytes_read;
+    uintptr_t idx = (uintptr_t)d->handle;
 
 	// Fields that are always the same, or needs initialization.
     f->fs      = this;
@@ -80,90 +315,23 @@ FRESULT FileSystemT64 :: dir_read(Directory *d, FileInfo *f)
     f->extension[0] = '\0';
 
 	if(idx == 0) {
-	    fres = t64_file->seek(0); // rewind
-		if(fres != FR_OK)
-			return fres;
-
-	    fres = t64_file->read(read_buf, 32, &bytes_read);
-		if(fres != FR_OK)
-			return fres;
-
-	    if((bytes_read != 32) || (read_buf[0] != 0x43) || (read_buf[1] != 0x36) || (read_buf[2] != 0x34)) {
-	        printf("Not a valid T64 file. %d %s\n", bytes_read, read_buf);
-	        return FR_NO_FILESYSTEM;
-	    }
-
-	    // read name of directory as first entry
-	    fres = t64_file->read(read_buf, 32, &bytes_read);
-		if(fres != FR_OK)
-			return fres;
-
-		read_buf[31] = 0;
-		f->lfname[24] = 0;
-	    for(int b=0;b<24;b++) {
-	    	char c = char(read_buf[b+8]);
-	    	f->lfname[b] = c; //(c == '/') ? '!' : c;
-	    }
-
-	    max  = LD_WORD(&read_buf[2]);
-	    used = LD_WORD(&read_buf[4]);
-		if(!used)
-			used = 1; // fix
+		// name of directory as first entry
+		strncpy(f->lfname, volume_name, f->lfsize);
+		f->lfname[f->lfsize - 1] = 0;
 	    f->size = 0L;
 	    f->cluster = 0L;
 	    f->attrib  = AM_VOL;
-	} else {
-		//printf("Idx = %d, Used = %d\n", idx, used);
-		if(idx <= used) {
-	        fres = t64_file->read(read_buf, 32, &bytes_read);
-			if(fres != FR_OK)
-				return fres;
-
-			int v=0;
-			//dump_hex(read_buf, 32);
-	        if(read_buf[0]) {
-	            memset(f->lfname, 0, f->lfsize);
-	            for(int s=0;s<16;s++) {
-	                c = read_buf[16+s];
-	                if (c == '/') {
-	                	c = '!';
-	                } else if (c & 0x80) {
-	                	c = ' ';
-	                }
-					f->lfname[s] = c;
-					v++;
-	            }
-
-				// eui: no trailing spaces please
-				for(int s=v-1; s>=0; s--) {
-					p = (uint8_t *)&f->lfname[s];
-	                if((*p == ' ') || (*p == 0xA0) || (*p == 0xE0)) {
-						*p = 0;
-	                }
-					else {
-						if(*p != 0)
-							break;
-					}
-				}
-
-	            if (v) {
-	                strt = LD_WORD(&read_buf[2]);
-	                stop = LD_WORD(&read_buf[4]);
-	                f->time = strt;  // patch to store start address ###
-	                f->cluster = LD_DWORD(&read_buf[8]); // file offset :)
-	                f->attrib = 0;
-	                strncpy(f->extension, "PRG", 4);
-	                f->size = (stop != 0)?(stop - strt):(65536 - strt);
-                    f->size += 2; // the file is actually two longer than the start-stop
-	                printf("%s: %04x-%04x (Size: %d)\n", f->lfname, strt, stop, f->size);
-	            } else {
-	            	strcpy(f->lfname, "- Invalid name -");
-	                f->cluster = 0;
-	            }
-	        }
-		} else { // no more
-			return FR_NO_FILE;
-		}
+	} else if(idx <= (uintptr_t)entry_count) {
+		t64_entry *e = &entries[idx - 1];
+		strncpy(f->lfname, e->name, f->lfsize);
+		f->lfname[f->lfsize - 1] = 0;
+		f->time = e->start;  // patch to store start address ###
+		f->cluster = e->offset; // file offset :)
+		f->attrib = 0;
+		strncpy(f->extension, "PRG", 4);
+		f->size = e->length + 2; // the file is actually two longer than the start-stop
+	} else { // no more
+		return FR_NO_FILE;
 	}
     idx++;
     d->handle = (void*)idx;
@@ -174,26 +342,20 @@ FRESULT FileSystemT64 :: dir_read(Directory *d, FileInfo *f)
 // Opens file (creates file object)
 FRESULT FileSystemT64 :: file_open(const char *path, Directory *dir, const char *filename, uint8_t flags, File **file)  // Opens file (creates file object)
 {
-	FileInfo info(24);
-	do {
-		FRESULT fres = dir_read(dir, &info);
-		if (fres != FR_OK) {
-			dir_close(dir);
-			return FR_NO_FILE;
-		}
-		if (info.attrib & AM_VOL)
-			continue;
-		if (pattern_match(filename, info.lfname)) {
-			break;
-		}
-	} while(1);
-
 	dir_close(dir);
 
+	FRESULT res = openT64File();
+	if (res != FR_OK)
+		return res;
+
+	int idx = find_entry(filename);
+	if (idx < 0)
+		return FR_NO_FILE;
+
 	FileInT64 *ff = new FileInT64(this);
 	*file = new File(this, ff);
 
-	FRESULT res = ff->open(&info, flags);
+	res = ff->open(&entries[idx], flags);
 	if(res == FR_OK) {
 		return res;
 	}
@@ -229,6 +391,12 @@ FRESULT FileSystemT64::file_seek(File *f, uint32_t pos)
     return ff->seek(pos);
 }
 
+uint32_t FileSystemT64::get_file_size(File *f)
+{
+    FileInT64 *ff = (FileInT64 *)f->handle;
+    return ff->get_size();
+}
+
 /*************************************************************/
 /* T64 File System implementation                            */
 /*************************************************************/
@@ -241,17 +409,13 @@ FileInT64 :: FileInT64(FileSystemT64 *f)
     fs = f;
 }
 
-FRESULT FileInT64 :: open(FileInfo *info, uint8_t flags)
+FRESULT FileInT64 :: open(t64_entry *entry, uint8_t flags)
 {
-	if(info->fs != fs)
-		return FR_INVALID_OBJECT;
-
-	file_offset = info->cluster;
+	file_offset = entry->offset;
 	offset = 0;
-	length = info->size;
-	start_addr = info->time; // hack
-
-	return fs->t64_file->seek(file_offset);
+	length = entry->length + 2;
+	start_addr = entry->start;
+	return FR_OK;
 }
 
 FRESULT FileInT64 :: close(void)
@@ -290,11 +454,11 @@ FRESULT FileInT64 :: read(void *buffer, uint32_t len, uint32_t *transferred)
     if(!len)
         return FR_OK;
 
-    if(len > (length - offset)) {
+    if(len > uint32_t(length - offset)) {
         len = length - offset;
     }
 
-	res = fs->t64_file->read(dst, len, &bytes_read);
+	res = fs->read_archive(file_offset + offset - 2, dst, len, &bytes_read);
 	*transferred += bytes_read;
 	offset += bytes_read;
 	return res;
@@ -12,13 +12,35 @@
 #include "partition.h"
 #include "file_system.h"
 
+// One file of the archive, as found in the directory when the archive is opened
+struct t64_entry {
+	uint32_t offset;    // of the data in the archive
+	uint32_t length;    // of the data, without the load address; checked against the archive
+	uint16_t start;     // load address
+	char     name[17];
+};
+
+#define T64_MAX_ENTRIES  1024   // larger directories are cut off
+#define T64_BUFFER_SIZE  2048   // window of the archive that small reads are taken from
+
 class FileSystemT64 : public FileSystem
 {
 	File *t64_file;
-	int max, used;
-	uint16_t strt, stop;
+	FRESULT index_result;   // of reading the directory; FR_NOT_READY until it was read
+	t64_entry *entries;     // in the order of the directory
+	uint16_t *by_name;      // entry numbers, sorted on name
+	int entry_count;
+	char volume_name[25];
+
+	uint8_t *buffer;
+	uint32_t buffer_offset; // in the archive
+	uint32_t buffer_valid;
+	uint32_t file_pos;      // of t64_file, to leave out seeks that are not needed
 
-	void    openT64File();
+	FRESULT openT64File();
+	void    validate_lengths(uint32_t archive_size, const uint16_t *end_addresses);
+	int     find_entry(const char *name);
+	FRESULT read_archive(uint32_t offset, uint8_t *dest, uint32_t len, uint32_t *transferred);
 public:
     FileSystemT64(File *file);
     ~FileSystemT64();
@@ -37,6 +59,7 @@ public:
     FRESULT file_write(File *f, const void *buffer, uint32_t len, uint32_t *transferred);
     FRESULT file_seek(File *f, uint32_t pos);
     FRESULT sync();
+    uint32_t get_file_size(File *f);
 
     friend class FileInT64;
 };
@@ -44,7 +67,7 @@ public:
 class FileInT64
 {
     FileSystemT64 *fs;
-    int file_offset;
+    uint32_t file_offset;
     int offset;
     int length;
     uint16_t start_addr;
@@ -52,11 +75,12 @@ public:
     FileInT64(FileSystemT64 *);
     ~FileInT64() { }
 
-    FRESULT open(FileInfo *info, uint8_t flags);
+    FRESULT open(t64_entry *entry, uint8_t flags);
     FRESULT close(void);
     FRESULT read(void *buffer, uint32_t len, uint32_t *transferred);
     FRESULT write(const void *buffer, uint32_t len, uint32_t *transferred);
     FRESULT seek(uint32_t pos);
+    uint32_t get_size(void) { return length; }
 };
 
 
@@ -32,7 +32,9 @@ typedef enum {
 	FR_TOO_MANY_OPEN_FILES,	/* (18) Number of open files > _FS_SHARE */
 	FR_INVALID_PARAMETER,	/* (19) Given parameter is invalid */
 	FR_DISK_FULL,			/* (20) OLD FATFS: no more free clusters */
-	FR_DIR_NOT_EMPTY		/* (21) Directory not empty */
+	FR_DIR_NOT_EMPTY,		/* (21) Directory not empty */
+	FR_ABORTED,				/* (22) Cancelled by the user */
+	FR_VERIFY_FAILED		/* (23) Copy differs from the original */
 } FRESULT;
 
 /*--------------------------------------------------------------*/
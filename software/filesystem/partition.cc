@@ -48,7 +48,7 @@ FileSystem *Partition :: attach_filesystem(void)
 	return NULL;
 }
     
-DRESULT Partition::read(uint8_t *buffer, uint32_t sector, uint8_t count)
+DRESULT Partition::read(uint8_t *buffer, uint32_t sector, uint32_t count)
 {
 	if(!dev)
         return RES_NOTRDY;
@@ -56,7 +56,7 @@ DRESULT Partition::read(uint8_t *buffer, uint32_t sector, uint8_t count)
 }
 
 #if	_READONLY == 0
-DRESULT Partition::write(const uint8_t *buffer, uint32_t sector, uint8_t count)
+DRESULT Partition::write(const uint8_t *buffer, uint32_t sector, uint32_t count)
 {
     if(!dev)
         return RES_NOTRDY;
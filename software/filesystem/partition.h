@@ -33,9 +33,9 @@ public:
     
     // Fall through:
     DSTATUS status(void);
-    DRESULT read(uint8_t *, uint32_t, uint8_t);
+    DRESULT read(uint8_t *, uint32_t, uint32_t);
 #if	_READONLY == 0
-    DRESULT write(const uint8_t *, uint32_t, uint8_t);
+    DRESULT write(const uint8_t *, uint32_t, uint32_t);
 #endif
     DRESULT ioctl(uint8_t, void *);
 };
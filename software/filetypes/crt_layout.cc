@@ -0,0 +1,288 @@
+/*
+ * crt_layout.cc
+ *
+ *  Where the CHIP packets of a CRT file go in cartridge ROM memory; see crt_layout.h.
+ */
+
+#include "crt_layout.h"
+#include <stdio.h>
+#include <string.h>
+
+CrtLayout *CrtLayout::cache[CRT_LAYOUT_CACHE];
+
+static inline uint16_t get_word(const uint8_t *p)
+{
+    return (uint16_t(p[0]) << 8) + p[1];
+}
+
+static inline uint32_t get_dword(const uint8_t *p)
+{
+    return uint32_t(get_word(p) << 16) + get_word(p + 2);
+}
+
+CrtLayout::CrtLayout(uint16_t type_select, const uint8_t *crt_header, const char *path, uint32_t file_size, uint16_t date, uint16_t time)
+{
+    if (!path)
+        path = "";
+    this->path = new char[strlen(path) + 1];
+    strcpy(this->path, path);
+    this->type_select = type_select;
+    this->file_size = file_size;
+    this->date = date;
+    this->time = time;
+    memcpy(this->crt_header, crt_header, CRT_HEADER_SIZE);
+
+    next_header = get_dword(crt_header + 16);
+    header_fill = 0;
+    open = 0;
+    checked = 0;
+    done = false;
+    max_bank = 0;
+    load_at_a000 = false;
+    total_read = 0;
+    num_segments = 0;
+    num_chips = 0;
+}
+
+CrtLayout::~CrtLayout()
+{
+    delete[] path;
+}
+
+// Places the chip in 'chip_header', of which the payload starts at file offset 'payload'
+bool CrtLayout::add_chip(uint32_t payload)
+{
+    if (strncmp((char*) chip_header, "CHIP", 4))
+        return false;
+    uint16_t bank = get_word(chip_header + 10);
+    uint16_t load = get_word(chip_header + 12);
+    uint16_t size = get_word(chip_header + 14);
+
+    if (bank > 0x7f)
+        return false;
+
+    if ((type_select == CART_OCEAN) && (load == 0xA000))
+        bank &= 0xEF; // max 128k per region
+
+    if (bank > max_bank)
+        max_bank = bank;
+
+    bool split = false;
+    if (size > 0x2000)
+        if ((type_select == CART_OCEAN) || (type_select == CART_EASYFLASH) || (type_select == CART_DOMARK)
+                || (type_select == CART_SYSTEM3))
+            split = true;
+
+    uint32_t rom_offset = 0;
+
+    if (type_select == CART_KCS) {
+        rom_offset += load - 0x8000;
+    } else if (type_select == CART_NORMAL) {
+        rom_offset += (load & 0x2000); // use bit 13 of the load address
+    } else if (type_select == CART_FINAL3) {
+        rom_offset += 0x4000 * uint32_t(bank) + (load & 0x2000);
+    } else if (split) {
+        rom_offset += 0x2000 * uint32_t(bank);
+    } else {
+        rom_offset += uint32_t(size) * uint32_t(bank);
+    }
+
+    if (load == 0xA000 && type_select != CART_KCS && type_select != CART_FINAL3) {
+        rom_offset += 512 * 1024; // interleaved mode (TODO: make it the same in hardware as well, currently only for EasyFlash)
+        load_at_a000 = true;
+    }
+
+    if ((num_segments + 2 > CRT_MAX_SEGMENTS) || (num_chips >= CRT_MAX_SEGMENTS)) {
+        printf("Too many chips in CRT file.\n");
+        return false;
+    }
+    crt_chip_t *c = &chips[num_chips++];
+    c->file_offset = payload - CRT_CHIP_SIZE;
+    memcpy(c->header, chip_header, CRT_CHIP_SIZE);
+
+    if (size) {
+        crt_segment_t *s = &segments[num_segments++];
+        s->file_offset = payload;
+        s->rom_offset = rom_offset;
+        s->length = (split) ? 0x2000 : size;
+        if (split) {
+            s++;
+            num_segments++;
+            s->file_offset = payload + 0x2000;
+            s->rom_offset = rom_offset + 512 * 1024; // interleaved
+            s->length = size - 0x2000;
+        }
+    }
+    next_header = payload + size;
+    return true;
+}
+
+// Copies the part of the segments from 'first' on that lies in this piece of the file
+void CrtLayout::copy(int first, const uint8_t *data, uint32_t offset, uint32_t length, uint8_t *rom)
+{
+    uint32_t end = offset + length;
+    for (int i = first; i < num_segments; i++) {
+        crt_segment_t *s = &segments[i];
+        if (s->file_offset >= end)
+            break;
+        uint32_t lo = (s->file_offset > offset) ? s->file_offset : offset;
+        uint32_t hi = s->file_offset + s->length;
+        if (hi > end)
+            hi = end;
+        if (lo < hi) {
+            memcpy(rom + s->rom_offset + (lo - s->file_offset), data + (lo - offset), hi - lo);
+            total_read += hi - lo;
+        }
+    }
+    while ((open < num_segments) && (segments[open].file_offset + segments[open].length <= end))
+        open++;
+}
+
+// Compares the chip headers that lie in this piece of the file with the ones seen by parse().
+// A header may cross the boundary between two pieces.
+bool CrtLayout::verify(const uint8_t *data, uint32_t offset, uint32_t length)
+{
+    uint32_t end = offset + length;
+    while (checked < num_chips) {
+        crt_chip_t *c = &chips[checked];
+        if (c->file_offset >= end)
+            break;
+        uint32_t lo = (c->file_offset > offset) ? c->file_offset : offset;
+        uint32_t hi = c->file_offset + CRT_CHIP_SIZE;
+        if (hi > end)
+            return !memcmp(c->header + (lo - c->file_offset), data + (lo - offset), end - lo);
+        if ((lo < hi) && memcmp(c->header + (lo - c->file_offset), data + (lo - offset), hi - lo))
+            return false;
+        checked++;
+    }
+    return true;
+}
+
+bool CrtLayout::feed(const uint8_t *data, uint32_t offset, uint32_t length, uint8_t *rom)
+{
+    uint32_t end = offset + length;
+
+    copy(open, data, offset, length, rom); // payloads that started in an earlier piece
+
+    while (!done) {
+        uint32_t pos = next_header + header_fill;
+        if (pos >= end)
+            break;
+        if (pos < offset) { // pieces shall be consecutive
+            done = true;
+            break;
+        }
+        uint32_t n = CRT_CHIP_SIZE - header_fill;
+        if (n > end - pos)
+            n = end - pos;
+        memcpy(chip_header + header_fill, data + (pos - offset), n);
+        header_fill += n;
+        if (header_fill < CRT_CHIP_SIZE)
+            break;
+        header_fill = 0;
+
+        int first = num_segments;
+        if (!add_chip(next_header + CRT_CHIP_SIZE)) {
+            done = true;
+            break;
+        }
+        copy(first, data, offset, length, rom);
+    }
+    return !done;
+}
+
+bool CrtLayout::parse(crt_read_t read, crt_seek_t seek, void *context, uint8_t *buffer, uint8_t *rom)
+{
+    uint32_t offset = 0;
+
+    if (!seek(context, 0))
+        return false;
+
+    while (1) {
+        uint32_t n = read(context, buffer, CRT_READ_CHUNK);
+        if (!n)
+            break;
+        bool more = feed(buffer, offset, n, rom);
+        offset += n;
+        if ((!more) || (n < CRT_READ_CHUNK))
+            break;
+    }
+
+    // what was not in the file, was not loaded
+    for (int i = 0; i < num_segments; i++) {
+        crt_segment_t *s = &segments[i];
+        if (s->file_offset >= offset)
+            s->length = 0;
+        else if (s->file_offset + s->length > offset)
+            s->length = offset - s->file_offset;
+    }
+    return (offset > 0);
+}
+
+bool CrtLayout::load(crt_read_t read, crt_seek_t seek, void *context, uint8_t *buffer, uint8_t *rom)
+{
+    uint32_t expected = total_read;
+    uint32_t offset, end;
+
+    if (!num_segments)
+        return true;
+
+    // from the sector that holds the first chip header, up to the end of the last payload or header
+    offset = chips[0].file_offset & ~511;
+    end = segments[num_segments - 1].file_offset + segments[num_segments - 1].length;
+    if (chips[num_chips - 1].file_offset + CRT_CHIP_SIZE > end)
+        end = chips[num_chips - 1].file_offset + CRT_CHIP_SIZE;
+    if (!seek(context, offset))
+        return false;
+
+    total_read = 0;
+    open = 0;
+    checked = 0;
+    while (offset < end) {
+        uint32_t n = end - offset;
+        if (n > CRT_READ_CHUNK)
+            n = CRT_READ_CHUNK;
+        uint32_t got = read(context, buffer, n);
+        if (!verify(buffer, offset, got))
+            return false;
+        copy(open, buffer, offset, got, rom);
+        offset += got;
+        if (got != n)
+            break;
+    }
+    return (total_read == expected) && (checked == num_chips);
+}
+
+CrtLayout *CrtLayout::find(const char *path, uint32_t file_size, uint16_t date, uint16_t time, const uint8_t *crt_header)
+{
+    for (int i = 0; i < CRT_LAYOUT_CACHE; i++) {
+        CrtLayout *l = cache[i];
+        if (l && (l->file_size == file_size) && (l->date == date) && (l->time == time) &&
+                !strcmp(l->path, path) && !memcmp(l->crt_header, crt_header, CRT_HEADER_SIZE)) {
+            return l;
+        }
+    }
+    return NULL;
+}
+
+void CrtLayout::store(CrtLayout *layout)
+{
+    // the oldest one drops out
+    delete cache[CRT_LAYOUT_CACHE - 1];
+    for (int i = CRT_LAYOUT_CACHE - 1; i > 0; i--)
+        cache[i] = cache[i - 1];
+    cache[0] = layout;
+}
+
+void CrtLayout::forget(CrtLayout *layout)
+{
+    for (int i = 0; i < CRT_LAYOUT_CACHE; i++) {
+        if (cache[i] == layout) {
+            for (int j = i; j < CRT_LAYOUT_CACHE - 1; j++)
+                cache[j] = cache[j + 1];
+            cache[CRT_LAYOUT_CACHE - 1] = NULL;
+            delete layout;
+            return;
+        }
+    }
+}
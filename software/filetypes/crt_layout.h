@@ -0,0 +1,119 @@
+/*
+ * crt_layout.h
+ *
+ *  Where the CHIP packets of a CRT file go in cartridge ROM memory.
+ *
+ *  A CRT file is parsed in one pass over large, sequential reads: the chip
+ *  headers are picked from the data as it passes, and the payloads are
+ *  copied to their place. The result, a list of segments (file offset, ROM
+ *  offset, length), is cached for the last few files that were loaded, keyed
+ *  by their path, size, time stamp and CRT header. When the same file is
+ *  loaded again, the reads end with the last payload, and the chip headers
+ *  that pass by are only compared with the ones that were seen by the parse.
+ *
+ *  The payloads are not read straight into ROM memory one by one: each of
+ *  those reads would cost its own device commands for the partial sectors
+ *  at both ends, and that is what made the chip by chip loader slow.
+ */
+
+#ifndef FILETYPES_CRT_LAYOUT_H_
+#define FILETYPES_CRT_LAYOUT_H_
+
+#include <stdint.h>
+
+#define CART_NOT_IMPL    0xFFFF
+#define CART_NORMAL      1
+#define CART_ACTION      2
+#define CART_RETRO       3
+#define CART_DOMARK      4
+#define CART_OCEAN       5
+#define CART_EASYFLASH   6
+#define CART_SUPERSNAP   7
+#define CART_EPYX        8
+#define CART_FINAL3      9
+#define CART_SYSTEM3    10
+#define CART_KCS        11
+#define CART_FINAL12    12
+#define CART_COMAL80    13
+#define CART_SBASIC     14
+#define CART_WESTERMANN 15
+#define CART_BBASIC     16
+#define CART_PAGEFOX    17
+#define CART_EXOS       18
+#define CART_SUPERGAMES 19
+#define CART_NORDIC     20
+
+#define CRT_HEADER_SIZE     0x20
+#define CRT_CHIP_SIZE       0x10
+#define CRT_MAX_SEGMENTS     512 // 1 MB of 4K chips, or of split 16K chips, twice over
+#define CRT_LAYOUT_CACHE       4
+#define CRT_READ_CHUNK   0x10000
+
+// Reads 'length' bytes from the CRT file; returns the number of bytes actually read
+typedef uint32_t (*crt_read_t)(void *context, void *buffer, uint32_t length);
+// Moves the file pointer; returns false on error
+typedef bool (*crt_seek_t)(void *context, uint32_t pos);
+
+typedef struct {
+    uint32_t file_offset;
+    uint32_t rom_offset;
+    uint32_t length;
+} crt_segment_t;
+
+typedef struct {
+    uint32_t file_offset;
+    uint8_t  header[CRT_CHIP_SIZE];
+} crt_chip_t;
+
+class CrtLayout
+{
+    static CrtLayout *cache[CRT_LAYOUT_CACHE];
+
+    uint32_t next_header;
+    uint8_t  chip_header[CRT_CHIP_SIZE];
+    int      header_fill;
+    int      open;       // first segment that may still receive data
+    int      checked;    // chip headers found unchanged by load()
+    bool     done;
+
+    bool add_chip(uint32_t payload);
+    void copy(int first, const uint8_t *data, uint32_t offset, uint32_t length, uint8_t *rom);
+    bool verify(const uint8_t *data, uint32_t offset, uint32_t length);
+public:
+    char    *path;
+    uint32_t file_size;
+    uint16_t date;
+    uint16_t time;
+    uint8_t  crt_header[CRT_HEADER_SIZE];
+
+    uint16_t type_select;
+    uint16_t max_bank;
+    bool     load_at_a000;
+    uint32_t total_read;
+    int      num_segments;
+    crt_segment_t segments[CRT_MAX_SEGMENTS];
+    int      num_chips;
+    crt_chip_t chips[CRT_MAX_SEGMENTS];
+
+    // 'crt_header' is the header as checked by the loader; the offset of the first chip is taken from it.
+    // 'path' is the full name of the file, and may be NULL when the layout is not going to be cached.
+    CrtLayout(uint16_t type_select, const uint8_t *crt_header, const char *path, uint32_t file_size, uint16_t date, uint16_t time);
+    ~CrtLayout();
+
+    // Takes the next piece of the file, which starts at file offset 'offset'. Chip headers and
+    // payloads may cross the boundaries between pieces. Returns false when no more data is needed.
+    bool feed(const uint8_t *data, uint32_t offset, uint32_t length, uint8_t *rom);
+
+    // Reads the whole file through 'buffer' (CRT_READ_CHUNK bytes) and feeds it
+    bool parse(crt_read_t read, crt_seek_t seek, void *context, uint8_t *buffer, uint8_t *rom);
+
+    // Loads the file again with a cached layout; returns false when the file did not match,
+    // which includes any chip header that differs from the one seen by parse()
+    bool load(crt_read_t read, crt_seek_t seek, void *context, uint8_t *buffer, uint8_t *rom);
+
+    static CrtLayout *find(const char *path, uint32_t file_size, uint16_t date, uint16_t time, const uint8_t *crt_header);
+    static void store(CrtLayout *layout); // the cache takes ownership
+    static void forget(CrtLayout *layout);
+};
+
+#endif /* FILETYPES_CRT_LAYOUT_H_ */
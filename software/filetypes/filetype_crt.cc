@@ -23,6 +23,7 @@
  */
 
 #include "filetype_crt.h"
+#include "crt_layout.h"
 #include "directory.h"
 #include "filemanager.h"
 #include "c64.h"
@@ -88,28 +89,6 @@ struct t_cart {
     const char *cart_name;
 };
 
-#define CART_NOT_IMPL    0xFFFF
-#define CART_NORMAL      1
-#define CART_ACTION      2
-#define CART_RETRO       3
-#define CART_DOMARK      4
-#define CART_OCEAN       5
-#define CART_EASYFLASH   6
-#define CART_SUPERSNAP   7
-#define CART_EPYX        8
-#define CART_FINAL3      9
-#define CART_SYSTEM3    10
-#define CART_KCS        11
-#define CART_FINAL12    12
-#define CART_COMAL80    13
-#define CART_SBASIC     14
-#define CART_WESTERMANN 15
-#define CART_BBASIC     16
-#define CART_PAGEFOX    17
-#define CART_EXOS       18
-#define CART_SUPERGAMES 19
-#define CART_NORDIC     20
-
 const struct t_cart c_recognized_carts[] = {
     {  0, CART_NORMAL,    "Normal cartridge" },
     {  1, CART_ACTION,    "Action Replay" },
@@ -242,10 +221,7 @@ int FileTypeCRT::execute(SubsysCommand *cmd)
             printf("Header OK. Now reading chip packets starting from %6x.\n", dw);
             if (type_select == CART_EASYFLASH)
                 memset((void *)mem_addr, 0xff, 1024*1024); // clear all cart memory
-            fres = file->seek(dw);
-            if (fres == FR_OK)
-                while (read_chip_packet(file))
-                    ;
+            load_chips(file, cmd->path.c_str(), cmd->filename.c_str());
 
             char* eapi = (char*)(mem_addr + 512*1024 + 0x1800);
             if (eapi[0] == 0x65 && eapi[1] == 0x61 && eapi[2] == 0x70 && eapi[3] == 0x69)
@@ -286,10 +262,8 @@ int FileTypeCRT::parseCrt(void *bufferVoid)
     static char str[64];
 
     int sizeCrt = *(int32_t*) buffer;
-    int bufferIdx = 0x24;
 
     uint8_t * crt_header;
-    uint8_t * chip_header;
     uint16_t type_select;
     bool hdrOk = true;
 
@@ -328,69 +302,12 @@ int FileTypeCRT::parseCrt(void *bufferVoid)
         dw = get_dword(crt_header + 16);
         printf("Header OK. Now reading chip packets starting from %6x.\n", dw);
 
-        bufferIdx = dw + 4;
-
-        while (bufferIdx < sizeCrt) {
-            chip_header = (uint8_t*) buffer + bufferIdx;
-            bufferIdx += 0x10;
-            if (strncmp((char*) chip_header, "CHIP", 4))
-                break;
-            uint32_t total_length = get_dword(chip_header + 4);
-            uint16_t bank = get_word(chip_header + 10);
-            uint16_t load = get_word(chip_header + 12);
-            uint16_t size = get_word(chip_header + 14);
-
-            if (bank > 0x7f)
-                break;
-
-            if ((type_select == CART_OCEAN) && (load == 0xA000))
-                bank &= 0xEF; // max 128k per region
-
-            if (bank > max_bank)
-                max_bank = bank;
-
-            bool split = false;
-            if (size > 0x2000)
-                if ((type_select == CART_OCEAN) || (type_select == CART_EASYFLASH) || (type_select == CART_DOMARK)
-                        || (type_select == CART_SYSTEM3))
-                    split = true;
-
-            uint32_t mem_addr = ((uint32_t)C64_CARTRIDGE_ROM_BASE) << 16;
-
-            if (type_select == CART_KCS) {
-                mem_addr += load - 0x8000;
-            } else if (type_select == CART_NORMAL) {
-                mem_addr += (load & 0x2000); // use bit 13 of the load address
-            } else if (type_select == CART_FINAL3) {
-                mem_addr += 0x4000 * uint32_t(bank) + (load & 0x2000);
-            } else if (split) {
-                mem_addr += 0x2000 * uint32_t(bank);
-            } else {
-                mem_addr += uint32_t(size) * uint32_t(bank);
-            }
-
-            if (load == 0xA000 && type_select != CART_KCS && type_select != CART_FINAL3) {
-                mem_addr += 512 * 1024; // interleaved mode (TODO: make it the same in hardware as well, currently only for EasyFlash)
-                load_at_a000 = true;
-            }
-            printf("Reading chip data bank %d to $%4x with size $%4x to 0x%8x. %s\n", bank, load, size, mem_addr,
-                    (split) ? "Split" : "Contiguous");
-
-            if (size) {
-                if (split) {
-                    memcpy((void*) mem_addr, buffer + bufferIdx, 0x2000);
-                    bufferIdx += 0x2000;
-
-                    mem_addr += 512 * 1024; // interleaved
-                    memcpy((void*) mem_addr, buffer + bufferIdx, size - 0x2000);
-                    bufferIdx += size - 0x2000;
-                } else {
-                    memcpy((void*) mem_addr, buffer + bufferIdx, size);
-                    bufferIdx += size;
-                }
-            }
-
-        }
+        CrtLayout *layout = new CrtLayout(type_select, crt_header, NULL, sizeCrt, 0, 0);
+        layout->feed((uint8_t *)crt_header, 0, sizeCrt, (uint8_t *)mem_addr);
+        max_bank = layout->max_bank;
+        load_at_a000 = layout->load_at_a000;
+        printf("%d bytes loaded in %d segments.\n", layout->total_read, layout->num_segments);
+        delete layout;
     } else {
         return -1;
     }
@@ -578,77 +495,59 @@ bool FileTypeCRT::check_header(File *f)
     return false;
 }
 
-bool FileTypeCRT::read_chip_packet(File *f)
+static uint32_t crt_file_read(void *context, void *buffer, uint32_t length)
 {
-    uint32_t bytes_read;
-    FRESULT res = f->read(chip_header, 0x10, &bytes_read);
-    if ((res != FR_OK) || (!bytes_read))
-        return false;
-    if (strncmp((char*) chip_header, "CHIP", 4))
-        return false;
-    uint32_t total_length = get_dword(chip_header + 4);
-    uint16_t bank = get_word(chip_header + 10);
-    uint16_t load = get_word(chip_header + 12);
-    uint16_t size = get_word(chip_header + 14);
-
-    if (bank > 0x7f)
-        return false;
-
-    if ((type_select == CART_OCEAN) && (load == 0xA000))
-        bank &= 0xEF; // max 128k per region
-
-    if (bank > max_bank)
-        max_bank = bank;
-
-    bool split = false;
-    if (size > 0x2000)
-        if ((type_select == CART_OCEAN) || (type_select == CART_EASYFLASH) || (type_select == CART_DOMARK)
-                || (type_select == CART_SYSTEM3))
-            split = true;
-
-    uint32_t mem_addr = ((uint32_t)C64_CARTRIDGE_ROM_BASE) << 16;
+    uint32_t transferred = 0;
+    ((File *)context)->read(buffer, length, &transferred);
+    return transferred;
+}
 
-    if (type_select == CART_KCS) {
-        mem_addr += load - 0x8000;
-    } else if (type_select == CART_NORMAL) {
-        mem_addr += (load & 0x2000); // use bit 13 of the load address
-    } else if (type_select == CART_FINAL3) {
-        mem_addr += 0x4000 * uint32_t(bank) + (load & 0x2000);
-    } else if (split) {
-        mem_addr += 0x2000 * uint32_t(bank);
-    } else {
-        mem_addr += uint32_t(size) * uint32_t(bank);
-    }
+static bool crt_file_seek(void *context, uint32_t pos)
+{
+    return (((File *)context)->seek(pos) == FR_OK);
+}
 
-    if (load == 0xA000 && type_select != CART_KCS && type_select != CART_FINAL3) {
-        mem_addr += 512 * 1024; // interleaved mode (TODO: make it the same in hardware as well, currently only for EasyFlash)
-        load_at_a000 = true;
+void FileTypeCRT::load_chips(File *f, const char *path, const char *filename)
+{
+    FileManager *fm = FileManager::getFileManager();
+    uint8_t *rom = (uint8_t *)(((uint32_t)C64_CARTRIDGE_ROM_BASE) << 16);
+    uint32_t size = f->get_size();
+    FileInfo info(32);
+    bool cacheable = (fm->fstat(path, filename, info) == FR_OK);
+    mstring full_name(path);
+    full_name += "/";
+    full_name += filename;
+
+    uint8_t *buffer = new uint8_t[CRT_READ_CHUNK];
+    CrtLayout *layout = NULL;
+    if (cacheable) {
+        layout = CrtLayout::find(full_name.c_str(), size, info.date, info.time, crt_header);
     }
-    printf("Reading chip data bank %d to $%4x with size $%4x to 0x%8x. %s\n", bank, load, size, mem_addr,
-            (split) ? "Split" : "Contiguous");
-
-    if (size) {
-        if (split) {
-            res = f->read((void *) mem_addr, 0x2000, &bytes_read);
-            total_read += uint32_t(bytes_read);
-            if (bytes_read != 0x2000) {
-                printf("Just read %4x bytes, expecting 8K\n", bytes_read);
-                return false;
-            }
-            mem_addr += 512 * 1024; // interleaved
-            res = f->read((void *) mem_addr, size - 0x2000, &bytes_read);
-            total_read += uint32_t(bytes_read);
-        } else {
-            res = f->read((void *) mem_addr, size, &bytes_read);
-            total_read += uint32_t(bytes_read);
-            if (bytes_read != size) {
-                printf("Just read %4x bytes\n", bytes_read);
-                return false;
-            }
+    if (layout) {
+        printf("Reading chip data with the layout of the last time.\n");
+        if (!layout->load(crt_file_read, crt_file_seek, f, buffer, rom)) {
+            printf("File does not match its layout anymore.\n");
+            CrtLayout::forget(layout);
+            layout = NULL;
+            memset(rom, (type_select == CART_EASYFLASH) ? 0xff : 0, 1024*1024);
         }
-        return (res == FR_OK);
     }
-    return true;
+    if (!layout) {
+        layout = new CrtLayout(type_select, crt_header, full_name.c_str(), size, info.date, info.time);
+        layout->parse(crt_file_read, crt_file_seek, f, buffer, rom);
+    }
+    delete[] buffer;
+
+    total_read = layout->total_read;
+    max_bank = layout->max_bank;
+    load_at_a000 = layout->load_at_a000;
+    printf("Read %6x bytes of chip data in %d segments.\n", total_read, layout->num_segments);
+
+    if (!cacheable) {
+        delete layout;
+    } else if (CrtLayout::find(full_name.c_str(), size, info.date, info.time, crt_header) != layout) {
+        CrtLayout::store(layout);
+    }
 }
 
 void FileTypeCRT::configure_cart(void)
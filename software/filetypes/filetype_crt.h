@@ -8,7 +8,6 @@ class FileTypeCRT : public FileType
 {
 	BrowsableDirEntry *node;
 	uint8_t  crt_header[0x20];
-    uint8_t  chip_header[0x10];
     uint16_t  type_select;
     uint16_t  max_bank;
     uint32_t total_read;
@@ -16,7 +15,7 @@ class FileTypeCRT : public FileType
     const char *name;
     bool  check_header(File *f);
     void  configure_cart(void);
-    bool  read_chip_packet(File *file);
+    void  load_chips(File *file, const char *path, const char *filename);
 
     static int execute_st(SubsysCommand *cmd);
     int execute(SubsysCommand *cmd);
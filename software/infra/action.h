@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
+#include "pool.h"
 
 class SubsysCommand;
 
@@ -22,7 +23,7 @@ class Action
 public:
 	Action(const char *name, int ID, int f, int m=0) : subsys(ID), function(f), mode(m), func(0) {
 		if(name) {
-			actionName = new char[strlen(name)+1];
+			actionName = pool_alloc_string(strlen(name)+1);
 			strcpy(actionName, name);
 		} else {
 			actionName = 0;
@@ -31,7 +32,7 @@ public:
 
 	Action(const char *name, actionFunction_t func, int f, int m=0) : subsys(-1), function(f), mode(m), func(func) {
 		if(name) {
-			actionName = new char[strlen(name)+1];
+			actionName = pool_alloc_string(strlen(name)+1);
 			strcpy(actionName, name);
 		} else {
 			actionName = 0;
@@ -40,10 +41,18 @@ public:
 
 	virtual ~Action() {
 		if (actionName) {
-			delete actionName;
+			pool_free_string(actionName, strlen(actionName)+1);
 		}
 	}
 
+	static void *operator new(size_t size) {
+		return action_pool.alloc(size);
+	}
+
+	static void operator delete(void *p) {
+		action_pool.release(p);
+	}
+
 	virtual const char *getName() {
 		return (const char *)actionName;
 	}
@@ -20,6 +20,9 @@ Acia :: Acia(uint32_t base)
     controlQueue = NULL;
     dataQueue = NULL;
     buffer = NULL;
+    txNotifyTask = NULL;
+    rxNotifyTask = NULL;
+    txStampValid = false;
 }
 
 int Acia :: init(uint16_t base, bool useNMI, QueueHandle_t controlQueue, QueueHandle_t dataQueue, DataBuffer *buffer)
@@ -161,14 +164,50 @@ uint8_t Acia :: IrqHandler(void)
         }
         //printf("ACIA MSG: %s\n", message);
         regs->tx_tail = tx_head;
+        if (!txStampValid) {
+            txStamp = getMsTimer();
+            txStampValid = true;
+        }
+        if (txNotifyTask) {
+            vTaskNotifyGiveFromISR(txNotifyTask, &retVal);
+        }
     }
-//    if (source & ACIA_IRQ_RX) {
-//        printf("ACIA_RX\n");
-//        regs->enable &= ~ACIA_IRQ_RX;
-//    }
-    // Let's turn it off for now
-    // regs->enable &= ~source;
-    return 0;
+    if (source & ACIA_IRQ_RX) {
+        // one shot: only enabled while someone is waiting for space
+        regs->enable &= ~ACIA_IRQ_RX;
+        regs->irq_source = ACIA_IRQ_RX;
+        if (rxNotifyTask) {
+            vTaskNotifyGiveFromISR(rxNotifyTask, &retVal);
+        }
+    }
+    return (uint8_t)retVal;
+}
+
+void Acia :: SetNotifyTasks(TaskHandle_t txTask, TaskHandle_t rxTask)
+{
+    ENTER_SAFE_SECTION
+    txNotifyTask = txTask;
+    rxNotifyTask = rxTask;
+    LEAVE_SAFE_SECTION
+}
+
+void Acia :: EnableRxSpaceIrq(void)
+{
+    ENTER_SAFE_SECTION
+    regs->enable |= ACIA_IRQ_RX;
+    LEAVE_SAFE_SECTION
+}
+
+// Returns the ms timer value at which the oldest data in the transmit buffer
+// arrived from the C64, and clears it.
+bool Acia :: GetTxStamp(uint16_t *stamp)
+{
+    if (!txStampValid) {
+        return false;
+    }
+    *stamp = txStamp;
+    txStampValid = false;
+    return true;
 }
 
 int Acia :: GetRxSpace(void)
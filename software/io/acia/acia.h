@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include "FreeRTOS.h"
 #include "queue.h"
+#include "task.h"
 
 typedef struct _acia_t {
     uint8_t rx_head;
@@ -147,6 +148,10 @@ class Acia
     QueueHandle_t controlQueue;
     QueueHandle_t dataQueue;
     DataBuffer *buffer;
+    TaskHandle_t txNotifyTask;
+    TaskHandle_t rxNotifyTask;
+    volatile uint16_t txStamp;
+    volatile bool txStampValid;
     static void TaskStart(void *a);
     void Task();
 public:
@@ -162,6 +167,12 @@ public:
     void SetCTS(uint8_t value);
     void SetRxRate(uint8_t value);
 
+    // event driven transfers: tasks that are notified when data arrives from
+    // the C64 (tx) or when the C64 has freed up space in the receive buffer (rx)
+    void SetNotifyTasks(TaskHandle_t txTask, TaskHandle_t rxTask);
+    void EnableRxSpaceIrq(void);
+    bool GetTxStamp(uint16_t *stamp);
+
     // efficient transfers
     int      GetRxSpace(void);
     volatile uint8_t *GetRxPointer(void);
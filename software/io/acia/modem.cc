@@ -4,6 +4,7 @@
 #include "socket.h"
 #include "netdb.h"
 #include <ctype.h>
+#include <errno.h>
 
 #include "filemanager.h"
 #include "dump_hex.h"
@@ -64,6 +65,12 @@ Modem :: Modem()
     connectQueue = xQueueCreate(2, sizeof(ModemCommand_t));
 
     connectionLock = xSemaphoreCreateMutex();
+    relayRxDone = xSemaphoreCreateBinary();
+    aciaRxLock = xSemaphoreCreateMutex();
+    relayTask = NULL;
+    relayActive = false;
+    relaySocket = -1;
+    memset(&stats, 0, sizeof(stats));
     xTaskCreate( Modem :: task, "Modem Task", configMINIMAL_STACK_SIZE, this, tskIDLE_PRIORITY + 1, NULL );
     xTaskCreate( Modem :: callerTask, "Outgoing Caller", configMINIMAL_STACK_SIZE, this, tskIDLE_PRIORITY + 1, NULL );
     listenerSocket = new ListenerSocket("Modem Listener", Modem :: listenerTask, "Modem External Connection");
@@ -107,6 +114,88 @@ void Modem :: listenerTask(void *a)
     vTaskDelete(NULL);
 }
 
+void Modem :: socketRxTask(void *a)
+{
+    Modem *obj = (Modem *)a;
+    obj->SocketToAcia();
+    xSemaphoreGive(obj->relayRxDone);
+    vTaskDelete(NULL);
+}
+
+void Modem :: WakeRelay(void)
+{
+    TaskHandle_t t = relayTask;
+    if (t) {
+        xTaskNotifyGive(t);
+    }
+}
+
+// Command responses go into the same ACIA receive buffer as the socket data,
+// from another task while the relay runs.
+int Modem :: SendToAcia(const char *data, int length)
+{
+    xSemaphoreTake(aciaRxLock, portMAX_DELAY);
+    int ret = acia.SendToRx((uint8_t *)data, length);
+    xSemaphoreGive(aciaRxLock);
+    return ret;
+}
+
+// Socket -> C64 direction. Blocks on the socket, and when the C64 has not
+// read the receive buffer yet, on the ACIA receive space interrupt. The wait
+// for the socket is done without the receive buffer lock; the data is then
+// taken from the socket directly into the ACIA buffer, under the lock.
+void Modem :: SocketToAcia(void)
+{
+    fd_set readset;
+    struct timeval tv;
+
+    while(relayActive) {
+        int space = acia.GetRxSpace();
+        if (space <= 0) {
+            stats.rxFullWaits++;
+            acia.EnableRxSpaceIrq();
+            ulTaskNotifyTake(pdTRUE, 2); // fall back to polling every other tick
+            continue;
+        }
+        FD_ZERO(&readset);
+        FD_SET(relaySocket, &readset);
+        tv.tv_sec = 0;
+        tv.tv_usec = 50000;
+        int ret = lwip_select(relaySocket + 1, &readset, NULL, NULL, &tv);
+        if (ret == 0) {
+            continue;
+        }
+        if (ret > 0) {
+            xSemaphoreTake(aciaRxLock, portMAX_DELAY);
+            space = acia.GetRxSpace(); // a command response may have taken some
+            if (space <= 0) {
+                xSemaphoreGive(aciaRxLock);
+                continue;
+            }
+            volatile uint8_t *dest = acia.GetRxPointer();
+            ret = recv(relaySocket, (void *)dest, space, MSG_DONTWAIT);
+            if (ret > 0) {
+                acia.AdvanceRx(ret);
+            }
+            xSemaphoreGive(aciaRxLock);
+        }
+        if (ret > 0) {
+            stats.bytesToAcia += ret;
+        } else if(ret == 0) {
+            printf("Receive returned 0. Exiting\n");
+            break;
+        } else if ((errno != EWOULDBLOCK) && (errno != EAGAIN)) {
+            printf("Receive error %d. Exiting\n", errno);
+            break;
+        }
+    }
+    relayActive = false;
+    WakeRelay();
+}
+
+// C64 -> Socket direction, escape detection and command handling. The task
+// sleeps until the ACIA receives data from the C64, a command is queued, the
+// connection is dropped, or the escape guard time expires.
 void Modem :: RunRelay(int socket)
 {
     struct timeval tv;
@@ -124,23 +213,27 @@ void Modem :: RunRelay(int socket)
     int escapeTime = 4 * (int)registerValues[MODEM_REG_ESCAPETIME]; // Ultimate Timer is 200 Hz, hence *4, register specifies fiftieths of seconds
     int escapeCount = 0;
     TickType_t escapeDetectTime = 0;
-
-    while(keepConnection) {
-        int space = acia.GetRxSpace();
-        volatile uint8_t *dest = acia.GetRxPointer();
-        if (space > 0) {
-            //printf("RELAY: Recv %p %d ", dest, space);
-            ret = recv(socket, (void *)dest, space, 0);
-            if (ret > 0) {
-                acia.AdvanceRx(ret);
-                //printf("%d\n", ret);
-            } else if(ret == 0) {
-                printf("Receive returned 0. Exiting\n");
-                break;
-            }
-        } else {
-            vTaskDelay(10);
+    uint16_t stamp;
+
+    memset(&stats, 0, sizeof(stats));
+    relaySocket = socket;
+    relayActive = true;
+    relayTask = xTaskGetCurrentTaskHandle();
+    TaskHandle_t rxTask;
+    xTaskCreate( Modem :: socketRxTask, "Modem Socket Rx", configMINIMAL_STACK_SIZE, this, tskIDLE_PRIORITY + 2, &rxTask );
+    acia.SetNotifyTasks(relayTask, rxTask);
+
+    while(keepConnection && relayActive) {
+        TickType_t wait = 200; // safety net; all relevant events notify this task
+        if (escapeCount == 3) {
+            TickType_t since = xTaskGetTickCount() - escapeDetectTime;
+            wait = (since >= escapeTime) ? 0 : escapeTime - since;
         }
+        if (wait) {
+            ulTaskNotifyTake(pdTRUE, wait);
+            stats.relayWakeups++;
+        }
+
         if (escapeCount == 3) {
             TickType_t since = xTaskGetTickCount() - escapeDetectTime;
             if (since >= escapeTime) {
@@ -149,40 +242,70 @@ void Modem :: RunRelay(int socket)
                 commandMode = true;
             }
         }
-        if (!commandMode) {
+        while (!commandMode) {
             int avail = aciaTxBuffer->AvailableContiguous();
-            if (avail > 0) {
-                uint8_t *pnt = aciaTxBuffer->GetReadPointer();
-                for(int i=0;i<avail;i++) {
-                    if (pnt[i] == escape) {
-                        escapeCount ++;
-                        if (escapeCount == 3) {
-                            escapeDetectTime = xTaskGetTickCount();
-                        }
-                    } else {
-                        escapeCount = 0;
+            if (avail <= 0) {
+                break;
+            }
+            uint8_t *pnt = aciaTxBuffer->GetReadPointer();
+            for(int i=0;i<avail;i++) {
+                if (pnt[i] == escape) {
+                    escapeCount ++;
+                    if (escapeCount == 3) {
+                        escapeDetectTime = xTaskGetTickCount();
                     }
+                } else {
+                    escapeCount = 0;
                 }
-                ret = send(socket, pnt, avail, 0);
-                if (ret > 0) {
-                    aciaTxBuffer->AdvanceReadPointer(ret);
-                } else if(ret < 0) {
-                    printf("Error writing to socket. Exiting\n");
-                    break;
+            }
+            ret = send(socket, pnt, avail, 0);
+            if (ret > 0) {
+                aciaTxBuffer->AdvanceReadPointer(ret);
+                stats.bytesToSocket += ret;
+                if (acia.GetTxStamp(&stamp)) {
+                    uint16_t latency = getMsTimer() - stamp;
+                    stats.txLatencyTotal += latency;
+                    stats.txLatencyCount++;
+                    if (latency > stats.txLatencyMax) {
+                        stats.txLatencyMax = latency;
+                    }
                 }
+            } else if(ret < 0) {
+                printf("Error writing to socket. Exiting\n");
+                relayActive = false;
+                break;
             }
         }
-        BaseType_t cmdAvailable = xQueueReceive(commandQueue, &modemCommand, 0);
-        if (cmdAvailable) {
+        while (xQueueReceive(commandQueue, &modemCommand, 0)) {
             ExecuteCommand(&modemCommand);
             escape = registerValues[MODEM_REG_ESCAPE];
             escapeTime = 4 * (int)registerValues[MODEM_REG_ESCAPETIME]; // Ultimate Timer is 200 Hz, hence *4, register specifies fiftieths of seconds
         }
     }
+
+    // stop the receive task; it leaves at the latest after the socket receive timeout
+    relayActive = false;
+    xTaskNotifyGive(rxTask);
+    xSemaphoreTake(relayRxDone, portMAX_DELAY);
+    acia.SetNotifyTasks(NULL, NULL);
+    relayTask = NULL;
+
+    char statsBuffer[128];
+    PrintStatistics(statsBuffer);
+    printf("Modem: Relay ended. %s", statsBuffer);
+
     commandMode = true;
     SetHandshakes(false);
 }
 
+void Modem :: PrintStatistics(char *buffer)
+{
+    int avgLatency = (stats.txLatencyCount) ? stats.txLatencyTotal / stats.txLatencyCount : 0;
+    sprintf(buffer, "TX %d RX %d\rWAKE %d FULL %d\rLAT %d/%d MS\r",
+            stats.bytesToSocket, stats.bytesToAcia, stats.relayWakeups, stats.rxFullWaits,
+            avgLatency, stats.txLatencyMax);
+}
+
 void Modem :: IncomingConnection(int socket)
 {
     char buffer[64];
@@ -201,7 +324,7 @@ void Modem :: IncomingConnection(int socket)
         ModemCommand_t modemCommand;
         registerValues[MODEM_REG_RINGCOUNTER] = 0;
         for(int rings=0; rings < 10; rings++) {
-            acia.SendToRx((uint8_t *)"RING\r", 5);
+            SendToAcia("RING\r", 5);
             int len = sprintf(buffer, "RING\n");
             registerValues[MODEM_REG_RINGCOUNTER] ++;
             if (send(socket, buffer, len, 0) <= 0) {
@@ -223,13 +346,13 @@ void Modem :: IncomingConnection(int socket)
 
         if (keepConnection) {
             int len = sprintf(buffer, "CONNECT %d\r", baudRate);
-            acia.SendToRx((uint8_t*)buffer, len);
+            SendToAcia(buffer, len);
             buffer[len-1] = 0x0a; // Use Newline instead of carriage return for the socket
             send(socket, buffer, len, 0);
 
             RunRelay(socket);
             len = sprintf(buffer, "NO CARRIER\r");
-            acia.SendToRx((uint8_t*)buffer, len);
+            SendToAcia(buffer, len);
         } else {
             int len = sprintf(buffer, "NO ANSWER\n");
             send(socket, buffer, len, 0);
@@ -307,7 +430,7 @@ void Modem :: Caller()
     while(1) {
         xQueueReceive(connectQueue, &cmd, portMAX_DELAY);
         if (xSemaphoreTake(connectionLock, 50) != pdTRUE) {
-            acia.SendToRx((uint8_t *)"MODEM BUSY\r", 11);
+            SendToAcia("MODEM BUSY\r", 11);
             continue;
         }
 
@@ -322,14 +445,14 @@ void Modem :: Caller()
         int result = gethostbyname_r(cmd.command, &my_host, buffer, 128, &ret_host, &error);
 
         if (!ret_host) {
-            acia.SendToRx((uint8_t *)"RESOLVE ERROR\r", 14);
+            SendToAcia("RESOLVE ERROR\r", 14);
             xSemaphoreGive(connectionLock);
             continue;
         }
 
         int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
         if (sock_fd < 0) {
-            acia.SendToRx((uint8_t *)"NO SOCKET\r", 10);
+            SendToAcia("NO SOCKET\r", 10);
             xSemaphoreGive(connectionLock);
             continue;
         }
@@ -344,7 +467,7 @@ void Modem :: Caller()
         serv_addr.sin_port = htons(portno);
 
         if (connect(sock_fd, (struct sockaddr *)&serv_addr,sizeof(serv_addr)) < 0) {
-            acia.SendToRx((uint8_t *)"NO CARRIER\r", 14);
+            SendToAcia("NO CARRIER\r", 14);
             xSemaphoreGive(connectionLock);
             continue;
         }
@@ -352,11 +475,11 @@ void Modem :: Caller()
         //dump_hex(buffer, 128);
         // run the relay
 
-        acia.SendToRx((uint8_t *)"CONNECTED\r", 10);
+        SendToAcia("CONNECTED\r", 10);
         keepConnection = true;
         RunRelay(sock_fd);
         lwip_close(sock_fd);
-        acia.SendToRx((uint8_t *)"NO CARRIER\r", 14);
+        SendToAcia("NO CARRIER\r", 14);
         keepConnection = false;
         xSemaphoreGive(connectionLock);
     }
@@ -407,6 +530,7 @@ bool Modem :: ExecuteCommand(ModemCommand_t *cmd)
     char *c;
     const char *response = "OK\r";
     char responseBuffer[16];
+    char statsBuffer[128];
     int registerValue, temp;
 
     printf("MODEM COMMAND: '%s'\n", cmd->command);
@@ -426,7 +550,16 @@ bool Modem :: ExecuteCommand(ModemCommand_t *cmd)
             response = "";
             break;
         case 'I': // identify
-            response = "ULTIMATE-II MODEM EMULATION LAYER\rMADE BY GIDEON\rVERSION V1.0\r";
+            temp = 0;
+            sscanf(cmd->command + i + 1, "%d", &temp);
+            while(i < cmd->length && (isdigit(cmd->command[i+1])))
+                i++;
+            if (temp == 1) { // relay statistics of the current or last connection
+                PrintStatistics(statsBuffer);
+                response = statsBuffer;
+            } else {
+                response = "ULTIMATE-II MODEM EMULATION LAYER\rMADE BY GIDEON\rVERSION V1.0\r";
+            }
             break;
         case 'Z': // reset
             ResetRegisters();
@@ -491,7 +624,7 @@ bool Modem :: ExecuteCommand(ModemCommand_t *cmd)
             break;
         }
     }
-    acia.SendToRx((uint8_t *)response, strlen(response));
+    SendToAcia(response, strlen(response));
     return connectionStateChange;
 }
 
@@ -565,6 +698,7 @@ void Modem :: ModemTask()
             lastHandshake = message.smallValue;
             if (!(message.smallValue & ACIA_HANDSH_DTR) && dropOnDTR) {
                 keepConnection = false;
+                WakeRelay();
                 //commandMode = true;
             }
             //acia.SendToRx((uint8_t *)outbuf, strlen(outbuf));
@@ -572,15 +706,16 @@ void Modem :: ModemTask()
         case ACIA_MSG_TXDATA:
             if (commandMode) {
                 len = aciaTxBuffer->Get(txbuf, 30);
-                acia.SendToRx(txbuf, len); // local echo
+                SendToAcia((const char *)txbuf, len); // local echo
                 txbuf[len] = 0;
                 CollectCommand(&modemCommand, (char *)txbuf, len);
                 if (modemCommand.state == 3) {
                     // Let's check if the modem is in a call
                     if (xSemaphoreTake(connectionLock, 0) != pdTRUE) {
                         if (xQueueSend(commandQueue, &modemCommand, 10) == pdFALSE) {
-                            acia.SendToRx((uint8_t *)"NAK\r", 4);
+                            SendToAcia("NAK\r", 4);
                         }
+                        WakeRelay();
                     } else {
                         // we were not in a call, release the semaphore that we got
                         xSemaphoreGive(connectionLock);
@@ -20,17 +20,32 @@ typedef struct {
 #define MODEM_REG_ESCAPE      2
 #define MODEM_REG_ESCAPETIME  12
 
+typedef struct {
+    uint32_t bytesToSocket;
+    uint32_t bytesToAcia;
+    uint32_t relayWakeups;
+    uint32_t rxFullWaits;
+    uint32_t txLatencyTotal; // ms, from ACIA interrupt to socket send
+    uint32_t txLatencyCount;
+    uint16_t txLatencyMax;
+} ModemStats_t;
+
 class Modem : public ConfigurableObject
 {
     static void task(void *a);
     static void listenerTask(void *a);
     static void callerTask(void *a);
+    static void socketRxTask(void *a);
     void ModemTask(void);
     void IncomingConnection(int socket);
     void Caller(void);
     void CollectCommand(ModemCommand_t *cmd, char *buf, int len);
     bool ExecuteCommand(ModemCommand_t *cmd);
     void RunRelay(int socket);
+    void SocketToAcia(void);
+    void WakeRelay(void);
+    int  SendToAcia(const char *data, int length);
+    void PrintStatistics(char *buffer);
     void ResetRegisters();
     void WriteRegister(int value);
     int  ReadRegister();
@@ -43,6 +58,12 @@ class Modem : public ConfigurableObject
     QueueHandle_t aciaQueue;
     DataBuffer *aciaTxBuffer;
     ListenerSocket *listenerSocket;
+    TaskHandle_t relayTask;
+    SemaphoreHandle_t relayRxDone;
+    SemaphoreHandle_t aciaRxLock; // the ACIA receive buffer is written by the socket rx task and by command responses
+    volatile bool relayActive;
+    int relaySocket;
+    ModemStats_t stats;
     uint8_t ctsMode, dsrMode, dcdMode;
     uint8_t lastHandshake;
     bool keepConnection;
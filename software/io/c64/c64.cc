@@ -687,6 +687,33 @@ void C64::reset(void)
     C64_MODE = C64_MODE_UNRESET;
 }
 
+// The C64 as the application sees it through the cartridge port, for C64IoBackup
+struct C64PortBus
+{
+    uint8_t read(uint16_t addr) {
+        return C64_PEEK(addr);
+    }
+    void write(uint16_t addr, uint8_t data) {
+        C64_POKE(addr, data);
+    }
+    void read_block(uint16_t addr, uint32_t *dest, int words) {
+        volatile uint32_t *src = (volatile uint32_t *)(C64_MEMORY_BASE + addr);
+        for (int i = 0; i < words; i++)
+            dest[i] = src[i];
+    }
+    void write_block(uint16_t addr, const uint32_t *src, int words) {
+        volatile uint32_t *dest = (volatile uint32_t *)(C64_MEMORY_BASE + addr);
+        for (int i = 0; i < words; i++)
+            dest[i] = src[i];
+    }
+    void timer_start(uint8_t ticks) {
+        ioWrite8(ITU_TIMER, ticks);
+    }
+    bool timer_expired(void) {
+        return !ioRead8(ITU_TIMER);
+    }
+};
+
 /*
  -------------------------------------------------------------------------------
  freeze (split in subfunctions)
@@ -703,59 +730,11 @@ void C64::backup_io(void)
 #ifdef OS
     configASSERT( !backupIsValid );
 #endif
-    int i;
     // enter ultimax mode, as this might not have taken place already!
     goUltimax();
 
-    // back up VIC registers
-    for (i = 0; i < NUM_VICREGS; i++)
-        vic_backup[i] = VIC_REG(i);
-
-    // now we can turn off the screen to avoid flicker
-    VIC_CTRL = 0;
-    BORDER = 0; // black
-    BACKGROUND = 0; // black for later
-    SID_VOLUME = 0;
-    SID2_VOLUME = 0;
-    SID3_VOLUME = 0;
-
-    // have a look at the timers.
-    // These printfs introduce some delay.. if you remove this, some programs won't resume well. Why?!
-    printf("CIA1 registers: ");
-    for (i = 0; i < 13; i++) {
-        printf("%b ", CIA1_REG(i));
-    }
-    printf("\n");
-
-    // back up 3 kilobytes of RAM to do our thing
-    for (i = 0; i < BACKUP_SIZE / 4; i++) {
-        ram_backup[i] = MEM_LOC[i];
-    }
-    for (i = 0; i < COLOR_SIZE / 4; i++) {
-        color_backup[i] = COLOR_RAM[i];
-    }
-    for (i = 0; i < COLOR_SIZE / 4; i++) {
-        screen_backup[i] = SCREEN_RAM[i];
-    }
-
-    // now copy our own character map into that piece of ram at 0800
-    for (i = 0; i < CHARSET_SIZE; i++) {
-        CHAR_DEST[i] = char_set[i];
-    }
-
-    // backup CIA registers
-    cia_backup[0] = CIA2_DDRA;
-    cia_backup[1] = CIA2_DPA;
-    cia_backup[2] = CIA1_DDRA;
-    cia_backup[3] = CIA1_DDRB;
-    CIA1_DDRA = 0x00;
-    CIA1_DDRB = 0xFF;
-    cia_backup[5] = CIA1_DPB;
-    CIA1_DDRB = 0x00;
-    CIA1_DDRA = 0xFF;
-    cia_backup[4] = CIA1_DPA;
-    cia_backup[6] = CIA1_CRA;
-    cia_backup[7] = CIA1_CRB;
+    C64PortBus bus;
+    io_backup.save(bus, char_set);
 
     backupIsValid = true;
 }
@@ -833,48 +812,8 @@ void C64::restore_io(void)
     configASSERT( backupIsValid );
 #endif
 
-    int i;
-
-    // disable screen
-    VIC_CTRL = 0;
-
-    // restore memory
-    for (i = 0; i < BACKUP_SIZE / 4; i++) {
-        MEM_LOC[i] = ram_backup[i];
-    }
-    for (i = 0; i < COLOR_SIZE / 4; i++) {
-        COLOR_RAM[i] = color_backup[i];
-    }
-    for (i = 0; i < COLOR_SIZE / 4; i++) {
-        SCREEN_RAM[i] = screen_backup[i];
-    }
-
-    // restore the cia registers
-    CIA2_DDRA = cia_backup[0];
-//    CIA2_DPA  = cia_backup[1]; // don't touch!
-    CIA1_DDRA = cia_backup[2];
-    CIA1_DDRB = cia_backup[3];
-    CIA1_DPA = cia_backup[4];
-    CIA1_DPB = cia_backup[5];
-    CIA1_CRA = cia_backup[6];
-    CIA1_CRB = cia_backup[7];
-
-    printf("Set CIA1 %b %b %b %b %b %b\n", cia_backup[0], cia_backup[1], cia_backup[2], cia_backup[3], cia_backup[4],
-            cia_backup[5]);
-
-    // restore vic registers
-    for (i = 0; i < NUM_VICREGS; i++) {
-        VIC_REG(i) = vic_backup[i];
-    }
-
-//    restore_cia();  // Restores the interrupt generation
-
-    SID_VOLUME = 15;  // turn on volume. Unfortunately we could not know what it was set to.
-    SID2_VOLUME = 15;  // turn on volume. Unfortunately we could not know what it was set to.
-    SID3_VOLUME = 15;  // turn on volume. Unfortunately we could not know what it was set to.
-    SID_DUMMY = 0;   // clear internal charge on databus!
-    SID2_DUMMY = 0;   // clear internal charge on databus!
-    SID3_DUMMY = 0;   // clear internal charge on databus!
+    C64PortBus bus;
+    io_backup.restore(bus);
 
     backupIsValid = false;
 }
@@ -8,6 +8,7 @@
 #include "screen.h"
 #include "config.h"
 #include "iomap.h"
+#include "c64_io_backup.h"
 
 #define REU_MEMORY_BASE 0x1000000
 #define REU_MAX_SIZE    0x1000000
@@ -172,11 +173,6 @@
 #define C64_POKE(x,y) *((volatile uint8_t *)(C64_MEMORY_BASE + x)) = y;
 #define C64_PEEK(x)   (*((volatile uint8_t *)(C64_MEMORY_BASE + x)))
 
-#define NUM_VICREGS    49
-#define COLOR_SIZE   1024
-#define BACKUP_SIZE  2048
-#define CHARSET_SIZE 2048
-
 #define CART_REU 0x80 
 #define CART_ETH 0x40
 #define CART_RAM 0x20
@@ -233,11 +229,7 @@ class C64 : public GenericHost, ConfigurableObject
     Screen *screen;
     
     uint8_t *char_set; //[CHARSET_SIZE];
-    uint8_t vic_backup[NUM_VICREGS];
-    uint32_t ram_backup[BACKUP_SIZE/4];
-    uint32_t screen_backup[COLOR_SIZE/4]; // only used now for vic state write
-    uint32_t color_backup[COLOR_SIZE/4];
-    uint8_t cia_backup[8];
+    C64IoBackup io_backup;
     uint8_t stop_mode;
     uint8_t raster;
     uint8_t raster_hi;
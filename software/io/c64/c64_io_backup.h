@@ -0,0 +1,189 @@
+#ifndef C64_IO_BACKUP_H
+#define C64_IO_BACKUP_H
+
+#include "integer.h"
+
+/*
+ -------------------------------------------------------------------------------
+ C64IoBackup
+ ===========
+ The part of the C64 that the freezer takes over: the VIC and CIA registers it
+ changes, the screen and colour RAM, and the RAM at $0800 where it puts its own
+ character set. save() and restore() are templates on the bus they run on, so
+ that they can be checked against a model of the machine. A bus provides:
+
+   uint8_t read(uint16_t addr)
+   void    write(uint16_t addr, uint8_t data)
+   void    read_block(uint16_t addr, uint32_t *dest, int words)
+   void    write_block(uint16_t addr, const uint32_t *src, int words)
+   void    timer_start(uint8_t ticks)     (ITU timer, 5 us per tick)
+   bool    timer_expired(void)
+ -------------------------------------------------------------------------------
+*/
+
+#define NUM_VICREGS    49
+#define COLOR_SIZE   1024
+#define BACKUP_SIZE  2048
+#define CHARSET_SIZE 2048
+
+// The C64 is given time to settle after its screen was turned off, and after the CIAs were
+// restored: until timer A of CIA1 underflows, but at least the minimum and at most the maximum.
+// The RAM copies run while waiting, in chunks small enough to keep polling the timers.
+#define C64_SETTLE_MIN_MS   1
+#define C64_SETTLE_MAX_MS  20
+#define C64_COPY_CHUNK     64 // words; 256 bus cycles
+
+class C64IoBackup
+{
+    bool     settle_underflow;
+    uint16_t settle_last;
+    uint8_t  settle_count;
+
+    template <class BUS> static uint16_t read_timer_a(BUS &bus)
+    {
+        // read the high byte twice, so that a borrow from the low byte cannot give a wrong value
+        uint8_t hi, lo;
+        do {
+            hi = bus.read(0xDC05);
+            lo = bus.read(0xDC04);
+        } while (bus.read(0xDC05) != hi);
+        return ((uint16_t)hi << 8) | lo;
+    }
+
+    template <class BUS> void settle_start(BUS &bus)
+    {
+        settle_underflow = !(bus.read(0xDC0E) & 0x01); // nothing to wait for when the timer is stopped
+        settle_last = read_timer_a(bus);
+        settle_count = 0;
+        bus.timer_start(200); // 1 ms
+    }
+
+    template <class BUS> bool settle_poll(BUS &bus)
+    {
+        if (bus.timer_expired()) {
+            bus.timer_start(200);
+            settle_count++;
+        }
+        if (!settle_underflow) {
+            uint16_t now = read_timer_a(bus);
+            settle_underflow = (now > settle_last); // the timer was reloaded
+            settle_last = now;
+        }
+        if (settle_count >= C64_SETTLE_MAX_MS) {
+            return true;
+        }
+        return settle_underflow && (settle_count >= C64_SETTLE_MIN_MS);
+    }
+
+    template <class BUS> uint8_t settle_finish(BUS &bus)
+    {
+        while (!settle_poll(bus))
+            ;
+        return settle_count;
+    }
+
+    template <class BUS> void copy_from(BUS &bus, uint16_t addr, uint32_t *dest, int words)
+    {
+        for (int i = 0; i < words; i += C64_COPY_CHUNK) {
+            int now = (words - i < C64_COPY_CHUNK) ? words - i : C64_COPY_CHUNK;
+            bus.read_block(addr + 4*i, dest + i, now);
+            settle_poll(bus);
+        }
+    }
+
+    template <class BUS> void copy_to(BUS &bus, uint16_t addr, const uint32_t *src, int words)
+    {
+        for (int i = 0; i < words; i += C64_COPY_CHUNK) {
+            int now = (words - i < C64_COPY_CHUNK) ? words - i : C64_COPY_CHUNK;
+            bus.write_block(addr + 4*i, src + i, now);
+            settle_poll(bus);
+        }
+    }
+public:
+    uint8_t  vic[NUM_VICREGS];
+    uint32_t ram[(COLOR_SIZE + BACKUP_SIZE) / 4]; // $0400-$0FFF: screen, and the RAM that holds our charset
+    uint32_t color[COLOR_SIZE / 4];
+    uint8_t  cia[8]; // CIA2 DDRA, CIA2 PRA, CIA1 DDRA, DDRB, PRA, PRB, CRA, CRB
+    uint8_t  settle_ms[2]; // time waited in save() and restore()
+
+    // The C64 shall be stopped, in Ultimax mode.
+    template <class BUS> void save(BUS &bus, const uint8_t *char_set)
+    {
+        int i;
+        for (i = 0; i < NUM_VICREGS; i++)
+            vic[i] = bus.read(0xD000 + i);
+
+        // now we can turn off the screen to avoid flicker
+        bus.write(0xD011, 0);
+        bus.write(0xD020, 0); // black
+        bus.write(0xD021, 0); // black for later
+        bus.write(0xD418, 0); // SID volumes
+        bus.write(0xD438, 0);
+        bus.write(0xD518, 0);
+
+        // Some programs do not resume well without a pause here. This used to be the time it
+        // took to print CIA1 registers $DC00-$DC0C to the console; the pause now overlaps the
+        // copies. The ICR ($DC0D) is not read, so that pending interrupts survive the freeze.
+        settle_start(bus);
+
+        copy_from(bus, 0x0400, ram, (COLOR_SIZE + BACKUP_SIZE) / 4);
+        copy_from(bus, 0xD800, color, COLOR_SIZE / 4);
+
+        // now copy our own character map into that piece of ram at 0800
+        copy_to(bus, 0x0800, (const uint32_t *)char_set, CHARSET_SIZE / 4);
+
+        settle_ms[0] = settle_finish(bus);
+
+        cia[0] = bus.read(0xDD02);
+        cia[1] = bus.read(0xDD00);
+        cia[2] = bus.read(0xDC02);
+        cia[3] = bus.read(0xDC03);
+        // the port registers can only be read back while they are all output
+        bus.write(0xDC02, 0x00);
+        bus.write(0xDC03, 0xFF);
+        cia[5] = bus.read(0xDC01);
+        bus.write(0xDC03, 0x00);
+        bus.write(0xDC02, 0xFF);
+        cia[4] = bus.read(0xDC00);
+        cia[6] = bus.read(0xDC0E);
+        cia[7] = bus.read(0xDC0F);
+    }
+
+    template <class BUS> void restore(BUS &bus)
+    {
+        int i;
+        // disable screen
+        bus.write(0xD011, 0);
+
+        // The CIAs go first, so that the pause that used to be the console output of their
+        // values can overlap the copies.
+        bus.write(0xDD02, cia[0]);
+//      bus.write(0xDD00, cia[1]); // don't touch!
+        bus.write(0xDC02, cia[2]);
+        bus.write(0xDC03, cia[3]);
+        bus.write(0xDC00, cia[4]);
+        bus.write(0xDC01, cia[5]);
+        bus.write(0xDC0E, cia[6]);
+        bus.write(0xDC0F, cia[7]);
+        settle_start(bus);
+
+        copy_to(bus, 0x0400, ram, (COLOR_SIZE + BACKUP_SIZE) / 4);
+        copy_to(bus, 0xD800, color, COLOR_SIZE / 4);
+
+        settle_ms[1] = settle_finish(bus);
+
+        for (i = 0; i < NUM_VICREGS; i++)
+            bus.write(0xD000 + i, vic[i]);
+
+        // turn on volume. Unfortunately we could not know what it was set to.
+        bus.write(0xD418, 15);
+        bus.write(0xD438, 15);
+        bus.write(0xD518, 15);
+        // clear internal charge on databus!
+        bus.write(0xD41F, 0);
+        bus.write(0xD43F, 0);
+        bus.write(0xD51F, 0);
+    }
+};
+
+#endif
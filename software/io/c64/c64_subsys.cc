@@ -746,18 +746,17 @@ bool C64_Subsys :: write_vic_state(File *f)
     C64_MODE = 0;
 
     // find bank
-    uint8_t bank = 3 - (c64->cia_backup[1] & 0x03);
+    uint8_t bank = 3 - (c64->io_backup.cia[1] & 0x03);
     uint32_t addr = C64_MEMORY_BASE + (uint32_t(bank) << 14);
     if(bank == 0) {
         f->write((uint8_t *)C64_MEMORY_BASE, 0x0400, &transferred);
-        f->write(c64->screen_backup, 0x0400, &transferred);
-        f->write(c64->ram_backup, 0x0800, &transferred);
+        f->write(c64->io_backup.ram, 0x0C00, &transferred);
         f->write((uint8_t *)(C64_MEMORY_BASE + 0x1000), 0x3000, &transferred);
     } else {
         f->write((uint8_t *)addr, 16384, &transferred);
     }
-    f->write(c64->color_backup, 0x0400, &transferred);
-    f->write(c64->vic_backup, NUM_VICREGS, &transferred);
+    f->write(c64->io_backup.color, 0x0400, &transferred);
+    f->write(c64->io_backup.vic, NUM_VICREGS, &transferred);
 
     C64_MODE = mode;
     return true;
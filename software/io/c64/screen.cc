@@ -13,7 +13,10 @@ extern "C" {
 
 
 /**
- * Basic screen implementation, on a memory mapped character grid and a memory mapped attribute grid
+ * Basic screen implementation, on a memory mapped character grid and a memory mapped attribute grid.
+ * All drawing is done in a local copy of the screen. Each row keeps the range of columns that changed,
+ * and sync() writes these ranges to the memory mapped screen with word accesses. On the cartridge, every
+ * access to the screen crosses the C64 bus, so this keeps the number of bus cycles per update small.
  */
 Screen_MemMappedCharMatrix :: Screen_MemMappedCharMatrix(char *b, char *c, int sx, int sy)
 {
@@ -38,6 +41,99 @@ Screen_MemMappedCharMatrix :: Screen_MemMappedCharMatrix(char *b, char *c, int s
     backup_chars = 0;
     backup_color = 0;
     backup_x = backup_y = 0;
+
+    int size = sx * sy;
+    shadow_chars = new char[size];
+    shadow_color = new char[size];
+    dirty_min = new short[sy];
+    dirty_max = new short[sy];
+    memset(shadow_chars, 32, size);
+    memset(shadow_color, 15, size);
+    for(int y=0;y<sy;y++) {
+        dirty_min[y] = sx;
+        dirty_max[y] = 0;
+    }
+    bus_accesses = 0;
+}
+
+Screen_MemMappedCharMatrix :: ~Screen_MemMappedCharMatrix()
+{
+    delete[] shadow_chars;
+    delete[] shadow_color;
+    delete[] dirty_min;
+    delete[] dirty_max;
+}
+
+void Screen_MemMappedCharMatrix :: mark_all(void)
+{
+    for(int y=0;y<size_y;y++) {
+        dirty_min[y] = 0;
+        dirty_max[y] = size_x;
+    }
+}
+
+// Copies a block to the memory mapped screen, using 32-bit stores for the aligned part.
+// Returns the number of bus accesses that were needed.
+static int screen_blit(char *dest, const char *src, int len)
+{
+    int accesses = 0;
+    while ((len > 0) && ((uintptr_t)dest & 3)) {
+        *(dest++) = *(src++);
+        len--;
+        accesses++;
+    }
+    volatile uint32_t *dw = (volatile uint32_t *)dest;
+    uint32_t word;
+    while (len >= 4) {
+        memcpy(&word, src, 4); // source may be unaligned
+        *(dw++) = word;
+        src += 4;
+        len -= 4;
+        accesses++;
+    }
+    dest = (char *)dw;
+    while (len > 0) {
+        *(dest++) = *(src++);
+        len--;
+        accesses++;
+    }
+    return accesses;
+}
+
+void Screen_MemMappedCharMatrix :: sync(void)
+{
+    int size = size_x * size_y;
+    int start = -1;
+    int end = 0;
+    bus_accesses = 0;
+
+    // Changed ranges are widened to word boundaries; adjacent ranges are merged into one block.
+    // Writing a few unchanged characters is cheaper than breaking up the word accesses.
+    for(int y=0;y<size_y;y++) {
+        if (dirty_min[y] >= dirty_max[y]) {
+            continue;
+        }
+        int s = (y * size_x + dirty_min[y]) & ~3;
+        int e = (y * size_x + dirty_max[y] + 3) & ~3;
+        if (e > size)
+            e = size;
+        dirty_min[y] = size_x;
+        dirty_max[y] = 0;
+
+        if ((start >= 0) && (s > end)) {
+            bus_accesses += screen_blit(char_base + start, shadow_chars + start, end - start);
+            bus_accesses += screen_blit(color_base + start, shadow_color + start, end - start);
+            start = -1;
+        }
+        if (start < 0) {
+            start = s;
+        }
+        end = e;
+    }
+    if (start >= 0) {
+        bus_accesses += screen_blit(char_base + start, shadow_chars + start, end - start);
+        bus_accesses += screen_blit(color_base + start, shadow_color + start, end - start);
+    }
 }
 
 void Screen_MemMappedCharMatrix :: backup(void)
@@ -47,15 +143,16 @@ void Screen_MemMappedCharMatrix :: backup(void)
 	backup_color = new char[size];
 	backup_x = cursor_x;
 	backup_y = cursor_y;
-	memcpy(backup_chars, char_base, size);
-	memcpy(backup_color, color_base, size);
+	memcpy(backup_chars, shadow_chars, size);
+	memcpy(backup_color, shadow_color, size);
 }
 
 void Screen_MemMappedCharMatrix :: restore(void)
 {
 	int size = size_x * size_y;
-	memcpy(char_base, backup_chars, size);
-	memcpy(color_base, backup_color, size);
+	memcpy(shadow_chars, backup_chars, size);
+	memcpy(shadow_color, backup_color, size);
+	mark_all();
 	move_cursor(backup_x, backup_y);
 	delete[] backup_chars;
 	delete[] backup_color;
@@ -63,8 +160,7 @@ void Screen_MemMappedCharMatrix :: restore(void)
 
 void  Screen_MemMappedCharMatrix :: cursor_visible(int a) {
 	if (cursor_on != a) {
-		char *p = char_base + pointer;
-		*p ^= 0x80; // remove or place cursor
+		toggle_cursor(); // remove or place cursor
 	}
 	cursor_on = a;
 }
@@ -72,7 +168,7 @@ void  Screen_MemMappedCharMatrix :: cursor_visible(int a) {
 void Screen_MemMappedCharMatrix :: move_cursor(int x, int y)
 {
 	if(cursor_on)
-		char_base[pointer] ^= 0x80;
+		toggle_cursor();
 
 	if (x > size_x-1)
 		x = size_x-1;
@@ -88,7 +184,7 @@ void Screen_MemMappedCharMatrix :: move_cursor(int x, int y)
 	pointer = (y * size_x) + x;
 
 	if(cursor_on)
-		char_base[pointer] ^= 0x80;
+		toggle_cursor();
 
 }
 
@@ -97,40 +193,26 @@ void Screen_MemMappedCharMatrix :: scroll_up()
 	if(!allow_scroll) {
 		return;
 	}
-	char *b = char_base;
-    char *c = color_base;
-    for(int y=0;y<size_y-1;y++) {
-        for(int x=0;x<size_x;x++) {
-            b[x] = b[x+size_x];
-            c[x] = c[x+size_x];
-        }
-        b+=size_x;
-        c+=size_x;
-    }
-    for(int x=0;x<size_x;x++)
-        b[x] = 0;
+	int move = (size_y - 1) * size_x;
+	memmove(shadow_chars, shadow_chars + size_x, move);
+	memmove(shadow_color, shadow_color + size_x, move);
+	memset(shadow_chars + move, 0, size_x);
+	mark_all();
 }
 
 void Screen_MemMappedCharMatrix :: scroll_down()
 {
-    char *b = &char_base[(size_y-2)*size_x];
-    char *c = &color_base[(size_y-2)*size_x];
-    for(int y=0;y<size_y-1;y++) {
-        for(int x=0;x<size_x;x++) {
-            b[x+size_x] = b[x];
-            c[x+size_x] = c[x];
-        }
-        b-=size_x;
-        c-=size_x;
-    }
-    for(int x=0;x<size_x;x++)
-        b[x+size_x] = 0;
+	int move = (size_y - 1) * size_x;
+	memmove(shadow_chars + size_x, shadow_chars, move);
+	memmove(shadow_color + size_x, shadow_color, move);
+	memset(shadow_chars, 0, size_x);
+	mark_all();
 }
 
 void Screen_MemMappedCharMatrix :: repeat(char a, int len)
 {
 	if(cursor_on)
-		char_base[pointer] ^= 0x80;
+		toggle_cursor();
 
 	bool cur = cursor_on;
 	cursor_on = false;
@@ -141,7 +223,7 @@ void Screen_MemMappedCharMatrix :: repeat(char a, int len)
 	cursor_on = cur;
 
 	if(cursor_on)
-		char_base[pointer] ^= 0x80;
+		toggle_cursor();
 }
 
 int  Screen_MemMappedCharMatrix :: output(char c)
@@ -178,8 +260,7 @@ int  Screen_MemMappedCharMatrix :: output(const char *c) {
 void Screen_MemMappedCharMatrix :: output_raw(char c)
 {
 	if (cursor_on) {
-		char *p = char_base + pointer;
-		*p ^= 0x80; // unplace cursor
+		toggle_cursor(); // unplace cursor
 	}
 	switch(c) {
         case 0x0A:
@@ -204,16 +285,18 @@ void Screen_MemMappedCharMatrix :: output_raw(char c)
             		cursor_x = size_x - 1;
             		cursor_y --;
             	}
-            	char_base[pointer] = 0;
+            	shadow_chars[pointer] = 0;
+            	mark(cursor_y, cursor_x, cursor_x + 1);
             }
             break;
         default:
             if(reverse)
-                char_base[pointer] = c | 0x80;
+                shadow_chars[pointer] = c | 0x80;
             else
-                char_base[pointer] = c;
+                shadow_chars[pointer] = c;
 
-            color_base[pointer] = (char)(color | background << 4);
+            shadow_color[pointer] = (char)(color | background << 4);
+            mark(cursor_y, cursor_x, cursor_x + 1);
             pointer ++;
             cursor_x++;
 
@@ -229,16 +312,14 @@ void Screen_MemMappedCharMatrix :: output_raw(char c)
             }
     }
 	if (cursor_on) {
-		char *p = char_base + pointer;
-		*p ^= 0x80; // place cursor
+		toggle_cursor(); // place cursor
 	}
 }
 
 void Screen_MemMappedCharMatrix :: output_fixed_length(const char *string, int offset_x, int width)
 {
 	if (cursor_on) {
-		char *p = char_base + pointer;
-		*p ^= 0x80; // unplace cursor
+		toggle_cursor(); // unplace cursor
 	}
 	pointer = (cursor_y * size_x) + offset_x;
 	cursor_x = offset_x;
@@ -255,8 +336,7 @@ void Screen_MemMappedCharMatrix :: output_fixed_length(const char *string, int o
         chars_placed += output(c);
     }
 	if (cursor_on) {
-		char *p = char_base + pointer;
-		*p ^= 0x80; // place cursor
+		toggle_cursor(); // place cursor
 	}
 }
 
@@ -264,8 +344,9 @@ void Screen_MemMappedCharMatrix :: clear() {
 	reverse_mode(0);
 	set_color(15);
 	int size = get_size_x() * get_size_y();
-	memset(char_base, 32, size);
-	memset(color_base, 15, size);
+	memset(shadow_chars, 32, size);
+	memset(shadow_color, 15, size);
+	mark_all();
 }
 
 /**
@@ -459,6 +540,7 @@ int console_print(Screen *s, const char *fmt, ...)
     va_start(ap, fmt);
 	if(s) {
 	    ret = _my_vprintf(Screen :: _put, (void **)s, fmt, ap);
+	    s->sync();
 	}
     va_end(ap);
     return (ret);
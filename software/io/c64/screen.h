@@ -1,6 +1,8 @@
 #ifndef SCREEN_H
 #define SCREEN_H
 
+#include <stdint.h>
+
 class Screen
 {
 public:
@@ -56,9 +58,27 @@ class Screen_MemMappedCharMatrix : public Screen
 	int cursor_y;
 	int pointer;
 
+    // local copy of the screen; only changed spans are written to char_base / color_base
+    char *shadow_chars;
+    char *shadow_color;
+    short *dirty_min;
+    short *dirty_max;
+    uint32_t bus_accesses;
+
 	// private stuff
 	void scroll_up(void);
     void scroll_down(void);
+    void mark_all(void);
+    void mark(int y, int x1, int x2) {
+        if (x1 < dirty_min[y])
+            dirty_min[y] = x1;
+        if (x2 > dirty_max[y])
+            dirty_max[y] = x2;
+    }
+    void toggle_cursor(void) {
+        shadow_chars[pointer] ^= 0x80;
+        mark(cursor_y, cursor_x, cursor_x + 1);
+    }
 
 protected:
     // draw mode
@@ -73,7 +93,7 @@ protected:
     void output_raw(char c);
 public:
     Screen_MemMappedCharMatrix(char *, char *, int, int);
-    ~Screen_MemMappedCharMatrix() { }
+    ~Screen_MemMappedCharMatrix();
 
     void backup(void);
     void restore(void);
@@ -95,6 +115,10 @@ public:
     int  output(const char *c);
     void repeat(char c, int rep);
     void output_fixed_length(const char *string, int offset_x, int width);
+
+    // writes the changed parts of the local copy to the memory mapped screen
+    void sync(void);
+    uint32_t get_bus_accesses(void) { return bus_accesses; } // during last sync
 };
 
 class Window
@@ -0,0 +1,171 @@
+#include "flash_delta.h"
+#include "crc32.h"
+#include <string.h>
+
+FlashDeltaWriter :: FlashDeltaWriter(Flash *f)
+{
+    flash = f;
+    page_size = f->get_page_size();
+    page_data = new uint8_t[page_size];
+    page_read = new uint8_t[page_size];
+    image_crc = 0;
+    image_data = NULL;
+    image_length = 0;
+    image_first = image_end = 0;
+    progress = NULL;
+    progress_context = NULL;
+    memset(&stats, 0, sizeof(stats));
+}
+
+FlashDeltaWriter :: ~FlashDeltaWriter()
+{
+    delete[] page_data;
+    delete[] page_read;
+}
+
+// Returns the data that should end up in the given page, or NULL when the page can stay erased.
+// Pages beyond the end of the image are padded with 0xFF. Pages outside of the image come from
+// 'keep', which holds the contents of the whole sector starting at page 'first'.
+const uint8_t *FlashDeltaWriter :: get_page(int page, int first, uint8_t *keep)
+{
+    if ((page >= image_first) && (page < image_end)) {
+        int offset = (page - image_first) * page_size;
+        int n = image_length - offset;
+        if (n >= page_size) {
+            return image_data + offset;
+        }
+        memcpy(page_data, image_data + offset, n);
+        memset(page_data + n, 0xFF, page_size - n);
+        return page_data;
+    }
+    if (!keep) {
+        return NULL;
+    }
+    const uint8_t *k = keep + (page - first) * page_size;
+    for(int i=0;i<page_size;i++) {
+        if (k[i] != 0xFF) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+// (Re)programs the pages first..end, which form one sector when do_erase is set.
+// Instead of reading back every page directly after writing it, the sector is read back
+// once everything is written, and compared by CRC.
+int FlashDeltaWriter :: write_pages(int first, int end, uint8_t *keep, bool do_erase)
+{
+    int retry = 3;
+    while(retry--) {
+        if (do_erase) {
+            if (!flash->erase_sector(flash->page_to_sector(first))) {
+                return -3; // sector erase error
+            }
+            stats.sectors_erased++;
+        }
+
+        uint32_t crc = 0;
+        bool ok = true;
+        for(int p = first; p < end; p++) {
+            const uint8_t *src = get_page(p, first, keep);
+            if (!src) {
+                continue;
+            }
+            if (!flash->write_page(p, (void *)src)) {
+                ok = false;
+                break;
+            }
+            stats.pages_written++;
+            crc = crc32_update(crc, src, page_size);
+        }
+        if (ok) {
+            uint32_t check = 0;
+            for(int p = first; p < end; p++) {
+                if (!get_page(p, first, keep)) {
+                    continue;
+                }
+                flash->read_page(p, page_read);
+                stats.pages_read++;
+                check = crc32_update(check, page_read, page_size);
+            }
+            if (check == crc) {
+                return 0;
+            }
+        }
+        stats.verify_errors++;
+    }
+    return -4; // programming failed
+}
+
+int FlashDeltaWriter :: write(int address, const uint8_t *data, int length)
+{
+    if (address % page_size) {
+        return -1;
+    }
+    image_crc = crc32_update(image_crc, data, length);
+
+    image_data = data;
+    image_length = length;
+    image_first = address / page_size;
+    image_end = image_first + (length + page_size - 1) / page_size;
+
+    int num_pages = flash->get_number_of_pages();
+    bool do_erase = flash->need_erase();
+    int page = image_first;
+
+    while(page < image_end) {
+        // Find the sector this page lives in. Flashes that do not need an erase are handled per page.
+        int first = page;
+        int end = page + 1;
+        if (do_erase) {
+            int sector = flash->page_to_sector(page);
+            while ((first > 0) && (flash->page_to_sector(first - 1) == sector)) {
+                first--;
+            }
+            while ((end < num_pages) && (flash->page_to_sector(end) == sector)) {
+                end++;
+            }
+        }
+        int last = (end < image_end) ? end : image_end;
+
+        // Compare the part of the image in this sector with what is in the flash already
+        bool equal = true;
+        for(int p = page; p < last; p++) {
+            flash->read_page(p, page_read);
+            stats.pages_read++;
+            if (memcmp(get_page(p, first, NULL), page_read, page_size)) {
+                equal = false;
+                break;
+            }
+        }
+
+        if (equal) {
+            stats.sectors_skipped++;
+        } else {
+            // Save the pages of the sector that are not part of the image, because the erase destroys them
+            uint8_t *keep = NULL;
+            if (do_erase && ((first < page) || (end > last))) {
+                keep = new uint8_t[(end - first) * page_size];
+                memset(keep, 0xFF, (end - first) * page_size);
+                for(int p = first; p < end; p++) {
+                    if ((p < page) || (p >= last)) {
+                        flash->read_page(p, keep + (p - first) * page_size);
+                        stats.pages_read++;
+                    }
+                }
+            }
+            int ret = write_pages(do_erase ? first : page, do_erase ? end : last, keep, do_erase);
+            if (keep) {
+                delete[] keep;
+            }
+            if (ret) {
+                return ret;
+            }
+        }
+        if (progress) {
+            progress(progress_context, last - 1);
+        }
+        page = last;
+    }
+    return 0;
+}
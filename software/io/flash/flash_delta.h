@@ -0,0 +1,51 @@
+#ifndef FLASH_DELTA_H
+#define FLASH_DELTA_H
+
+#include "integer.h"
+#include "flash.h"
+
+typedef struct {
+    int sectors_skipped;  // contents were already equal
+    int sectors_erased;
+    int pages_read;
+    int pages_written;
+    int verify_errors;
+} t_flash_delta_stats;
+
+// Writes an image to flash, but only touches the sectors of which the contents differ.
+// Pages that share an erased sector with the image, but are not part of it, are preserved.
+// Each sector is verified with a CRC over the read-back data, after all of its pages are written.
+class FlashDeltaWriter
+{
+    Flash   *flash;
+    int      page_size;
+    uint8_t *page_data;
+    uint8_t *page_read;
+    uint32_t image_crc;
+    void   (*progress)(void *context, int page);
+    void    *progress_context;
+
+    // image that is currently being written
+    const uint8_t *image_data;
+    int      image_length;
+    int      image_first; // page
+    int      image_end;   // page, exclusive
+
+    const uint8_t *get_page(int page, int first, uint8_t *keep);
+    int  write_pages(int first, int end, uint8_t *keep, bool do_erase);
+public:
+    t_flash_delta_stats stats;
+
+    FlashDeltaWriter(Flash *f);
+    ~FlashDeltaWriter();
+
+    void set_progress(void (*func)(void *, int), void *context) {
+        progress = func;
+        progress_context = context;
+    }
+    uint32_t get_crc(void) { return image_crc; } // CRC32 of everything passed to write()
+
+    int write(int address, const uint8_t *data, int length);
+};
+
+#endif
@@ -32,6 +32,7 @@ void IecChannel :: reset_prefetch(void)
     printf("(R)");
 #endif
     prefetch = pointer;
+    readahead.reset_prefetch();
 }
 
 int IecChannel :: prefetch_data(uint8_t& data)
@@ -39,6 +40,9 @@ int IecChannel :: prefetch_data(uint8_t& data)
     if (state == e_error) {
         return IEC_NO_FILE;
     }
+    if ((state == e_file) && !write) {
+        return readahead.prefetch_data(data);
+    }
     if (prefetch == last_byte) {
         data = buffer[prefetch];
         prefetch++;
@@ -59,16 +63,14 @@ int IecChannel :: pop_data(void)
 {
     switch(state) {
         case e_file:
-            if(pointer == last_byte) {
+            if(write) {
+                break;
+            }
+            if(readahead.pop_data() == IEC_LAST) {
                 state = e_complete;
                 return IEC_NO_FILE; // no more data?
-            } else if(pointer == 255) {
-                if(read_block())  // also resets pointer.
-                    return IEC_READ_ERROR;
-                else
-                    return IEC_OK;
             }
-            break;
+            return IEC_OK;
         case e_dir:
             if(pointer == last_byte) {
                 state = e_complete;
@@ -153,33 +155,6 @@ int IecChannel :: read_dir_entry(void)
     return 0;
 }
 
-int IecChannel :: read_block(void)
-{
-    FRESULT res = FR_DENIED;
-    uint32_t bytes;
-    if(f) {
-        res = f->read(buffer, 256, &bytes);
-        printf("\nSize was %d. Read %d bytes. ", size, bytes);
-    }
-    if(res != FR_OK) {
-        state = e_error;
-        return IEC_READ_ERROR;
-    }
-    if(bytes == 0)
-        state = e_complete; // end should have triggered already
-
-    if(bytes != 256) {
-        last_byte = int(bytes)-1;
-    } else if(size == 256) {
-        last_byte = 255;
-    }
-    size -= 256;
-    pointer = 0;
-    prefetch = 0;
-    prefetch_max = 256;
-    return 0;
-}
-
 int IecChannel :: push_data(uint8_t b)
 {
     uint32_t bytes;
@@ -578,7 +553,10 @@ int IecChannel :: open_file(void)  // name should be in buffer
         state = e_file;
         if(!write) {
             size = f->get_size();
-            return read_block();
+            if (readahead.start(f, size) != IEC_OK) {
+                state = e_error;
+                return IEC_READ_ERROR;
+            }
         }
     } else {
         printf("Can't open file %s in %s: %s\n", buffer, partition->GetFullPath(), FileSystem :: get_error_string(fres));
@@ -589,6 +567,7 @@ int IecChannel :: open_file(void)  // name should be in buffer
 
 int IecChannel :: close_file(void) // file should be open
 {
+    readahead.stop();
     if(f)
         fm->fclose(f);
     f = NULL;
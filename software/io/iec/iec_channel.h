@@ -8,17 +8,13 @@
 #include <string.h>
 #include "filemanager.h"
 #include "mystring.h"
+#include "iec_readahead.h"
 
 typedef enum _t_channel_state {
     e_idle, e_filename, e_file, e_dir, e_complete, e_error
     
 } t_channel_state;
 
-enum t_channel_retval {
-    IEC_OK=0, IEC_LAST=1, IEC_NO_DATA=-1, IEC_FILE_NOT_FOUND=-2, IEC_NO_FILE=-3,
-    IEC_READ_ERROR=-4, IEC_WRITE_ERROR=-5, IEC_BYTE_LOST=-6, IEC_BUFFER_END=-7
-};
-
 static uint8_t c_header[32] = { 1,  1,  4,  1,  0,  0, 18, 34,
                             32, 32, 32, 32, 32, 32, 32, 32,
                             32, 32, 32, 32, 32, 32, 32, 32,
@@ -323,6 +319,7 @@ class IecChannel
     int  prefetch;
     int  prefetch_max;
     File *f;
+    IecReadAhead readahead;
     int  last_command;
     int  dir_index;
     int  dir_last;
@@ -342,7 +339,6 @@ public:
     virtual int prefetch_data(uint8_t& data);
     virtual int pop_data(void);
     int read_dir_entry(void);
-    int read_block(void);
     virtual int push_data(uint8_t b);
     virtual int push_command(uint8_t b);
     void parse_command(char *buffer, command_t *command);
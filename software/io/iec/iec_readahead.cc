@@ -0,0 +1,201 @@
+#include "iec_readahead.h"
+#include "file.h"
+
+#ifdef OS
+#include "task.h"
+
+QueueHandle_t IecReadAhead :: requests = 0;
+SemaphoreHandle_t IecReadAhead :: reader_lock = 0;
+
+void IecReadAhead :: reader_task(void *a)
+{
+    IecReadAhead *ra;
+    while(1) {
+        // Wait without taking the request, then take it under the lock. A destructor
+        // removes its requests under the same lock, so 'ra' is alive until we release it.
+        if (xQueuePeek(requests, &ra, portMAX_DELAY)) {
+            xSemaphoreTake(reader_lock, portMAX_DELAY);
+            if (xQueueReceive(requests, &ra, 0)) {
+                while(ra->fill())
+                    ;
+            }
+            xSemaphoreGive(reader_lock);
+        }
+    }
+}
+#endif
+
+IecReadAhead :: IecReadAhead(int slots, int size)
+{
+    num_slots = slots;
+    slot_size = size;
+    this->slots = new slot_t[slots];
+    storage = NULL;
+    file = NULL;
+    remaining = 0;
+    filled = freed = 0;
+    eof = true;
+    error = false;
+    pop_slot = prefetch_slot = 0;
+    pop_pos = prefetch_pos = 0;
+
+#ifdef OS
+    busy = xSemaphoreCreateMutex();
+    if (!requests) {
+        requests = xQueueCreate(16, sizeof(IecReadAhead *));
+        reader_lock = xSemaphoreCreateMutex();
+        xTaskCreate( IecReadAhead :: reader_task, "IEC Reader", configMINIMAL_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1, NULL );
+    }
+#endif
+}
+
+IecReadAhead :: ~IecReadAhead()
+{
+    stop();
+#ifdef OS
+    // Remove the requests for this instance that are still queued; the others
+    // go back in the same order.
+    xSemaphoreTake(reader_lock, portMAX_DELAY);
+    int pending = (int)uxQueueMessagesWaiting(requests);
+    for (int i=0; i < pending; i++) {
+        IecReadAhead *ra;
+        if (!xQueueReceive(requests, &ra, 0))
+            break;
+        if (ra != this)
+            xQueueSend(requests, &ra, 0);
+    }
+    xSemaphoreGive(reader_lock);
+    vSemaphoreDelete(busy);
+#endif
+    delete[] storage;
+    delete[] slots;
+}
+
+void IecReadAhead :: wakeup(void)
+{
+#ifdef OS
+    IecReadAhead *me = this;
+    xQueueSend(requests, &me, 0); // when the queue is full, the reader is busy anyway
+#endif
+}
+
+int IecReadAhead :: start(File *f, uint32_t size)
+{
+    stop();
+
+    // buffers are allocated on first use, and kept for the next file
+    if (!storage) {
+        storage = new uint8_t[num_slots * slot_size];
+        for(int i=0;i<num_slots;i++) {
+            slots[i].data = storage + i * slot_size;
+        }
+    }
+
+    remaining = size;
+    filled = freed = 0;
+    eof = false;
+    error = false;
+    pop_slot = prefetch_slot = 0;
+    pop_pos = prefetch_pos = 0;
+    file = f;
+
+    // The first buffer is read in the caller's context, such that a read error
+    // can still be reported on open, and the first bytes are available right away.
+    fill();
+    if (error) {
+        return IEC_READ_ERROR;
+    }
+    wakeup();
+    return IEC_OK;
+}
+
+void IecReadAhead :: stop(void)
+{
+#ifdef OS
+    xSemaphoreTake(busy, portMAX_DELAY);
+#endif
+    file = NULL;
+    eof = true;
+#ifdef OS
+    xSemaphoreGive(busy);
+#endif
+}
+
+bool IecReadAhead :: fill(void)
+{
+    bool done = false;
+#ifdef OS
+    xSemaphoreTake(busy, portMAX_DELAY);
+#endif
+    if (file && !eof && !error && (filled - freed < (uint32_t)num_slots)) {
+        slot_t *s = &slots[filled % num_slots];
+        uint32_t bytes = 0;
+        FRESULT res = file->read(s->data, slot_size, &bytes);
+        if (res != FR_OK) {
+            error = true;
+        } else {
+            remaining = (bytes < remaining) ? remaining - bytes : 0;
+            s->length = (int)bytes;
+            s->last = (bytes < (uint32_t)slot_size) || (remaining == 0);
+            if (s->last) {
+                eof = true;
+            }
+            filled++; // publish the buffer after it has been completely written
+        }
+        done = true;
+    }
+#ifdef OS
+    xSemaphoreGive(busy);
+#endif
+    return done;
+}
+
+int IecReadAhead :: prefetch_data(uint8_t& data)
+{
+    while(1) {
+        if (prefetch_slot == filled) {
+            // nothing available yet; the reader is still busy or the file failed
+            return (error) ? IEC_NO_FILE : IEC_BUFFER_END;
+        }
+        slot_t *s = &slots[prefetch_slot % num_slots];
+        if (prefetch_pos < s->length) {
+            data = s->data[prefetch_pos++];
+            if (s->last && (prefetch_pos == s->length)) {
+                return IEC_LAST;
+            }
+            return IEC_OK;
+        }
+        if (s->last) {
+            return IEC_NO_FILE; // empty file, or prefetched beyond the end
+        }
+        prefetch_slot++;
+        prefetch_pos = 0;
+    }
+}
+
+void IecReadAhead :: reset_prefetch(void)
+{
+    prefetch_slot = pop_slot;
+    prefetch_pos = pop_pos;
+}
+
+int IecReadAhead :: pop_data(void)
+{
+    if (pop_slot == filled) {
+        return IEC_NO_DATA;
+    }
+    slot_t *s = &slots[pop_slot % num_slots];
+    pop_pos++;
+    if (pop_pos < s->length) {
+        return IEC_OK;
+    }
+    if (s->last) {
+        return IEC_LAST;
+    }
+    // buffer completely acknowledged on the bus, give it back to the reader
+    pop_slot++;
+    pop_pos = 0;
+    freed = pop_slot;
+    wakeup();
+    return IEC_OK;
+}
@@ -0,0 +1,82 @@
+#ifndef IEC_READAHEAD_H
+#define IEC_READAHEAD_H
+
+#include "integer.h"
+#ifdef OS
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#endif
+
+class File;
+
+enum t_channel_retval {
+    IEC_OK=0, IEC_LAST=1, IEC_NO_DATA=-1, IEC_FILE_NOT_FOUND=-2, IEC_NO_FILE=-3,
+    IEC_READ_ERROR=-4, IEC_WRITE_ERROR=-5, IEC_BYTE_LOST=-6, IEC_BUFFER_END=-7
+};
+
+#define IEC_READAHEAD_SLOTS      4
+#define IEC_READAHEAD_SLOT_SIZE  1024
+
+/*
+ * Ring of read buffers for a channel that is talking a file. The buffers
+ * are filled by a background reader task, such that the IEC task only
+ * consumes data that is already in memory and never waits for the file
+ * system in the middle of a transfer.
+ *
+ * The IEC side keeps two positions: 'pop', the byte last acknowledged
+ * on the bus, and 'prefetch', the next byte to give to the hardware fifo.
+ * A buffer is handed back to the reader when all its bytes are popped.
+ */
+class IecReadAhead
+{
+    struct slot_t {
+        uint8_t *data;
+        int length;
+        bool last;
+    };
+    int num_slots;
+    int slot_size;
+    slot_t *slots;
+    uint8_t *storage;
+
+    File *file;
+    uint32_t remaining;
+
+    // written by reader only
+    volatile uint32_t filled;
+    volatile bool eof;
+    volatile bool error;
+    // written by the IEC side only
+    volatile uint32_t freed;
+
+    uint32_t pop_slot;
+    int pop_pos;
+    uint32_t prefetch_slot;
+    int prefetch_pos;
+
+#ifdef OS
+    SemaphoreHandle_t busy;
+    static QueueHandle_t requests;
+    static SemaphoreHandle_t reader_lock; // held while the reader owns an instance from the queue
+    static void reader_task(void *a);
+#endif
+    void wakeup(void);
+public:
+    IecReadAhead(int slots = IEC_READAHEAD_SLOTS, int size = IEC_READAHEAD_SLOT_SIZE);
+    ~IecReadAhead();
+
+    // IEC side
+    int  start(File *f, uint32_t size); // reads the first buffer right away
+    void stop(void);                    // reader no longer touches the file after this
+    int  prefetch_data(uint8_t& data);
+    void reset_prefetch(void);
+    int  pop_data(void);
+
+    // reader side; fills one buffer, returns false when there was nothing to do
+    bool fill(void);
+
+    int  get_buffered(void) { return filled - freed; }
+};
+
+#endif /* IEC_READAHEAD_H */
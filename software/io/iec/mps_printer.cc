@@ -31,7 +31,6 @@
 #ifdef NOT_ULTIMATE
 #include <strings.h>
 #endif
-#include "lodepng.h"
 #include "mps_printer.h"
 
 /************************************************************************
@@ -63,6 +62,44 @@ uint8_t MpsPrinter::spacing_y[6][17] =
     { 11,13,14,15,17,18,19,21,23,24,25,27,28,29,31,32,33 },    // Subscript NLQ Low
 };
 
+/* =======  Ink shades around a dot, rows y-1 to y+2 and columns x-1 to x+2 */
+uint8_t MpsPrinter::dot_pattern[3][4][4] =
+{
+    {                       // Density 0 : 1 single full color point (diameter 1 pixel) mostly for debug
+        { 0, 0, 0, 0 },
+        { 0, 3, 0, 0 },
+        { 0, 0, 0, 0 },
+        { 0, 0, 0, 0 },
+    },
+    {                       // Density 1 : 1 full color point with shade around (looks like diameter 2)
+        { 1, 2, 1, 0 },
+        { 2, 3, 2, 0 },
+        { 1, 2, 1, 0 },
+        { 0, 0, 0, 0 },
+    },
+    {                       // Density 2 : 4 full color points with shade around (looks like diameter 3)
+        { 1, 2, 2, 1 },
+        { 2, 3, 3, 2 },
+        { 2, 5, 3, 2 },
+        { 1, 2, 2, 1 },
+    },
+};
+
+/* =======  Bit n of a byte moved to bit 2n, to interleave 2 bit pixels */
+uint16_t MpsPrinter::spread_bits[256];
+
+/* =======  Planes inked by each ribbon color (black, yellow, magenta, cyan) */
+uint8_t MpsPrinter::color_planes[7] =
+{
+    0x01,   // MPS_PRINTER_COLOR_BLACK
+    0x04,   // MPS_PRINTER_COLOR_MAGENTA
+    0x08,   // MPS_PRINTER_COLOR_CYAN
+    0x0C,   // MPS_PRINTER_COLOR_VIOLET
+    0x02,   // MPS_PRINTER_COLOR_YELLOW
+    0x06,   // MPS_PRINTER_COLOR_ORANGE
+    0x0A,   // MPS_PRINTER_COLOR_GREEN
+};
+
 #ifndef TRUE_CMYK
 
 /* =======  Color PNG Palette */
@@ -175,6 +212,24 @@ MpsPrinter::MpsPrinter(char * filename)
 #endif
     strcpy(outfile,filename);
 
+    /* =======  Table to interleave shade bits of greyscale pixels */
+    for (int i=0; i<256; i++)
+    {
+        spread_bits[i] = 0;
+        for (int b=0; b<8; b++)
+            if (i & (1 << b)) spread_bits[i] |= 1 << (2*b);
+    }
+
+    /* =======  No page started yet */
+    bitmap = NULL;
+    png_row = NULL;
+    png = NULL;
+#ifndef NOT_ULTIMATE
+    png_file = NULL;
+#else
+    png_fd = -1;
+#endif
+
     /* =======  BW/Color printer init (default is BW) */
     setColorMode(false, true);
 
@@ -224,10 +279,13 @@ MpsPrinter::MpsPrinter(char * filename)
 
 MpsPrinter::~MpsPrinter()
 {
+    /* =======  Finish the page if its PNG file was already started */
+    EndPage();
 #ifndef NOT_ULTIMATE
     fm->release_path(path);
 #endif
-    lodepng_state_cleanup(&lodepng_state);
+    delete[] bitmap;
+    delete[] png_row;
     DBGMSG("deletion");
 }
 
@@ -366,31 +424,16 @@ MpsPrinter::Clear(void)
 {
     DBGMSG("clear page bitmap");
 
-    if (color_mode)
-    {
-        bzero (bitmap,MPS_PRINTER_BITMAP_SIZE_COLOR);
-    }
-    else
-    {
-        bzero (bitmap,MPS_PRINTER_BITMAP_SIZE_BW);
-    }
+    /* =======  Part of the page already in a PNG file, finish it */
+    EndPage();
+
+    bzero (bitmap,MPS_PRINTER_WINDOW_ROWS*planes*MPS_PRINTER_ROW_WORDS*sizeof(uint32_t));
+    first_row = 0;
 
     head_x = margin_left;
     head_y = margin_top;
     clean  = true;
     quoted = false;
-
-#ifdef DEBUG
-    /* DEBUG : Palette display on top of page */
-    int x, y, i;
-
-    for ( x=0; x<256; x++)
-        for ( y=0; y<256; y++)
-        {
-            int c = (x >> 4) | (y & 0xF0);
-            InkTest(x,y,c);
-        }
-#endif /* DEBUG */
 }
 
 /************************************************************************
@@ -425,7 +468,8 @@ MpsPrinter::Reset(void)
 *                    MpsPrinter::setColorMode(mode,init)                *
 *                    ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~                *
 * Function : Set printer to color or black and white mode               *
-*            the current page is lost                                   *
+*            the current page is lost unless its PNG file was already   *
+*            started, it is then finished with the old configuration    *
 *-----------------------------------------------------------------------*
 * Inputs:                                                               *
 *                                                                       *
@@ -450,27 +494,21 @@ MpsPrinter::setColorMode(bool mode, bool init)
     if (!init && color_mode == mode)
         return;
 
-    color_mode = mode;
-
-    /* Except on first call, release resources of previous configuration */
-    if (!init)
-    {
-        lodepng_state_cleanup(&lodepng_state);
-    }
+    /* Page in progress uses the previous configuration, finish it first */
+    EndPage();
 
-    /* Initialise PNG convertor attributes */
-    lodepng_state_init(&lodepng_state);
+    color_mode = mode;
 
-    /* PNG compression settings */
-    lodepng_state.encoder.zlibsettings.btype        = 2;
-    lodepng_state.encoder.zlibsettings.use_lz77     = true;
-    lodepng_state.encoder.zlibsettings.windowsize   = 1024;
-    lodepng_state.encoder.zlibsettings.minmatch     = 3;
-    lodepng_state.encoder.zlibsettings.nicematch    = 128;
+    /* Page dot planes and PNG row for the new pixel depth */
+    delete[] bitmap;
+    delete[] png_row;
+    planes = color_mode ? MPS_PRINTER_PLANES_COLOR : MPS_PRINTER_PLANES_BW;
+    row_size = color_mode ? MPS_PRINTER_ROW_SIZE_COLOR : MPS_PRINTER_ROW_SIZE_BW;
+    bitmap = new uint32_t[MPS_PRINTER_WINDOW_ROWS*planes*MPS_PRINTER_ROW_WORDS];
+    png_row = new uint8_t[row_size];
 
     /* Initialise color palette for memory bitmap and file output */
-    lodepng_palette_clear(&lodepng_state.info_png.color);
-    lodepng_palette_clear(&lodepng_state.info_raw);
+    palette_size = 0;
 
     if (color_mode)
     {
@@ -526,52 +564,31 @@ MpsPrinter::setColorMode(bool mode, bool init)
             uint8_t b = rgb_palette[x++];
 
 #endif /* TRUE_CMYK */
-            lodepng_palette_add(&lodepng_state.info_png.color, r, g, b, 255);
-            lodepng_palette_add(&lodepng_state.info_raw, r, g, b, 255);
+            palette[palette_size*3]   = r;
+            palette[palette_size*3+1] = g;
+            palette[palette_size*3+2] = b;
+            palette_size++;
         }
-
-        /* Bitmap uses 6 bit depth and a palette */
-        lodepng_state.info_png.color.colortype  = LCT_PALETTE;
-        lodepng_state.info_png.color.bitdepth   = MPS_PRINTER_PAGE_DEPTH_COLOR;
-        lodepng_state.info_raw.colortype        = LCT_PALETTE;
-        lodepng_state.info_raw.bitdepth         = MPS_PRINTER_PAGE_DEPTH_COLOR;
     }
     else
     {
         /* =======  Greyscale printer */
-
-        /* White */
-        lodepng_palette_add(&lodepng_state.info_png.color, 255, 255, 255, 255);
-        lodepng_palette_add(&lodepng_state.info_raw, 255, 255, 255, 255);
-
-        /* Light grey */
-        lodepng_palette_add(&lodepng_state.info_png.color, 224, 224, 224, 255);
-        lodepng_palette_add(&lodepng_state.info_raw, 224, 224, 224, 255);
-
-        /* Dark grey */
-        lodepng_palette_add(&lodepng_state.info_png.color, 160, 160, 160, 255);
-        lodepng_palette_add(&lodepng_state.info_raw, 160, 160, 160, 255);
-
-        /* Black */
-        lodepng_palette_add(&lodepng_state.info_png.color, 0, 0, 0, 255);
-        lodepng_palette_add(&lodepng_state.info_raw, 0, 0, 0, 255);
-
-        /* Bitmap uses 2 bit depth and a palette */
-        lodepng_state.info_png.color.colortype  = LCT_PALETTE;
-        lodepng_state.info_png.color.bitdepth   = MPS_PRINTER_PAGE_DEPTH;
-        lodepng_state.info_raw.colortype        = LCT_PALETTE;
-        lodepng_state.info_raw.bitdepth         = MPS_PRINTER_PAGE_DEPTH;
+        static const uint8_t grey[4] = {
+            255,    /* White */
+            224,    /* Light grey */
+            160,    /* Dark grey */
+            0       /* Black */
+        };
+
+        for (int i=0; i<4; i++)
+        {
+            palette[palette_size*3]   = grey[i];
+            palette[palette_size*3+1] = grey[i];
+            palette[palette_size*3+2] = grey[i];
+            palette_size++;
+        }
     }
 
-    /* Physical page description (A4 240x216 dpi) */
-    lodepng_state.info_png.phys_defined     = 1;
-    lodepng_state.info_png.phys_x           = 9448;
-    lodepng_state.info_png.phys_y           = 8687;
-    lodepng_state.info_png.phys_unit        = 1;
-
-    /* I rule, you don't */
-    lodepng_state.encoder.auto_convert      = 0;
-
     Clear();
 }
 
@@ -766,34 +783,115 @@ MpsPrinter::calcPageNum(void)
 void
 MpsPrinter::FormFeed(void)
 {
-    char filename[40];
-
     if (!clean)
     {
+        /* -------  Send all rows still in memory to the PNG file */
+        FlushRows(MPS_PRINTER_PAGE_HEIGHT);
+        EndPage();
+    }
+
+    Clear();
+}
+
+/************************************************************************
+*                       png_write(ctx,data,len)           Static        *
+*                       ~~~~~~~~~~~~~~~~~~~~~~~                         *
+* Function : PngStream output callback, write data to the page file     *
+*-----------------------------------------------------------------------*
+* Inputs:                                                               *
+*                                                                       *
+*    ctx  : (void *) file to write to                                   *
+*    data : (uint8_t *) PNG data                                        *
+*    len  : (uint32_t) number of bytes to write                         *
+*                                                                       *
+*-----------------------------------------------------------------------*
+* Outputs:                                                              *
+*                                                                       *
+*    (bool) false if the data could not be written                      *
+*                                                                       *
+************************************************************************/
+
+static bool
+png_write(void *ctx, const uint8_t *data, uint32_t len)
+{
 #ifndef NOT_ULTIMATE
-        calcPageNum();
+    File *f = (File *) ctx;
+    uint32_t bytes;
+
+    if (!f) return false;
+    return (f->write(data, len, &bytes) == FR_OK) && (bytes == len);
+#else
+    int fhd = *(int *) ctx;
+
+    if (fhd < 0) return false;
+    return write(fhd, data, len) == (ssize_t) len;
 #endif
-        sprintf(filename,"%s-%03d.png", outfile, page_num);
-        page_num++;
+}
+
+/************************************************************************
+*                       MpsPrinter::BeginPage()           Private       *
+*                       ~~~~~~~~~~~~~~~~~~~~~~~                         *
+* Function : Create the PNG file for the current page and write its     *
+*            header. Called when the first rows of the page are ready   *
+*-----------------------------------------------------------------------*
+* Inputs:                                                               *
+*                                                                       *
+*    none                                                               *
+*                                                                       *
+*-----------------------------------------------------------------------*
+* Outputs:                                                              *
+*                                                                       *
+*    none                                                               *
+*                                                                       *
+************************************************************************/
+
+void
+MpsPrinter::BeginPage(void)
+{
+    char filename[40];
+
+#ifndef NOT_ULTIMATE
+    calcPageNum();
+#endif
+    sprintf(filename,"%s-%03d.png", outfile, page_num);
+    page_num++;
 #ifdef NOT_ULTIMATE
-        printf("printing to file %s\n", filename);
+    printf("printing to file %s\n", filename);
+
+    png_fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (png_fd < 0)
+    {
+        printf("Saving file failed\n");
+    }
+    png = new PngStream(png_write, &png_fd);
 #else
-        DBGMSGV("printing to file %s", filename);
-#endif
-        Print(filename);
+    DBGMSGV("printing to file %s", filename);
+
+    png_file = NULL;
+    fm->fopen((const char *) filename, FA_WRITE|FA_CREATE_NEW, &png_file);
+    if (!png_file)
+    {
+        DBGMSG("Saving PNG failed");
     }
+    png = new PngStream(png_write, png_file);
+#endif
 
-    Clear();
+    /* Physical page description (A4 240x216 dpi) */
+    png->Begin(MPS_PRINTER_PAGE_WIDTH, MPS_PRINTER_PAGE_HEIGHT,
+               color_mode ? MPS_PRINTER_PAGE_DEPTH_COLOR : MPS_PRINTER_PAGE_DEPTH,
+               palette, palette_size, 9448, 8687);
 }
 
 /************************************************************************
-*                       MpsPrinter::Print(filename)       Private       *
+*                       MpsPrinter::FlushRows(last)       Private       *
 *                       ~~~~~~~~~~~~~~~~~~~~~~~~~~~                     *
-* Function : Save current page to PNG finename provided                 *
+* Function : Compress page rows to the PNG file and free their place    *
+*            in the bitmap window. Once written, rows can't get ink     *
+*            anymore                                                    *
 *-----------------------------------------------------------------------*
 * Inputs:                                                               *
 *                                                                       *
-*    filename : (char *) filename to save PNG file to                   *
+*    last : (uint16_t) first page row to keep in memory                 *
 *                                                                       *
 *-----------------------------------------------------------------------*
 * Outputs:                                                              *
@@ -803,46 +901,89 @@ MpsPrinter::FormFeed(void)
 ************************************************************************/
 
 void
-MpsPrinter::Print(const char * filename)
+MpsPrinter::FlushRows(uint16_t last)
 {
-    uint8_t *buffer;
-    size_t outsize;
+    if (last > MPS_PRINTER_PAGE_HEIGHT)
+        last = MPS_PRINTER_PAGE_HEIGHT;
 
-    DBGMSG("start PNG encoder");
+    if (first_row >= last)
+        return;
+
+    if (!png)
+        BeginPage();
+
+    DBGMSGV("PNG rows %d to %d", first_row, last-1);
 #ifndef NOT_ULTIMATE
     ActivityLedOn();
 #endif
-    buffer=NULL;
-    unsigned error = lodepng_encode(&buffer, &outsize, bitmap, MPS_PRINTER_PAGE_WIDTH, MPS_PRINTER_PAGE_HEIGHT, &lodepng_state);
-    DBGMSG("ended PNG encoder, now saving");
+    while (first_row < last)
+    {
+        RenderRow(first_row);
+        png->AddRow(png_row);
+
+        /* Dots 2 rows above can't ink next rows, free their place in window */
+        if (first_row >= 2)
+        {
+            uint32_t *row = bitmap + ((first_row - 2) % MPS_PRINTER_WINDOW_ROWS) * planes * MPS_PRINTER_ROW_WORDS;
+            bzero(row, planes * MPS_PRINTER_ROW_WORDS * sizeof(uint32_t));
+        }
+        first_row++;
+    }
 #ifndef NOT_ULTIMATE
     ActivityLedOff();
+#endif
+}
 
-    File *f;
-    FRESULT fres = fm->fopen((const char *) filename, FA_WRITE|FA_CREATE_NEW, &f);
-    if (f) {
-        uint32_t bytes;
-        f->write(buffer, outsize, &bytes);
-        fm->fclose(f);
+/************************************************************************
+*                       MpsPrinter::EndPage()             Private       *
+*                       ~~~~~~~~~~~~~~~~~~~~~                           *
+* Function : Terminate and close the PNG file of the current page, if  *
+*            it was started. Rows still in memory are written first     *
+*-----------------------------------------------------------------------*
+* Inputs:                                                               *
+*                                                                       *
+*    none                                                               *
+*                                                                       *
+*-----------------------------------------------------------------------*
+* Outputs:                                                              *
+*                                                                       *
+*    none                                                               *
+*                                                                       *
+************************************************************************/
+
+void
+MpsPrinter::EndPage(void)
+{
+    if (!png)
+        return;
+
+    FlushRows(MPS_PRINTER_PAGE_HEIGHT);
+
+    bool ok = png->End();
+    delete png;
+    png = NULL;
+
+#ifndef NOT_ULTIMATE
+    if (png_file)
+        fm->fclose(png_file);
+    png_file = NULL;
+
+    if (ok)
+    {
         DBGMSG("PNG saved");
     }
     else
     {
-        DBGMSG("Saving PNG failed\n");
+        DBGMSG("Saving PNG failed");
     }
 #else
-    int fhd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
-    if (fhd) {
-        write(fhd, buffer, outsize);
-        close(fhd);
-    }
-    else
-    {
+    if (png_fd >= 0)
+        close(png_fd);
+    png_fd = -1;
+
+    if (!ok)
         printf("Saving file failed\n");
-    }
 #endif
-
-    free(buffer);
 }
 
 /************************************************************************
@@ -874,51 +1015,26 @@ MpsPrinter::Dot(uint16_t x, uint16_t y, bool b)
     if ( x > MPS_PRINTER_PAGE_PRINTABLE_WIDTH  ||
          y > MPS_PRINTER_PAGE_PRINTABLE_HEIGHT ) return;
 
-    /* =======  Draw dot */
+    /* =======  Calculate true x and y position on page */
+    uint16_t tx=x+MPS_PRINTER_PAGE_OFFSET_LEFT;
+    uint16_t ty=y+MPS_PRINTER_PAGE_OFFSET_TOP;
 
-    switch (dot_size)
+    /* =======  Shade above the dot would be on a row already in the PNG file */
+    if (ty > first_row)
     {
-        case 0:     // Density 0 : 1 single full color point (diameter 1 pixel) mostly for debug
-            Ink(x,y);
-            break;
+        /* -------  Make room in the window, older rows are written to file */
+        if (ty + 3 > first_row + MPS_PRINTER_WINDOW_ROWS)
+            FlushRows(ty + 3 - MPS_PRINTER_WINDOW_ROWS + MPS_PRINTER_BAND_ROWS);
 
-        case 1:     // Density 1 : 1 full color point with shade around (looks like diameter 2)
-            Ink(x,y);
-            Ink(x-1,y-1,1);
-            Ink(x+1,y+1,1);
-            Ink(x-1,y+1,1);
-            Ink(x+1,y-1,1);
-            Ink(x,y-1,2);
-            Ink(x,y+1,2);
-            Ink(x-1,y,2);
-            Ink(x+1,y,2);
-            break;
+        /* -------  Set the dot bit on each plane of the ribbon color */
+        uint32_t *row = bitmap + (ty % MPS_PRINTER_WINDOW_ROWS) * planes * MPS_PRINTER_ROW_WORDS + (tx >> 5);
+        uint32_t mask = 0x80000000 >> (tx & 31);
+        uint8_t p = color_mode ? color_planes[color] : 1;
 
-        case 2:     // Density 2 : 4 full color points with shade around (looks like diameter 3)
-        default:
-            Ink(x,y);
-            Ink(x,y+1);
-            Ink(x+1,y);
-            Ink(x+1,y+1);
-
-            Ink(x-1,y-1,1);
-            Ink(x+2,y-1,1);
-            Ink(x-1,y+2,1);
-            Ink(x+2,y+2,1);
-
-            Ink(x,y-1,2);
-            Ink(x+1,y-1,2);
-            Ink(x,y+1,2);
-            Ink(x-1,y,2);
-            Ink(x-1,y+1,2);
-            Ink(x+2,y,2);
-            Ink(x+2,y+1,2);
-            Ink(x,y+2,2);
-            Ink(x+1,y+2,2);
-            break;
+        for (int i=0; p; i++, p>>=1)
+            if (p & 1) row[i*MPS_PRINTER_ROW_WORDS] |= mask;
     }
 
-
     if (!b)   /* This is not BIM related, we can double strike and bold */
     {
         /* -------  If double strike is ON, draw a second dot just to the right of the first one */
@@ -935,18 +1051,15 @@ MpsPrinter::Dot(uint16_t x, uint16_t y, bool b)
 }
 
 /************************************************************************
-*                             MpsPrinter::Ink(x,y,c)          Private   *
-*                             ~~~~~~~~~~~~~~~~~~~~~~                    *
-* Function : Add ink on a single pixel position. If ink as already been *
-*            added on this position it will add more ink to be darker   *
-*            On color printer, use the current color ribbon for ink     *
+*                             MpsPrinter::RenderRow(y)        Private   *
+*                             ~~~~~~~~~~~~~~~~~~~~~~~~                  *
+* Function : Convert a page row from dot planes to PNG pixels. Ink of   *
+*            each dot is spread around according to dot size, when     *
+*            ink is added several times on a pixel it gets darker       *
 *-----------------------------------------------------------------------*
 * Inputs:                                                               *
 *                                                                       *
-*    x : (uint16_t) pixel position from left of printable area of page  *
-*    y : (uint16_t) pixel position from top of printable area of page   *
-*    c : (uint8_t) shade level                                          *
-*        0=full (default), 1=dark shade, 2=light shade                  *
+*    y : (uint16_t) page row to convert to png_row                      *
 *                                                                       *
 *-----------------------------------------------------------------------*
 * Outputs:                                                              *
@@ -956,187 +1069,133 @@ MpsPrinter::Dot(uint16_t x, uint16_t y, bool b)
 ************************************************************************/
 
 void
-MpsPrinter::Ink(uint16_t x, uint16_t y, uint8_t c)
+MpsPrinter::RenderRow(uint16_t y)
 {
-    /* =======  Calculate true x and y position on page */
-    uint16_t tx=x+MPS_PRINTER_PAGE_OFFSET_LEFT;
-    uint16_t ty=y+MPS_PRINTER_PAGE_OFFSET_TOP;
-    uint8_t current;
+    uint8_t (*pattern)[4] = dot_pattern[dot_size > 2 ? 2 : dot_size];
+    uint32_t *rows[4];
 
-    if (color_mode)
+    bzero(png_row, row_size);
+
+    /* =======  Dots from 2 rows above to 1 row below can ink this row */
+    for (int dy=-1; dy<=2; dy++)
     {
-        /* =======  Color printer mode, each pixel is coded with 8 bits */
-        /* -------  Which byte address is it on raster buffer */
-        uint32_t byte = ((ty*MPS_PRINTER_PAGE_WIDTH+tx)*MPS_PRINTER_PAGE_DEPTH_COLOR)>>3;
+        int dot_y = y - dy;
 
-        /* -------  Which bits on byte are coding the color (1 pixel per byte) */
-        switch (color)
-        {
-            case MPS_PRINTER_COLOR_BLACK:
-                current = (bitmap[byte] >> 6) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0x3F;
-                bitmap[byte] |= c << 6;
-                break;
+        if (dot_y < 0 || dot_y >= MPS_PRINTER_PAGE_HEIGHT)
+            rows[dy+1] = NULL;
+        else
+            rows[dy+1] = bitmap + (dot_y % MPS_PRINTER_WINDOW_ROWS) * planes * MPS_PRINTER_ROW_WORDS;
+    }
 
-            case MPS_PRINTER_COLOR_YELLOW:
-                current = (bitmap[byte] >> 4) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xCF;
-                bitmap[byte] |= c << 4;
-                break;
+    for (int p=0; p<planes; p++)
+    {
+        /* -------  Words with dots (used) and words with dots or next to dots (near) */
+        uint32_t used[MPS_PRINTER_ROW_WORDS];
+        bool any = false;
 
-            case MPS_PRINTER_COLOR_MAGENTA:
-                current = (bitmap[byte] >> 2) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xF3;
-                bitmap[byte] |= c << 2;
-                break;
+        for (int i=0; i<MPS_PRINTER_ROW_WORDS; i++)
+        {
+            uint32_t u = 0;
+            for (int r=0; r<4; r++)
+                if (rows[r]) u |= rows[r][p*MPS_PRINTER_ROW_WORDS+i];
+            used[i] = u;
+            if (u) any = true;
+        }
 
-            case MPS_PRINTER_COLOR_CYAN:
-                current = bitmap[byte] & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xFC;
-                bitmap[byte] |= c;
-                break;
+        if (!any) continue;
 
-            case MPS_PRINTER_COLOR_VIOLET:      // CYAN + MAGENTA
-                // CYAN
-                current = bitmap[byte] & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xFC;
-                bitmap[byte] |= c;
-                // MAGENTA
-                current = (bitmap[byte] >> 2) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xF3;
-                bitmap[byte] |= c << 2;
-                break;
+        for (int i=0; i<MPS_PRINTER_ROW_WORDS; i++)
+        {
+            if (!(used[i] | (i ? used[i-1] : 0) | (i < MPS_PRINTER_ROW_WORDS-1 ? used[i+1] : 0)))
+                continue;
 
-            case MPS_PRINTER_COLOR_ORANGE:      // MANGENTA + YELLOW
-                // MAGENTA
-                current = (bitmap[byte] >> 2) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xF3;
-                bitmap[byte] |= c << 2;
-                // YELLOW
-                current = (bitmap[byte] >> 4) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xCF;
-                bitmap[byte] |= c << 4;
-                break;
+                /*-
+                 *
+                 *  Shade of 32 pixels is kept as 2 bit counters,
+                 *  lo and hi words hold bit 0 and bit 1 of each
+                 *  counter. Adding more than black is still black.
+                 *
+                -*/
 
-            case MPS_PRINTER_COLOR_GREEN:       // CYAN + YELLOW
-                // CYAN
-                current = bitmap[byte] & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xFC;
-                bitmap[byte] |= c;
-                // YELLOW
-                current = (bitmap[byte] >> 4) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xCF;
-                bitmap[byte] |= c << 4;
-                break;
-        }
-    }
-    else
-    {
-        /* =======  Greyscale printer mode, each pixel is coded with 2 bits */
-        /* -------  Which byte address is it on raster buffer */
-        uint32_t byte = ((ty*MPS_PRINTER_PAGE_WIDTH+tx)*MPS_PRINTER_PAGE_DEPTH)>>3;
+            uint32_t lo = 0, hi = 0;
 
-        /* -------  Whitch bits on byte are coding the pixel (4 pixels per byte) */
-        uint8_t sub = tx & 0x3;
-        c &= 0x3;
+            for (int r=0; r<4; r++)
+            {
+                if (!rows[r]) continue;
 
-        /* =======  Add ink to the pixel */
-        switch (sub)
-        {
-            case 0:
-                current = (bitmap[byte] >> 6) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0x3F;
-                bitmap[byte] |= c << 6;
-                break;
+                uint32_t *row = rows[r] + p*MPS_PRINTER_ROW_WORDS;
+                uint32_t prev = i ? row[i-1] : 0;
+                uint32_t cur  = row[i];
+                uint32_t next = (i < MPS_PRINTER_ROW_WORDS-1) ? row[i+1] : 0;
 
-            case 1:
-                current = (bitmap[byte] >> 4) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xCF;
-                bitmap[byte] |= c << 4;
-                break;
+                if (!(prev | cur | next)) continue;
 
-            case 2:
-                current = (bitmap[byte] >> 2) & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xF3;
-                bitmap[byte] |= c << 2;
-                break;
+                for (int dx=-1; dx<=2; dx++)
+                {
+                    uint8_t weight = pattern[r][dx+1];
+                    uint32_t s;
+
+                    if (!weight) continue;
+
+                    /* Pixels with a dot dx pixels on their left (MSB is left) */
+                    if (dx < 0)
+                        s = (cur << 1) | (next >> 31);
+                    else if (dx == 0)
+                        s = cur;
+                    else
+                        s = (cur >> dx) | (prev << (32 - dx));
+
+                    if (!s) continue;
+
+                    if (weight >= 3)
+                    {
+                        lo |= s;
+                        hi |= s;
+                    }
+                    else if (weight == 2)
+                    {
+                        lo |= hi & s;
+                        hi |= s;
+                    }
+                    else
+                    {
+                        uint32_t carry = lo & s;
+                        lo = (lo ^ s) | (hi & s);
+                        hi |= carry;
+                    }
+                }
+            }
 
-            case 3:
-                current = bitmap[byte] & 0x03;
-                c = Combine(c, current);
-                bitmap[byte] &= 0xFC;
-                bitmap[byte] |= c;
-                break;
-        }
-    }
-}
+            if (!(lo | hi)) continue;
 
-/* ONLY FOR COLOR DEBUG */
-#ifdef DEBUG
-void
-MpsPrinter::InkTest(uint16_t x, uint16_t y, uint8_t c)
-{
-    uint16_t tx=x+MPS_PRINTER_PAGE_OFFSET_LEFT;
-    uint16_t ty=y+MPS_PRINTER_PAGE_OFFSET_TOP;
+            /* -------  Pack pixels to PNG row */
+            for (int b=0; b<4; b++)
+            {
+                uint8_t l = lo >> (24 - 8*b);
+                uint8_t h = hi >> (24 - 8*b);
 
-    if (color_mode)
-    {
-        uint32_t byte = ((ty*MPS_PRINTER_PAGE_WIDTH+tx)*MPS_PRINTER_PAGE_DEPTH_COLOR)>>3;
-        bitmap[byte]=c;
-    }
-}
-#endif /* DEBUG */
+                if (!(l | h)) continue;
 
-/************************************************************************
-*                       MpsPrinter::Combine(c1,c2)            Private   *
-*                       ~~~~~~~~~~~~~~~~~~~~~~~~~~                      *
-* Function : Combine two grey levels and give the resulting grey        *
-*-----------------------------------------------------------------------*
-* Inputs:                                                               *
-*                                                                       *
-*    c1 : (int) first grey level (0 is white, 3 is black)               *
-*    c2 : (int) second grey level (0 is white, 3 is black)              *
-*                                                                       *
-*-----------------------------------------------------------------------*
-* Outputs:                                                              *
-*                                                                       *
-*    (uint8_t) resulting grey level (in range range 0-3)                *
-*                                                                       *
-************************************************************************/
+                if (color_mode)
+                {
+                    /* 1 pixel per byte, planes are black, yellow, magenta, cyan */
+                    uint8_t *out = png_row + (i << 5) + (b << 3);
 
-uint8_t
-MpsPrinter::Combine(uint8_t c1, uint8_t c2)
-{
-        /*-
-         *
-         *   Very easy to understand :
-         *
-         *   white      + white         = white
-         *   white      + light grey    = light grey
-         *   white      + dark grey     = dark grey
-         *   light grey + light grey    = dark grey
-         *   light grey + dark grey     = black
-         *   dark grey  + dark grey     = black
-         *   black      + *whatever*    = black
-         *
-        -*/
+                    for (int k=0; k<8; k++)
+                        out[k] |= (((h >> (7-k)) & 1) << 1 | ((l >> (7-k)) & 1)) << (6 - 2*p);
+                }
+                else
+                {
+                    /* 4 pixels per byte */
+                    uint16_t v = (spread_bits[h] << 1) | spread_bits[l];
+                    uint8_t *out = png_row + (i << 3) + (b << 1);
 
-    uint8_t result = c1 + c2;
-    if (result > 3) result = 3;
-    return result;
+                    out[0] = v >> 8;
+                    out[1] = v;
+                }
+            }
+        }
+    }
 }
 
 /************************************************************************
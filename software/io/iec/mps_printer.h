@@ -33,7 +33,9 @@
 #endif
 
 #include <stdint.h>
-#include "lodepng.h"
+#include <stdlib.h>
+#include <string.h>
+#include "png_stream.h"
 
 /*******************************  Constants  ****************************/
 
@@ -51,9 +53,41 @@
 #define MPS_PRINTER_MAX_VTABULATIONS        32
 #define MPS_PRINTER_MAX_VTABSTORES          8
 
-#define MPS_PRINTER_BITMAP_SIZE_BW          ((MPS_PRINTER_PAGE_WIDTH*MPS_PRINTER_PAGE_HEIGHT*MPS_PRINTER_PAGE_DEPTH+7)>>3)
-#define MPS_PRINTER_BITMAP_SIZE_COLOR       ((MPS_PRINTER_PAGE_WIDTH*MPS_PRINTER_PAGE_HEIGHT*MPS_PRINTER_PAGE_DEPTH_COLOR+7)>>3)
-#define MPS_PRINTER_BITMAP_SIZE             MPS_PRINTER_BITMAP_SIZE_COLOR
+#define MPS_PRINTER_ROW_SIZE_BW             ((MPS_PRINTER_PAGE_WIDTH*MPS_PRINTER_PAGE_DEPTH+7)>>3)
+#define MPS_PRINTER_ROW_SIZE_COLOR          ((MPS_PRINTER_PAGE_WIDTH*MPS_PRINTER_PAGE_DEPTH_COLOR+7)>>3)
+
+    /*-
+     *
+     *  Page is stored as 1 bit per pixel planes telling where a needle
+     *  hit the paper, one plane for greyscale, one per ribbon color
+     *  (black, yellow, magenta, cyan) on color printer. Ink shades
+     *  around each dot are only calculated when rows go to the PNG file.
+     *
+    -*/
+
+#define MPS_PRINTER_ROW_WORDS               ((MPS_PRINTER_PAGE_WIDTH+31)>>5)
+#define MPS_PRINTER_PLANES_BW               1
+#define MPS_PRINTER_PLANES_COLOR            4
+
+/* Define this to keep the whole page in memory, PNG is then written on form feed */
+//#define MPS_PRINTER_FULL_PAGE
+
+    /*-
+     *
+     *  Without full page buffer, only a window of rows is kept in
+     *  memory. When ink goes below the window, the oldest band of
+     *  rows is compressed to the PNG file. The window must be taller
+     *  than a reverse line feed (255 dots) plus the print head.
+     *  Dots can shade pixels up to 2 rows away, these rows are kept.
+     *
+    -*/
+
+#ifdef MPS_PRINTER_FULL_PAGE
+#define MPS_PRINTER_WINDOW_ROWS             (MPS_PRINTER_PAGE_HEIGHT+4)
+#else
+#define MPS_PRINTER_WINDOW_ROWS             512
+#endif
+#define MPS_PRINTER_BAND_ROWS               128
 
 #define MPS_PRINTER_MAX_BIM_SUB             256
 #define MPS_PRINTER_MAX_SPECIAL             46
@@ -152,6 +186,15 @@ class MpsPrinter
         /* Dot spacing on Y axis depending on character style (normal, superscript, subscript) */
         static uint8_t spacing_y[6][17];
 
+        /* Ink shades around a dot for each dot size (4x4, dot is at [1][1]) */
+        static uint8_t dot_pattern[3][4][4];
+
+        /* Bit planes to ink for each ribbon color */
+        static uint8_t color_planes[7];
+
+        /* Bit n of a byte moved to bit 2n */
+        static uint16_t spread_bits[256];
+
         /* CBM character specia for quote mode */
         static uint8_t cbm_special[MPS_PRINTER_MAX_SPECIAL];
 
@@ -165,7 +208,8 @@ class MpsPrinter
         char outfile[32];
 
         /* PNG palette */
-        LodePNGState lodepng_state;
+        uint8_t palette[768];
+        uint16_t palette_size;
 
         /* tabulation stops */
         uint16_t htab[MPS_PRINTER_MAX_HTABULATIONS];
@@ -175,8 +219,24 @@ class MpsPrinter
         /* True if color printer */
         bool color_mode;
 
-        /* Page bitmap */
-        uint8_t bitmap[MPS_PRINTER_BITMAP_SIZE];
+        /* Page dot planes, a window of MPS_PRINTER_WINDOW_ROWS rows used as a ring */
+        uint32_t *bitmap;
+        uint8_t planes;
+
+        /* PNG row converted from dot planes */
+        uint8_t *png_row;
+        uint16_t row_size;
+
+        /* First page row still in the window, rows above are in the PNG file */
+        uint16_t first_row;
+
+        /* PNG output of the current page, NULL if nothing written yet */
+        PngStream *png;
+#ifndef NOT_ULTIMATE
+        File *png_file;
+#else
+        int png_fd;
+#endif
 
         /* How many pages printed since start */
         int page_num;
@@ -297,17 +357,15 @@ class MpsPrinter
         void Reset(void);
 
     private:
-        uint8_t Combine(uint8_t c1, uint8_t c2);
         void Clear(void);
         void Init(void);
 #ifndef NOT_ULTIMATE
         void calcPageNum(void);
 #endif
-        void Print(const char* filename);
-        void Ink(uint16_t x, uint16_t y, uint8_t c=3);
-#ifdef DEBUG
-        void InkTest(uint16_t x, uint16_t y, uint8_t c);
-#endif
+        void BeginPage(void);
+        void FlushRows(uint16_t last);
+        void EndPage(void);
+        void RenderRow(uint16_t y);
         void Dot(uint16_t x, uint16_t y, bool b=false);
         uint16_t Charset2Chargen(uint8_t input);
         uint16_t Char(uint16_t c);
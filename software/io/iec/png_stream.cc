@@ -0,0 +1,369 @@
+/*
+ * png_stream.cc
+ *
+ * Streaming PNG writer for palette images, see png_stream.h.
+ */
+
+#include <string.h>
+#include "png_stream.h"
+extern "C" {
+#include "crc32.h"
+}
+
+#define PNG_MIN_MATCH   3
+#define PNG_MAX_MATCH   258
+#define PNG_LOOKAHEAD   (PNG_MAX_MATCH + PNG_MIN_MATCH)
+
+/* =======  Deflate tables (RFC 1951) */
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static uint16_t reverse_bits(uint16_t code, int count)
+{
+    uint16_t r = 0;
+    for (int i = 0; i < count; i++) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+/* Fixed Huffman code of a literal/length symbol, already bit reversed */
+static void fixed_code(int symbol, uint16_t *code, int *count)
+{
+    if (symbol < 144) {
+        *count = 8;
+        *code = reverse_bits(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        *count = 9;
+        *code = reverse_bits(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        *count = 7;
+        *code = reverse_bits(symbol - 256, 7);
+    } else {
+        *count = 8;
+        *code = reverse_bits(0xC0 + symbol - 280, 8);
+    }
+}
+
+static uint16_t lit_code[288];
+static uint8_t  lit_count[288];
+static uint8_t  length_symbol[PNG_MAX_MATCH + 1];
+static bool     tables_valid = false;
+
+static void build_tables(void)
+{
+    int count;
+    for (int i = 0; i < 288; i++) {
+        fixed_code(i, &lit_code[i], &count);
+        lit_count[i] = (uint8_t)count;
+    }
+    for (int i = 0; i < 29; i++) {
+        int end = (i == 28) ? 259 : length_base[i + 1];
+        for (int l = length_base[i]; l < end; l++) {
+            length_symbol[l] = (uint8_t)i;
+        }
+    }
+    length_symbol[258] = 28;
+    tables_valid = true;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+PngStream::PngStream(write_t func, void *context)
+{
+    write_func = func;
+    write_context = context;
+    window = 0;
+    hash_head = 0;
+    chunk = 0;
+    error = false;
+    if (!tables_valid) {
+        build_tables();
+    }
+}
+
+PngStream::~PngStream()
+{
+    delete[] window;
+    delete[] hash_head;
+    delete[] chunk;
+}
+
+uint32_t PngStream::MemoryUse(void)
+{
+    return 2 * PNG_STREAM_WINDOW + (sizeof(int32_t) << PNG_STREAM_HASH_BITS) + PNG_STREAM_CHUNK_SIZE + 4;
+}
+
+void PngStream::WriteChunk(const char *type, const uint8_t *data, uint32_t length)
+{
+    uint8_t head[8];
+    uint8_t tail[4];
+
+    put_be32(head, length);
+    memcpy(head + 4, type, 4);
+    uint32_t crc = crc32_update(0, head + 4, 4);
+    crc = crc32_update(crc, data, length);
+    put_be32(tail, crc);
+
+    if (error) {
+        return;
+    }
+    if (!write_func(write_context, head, 8) ||
+        (length && !write_func(write_context, data, length)) ||
+        !write_func(write_context, tail, 4)) {
+        error = true;
+    }
+}
+
+void PngStream::FlushChunk(void)
+{
+    if (chunk_fill) {
+        WriteChunk("IDAT", chunk, chunk_fill);
+        chunk_fill = 0;
+    }
+}
+
+void PngStream::PutBits(uint32_t value, int count)
+{
+    bit_buffer |= value << bit_count;
+    bit_count += count;
+    while (bit_count >= 8) {
+        chunk[chunk_fill++] = (uint8_t)bit_buffer;
+        bit_buffer >>= 8;
+        bit_count -= 8;
+        if (chunk_fill == PNG_STREAM_CHUNK_SIZE) {
+            FlushChunk();
+        }
+    }
+}
+
+void PngStream::PutLiteral(int c)
+{
+    PutBits(lit_code[c], lit_count[c]);
+}
+
+void PngStream::PutMatch(int length, int distance)
+{
+    int s = length_symbol[length];
+    PutBits(lit_code[257 + s], lit_count[257 + s]);
+    if (length_extra[s]) {
+        PutBits(length - length_base[s], length_extra[s]);
+    }
+    int d = 0;
+    while ((d < 29) && (distance_base[d + 1] <= distance)) {
+        d++;
+    }
+    PutBits(reverse_bits(d, 5), 5);
+    if (distance_extra[d]) {
+        PutBits(distance - distance_base[d], distance_extra[d]);
+    }
+}
+
+/* Compresses the window up to 'end'. Matches are only taken from the data before 'window_fill'. */
+void PngStream::Compress(uint32_t end)
+{
+    uint32_t pos = window_pos;
+    uint32_t stride = row_bytes + 1;
+
+    while (pos < end) {
+        uint32_t max = window_fill - pos;
+        if (max > PNG_MAX_MATCH) {
+            max = PNG_MAX_MATCH;
+        }
+        uint32_t best_len = 0, best_dist = 0;
+
+        if (max >= PNG_MIN_MATCH) {
+            /* Candidates: previous byte (runs), same column of the previous row, and the hash chain head */
+            uint32_t h = ((window[pos] << 8) ^ (window[pos + 1] << 4) ^ window[pos + 2]) & ((1 << PNG_STREAM_HASH_BITS) - 1);
+            int32_t candidates[3] = { (int32_t)pos - 1, (int32_t)(pos - stride), hash_head[h] };
+            hash_head[h] = (int32_t)pos;
+
+            for (int i = 0; i < 3; i++) {
+                int32_t c = candidates[i];
+                if ((c < 0) || ((uint32_t)c >= pos) || (pos - c > PNG_STREAM_WINDOW)) {
+                    continue;
+                }
+                uint32_t len = 0;
+                while ((len < max) && (window[c + len] == window[pos + len])) {
+                    len++;
+                }
+                if (len > best_len) {
+                    best_len = len;
+                    best_dist = pos - c;
+                }
+            }
+        }
+
+        if (best_len >= PNG_MIN_MATCH) {
+            PutMatch(best_len, best_dist);
+            pos += best_len;
+        } else {
+            PutLiteral(window[pos]);
+            pos++;
+        }
+    }
+    window_pos = pos;
+}
+
+void PngStream::Append(const uint8_t *data, uint32_t length)
+{
+    /* Adler32 of the uncompressed data, for the zlib trailer */
+    for (uint32_t i = 0; i < length; i++) {
+        adler_a += data[i];
+        if (adler_a >= 65521) adler_a -= 65521;
+        adler_b += adler_a;
+        if (adler_b >= 65521) adler_b -= 65521;
+    }
+
+    while (length) {
+        if (window_fill == 2 * PNG_STREAM_WINDOW) {
+            /* Slide the window; all data before window_pos is compressed already */
+            uint32_t shift = window_pos - PNG_STREAM_WINDOW;
+            memmove(window, window + shift, window_fill - shift);
+            window_fill -= shift;
+            window_pos -= shift;
+            for (int i = 0; i < (1 << PNG_STREAM_HASH_BITS); i++) {
+                hash_head[i] = (hash_head[i] >= (int32_t)shift) ? hash_head[i] - shift : -1;
+            }
+        }
+        uint32_t n = 2 * PNG_STREAM_WINDOW - window_fill;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(window + window_fill, data, n);
+        window_fill += n;
+        data += n;
+        length -= n;
+
+        /* Keep enough data behind to find matches that run into the next row */
+        if (window_fill > window_pos + PNG_LOOKAHEAD) {
+            Compress(window_fill - PNG_LOOKAHEAD);
+        }
+    }
+}
+
+bool PngStream::Begin(uint32_t w, uint32_t h, uint8_t depth, const uint8_t *palette, uint16_t colors,
+                      uint32_t ppm_x, uint32_t ppm_y)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    uint8_t ihdr[13];
+    uint8_t phys[9];
+
+    width = w;
+    height = h;
+    row_bytes = (w * depth + 7) >> 3;
+    rows_done = 0;
+
+    if (!window) {
+        window = new uint8_t[2 * PNG_STREAM_WINDOW];
+        hash_head = new int32_t[1 << PNG_STREAM_HASH_BITS];
+        chunk = new uint8_t[PNG_STREAM_CHUNK_SIZE];
+    }
+    for (int i = 0; i < (1 << PNG_STREAM_HASH_BITS); i++) {
+        hash_head[i] = -1;
+    }
+    window_fill = window_pos = 0;
+    chunk_fill = 0;
+    bit_buffer = 0;
+    bit_count = 0;
+    adler_a = 1;
+    adler_b = 0;
+    error = false;
+
+    if (!write_func(write_context, signature, 8)) {
+        error = true;
+    }
+
+    put_be32(ihdr, w);
+    put_be32(ihdr + 4, h);
+    ihdr[8] = depth;
+    ihdr[9] = 3;    /* palette */
+    ihdr[10] = 0;   /* deflate */
+    ihdr[11] = 0;   /* adaptive filtering */
+    ihdr[12] = 0;   /* no interlace */
+    WriteChunk("IHDR", ihdr, 13);
+    WriteChunk("PLTE", palette, colors * 3);
+    if (ppm_x && ppm_y) {
+        put_be32(phys, ppm_x);
+        put_be32(phys + 4, ppm_y);
+        phys[8] = 1;    /* meter */
+        WriteChunk("pHYs", phys, 9);
+    }
+
+    /* zlib header, followed by the header of the one and only (final, fixed Huffman) deflate block */
+    chunk[chunk_fill++] = 0x78;
+    chunk[chunk_fill++] = 0x01;
+    PutBits(1, 1);
+    PutBits(1, 2);
+
+    return !error;
+}
+
+bool PngStream::AddRow(const uint8_t *row)
+{
+    static const uint8_t filter_none = 0;
+
+    if (rows_done >= height) {
+        return false;
+    }
+    Append(&filter_none, 1);
+    Append(row, row_bytes);
+    rows_done++;
+    return !error;
+}
+
+bool PngStream::End(void)
+{
+    if (rows_done < height) {
+        uint8_t *blank = new uint8_t[row_bytes];
+        memset(blank, 0, row_bytes);
+        while (rows_done < height) {
+            AddRow(blank);
+        }
+        delete[] blank;
+    }
+    Compress(window_fill);
+    PutLiteral(256); /* end of block */
+    if (bit_count) {
+        PutBits(0, 8 - bit_count);
+    }
+
+    uint8_t adler[4];
+    put_be32(adler, (adler_b << 16) | adler_a);
+    for (int i = 0; i < 4; i++) {
+        PutBits(adler[i], 8);
+    }
+    FlushChunk();
+    WriteChunk("IEND", 0, 0);
+
+    /* The buffers are only needed while a file is being written */
+    delete[] window;
+    delete[] hash_head;
+    delete[] chunk;
+    window = 0;
+    hash_head = 0;
+    chunk = 0;
+
+    return !error;
+}
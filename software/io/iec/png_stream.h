@@ -0,0 +1,74 @@
+/*
+ * png_stream.h
+ *
+ * Streaming PNG writer for palette images. Rows are compressed as they are
+ * added and written out in IDAT chunks, so the image itself never has to be
+ * in memory as a whole. Compression is a single fixed-Huffman deflate block
+ * with a 32K window, which is good enough for mostly white printer pages.
+ */
+
+#ifndef PNG_STREAM_H
+#define PNG_STREAM_H
+
+#include <stdint.h>
+
+#define PNG_STREAM_WINDOW       32768
+#define PNG_STREAM_HASH_BITS    12
+#define PNG_STREAM_CHUNK_SIZE   16384
+
+class PngStream
+{
+public:
+    /* Called for every piece of output; returns false on a write error */
+    typedef bool (*write_t)(void *context, const uint8_t *data, uint32_t length);
+
+private:
+    write_t write_func;
+    void *write_context;
+    bool error;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t row_bytes;
+    uint32_t rows_done;
+
+    /* LZ77 window: the last 32K of uncompressed data, followed by new data */
+    uint8_t *window;
+    uint32_t window_fill;
+    uint32_t window_pos;        /* first byte not compressed yet */
+    int32_t *hash_head;
+    uint32_t adler_a, adler_b;
+
+    /* Compressed data, waiting to be written as an IDAT chunk */
+    uint8_t *chunk;
+    uint32_t chunk_fill;
+    uint32_t bit_buffer;
+    int bit_count;
+
+    void PutBits(uint32_t value, int count);
+    void PutLiteral(int c);
+    void PutMatch(int length, int distance);
+    void Compress(uint32_t end);
+    void Append(const uint8_t *data, uint32_t length);
+    void WriteChunk(const char *type, const uint8_t *data, uint32_t length);
+    void FlushChunk(void);
+
+public:
+    PngStream(write_t func, void *context);
+    ~PngStream();
+
+    /* palette: 'colors' RGB triplets. ppm: pixels per meter, 0 if unknown */
+    bool Begin(uint32_t width, uint32_t height, uint8_t depth, const uint8_t *palette, uint16_t colors,
+               uint32_t ppm_x, uint32_t ppm_y);
+
+    /* One row of packed pixels, as in the PNG file (depth * width bits) */
+    bool AddRow(const uint8_t *row);
+
+    /* Rows that were not added are written as zeros (palette entry 0) */
+    bool End(void);
+
+    /* Bytes of heap used while a file is written */
+    static uint32_t MemoryUse(void);
+};
+
+#endif /* PNG_STREAM_H */
@@ -6,6 +6,7 @@
 #include "profiler.h"
 #include "u64.h"
 #include "network_interface.h"
+#include "rmii_interface.h"
 #include "socket.h"
 #include "netdb.h"
 #include "userinterface.h"
@@ -71,12 +72,59 @@ void DataStreamer :: S_timer(TimerHandle_t a)
     int streamID = (int)pvTimerGetTimerID(a);
     printf("S_timer %p %d\n", a, streamID);
     if ((streamID >= 0) && (streamID <= 3)) {
-        stream_config_t *stream = &dataStreamer.streams[streamID];
-        stream->enable = 0;
-        dataStreamer.calculate_udp_headers(streamID);
+        dataStreamer.disable(streamID);
     }
 }
 
+void DataStreamer :: disable(int id)
+{
+    stream_config_t *stream = &streams[id];
+    uint8_t was_enabled = stream->enable;
+    stream->enable = 0;
+    calculate_udp_headers(id);
+    if (!was_enabled) {
+        return;
+    }
+    stream->active_ticks += xTaskGetTickCount() - stream->started;
+
+    printf("Stream %d off. On for %u ticks in total. CPU frames sent: %u, deferred: %u, dropped: %u\n",
+            id, stream->active_ticks, stream->tx_sent, stream->tx_deferred, stream->tx_dropped);
+}
+
+// Called by the RMII interface for every frame the CPU offers. The frame is
+// accounted to each stream that is on, as they all compete with it for the line.
+void DataStreamer :: S_txReport(void *context, int outcome)
+{
+    DataStreamer *str = (DataStreamer *)context;
+    for (int i=0; i < 4; i++) {
+        stream_config_t *stream = &str->streams[i];
+        if (!stream->enable) {
+            continue;
+        }
+        if (outcome == RMII_TX_DROPPED) {
+            stream->tx_dropped++;
+            continue;
+        }
+        stream->tx_sent++;
+        if (outcome == RMII_TX_DEFERRED) {
+            stream->tx_deferred++;
+        }
+    }
+}
+
+void DataStreamer :: getStatistics(int id, stream_stats_t *stats)
+{
+    stream_config_t *stream = &streams[id & 3];
+    stats->starts = stream->starts;
+    stats->active_ticks = stream->active_ticks;
+    if (stream->enable) {
+        stats->active_ticks += xTaskGetTickCount() - stream->started;
+    }
+    stats->tx_sent = stream->tx_sent;
+    stats->tx_deferred = stream->tx_deferred;
+    stats->tx_dropped = stream->tx_dropped;
+}
+
 int DataStreamer :: startStream(SubsysCommand *cmd)
 {
     if(NetworkInterface :: getNumberOfInterfaces() < 1) {
@@ -207,6 +255,11 @@ int DataStreamer :: startStream(SubsysCommand *cmd)
             return -8;
         }
     }
+    if (!stream->enable) {
+        stream->starts++;
+        stream->started = xTaskGetTickCount();
+        rmii_interface.set_tx_report(DataStreamer :: S_txReport, this);
+    }
     stream->enable = 1;
 
     // start stream!
@@ -234,9 +287,7 @@ int DataStreamer :: stopStream(SubsysCommand *cmd)
     if ((streamID < 0) || (streamID > 3)) {
         return -10;
     }
-    stream_config_t *stream = &streams[streamID];
-    stream->enable = 0;
-    calculate_udp_headers(streamID);
+    disable(streamID);
     return 0;
 }
 
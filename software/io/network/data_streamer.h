@@ -25,8 +25,25 @@ typedef struct {
     int      dest_port;
     uint8_t  dest_mac[6];
     uint8_t  enable;
+    uint32_t starts;        // number of times the stream was started
+    TickType_t started;     // tick count at the last start
+    uint32_t active_ticks;  // total time the stream was on, up to the last stop
+    uint32_t tx_sent;       // CPU frames offered to the transmitter while the stream was on
+    uint32_t tx_deferred;   // .. of which had to wait for the transmitter
+    uint32_t tx_dropped;    // .. of which could not be sent
 } stream_config_t;
 
+// Reported by the stream off commands. The packets of the streams are generated by the
+// hardware; what software can see is how often its own frames on the same transmitter
+// had to wait (deferred), or could not be sent at all (dropped), while this stream was on.
+typedef struct {
+    uint32_t starts;
+    uint32_t active_ticks;
+    uint32_t tx_sent;
+    uint32_t tx_deferred;
+    uint32_t tx_dropped;
+} stream_stats_t;
+
 
 class DataStreamer : public ObjectWithMenu
 {
@@ -40,8 +57,10 @@ class DataStreamer : public ObjectWithMenu
 
 
     static void S_timer(TimerHandle_t a);
+    static void S_txReport(void *context, int outcome);
     int startStream(SubsysCommand *cmd);
     int stopStream(SubsysCommand *cmd);
+    void disable(int id);
 
     void calculate_udp_headers(int id);
     void send_udp_packet(uint32_t ip, uint16_t port);
@@ -51,6 +70,7 @@ public:
 
     static int  S_startStream(SubsysCommand *cmd);
     static int  S_stopStream(SubsysCommand *cmd);
+    void getStatistics(int id, stream_stats_t *stats);
 
     // from ObjectWithMenu
     int fetch_task_items(Path *path, IndexedList<Action*> &item_list);
@@ -269,12 +269,12 @@ bool NetworkLWIP :: input(uint8_t *raw_buffer, uint8_t *payload, int pkt_size)
 {
 	//dump_hex(payload, pkt_size);
 
-	PROFILER_SUB = 7;
+	PROFILER_MARK(7);
 	struct pbuf_custom *pbuf = pbuf_fifo.pop();
 
 	if (!pbuf) {
 		printf("No memory");
-		PROFILER_SUB = 0;
+		PROFILER_MARK(0);
 		return false;
 	}
 	pbuf->custom_obj = this;
@@ -296,7 +296,7 @@ bool NetworkLWIP :: input(uint8_t *raw_buffer, uint8_t *payload, int pkt_size)
 //		pbuf_free(p);
 		return false;
 	}
-	PROFILER_SUB = 15;
+	PROFILER_MARK(15);
 	return true;
 }
 
@@ -23,20 +23,181 @@ Message c_status_no_socket           = { 23, true, (uint8_t *)"85,ERROR OPENING
 Message c_status_socket_closed       = { 28, true, (uint8_t *)"01,CONNECTION CLOSED BY HOST" };
 Message c_status_net_no_data         = { 26, true, (uint8_t *)"03,MORE DATA NOT SUPPORTED" };
 Message c_status_internal_error      = { 17, true, (uint8_t *)"86,INTERNAL ERROR" };
+Message c_status_not_buffered        = { 22, true, (uint8_t *)"87,SOCKET NOT BUFFERED" };
+
+NetSocketBuffer :: NetSocketBuffer(int s)
+{
+    socket = s;
+    rx_head = 0;
+    rx_tail = 0;
+    closed = false;
+    error = 0;
+    tx_count = 0;
+    rx_ring = new uint8_t[NET_RX_RINGSIZE];
+    tx_stage = new uint8_t[NET_TX_STAGESIZE];
+}
+
+NetSocketBuffer :: ~NetSocketBuffer()
+{
+    delete[] rx_ring;
+    delete[] tx_stage;
+}
+
+int NetSocketBuffer :: rx_contiguous_space(void)
+{
+    int space = rx_space();
+    int to_end = NET_RX_RINGSIZE - rx_head;
+    return (space < to_end) ? space : to_end;
+}
+
+int NetSocketBuffer :: rx_read(uint8_t *dest, int len)
+{
+    int avail = rx_available();
+    if (len > avail) {
+        len = avail;
+    }
+    int first = NET_RX_RINGSIZE - rx_tail;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(dest, rx_ring + rx_tail, first);
+    memcpy(dest + first, rx_ring, len - first);
+    rx_tail = (rx_tail + len) & (NET_RX_RINGSIZE - 1);
+    return len;
+}
 
 NetworkTarget::NetworkTarget(int id)
 {
     command_targets[id] = this;
-    data_message.message = new uint8_t[512];
+    data_message.message = new uint8_t[NET_CMD_BUFSIZE];
     status_message.message = new uint8_t[80];
+    for (int i=0; i < NET_MAX_SOCKETS; i++) {
+        sockets[i] = NULL;
+    }
+    socketLock = xSemaphoreCreateMutex();
+    rxSignal = xSemaphoreCreateBinary();
+    xTaskCreate( NetworkTarget :: receive_task, "Net Target Rx", configMINIMAL_STACK_SIZE, this, tskIDLE_PRIORITY + 2, &receiveTask );
 }
 
 NetworkTarget::~NetworkTarget()
 {
+    for (int i=0; i < NET_MAX_SOCKETS; i++) {
+        if (sockets[i]) {
+            delete sockets[i];
+        }
+    }
     delete[] data_message.message;
     delete[] status_message.message;
 }
 
+void NetworkTarget :: receive_task(void *a)
+{
+    NetworkTarget *target = (NetworkTarget *)a;
+    target->run_receive();
+}
+
+// Keeps the receive rings of all buffered sockets filled, such that a read
+// command from the C64 never has to wait for the network.
+void NetworkTarget :: run_receive(void)
+{
+    fd_set readset;
+    struct timeval tv;
+
+    while(1) {
+        int maxfd = -1;
+        FD_ZERO(&readset);
+        xSemaphoreTake(socketLock, portMAX_DELAY);
+        for (int i=0; i < NET_MAX_SOCKETS; i++) {
+            NetSocketBuffer *sb = sockets[i];
+            if (sb && !sb->closed && !sb->error && (sb->rx_space() > 0)) {
+                FD_SET(i, &readset);
+                maxfd = i;
+            }
+        }
+        xSemaphoreGive(socketLock);
+
+        if (maxfd < 0) {
+            // Nothing to listen to; wait until a socket is opened or a ring is drained
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // Short timeout, such that newly opened sockets get picked up
+        tv.tv_sec = 0;
+        tv.tv_usec = 20000;
+        int ret = lwip_select(maxfd + 1, &readset, NULL, NULL, &tv);
+        if (ret <= 0) {
+            continue;
+        }
+
+        bool signal = false;
+        xSemaphoreTake(socketLock, portMAX_DELAY);
+        for (int i=0; i <= maxfd; i++) {
+            NetSocketBuffer *sb = sockets[i];
+            if (!sb || !FD_ISSET(i, &readset)) {
+                continue; // might have been closed in the meantime
+            }
+            int space = sb->rx_contiguous_space();
+            if (!space) {
+                continue;
+            }
+            int len = lwip_recv(i, sb->rx_ring + sb->rx_head, space, MSG_DONTWAIT);
+            if (len > 0) {
+                sb->rx_head = (sb->rx_head + len) & (NET_RX_RINGSIZE - 1);
+                signal = true;
+            } else if (len == 0) {
+                sb->closed = true;
+                signal = true;
+            } else if ((errno != EWOULDBLOCK) && (errno != EAGAIN)) {
+                sb->error = errno;
+                signal = true;
+            }
+        }
+        xSemaphoreGive(socketLock);
+        if (signal) {
+            xSemaphoreGive(rxSignal);
+        }
+    }
+}
+
+void NetworkTarget :: set_error_status(Message **status, const char *msg, int err)
+{
+    *status = &status_message;
+    sprintf((char *)this->status_message.message, msg, err);
+    this->status_message.length = strlen((char *)this->status_message.message);
+}
+
+// Sends the staged data of a socket. Must be called WITHOUT the socket lock, as the
+// send may block until the peer opens its window; the staging area is ours alone.
+int NetworkTarget :: flush_socket(NetSocketBuffer *sb)
+{
+    int offset = 0;
+    while (offset < sb->tx_count) {
+        int ret = lwip_send(sb->socket, sb->tx_stage + offset, sb->tx_count - offset, 0);
+        if (ret < 0) {
+            sb->tx_count = 0;
+            return ret;
+        }
+        offset += ret;
+    }
+    sb->tx_count = 0;
+    return offset;
+}
+
+void NetworkTarget :: release_socket(int socketnr)
+{
+    if ((socketnr < 0) || (socketnr >= NET_MAX_SOCKETS)) {
+        return;
+    }
+    xSemaphoreTake(socketLock, portMAX_DELAY);
+    NetSocketBuffer *sb = sockets[socketnr];
+    sockets[socketnr] = NULL;
+    xSemaphoreGive(socketLock);
+    if (sb) {
+        delete sb;
+    }
+}
+
 
 void NetworkTarget :: parse_command(Message *command, Message **reply, Message **status)
 {
@@ -165,6 +326,25 @@ void NetworkTarget :: parse_command(Message *command, Message **reply, Message *
         case NET_CMD_WRITE_SOCKET:
         	write_socket(command, reply, status);
         	break;
+        case NET_CMD_WRITE_BUFFERED:
+            if (command->length < 3) {
+                *reply = &c_message_empty;
+                *status = &c_status_invalid_params;
+                break;
+            }
+            write_buffered(command, reply, status);
+            break;
+        case NET_CMD_FLUSH_SOCKET:
+            if (command->length != 3) { // 2 + 1
+                *reply = &c_message_empty;
+                *status = &c_status_invalid_params;
+                break;
+            }
+            flush_command(command, reply, status);
+            break;
+        case NET_CMD_POLL_SOCKETS:
+            poll_sockets(command, reply, status);
+            break;
         default:
             *reply  = &c_message_empty;
             *status = &c_status_unknown_command;
@@ -230,17 +410,74 @@ void NetworkTarget :: open_socket(Message *command, Message **reply, Message **s
 	tv.tv_sec = 4;
 	tv.tv_usec = 4;
 	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(struct timeval));
+
+	// Datagram boundaries would be lost in the ring, so only streams are buffered
+	if ((type == SOCK_STREAM) && (socket < NET_MAX_SOCKETS)) {
+	    NetSocketBuffer *sb = new NetSocketBuffer(socket);
+	    xSemaphoreTake(socketLock, portMAX_DELAY);
+	    sockets[socket] = sb;
+	    xSemaphoreGive(socketLock);
+	    xTaskNotifyGive(receiveTask);
+	}
 }
 
 void NetworkTarget :: read_socket(Message *command, Message **reply, Message **status)
 {
 	uint8_t socketnr = command->message[2];
 	uint32_t length = ((uint32_t)command->message[3]) | (((uint32_t)command->message[4]) << 8);
+	if (length > NET_CMD_BUFSIZE - 2) {
+	    length = NET_CMD_BUFSIZE - 2;
+	}
 
     *reply = &data_message;
-	int ret = lwip_recv(socketnr, &data_message.message[2], length, 0);
     data_message.length = 2;
     data_message.last_part = true;
+
+    NetSocketBuffer *sb = (socketnr < NET_MAX_SOCKETS) ? sockets[socketnr] : NULL;
+    int ret;
+    if (sb) {
+        if (sb->tx_count) {
+            flush_socket(sb); // the peer might be waiting for our staged data before it answers
+        }
+        // Like a read on an unbuffered socket, wait for data until the timeout expires
+        TickType_t start = xTaskGetTickCount();
+        TickType_t timeout = NET_READ_TIMEOUT_MS / portTICK_PERIOD_MS;
+        bool wasFull, closed;
+        int error;
+        while(1) {
+            xSemaphoreTake(socketLock, portMAX_DELAY);
+            wasFull = (sb->rx_space() == 0);
+            ret = sb->rx_read(&data_message.message[2], length);
+            closed = sb->closed;
+            error = sb->error;
+            xSemaphoreGive(socketLock);
+
+            TickType_t waited = xTaskGetTickCount() - start;
+            if (ret || closed || error || (waited >= timeout)) {
+                break;
+            }
+            xSemaphoreTake(rxSignal, timeout - waited);
+        }
+
+        if (wasFull && ret) {
+            xTaskNotifyGive(receiveTask);
+        }
+        if (!ret) {
+            if (closed) {
+                ret = 0;
+            } else {
+                ret = -1;
+                errno = (error) ? error : EWOULDBLOCK;
+            }
+        }
+        if (ret == 0) {
+            // The peer closed the connection; the ring goes now, and the socket
+            // itself is closed below, just like an unbuffered one.
+            release_socket(socketnr);
+        }
+    } else {
+        ret = lwip_recv(socketnr, &data_message.message[2], length, 0);
+    }
     data_message.message[0] = (ret & 0xFF);
     data_message.message[1] = (ret & 0xFF00) >> 8;
 
@@ -255,10 +492,9 @@ void NetworkTarget :: read_socket(Message *command, Message **reply, Message **s
 		*status = &c_status_ok;
 		return;
 	}
-	*status = &status_message;
-	sprintf((char *)this->status_message.message, "02,NO DATA: %d", errno);
-	this->status_message.length = strlen((char *)this->status_message.message);
+	set_error_status(status, "02,NO DATA: %d", errno);
 }
+
 #include "dump_hex.h"
 void NetworkTarget :: write_socket(Message *command, Message **reply, Message **status)
 {
@@ -266,7 +502,17 @@ void NetworkTarget :: write_socket(Message *command, Message **reply, Message **
     uint8_t *src = &command->message[3];
 
     int length = command->length - 3;
-    int ret = lwip_send(socketnr, src, length, 0);
+    NetSocketBuffer *sb = (socketnr < NET_MAX_SOCKETS) ? sockets[socketnr] : NULL;
+    int ret = 0;
+    if (sb) {
+        // keep the order of the data intact when buffered writes are pending
+        if (sb->tx_count) {
+            ret = flush_socket(sb);
+        }
+    }
+    if (ret >= 0) {
+        ret = lwip_send(socketnr, src, length, 0);
+    }
     // printf("Writing %d bytes to socket %d resulted in %d\n", length, socketnr, ret);
     // dump_hex_relative(src, length);
 
@@ -277,23 +523,152 @@ void NetworkTarget :: write_socket(Message *command, Message **reply, Message **
     data_message.message[1] = (ret & 0xFF00) >> 8;
 
     if (ret < 0) {
-		*status = &status_message;
-		sprintf((char *)this->status_message.message, "12,SEND ERROR: %d", errno);
-		this->status_message.length = strlen((char *)this->status_message.message);
+        set_error_status(status, "12,SEND ERROR: %d", errno);
 	} else {
 	    *status = &c_status_ok;
 	}
 }
 
+// Appends the data to the staging area of the socket. The data is only sent
+// when the staging area fills up, on a flush command, or before a read.
+void NetworkTarget :: write_buffered(Message *command, Message **reply, Message **status)
+{
+    uint8_t socketnr = command->message[2];
+    uint8_t *src = &command->message[3];
+    int length = command->length - 3;
+
+    *reply = &data_message;
+    data_message.length = 2;
+    data_message.last_part = true;
+
+    NetSocketBuffer *sb = (socketnr < NET_MAX_SOCKETS) ? sockets[socketnr] : NULL;
+    if (!sb) {
+        *reply = &c_message_empty;
+        *status = &c_status_not_buffered;
+        return;
+    }
+
+    int ret = 0;
+    if (sb->tx_count + length > NET_TX_STAGESIZE) {
+        ret = flush_socket(sb);
+    }
+    if (ret >= 0) {
+        if (length > NET_TX_STAGESIZE) {
+            ret = lwip_send(socketnr, src, length, 0);
+        } else {
+            memcpy(sb->tx_stage + sb->tx_count, src, length);
+            sb->tx_count += length;
+            ret = length;
+        }
+    }
+
+    data_message.message[0] = (ret & 0xFF);
+    data_message.message[1] = (ret & 0xFF00) >> 8;
+    if (ret < 0) {
+        set_error_status(status, "12,SEND ERROR: %d", errno);
+    } else {
+        *status = &c_status_ok;
+    }
+}
+
+void NetworkTarget :: flush_command(Message *command, Message **reply, Message **status)
+{
+    uint8_t socketnr = command->message[2];
+    NetSocketBuffer *sb = (socketnr < NET_MAX_SOCKETS) ? sockets[socketnr] : NULL;
+
+    *reply = &c_message_empty;
+    *status = &c_status_ok;
+    if (!sb) {
+        return; // unbuffered sockets are always flushed
+    }
+    int ret = flush_socket(sb);
+    if (ret < 0) {
+        set_error_status(status, "12,SEND ERROR: %d", errno);
+    }
+}
+
+// Reports the receive state of a list of sockets in one go, or of all open
+// buffered sockets when no list is given. Pending buffered writes are flushed.
+// Reply: 4 bytes per socket: socket number, available bytes (LE), flags.
+void NetworkTarget :: poll_sockets(Message *command, Message **reply, Message **status)
+{
+    uint8_t list[NET_MAX_SOCKETS];
+    int count = command->length - 2;
+
+    if (count > NET_MAX_SOCKETS) {
+        *reply = &c_message_empty;
+        *status = &c_status_param_out_of_range;
+        return;
+    }
+    if (count > 0) {
+        memcpy(list, &command->message[2], count);
+    } else {
+        for (int i=0; i < NET_MAX_SOCKETS; i++) {
+            if (sockets[i]) {
+                list[count++] = (uint8_t)i;
+            }
+        }
+    }
+
+    // flush first, outside the lock
+    int flush_error[NET_MAX_SOCKETS];
+    for (int i=0; i < count; i++) {
+        uint8_t socketnr = list[i];
+        NetSocketBuffer *sb = (socketnr < NET_MAX_SOCKETS) ? sockets[socketnr] : NULL;
+        flush_error[i] = 0;
+        if (sb && sb->tx_count && (flush_socket(sb) < 0)) {
+            flush_error[i] = errno;
+        }
+    }
+
+    uint8_t *out = data_message.message;
+    xSemaphoreTake(socketLock, portMAX_DELAY);
+    for (int i=0; i < count; i++) {
+        uint8_t socketnr = list[i];
+        NetSocketBuffer *sb = (socketnr < NET_MAX_SOCKETS) ? sockets[socketnr] : NULL;
+        int avail = 0;
+        uint8_t flags = NET_POLL_UNBUFFERED;
+        if (sb) {
+            flags = 0;
+            if (flush_error[i]) {
+                sb->error = flush_error[i];
+            }
+            avail = sb->rx_available();
+            if (sb->closed) {
+                flags |= NET_POLL_CLOSED;
+            }
+            if (sb->error) {
+                flags |= NET_POLL_ERROR;
+            }
+            if (sb->tx_count) {
+                flags |= NET_POLL_TX_PENDING;
+            }
+        }
+        *(out++) = socketnr;
+        *(out++) = (uint8_t)avail;
+        *(out++) = (uint8_t)(avail >> 8);
+        *(out++) = flags;
+    }
+    xSemaphoreGive(socketLock);
+
+    data_message.length = 4 * count;
+    data_message.last_part = true;
+    *reply = &data_message;
+    *status = &c_status_ok;
+}
+
 void NetworkTarget :: close_socket(Message *command, Message **reply, Message **status)
 {
     uint8_t socketnr = command->message[2];
+    NetSocketBuffer *sb = (socketnr < NET_MAX_SOCKETS) ? sockets[socketnr] : NULL;
+    if (sb) {
+        flush_socket(sb);
+        release_socket(socketnr);
+    }
     int result = lwip_close(socketnr);
     *reply = &c_message_empty;
     if (result < 0) {
-        *status = &status_message;
-        sprintf((char *)this->status_message.message, "12,ERROR ON CLOSE: %d", errno);
-        this->status_message.length = strlen((char *)this->status_message.message);
+        set_error_status(status, "12,ERROR ON CLOSE: %d", errno);
     } else {
         *status = &c_status_ok;
     }
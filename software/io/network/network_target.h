@@ -9,6 +9,9 @@
 #define IO_NETWORK_NETWORK_TARGET_H_
 
 #include "command_intf.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
 
 #define NET_CMD_IDENTIFY            0x01
 #define NET_CMD_GET_INTERFACE_COUNT 0x02
@@ -21,16 +24,69 @@
 #define NET_CMD_CLOSE_SOCKET        0x09
 #define NET_CMD_READ_SOCKET         0x10
 #define NET_CMD_WRITE_SOCKET        0x11
+#define NET_CMD_WRITE_BUFFERED      0x12
+#define NET_CMD_FLUSH_SOCKET        0x13
+#define NET_CMD_POLL_SOCKETS        0x14
 
 #define NET_CMD_BUFSIZE 2048
 
+#define NET_MAX_SOCKETS     16    // equal to MEMP_NUM_NETCONN; socket numbers are 0..15
+#define NET_RX_RINGSIZE     4096  // must be a power of 2
+#define NET_TX_STAGESIZE    1024
+#define NET_READ_TIMEOUT_MS 4000  // how long a read waits for data, like SO_RCVTIMEO of the unbuffered sockets
+
+// Flags returned per socket by NET_CMD_POLL_SOCKETS
+#define NET_POLL_CLOSED     0x01
+#define NET_POLL_ERROR      0x02
+#define NET_POLL_TX_PENDING 0x04
+#define NET_POLL_UNBUFFERED 0x80
+
+// Receive ring and transmit staging area of one TCP socket. The ring is filled
+// by the network receive task and drained by the command target, under the socket
+// lock. The staging area is only ever touched by the command target, so it is sent
+// without the lock: a send that blocks must not stop the receive task.
+class NetSocketBuffer {
+public:
+    int socket;
+    int rx_head; // written by the receive task
+    int rx_tail; // written by the command target
+    bool closed;
+    int error;
+    int tx_count;
+    uint8_t *rx_ring;
+    uint8_t *tx_stage;
+
+    NetSocketBuffer(int s);
+    ~NetSocketBuffer();
+
+    int rx_available(void) { return (rx_head - rx_tail) & (NET_RX_RINGSIZE - 1); }
+    int rx_space(void) { return (NET_RX_RINGSIZE - 1) - rx_available(); }
+    int rx_contiguous_space(void);
+    int rx_read(uint8_t *dest, int len);
+};
+
 class NetworkTarget : public CommandTarget {
     Message data_message;
     Message status_message;
     uint8_t buffer[NET_CMD_BUFSIZE];
+
+    NetSocketBuffer *sockets[NET_MAX_SOCKETS];
+    SemaphoreHandle_t socketLock;
+    SemaphoreHandle_t rxSignal; // given by the receive task when a ring got data, or a socket closed
+    TaskHandle_t receiveTask;
+
+    static void receive_task(void *a);
+    void run_receive(void);
+    int  flush_socket(NetSocketBuffer *sb);
+    void release_socket(int socketnr);
+    void set_error_status(Message **status, const char *msg, int err);
+
     void open_socket(Message *command, Message **reply, Message **status, int);
     void read_socket(Message *command, Message **reply, Message **status);
     void write_socket(Message *command, Message **reply, Message **status);
+    void write_buffered(Message *command, Message **reply, Message **status);
+    void flush_command(Message *command, Message **reply, Message **status);
+    void poll_sockets(Message *command, Message **reply, Message **status);
     void close_socket(Message *command, Message **reply, Message **status);
 public:
 	NetworkTarget(int id);
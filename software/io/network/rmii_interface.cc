@@ -7,6 +7,7 @@
 #include "dump_hex.h"
 #include "flash.h"
 #include "mdio.h"
+#include "itu.h"
 
 __inline uint32_t cpu_to_32le(uint32_t a)
 {
@@ -50,6 +51,8 @@ extern "C" {
 
 RmiiInterface :: RmiiInterface()
 {
+    tx_report = NULL;
+    tx_report_context = NULL;
     if(getFpgaCapabilities() & CAPAB_ETH_RMII) {
 		netstack = NULL;
 		link_up = false;
@@ -217,19 +220,41 @@ uint8_t RmiiInterface :: output_packet(uint8_t *buffer, int pkt_len)
 	if (!link_up)
 		return 0;
 
+	int outcome = RMII_TX_SENT;
 	if (RMII_TX_BUSY) {
-		printf("Oops.. tx is busy!\n");
-		return 1;
+		// Most likely the stream generators are keeping the line busy. Give the
+		// previous frame some time to get out, rather than dropping this one.
+		// The ITU timer is not ours to program from this task, so the free running
+		// millisecond counter is used to time the wait.
+		uint16_t start = getMsTimer();
+		while (RMII_TX_BUSY) {
+			if ((uint16_t)(getMsTimer() - start) > RMII_TX_WAIT_MS) {
+				if (tx_report)
+					tx_report(tx_report_context, RMII_TX_DROPPED);
+				return 1;
+			}
+		}
+		outcome = RMII_TX_DEFERRED;
 	}
 	//printf("Rmii Out Packet: %p %4x\n", buffer, pkt_len);
 	//dump_hex_relative(buffer, (pkt_len > 64)?64:pkt_len);
 	RMII_TX_ADDRESS = (uint32_t)buffer;
 	RMII_TX_LENGTH  = (uint16_t)((pkt_len < 60)?60:pkt_len);
 	RMII_TX_START   = 1;
+	if (tx_report)
+		tx_report(tx_report_context, outcome);
 
 	return 0;
 }
 
+// The owner of the hardware streams (DataStreamer) keeps track of the CPU frames
+// that had to compete with them for the transmitter.
+void RmiiInterface :: set_tx_report(rmii_tx_report_t func, void *context)
+{
+	tx_report_context = context;
+	tx_report = func;
+}
+
 /*
 uint8_t rmiiTransmit(uint8_t *buffer, int pkt_len)
 {
@@ -28,6 +28,18 @@
 #define RMII_ALLOC_SIZE  *((volatile uint16_t *)(RMII_BASE + 0x2A))
 #define RMII_FREE_RESET  *((volatile uint8_t *)(RMII_BASE + 0x2E)) // write
 
+// The hardware stream generators (U64) share the transmitter with the CPU. When a frame
+// is offered while the transmitter is still busy, it waits until the millisecond timer
+// has advanced by more than this (so 1 to 2 ms) before it is dropped.
+#define RMII_TX_WAIT_MS    1
+
+// Outcome of a frame offered by the CPU, as reported to the tx report callback
+#define RMII_TX_SENT       0
+#define RMII_TX_DEFERRED   1 // sent, but had to wait for the transmitter
+#define RMII_TX_DROPPED    2
+
+typedef void (*rmii_tx_report_t)(void *context, int outcome);
+
 struct EthPacket
 {
 	uint16_t size;
@@ -42,6 +54,8 @@ class RmiiInterface
 	bool link_up;
 	uint8_t local_mac[6];
 	QueueHandle_t queue;
+	rmii_tx_report_t tx_report;
+	void *tx_report_context;
 
 
 	static void startRmiiTask(void *);
@@ -56,6 +70,9 @@ public:
 	uint8_t output_packet(uint8_t *buffer, int pkt_len);
     void free_buffer(uint8_t *b);
     void rx_interrupt_handler(void);
+    void set_tx_report(rmii_tx_report_t func, void *context);
 };
 
+extern RmiiInterface rmii_interface;
+
 #endif
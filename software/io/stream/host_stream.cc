@@ -13,12 +13,18 @@ Screen   *HostStream :: getScreen(void)
 {
 	if (!screen) {
 		screen = new Screen_VT100(stream);
+		if (keyboard) {
+			((Keyboard_VT100 *)keyboard)->set_screen(screen);
+		}
 	}
 	return screen;
 }
 
 void HostStream :: releaseScreen(void)
 {
+	if (keyboard) {
+		((Keyboard_VT100 *)keyboard)->set_screen(0);
+	}
 	delete screen;
 	screen = 0;
 }
@@ -27,6 +33,7 @@ Keyboard *HostStream :: getKeyboard(void)
 {
 	if (!keyboard) {
 		keyboard = new Keyboard_VT100(stream);
+		((Keyboard_VT100 *)keyboard)->set_screen(screen);
 	}
 	return keyboard;
 }
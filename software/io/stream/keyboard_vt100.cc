@@ -23,6 +23,9 @@ int Keyboard_VT100 :: getch()
 
 	switch(escape_state) {
 	case e_esc_idle:
+		if (screen) {
+			screen->sync();
+		}
 		charin = stream->get_char();
 		if (charin == '\e')
 			escape_state = e_esc_escape;
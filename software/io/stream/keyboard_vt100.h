@@ -10,10 +10,12 @@
 
 #include "keyboard.h"
 #include "stream.h"
+#include "screen.h"
 
 class Keyboard_VT100 : public Keyboard
 {
 	Stream *stream;
+	Screen *screen;
 
 	typedef enum {
 		e_esc_idle,
@@ -28,10 +30,16 @@ class Keyboard_VT100 : public Keyboard
 public:
 	Keyboard_VT100(Stream *s) {
 		stream = s;
+		screen = 0;
 		escape_state = e_esc_idle;
 		escape_value = 0;
 	}
 
+	// The screen that shares the stream; it is synchronized before waiting for keys
+	void set_screen(Screen *s) {
+		screen = s;
+	}
+
     ~Keyboard_VT100() {
 
     }
@@ -7,14 +7,37 @@
 
 #include "screen_vt100.h"
 
+/*
+ * All draw functions only update the 'wanted' shadow buffer. Upon sync(), the
+ * changed cells are compared to what the terminal already shows, and only
+ * the differences are sent: cursor jumps only where a run of changes starts,
+ * and color changes only when the attribute actually changes.
+ */
+
 Screen_VT100::Screen_VT100(Stream *m) {
 
 	stream = m;
-	draw_mode = false;
 	expect_color = false;
+	allow_scroll = true;
+	color = 15;
+	reverse = 0;
 	stream->write("\377\376\042\377\373\001", 6);
 	stream->write("\ec", 2);
-	set_color(15);
+
+	// After the reset, the terminal is empty and the cursor is home
+	for(int y=0; y < VT100_SIZE_Y; y++) {
+		for(int x=0; x < VT100_SIZE_X; x++) {
+			wanted[y][x] = VT100_BLANK;
+			shown[y][x] = VT100_BLANK;
+		}
+		dirty_min[y] = VT100_SIZE_X;
+		dirty_max[y] = -1;
+	}
+	clear_pending = false;
+	term_x = 0;
+	term_y = 0;
+	term_attr = VT100_UNKNOWN;
+	term_draw_mode = false;
     move_cursor(0, 0);
 }
 
@@ -24,11 +47,6 @@ Screen_VT100::~Screen_VT100() {
 
 void Screen_VT100::set_color(int c)
 {
-	color = c;
-
-	const char *set_color[] = { "\e[0;30m", "\e[0;37;1m", "\e[0;31m", "\e[0;36m", "\e[0;35m", "\e[0;32m", "\e[0;34m", "\e[0;33m",
-								"\e[0;33;2m", "\e[0;31;2m", "\e[0;31;1m", "\e[0;31;2m", "\e[0;31;2m", "\e[0;32;1m", "\e[0;34;1m", "\e[0;37;2m" };
-
 	if (c == 'R') {
 		reverse_mode(1);
 		return;
@@ -36,42 +54,94 @@ void Screen_VT100::set_color(int c)
 		reverse_mode(0);
 		return;
 	}
-	const char *sequence = set_color[c & 15];
-	stream->write(sequence, strlen(sequence));
+	color = c & 15;
 }
 
 void Screen_VT100::reverse_mode(int r)
 {
-	if (r)
-		stream->write("\e[7m", 4);
-	else
-		stream->write("\e[27m", 5);
+	reverse = r;
 }
 
 void Screen_VT100::scroll_mode(bool b)
 {
-	if (b) {
-		stream->write("\e[r", 3);
-	}
+	allow_scroll = b;
 }
 
 // draw functions
 void Screen_VT100::clear()
 {
-	stream->write("\ec", 2);
-	set_color(color);
+	for(int y=0; y < VT100_SIZE_Y; y++) {
+		for(int x=0; x < VT100_SIZE_X; x++) {
+			wanted[y][x] = VT100_BLANK;
+		}
+	}
+	// Clearing the terminal is cheaper than overwriting everything that was on it
+	clear_pending = true;
 	move_cursor(0, 0);
 }
 
 void Screen_VT100::move_cursor(int x, int y)
 {
-	stream->format("\e[%d;%dH", y+1, x+1);
+	if (x > VT100_SIZE_X-1)
+		x = VT100_SIZE_X-1;
+	if (y > VT100_SIZE_Y-1)
+		y = VT100_SIZE_Y-1;
+	if (x < 0)
+		x = 0;
+	if (y < 0)
+		y = 0;
+	cursor_x = x;
+	cursor_y = y;
 }
 
-int  Screen_VT100::output(char c)
+void Screen_VT100::mark_dirty(int y, int x1, int x2)
 {
-	const char mapping[33] = " lqkxmjlwktnumvjABa`EFGHIJKLMNOP";
+	if (x1 < dirty_min[y])
+		dirty_min[y] = (int8_t)x1;
+	if (x2 > dirty_max[y])
+		dirty_max[y] = (int8_t)x2;
+}
+
+void Screen_VT100::line_feed(void)
+{
+	cursor_x = 0;
+	if (cursor_y < VT100_SIZE_Y-1) {
+		cursor_y++;
+		return;
+	}
+	if (!allow_scroll) {
+		return;
+	}
+	for(int y=0; y < VT100_SIZE_Y-1; y++) {
+		memcpy(wanted[y], wanted[y+1], sizeof(wanted[y]));
+		mark_dirty(y, 0, VT100_SIZE_X-1);
+	}
+	for(int x=0; x < VT100_SIZE_X; x++) {
+		wanted[VT100_SIZE_Y-1][x] = VT100_BLANK;
+	}
+	mark_dirty(VT100_SIZE_Y-1, 0, VT100_SIZE_X-1);
+}
+
+void Screen_VT100::put_cell(char c)
+{
+	if (cursor_x >= VT100_SIZE_X) {
+		return; // clip; the terminal may be wider than what we claim to be
+	}
+	uint16_t cell;
+	if ((c == ' ') && !reverse) {
+		cell = VT100_BLANK;
+	} else {
+		cell = (uint16_t)(uint8_t)c | ((uint16_t)(color | (reverse ? VT100_ATTR_REVERSE : 0)) << 8);
+	}
+	if (wanted[cursor_y][cursor_x] != cell) {
+		wanted[cursor_y][cursor_x] = cell;
+		mark_dirty(cursor_y, cursor_x, cursor_x);
+	}
+	cursor_x++;
+}
 
+int  Screen_VT100::output(char c)
+{
 	if (c == 27) { // escape = set color
 		expect_color = true;
 		return 0;
@@ -81,18 +151,18 @@ int  Screen_VT100::output(char c)
 		this->set_color(c);
 		return 0;
 	}
-	if ((c >= 32) || (c < 0) || (c == 13) || (c == 10) || (c == 9)) {
-		if (draw_mode) {
-			stream->write("\e(B", 3);
-			draw_mode = false;
-		}
-		stream->charout((int)c);
-	} else {
-		if (!draw_mode) {
-			stream->write("\e(0", 3);
-			draw_mode = true;
-		}
-		stream->charout(mapping[c]);
+	switch(c) {
+	case 13:
+		cursor_x = 0;
+		break;
+	case 10:
+		line_feed();
+		break;
+	case 9:
+		put_cell(' ');
+		break;
+	default:
+		put_cell(c);
 	}
 	return 1;
 }
@@ -115,12 +185,8 @@ void Screen_VT100::repeat(char c, int rep)
 
 void Screen_VT100::output_fixed_length(const char *string, int offset_x, int width)
 {
-	if (offset_x)
-		stream->format("\r\e[%dC", offset_x);
-	else
-		stream->format("\r");
+	cursor_x = offset_x;
 
-	//repeat(' ', offset_x);
 	while(width > 0) {
 		if (*string == 0) {
 			break;
@@ -132,7 +198,131 @@ void Screen_VT100::output_fixed_length(const char *string, int offset_x, int wid
 	}
 }
 
+void Screen_VT100::emit_attr(int attr)
+{
+	const char *set_color[] = { "\e[0;30m", "\e[0;37;1m", "\e[0;31m", "\e[0;36m", "\e[0;35m", "\e[0;32m", "\e[0;34m", "\e[0;33m",
+								"\e[0;33;2m", "\e[0;31;2m", "\e[0;31;1m", "\e[0;31;2m", "\e[0;31;2m", "\e[0;32;1m", "\e[0;34;1m", "\e[0;37;2m" };
+
+	const char *sequence = set_color[attr & 15];
+	stream->write(sequence, strlen(sequence));
+	if (attr & VT100_ATTR_REVERSE) {
+		stream->write("\e[7m", 4);
+	}
+	term_attr = attr;
+}
+
+void Screen_VT100::emit_goto(int x, int y)
+{
+	if ((x == term_x) && (y == term_y)) {
+		return;
+	}
+	if ((term_x == VT100_UNKNOWN) || (term_y == VT100_UNKNOWN)) {
+		stream->format("\e[%d;%dH", y+1, x+1);
+	} else if (y == term_y) {
+		if (x == 0) {
+			stream->charout('\r');
+		} else if (x > term_x) {
+			// Rewriting a few cells that are already correct is cheaper than an escape sequence,
+			// as long as it does not require an attribute change.
+			int gap = x - term_x;
+			bool rewrite = (gap <= 3);
+			for(int i=term_x; rewrite && (i < x); i++) {
+				uint16_t cell = shown[y][i];
+				uint8_t ch = (uint8_t)cell;
+				bool needs_draw = (ch < 32);
+				if (needs_draw != term_draw_mode) {
+					rewrite = false;
+				} else if ((cell != VT100_BLANK) && ((cell >> 8) != term_attr)) {
+					rewrite = false;
+				} else if ((cell == VT100_BLANK) && ((term_attr == VT100_UNKNOWN) || (term_attr & VT100_ATTR_REVERSE))) {
+					rewrite = false;
+				}
+			}
+			if (rewrite) {
+				for(int i=term_x; i < x; i++) {
+					emit_cell(shown[y][i]);
+				}
+			} else {
+				stream->format("\e[%dC", gap);
+			}
+		} else {
+			stream->format("\e[%dD", term_x - x);
+		}
+	} else if ((x == 0) && (y == term_y + 1)) {
+		stream->write("\r\n", 2);
+	} else {
+		stream->format("\e[%d;%dH", y+1, x+1);
+	}
+	term_x = x;
+	term_y = y;
+}
+
+void Screen_VT100::emit_cell(uint16_t cell)
+{
+	const char mapping[33] = " lqkxmjlwktnumvjABa`EFGHIJKLMNOP";
+
+	uint8_t ch = (uint8_t)cell;
+	if (cell == VT100_BLANK) {
+		// any color will do, as long as it is not reversed
+		if ((term_attr == VT100_UNKNOWN) || (term_attr & VT100_ATTR_REVERSE)) {
+			emit_attr(15);
+		}
+	} else if ((cell >> 8) != term_attr) {
+		emit_attr(cell >> 8);
+	}
+
+	if (ch >= 32) {
+		if (term_draw_mode) {
+			stream->write("\e(B", 3);
+			term_draw_mode = false;
+		}
+		stream->charout((int)ch);
+	} else {
+		if (!term_draw_mode) {
+			stream->write("\e(0", 3);
+			term_draw_mode = true;
+		}
+		stream->charout(mapping[ch]);
+	}
+	term_x++;
+}
+
 void Screen_VT100::sync(void)
 {
+	if (clear_pending) {
+		stream->write("\e[0m\e[2J\e[H", 11);
+		term_attr = VT100_UNKNOWN;
+		term_x = 0;
+		term_y = 0;
+		for(int y=0; y < VT100_SIZE_Y; y++) {
+			for(int x=0; x < VT100_SIZE_X; x++) {
+				shown[y][x] = VT100_BLANK;
+			}
+			dirty_min[y] = 0;
+			dirty_max[y] = VT100_SIZE_X-1;
+		}
+		clear_pending = false;
+	}
+
+	for(int y=0; y < VT100_SIZE_Y; y++) {
+		if (dirty_min[y] > dirty_max[y]) {
+			continue;
+		}
+		for(int x = dirty_min[y]; x <= dirty_max[y]; x++) {
+			uint16_t cell = wanted[y][x];
+			if (cell == shown[y][x]) {
+				continue;
+			}
+			emit_goto(x, y);
+			emit_cell(cell);
+			shown[y][x] = cell;
+			if (term_x >= VT100_SIZE_X) {
+				term_x = VT100_UNKNOWN; // terminal may wrap or not, depending on its width
+				term_y = VT100_UNKNOWN;
+			}
+		}
+		dirty_min[y] = VT100_SIZE_X;
+		dirty_max[y] = -1;
+	}
 	stream->sync();
 }
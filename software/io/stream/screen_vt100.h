@@ -11,19 +11,55 @@
 #include "screen.h"
 #include "stream.h"
 
+#define VT100_SIZE_X 60
+#define VT100_SIZE_Y 24
+
+// Cell = character in the low byte, attribute in the high byte.
+// Attribute = color in bits 3..0, reverse in bit 4.
+// Spaces that are not reversed look the same in every color, and are stored as plain 0x0020.
+#define VT100_ATTR_REVERSE 0x10
+#define VT100_BLANK        0x0020
+#define VT100_UNKNOWN      -1
+
 class Screen_VT100: public Screen {
 	Stream *stream;
 	int color;
-	bool draw_mode;
+	int reverse;
 	bool expect_color;
+	bool allow_scroll;
+
+	// Shadow buffers: what we want to show, and what the terminal shows
+	uint16_t wanted[VT100_SIZE_Y][VT100_SIZE_X];
+	uint16_t shown[VT100_SIZE_Y][VT100_SIZE_X];
+	// Dirty span per row; dirty_min > dirty_max means the row is clean
+	int8_t dirty_min[VT100_SIZE_Y];
+	int8_t dirty_max[VT100_SIZE_Y];
+	bool clear_pending;
+
+	// Logical cursor
+	int cursor_x;
+	int cursor_y;
+
+	// State of the terminal, as far as we know
+	int term_x;
+	int term_y;
+	int term_attr;
+	bool term_draw_mode;
+
+	void put_cell(char c);
+	void mark_dirty(int y, int x1, int x2);
+	void line_feed(void);
+	void emit_attr(int attr);
+	void emit_goto(int x, int y);
+	void emit_cell(uint16_t cell);
 public:
 	Screen_VT100(Stream *s);
 	virtual ~Screen_VT100();
 
     // functions called directly, or from a window
     int  get_color() { return color; }
-    int   get_size_x(void) { return 60; }
-    int   get_size_y(void) { return 24; }
+    int   get_size_x(void) { return VT100_SIZE_X; }
+    int   get_size_y(void) { return VT100_SIZE_Y; }
     void  cursor_visible(int a) { }
     void set_color(int c);
     void reverse_mode(int r);
@@ -37,7 +73,7 @@ public:
     void repeat(char c, int rep);
     void output_fixed_length(const char *string, int offset_x, int width);
 
-    // Synchronization
+    // Synchronization; sends the difference between the shadow buffers to the terminal
     void sync(void);
 };
 
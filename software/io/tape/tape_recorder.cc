@@ -276,7 +276,7 @@ void TapeRecorder :: poll()
 	printf("** tape recorder this = %p\n", this);
 	while(1) {
 		if(error_code != REC_ERR_OK) {
-			PROFILER_SUB = 15;
+			PROFILER_MARK(15);
 			if (last_user_interface) {
 				printf("** tape recorder this = %p\n", this);
 				printf("Last User Interface = %p\n");
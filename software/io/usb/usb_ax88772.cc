@@ -115,18 +115,45 @@ UsbAx88772Driver :: UsbAx88772Driver(UsbInterface *intf, uint16_t prodID) : UsbD
     link_up = false;
     this->prodID = prodID;
 
-    dataBuffersBlock = new uint8_t[1536 * NUM_BUFFERS];
+    dataBuffersBlock = new uint8_t[AX_RX_BUFFER_SIZE * NUM_BUFFERS];
 
     for (int i=0; i < NUM_BUFFERS; i++) {
-        freeBuffers.push(&dataBuffersBlock[0x80000000 + 1536 * i]); // set bit 31, so that it is non-cacheable
+        freeBuffers.push(&dataBuffersBlock[0x80000000 + AX_RX_BUFFER_SIZE * i]); // set bit 31, so that it is non-cacheable
+        bufferRefs[i] = 0;
     }
+    carryBuffer = NULL;
+    carryFill = 0;
+    carryLength = 0;
+
+    txBuffers[0] = new uint8_t[AX_TX_AGGR_SIZE];
+    txBuffers[1] = new uint8_t[AX_TX_AGGR_SIZE];
+    txFill[0] = txFill[1] = 0;
+    txFrames[0] = txFrames[1] = 0;
+    txCurrent = 0;
+    txRunning = false;
+    txTask = NULL;
+    txLock = xSemaphoreCreateMutex();
+    txSpace = xSemaphoreCreateBinary();
+    txStopped = xSemaphoreCreateBinary();
+
+    memset(&stats, 0, sizeof(stats));
 }
 
 UsbAx88772Driver :: ~UsbAx88772Driver()
 {
+    if (txTask) {
+        txRunning = false;
+        xTaskNotifyGive(txTask);
+        xSemaphoreTake(txStopped, 1000);
+    }
 	if(netstack)
 		releaseNetworkStack(netstack);
 	delete[] dataBuffersBlock;
+	delete[] txBuffers[0];
+	delete[] txBuffers[1];
+	vSemaphoreDelete(txLock);
+	vSemaphoreDelete(txSpace);
+	vSemaphoreDelete(txStopped);
 }
 
 UsbDriver * UsbAx88772Driver :: test_driver(UsbInterface *intf)
@@ -315,10 +342,13 @@ void UsbAx88772Driver :: install(UsbInterface *intf)
 
 		host->initialize_pipe(&bpipe, device, bin);
 		bpipe.Interval = 1; // fast!
-		bpipe.Length = 1536; // big blocks!
+		bpipe.Length = AX_RX_BUFFER_SIZE; // big blocks, multiple frames per transfer!
 		bpipe.buffer = getBuffer();
 		bulk_transaction = host->allocate_input_pipe(&bpipe, UsbAx88772Driver_bulk_callback, this);
 
+		txRunning = true;
+		xTaskCreate( UsbAx88772Driver :: tx_task, "AX88772 Tx", configMINIMAL_STACK_SIZE, this, tskIDLE_PRIORITY + 2, &txTask );
+
 		netstack->start();
     }
 }
@@ -327,7 +357,9 @@ void UsbAx88772Driver :: disable()
 {
 	host->free_input_pipe(irq_transaction);
 	host->free_input_pipe(bulk_transaction);
+	link_up = false;
     printf("AX88772 Disabled.\n");
+    dump_statistics();
     if (netstack) {
     	netstack->stop();
     	//netstack = NULL;
@@ -412,62 +444,105 @@ void UsbAx88772Driver :: interrupt_handler()
 	host->resume_input_pipe(this->irq_transaction);
 }
 
+// The AX88772 packs as many frames in one bulk transfer as fit in the Rx burst
+// length. Each frame is preceded by a 4-byte header (length, inverted length),
+// and the next header starts on a 16-bit boundary. All frames of one buffer are
+// handed to the stack; the buffer returns to the pool after the last one is freed.
+// A frame that does not fit in a transfer continues in the next one; it is
+// collected in a buffer of its own (see start_carry / continue_carry).
 void UsbAx88772Driver :: bulk_handler()
 {
     uint8_t *usb_buffer = lastPacketBuffer;
     int data_len = host->getReceivedLength(this->bulk_transaction);
 
     //printf("Packet %p Len: %d\n", usb_buffer, data_len);
-	PROFILER_SUB = 6;
+	PROFILER_MARK(6);
 
 	if (!link_up) {
 	    free_buffer(usb_buffer);
-		PROFILER_SUB = 0;
+	    drop_carry();
+		PROFILER_MARK(0);
 		return;
 	}
 
-	uint16_t pkt_size  = uint16_t(usb_buffer[0]) | (uint16_t(usb_buffer[1])) << 8;
-	uint16_t pkt_size2 = (uint16_t(usb_buffer[2]) | (uint16_t(usb_buffer[3])) << 8) ^ 0xFFFF;
+	int idx = bufferIndex(usb_buffer);
+	bufferRefs[idx] = 1; // reference held by this handler while walking the frames
+	int offset = 0;
+	int frames = 0;
+	bool more = (data_len > 0) && ((data_len % bpipe.MaxTrans) == 0); // not ended by a short packet
 
-	pkt_size &= 0x7FF;
-	pkt_size2 &= 0x7FF;
+	if (carryBuffer) {
+	    offset = continue_carry(usb_buffer, data_len, more, frames);
+	}
 
-	//printf("Packet_sizes: %d %d\n", pkt_size, pkt_size2);
+	while (offset < data_len) {
+	    uint8_t *hdr = usb_buffer + offset;
+	    if ((offset + 4) > data_len) {
+	        if (more) {
+	            start_carry(hdr, data_len - offset, 0); // header continues in the next transfer
+	        }
+	        break;
+	    }
+        uint16_t pkt_size  = uint16_t(hdr[0]) | (uint16_t(hdr[1])) << 8;
+        uint16_t pkt_size2 = (uint16_t(hdr[2]) | (uint16_t(hdr[3])) << 8) ^ 0xFFFF;
+
+        pkt_size &= 0x7FF;
+        pkt_size2 &= 0x7FF;
+
+        //printf("Packet_sizes: %d %d\n", pkt_size, pkt_size2);
+
+        if (pkt_size != pkt_size2) {
+            printf("ERROR: Corrupted packet %4x %4x at offset %d\n", pkt_size, pkt_size2, offset);
+#if DEBUG_INVALID_PKT
+            volatile t_usb_descriptor *descr = &USB2_DESCRIPTORS[bulk_transaction];
+            dump_hex(usb_buffer, 64);
+            dump_hex((void *)descr, 24);
+#endif
+            stats.rx_errors++;
+            break;
+        }
 
-	if (pkt_size != pkt_size2) {
-		printf("ERROR: Corrupted packet %4x %4x\n", pkt_size, pkt_size2);
-        volatile t_usb_descriptor *descr = &USB2_DESCRIPTORS[bulk_transaction];
-        dump_hex(usb_buffer, 64);
-        dump_hex((void *)descr, 24);
-		free_buffer(usb_buffer);
-        //LINK_STATS_INC(link.drop);
-		PROFILER_SUB = 0;
-		return;
-	}
+        if (int(pkt_size) > (data_len - offset - 4)) {
+            if (more) {
+                start_carry(hdr, data_len - offset, 4 + pkt_size); // frame continues in the next transfer
+                break;
+            }
+            printf("ERROR: Not enough data? %d %d\n", pkt_size, data_len - offset);
+#if DEBUG_INVALID_PKT
+            volatile t_usb_descriptor *descr = &USB2_DESCRIPTORS[bulk_transaction];
+            dump_hex(usb_buffer, 64);
+            dump_hex((void *)descr, 24);
+#endif
+            stats.rx_errors++;
+            break;
+        }
 
-	if (int(pkt_size) > (data_len - 4)) {
-		printf("ERROR: Not enough data? %d %d\n", pkt_size, data_len);
-	    volatile t_usb_descriptor *descr = &USB2_DESCRIPTORS[bulk_transaction];
-		dump_hex(usb_buffer, 64);
-		dump_hex((void *)descr, 24);
+        if (!pkt_size) {
+            break;
+        }
 
-		free_buffer(usb_buffer);
-        //LINK_STATS_INC(link.drop);
-		PROFILER_SUB = 0;
-		return;
-	}
+        //LINK_STATS_INC(link.recv);
 
-	//LINK_STATS_INC(link.recv);
+        if(netstack) {
+            ENTER_SAFE_SECTION
+            bufferRefs[idx]++;
+            LEAVE_SAFE_SECTION
+            if (!netstack->input(usb_buffer, hdr + 4, pkt_size)) {
+                free_buffer(usb_buffer);
+            }
+        }
+        frames++;
+        offset += 4 + ((pkt_size + 1) & 0xFFFE);
+	}
 
-	if(netstack) {
-		if (!netstack->input(usb_buffer, usb_buffer+4, pkt_size)) {
-		    free_buffer(usb_buffer);
-		} /*else { // this else is to free immediately. this is temporary in order to test. free from lwip is not performed
-			host->free_input_buffer(bulk_transaction, usb_buffer);
-		}*/
-	} else {
-	    free_buffer(usb_buffer);
+	stats.rx_urbs++;
+	stats.rx_frames += frames;
+	if (frames > stats.rx_max_frames_per_urb) {
+	    stats.rx_max_frames_per_urb = frames;
 	}
+
+	free_buffer(usb_buffer); // drop the handler reference
+
 	bpipe.buffer = getBuffer();
 	if (bpipe.buffer) {
 	    host->resume_input_pipe(bulk_transaction);
@@ -475,11 +550,127 @@ void UsbAx88772Driver :: bulk_handler()
 	    printf("ERROR: No free buffers.");
 	}
 }
- 	
+
+int UsbAx88772Driver :: bufferIndex(uint8_t *buffer)
+{
+    return (int)((((uint32_t)buffer) & 0x7FFFFFFF) - (((uint32_t)dataBuffersBlock) & 0x7FFFFFFF)) / AX_RX_BUFFER_SIZE;
+}
+
+// Keeps the tail of a transfer that holds the start of a frame. 'total' is the
+// header plus frame length, or 0 when not even the header is complete.
+void UsbAx88772Driver :: start_carry(uint8_t *data, int len, int total)
+{
+    if (total > AX_RX_BUFFER_SIZE) {
+        stats.rx_errors++;
+        return;
+    }
+    carryBuffer = freeBuffers.pop();
+    if (!carryBuffer) {
+        printf("ERROR: No free buffer for split frame.\n");
+        stats.rx_errors++;
+        return;
+    }
+    bufferRefs[bufferIndex(carryBuffer)] = 0;
+    memcpy(carryBuffer, data, len);
+    carryFill = len;
+    carryLength = total;
+}
+
+// Completes the frame kept by start_carry from the start of the next transfer,
+// and hands it to the stack once it is complete. Returns the number of bytes
+// taken from this transfer, which is where its first own header starts.
+int UsbAx88772Driver :: continue_carry(uint8_t *data, int data_len, bool more, int &frames)
+{
+    int used = 0;
+    if (!carryLength) {
+        used = 4 - carryFill;
+        if (used > data_len) {
+            used = data_len;
+        }
+        memcpy(carryBuffer + carryFill, data, used);
+        carryFill += used;
+        if (carryFill < 4) {
+            if (!more) {
+                drop_carry();
+            }
+            return used;
+        }
+        uint16_t pkt_size  = uint16_t(carryBuffer[0]) | (uint16_t(carryBuffer[1])) << 8;
+        uint16_t pkt_size2 = (uint16_t(carryBuffer[2]) | (uint16_t(carryBuffer[3])) << 8) ^ 0xFFFF;
+
+        pkt_size &= 0x7FF;
+        pkt_size2 &= 0x7FF;
+
+        if ((pkt_size != pkt_size2) || (!pkt_size) || ((4 + pkt_size) > AX_RX_BUFFER_SIZE)) {
+            printf("ERROR: Corrupted split packet %4x %4x\n", pkt_size, pkt_size2);
+            stats.rx_errors++;
+            drop_carry();
+            return data_len; // out of sync; skip the rest of this transfer
+        }
+        carryLength = 4 + pkt_size;
+    }
+
+    int len = carryLength - carryFill;
+    if (len > (data_len - used)) {
+        len = data_len - used;
+    }
+    memcpy(carryBuffer + carryFill, data + used, len);
+    carryFill += len;
+    used += len;
+
+    if (carryFill < carryLength) {
+        if (!more) {
+            printf("ERROR: Split packet incomplete %d %d\n", carryFill, carryLength);
+            stats.rx_errors++;
+            drop_carry();
+        }
+        return used;
+    }
+
+    if (carryLength & 1) { // skip the padding byte; next header is 16-bit aligned
+        used++;
+    }
+    uint8_t *frame = carryBuffer;
+    carryBuffer = NULL;
+    if (!netstack || !netstack->input(frame, frame + 4, carryLength - 4)) {
+        free_buffer(frame);
+    }
+    frames++;
+    return used;
+}
+
+void UsbAx88772Driver :: drop_carry(void)
+{
+    if (carryBuffer) {
+        free_buffer(carryBuffer);
+        carryBuffer = NULL;
+    }
+}
+
 void UsbAx88772Driver :: free_buffer(uint8_t *buffer)
 {
 //	printf("FREE PBUF CALLED %p!\n", buffer);
-    freeBuffers.push(buffer);
+    int idx = bufferIndex(buffer);
+    bool release = true;
+    ENTER_SAFE_SECTION
+    if (bufferRefs[idx] > 1) {
+        bufferRefs[idx]--;
+        release = false;
+    } else {
+        bufferRefs[idx] = 0;
+    }
+    LEAVE_SAFE_SECTION
+    if (release) {
+        freeBuffers.push(buffer);
+    }
+}
+
+void UsbAx88772Driver :: dump_statistics(void)
+{
+    printf("AX88772 Rx: %d frames in %d transfers (max %d per transfer, %d errors)\n",
+            stats.rx_frames, stats.rx_urbs, stats.rx_max_frames_per_urb, stats.rx_errors);
+    printf("AX88772 Tx: %d frames in %d transfers (max %d per transfer)\n",
+            stats.tx_frames, stats.tx_urbs, stats.tx_max_frames_per_urb);
 }
 
 void UsbAx88772Driver :: read_srom()
@@ -612,22 +803,93 @@ void UsbAx88772Driver :: pipe_error(int pipe) // called from IRQ!
 }
 
 
+// Called by the stack for each outgoing frame. The frame is copied into the
+// aggregation buffer that is currently being filled. All frames that arrive
+// while the previous bulk transfer is in progress are sent together.
 uint8_t UsbAx88772Driver :: output_packet(uint8_t *buffer, int pkt_len)
 {
 	//printf("OUTPUT: payload = %p. Size = %d\n", buffer, pkt_len);
-	if (!link_up)
+	if (!link_up || !txRunning)
 		return 0;
 	//dump_hex(buffer, 32);
 
-	uint8_t *size = buffer - 4;
-    size[0] = uint8_t(pkt_len & 0xFF);
-    size[1] = uint8_t(pkt_len >> 8);
-    size[2] = size[0] ^ 0xFF;
-    size[3] = size[1] ^ 0xFF;
+	int needed = 4 + ((pkt_len + 1) & ~1);
+
+	while (txRunning) {
+	    xSemaphoreTake(txLock, portMAX_DELAY);
+	    int cur = txCurrent;
+	    if ((txFill[cur] + needed + 4) <= AX_TX_AGGR_SIZE) { // 4 bytes reserved for the padding word
+	        uint8_t *size = txBuffers[cur] + txFill[cur];
+	        size[0] = uint8_t(pkt_len & 0xFF);
+	        size[1] = uint8_t(pkt_len >> 8);
+	        size[2] = size[0] ^ 0xFF;
+	        size[3] = size[1] ^ 0xFF;
+	        memcpy(size + 4, buffer, pkt_len);
+	        txFill[cur] += needed;
+	        txFrames[cur]++;
+	        xSemaphoreGive(txLock);
+	        xTaskNotifyGive(txTask);
+	        break;
+	    }
+	    xSemaphoreGive(txLock);
+	    // Both buffers are in use; wait for the running transfer to complete
+	    xSemaphoreTake(txSpace, 10);
+	}
+	return 0;
+}
 
-	host->bulk_out(&bulk_out_pipe, size, pkt_len + 4);
+void UsbAx88772Driver :: tx_task(void *a)
+{
+    UsbAx88772Driver *drv = (UsbAx88772Driver *)a;
+    drv->run_tx();
+}
 
-	return 0;
+void UsbAx88772Driver :: run_tx(void)
+{
+    while(txRunning) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Give the stack the chance to queue more frames before we close the buffer
+        taskYIELD();
+
+        while(txRunning) {
+            xSemaphoreTake(txLock, portMAX_DELAY);
+            int send = txCurrent;
+            int len = txFill[send];
+            int frames = txFrames[send];
+            if (!len) {
+                xSemaphoreGive(txLock);
+                break;
+            }
+            txCurrent ^= 1;
+            xSemaphoreGive(txLock);
+
+            // A transfer of an exact multiple of the packet size would not be terminated.
+            // The chip ignores a padding word with length 0 / 0xFFFF.
+            if ((len % bulk_out_pipe.MaxTrans) == 0) {
+                uint8_t *pad = txBuffers[send] + len;
+                pad[0] = 0x00;
+                pad[1] = 0x00;
+                pad[2] = 0xFF;
+                pad[3] = 0xFF;
+                len += 4;
+            }
+            host->bulk_out(&bulk_out_pipe, txBuffers[send], len);
+
+            stats.tx_urbs++;
+            stats.tx_frames += frames;
+            if (frames > stats.tx_max_frames_per_urb) {
+                stats.tx_max_frames_per_urb = frames;
+            }
+
+            xSemaphoreTake(txLock, portMAX_DELAY);
+            txFill[send] = 0;
+            txFrames[send] = 0;
+            xSemaphoreGive(txLock);
+            xSemaphoreGive(txSpace);
+        }
+    }
+    xSemaphoreGive(txStopped);
+    vTaskDelete(NULL);
 }
 
 uint8_t *UsbAx88772Driver :: getBuffer()
@@ -5,8 +5,22 @@
 #include "usb_device.h"
 #include "network_interface.h"
 #include "fifo.h"
+#include "task.h"
+#include "semphr.h"
 
 #define NUM_BUFFERS 64
+#define AX_RX_BUFFER_SIZE 2048 // equal to the Rx burst length, may hold several frames
+#define AX_TX_AGGR_SIZE   8192 // maximum number of bytes sent in one bulk out transfer
+
+struct t_ax88772_stats {
+    uint32_t rx_urbs;
+    uint32_t rx_frames;
+    uint32_t rx_errors;
+    uint32_t rx_max_frames_per_urb;
+    uint32_t tx_urbs;
+    uint32_t tx_frames;
+    uint32_t tx_max_frames_per_urb;
+};
 
 class UsbAx88772Driver : public UsbDriver
 {
@@ -23,6 +37,25 @@ class UsbAx88772Driver : public UsbDriver
 
     Fifo<uint8_t *> freeBuffers;
     uint8_t *dataBuffersBlock;
+    uint8_t bufferRefs[NUM_BUFFERS];
+
+    // Receive frame that continues in the next bulk transfer
+    uint8_t *carryBuffer;
+    int carryFill;   // bytes of header and frame collected so far
+    int carryLength; // header plus frame length, 0 while the header is incomplete
+
+    // Transmit aggregation: one buffer is filled while the other one is sent
+    uint8_t *txBuffers[2];
+    int txFill[2];
+    int txFrames[2];
+    int txCurrent;
+    volatile bool txRunning;
+    SemaphoreHandle_t txLock;
+    SemaphoreHandle_t txSpace;
+    SemaphoreHandle_t txStopped;
+    TaskHandle_t txTask;
+
+    t_ax88772_stats stats;
 
     UsbBase   *host;
     UsbDevice *device;
@@ -43,6 +76,13 @@ class UsbAx88772Driver : public UsbDriver
     uint16_t read_phy_register(uint8_t reg);
 
     uint8_t *getBuffer();
+    int  bufferIndex(uint8_t *b);
+    void start_carry(uint8_t *data, int len, int total);
+    int  continue_carry(uint8_t *data, int data_len, bool more, int &frames);
+    void drop_carry(void);
+
+    static void tx_task(void *a);
+    void run_tx(void);
 public:
 	static UsbDriver *test_driver(UsbInterface *intf);
 
@@ -61,6 +101,8 @@ public:
     void interrupt_handler();
     void bulk_handler();
     void free_buffer(uint8_t *b);
+    void dump_statistics(void);
+    const t_ax88772_stats *get_statistics(void) { return &stats; }
 };
 
 #endif
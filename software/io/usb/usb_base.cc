@@ -235,7 +235,7 @@ void UsbBase :: input_task_impl(void)
 		}
 		if (xQueueReceive(queue, &fifoWord, 5000) == pdTRUE) {
 			// printf("{%04x:%04x}", ev.fifo_word[0], ev.fifo_word[1]);
-			PROFILER_SUB = 5;
+			PROFILER_MARK(5);
 			process_fifo(fifoWord);
 		} else {
 			printf("@");
@@ -257,13 +257,13 @@ void UsbBase :: process_fifo(uint16_t pipe)
 
 	void *object = inputPipeObjects[pipe];
 
-	PROFILER_SUB = 3;
+	PROFILER_MARK(3);
     if (!object || (pipe >= USB2_NUM_PIPES)) {
 		printf("** INVALID USB PACKET RECEIVED IN QUEUE! Pipe : %d\n", pipe);
 		return;
 	}
 	inputPipeCallBacks[pipe](object);
-	PROFILER_SUB = 12;
+	PROFILER_MARK(12);
 }
 
 // Called from event context
@@ -748,7 +748,7 @@ int  UsbBase :: bulk_out(struct t_pipe *pipe, void *buf, int len, int timeout)
     }
 	// printf("BULK OUT to %4x, len = %d\n", pipe->DevEP, len);
 
-	uint8_t sub = PROFILER_SUB; PROFILER_SUB = 13;
+	uint8_t sub = PROFILER_SUB; PROFILER_MARK(13);
     volatile t_usb_descriptor *descr = USB2_DESCRIPTOR(0);
 
 /*
@@ -801,7 +801,7 @@ int  UsbBase :: bulk_out(struct t_pipe *pipe, void *buf, int len, int timeout)
     // printf("Bulk out done: %d\n", total_trans);
     xSemaphoreGive(mutex);
 
-    PROFILER_SUB = sub;
+    PROFILER_MARK(sub);
 	return total_trans;
 }
 
@@ -909,7 +909,7 @@ UsbDevice *UsbBase :: init_simple(void)
 // Called from IRQ
 BaseType_t UsbBase :: irq_handler(void)
 {
-	PROFILER_SUB = 2;
+	PROFILER_MARK_ISR(2);
 	irq_count++;
 	uint16_t read;
 
@@ -926,7 +926,7 @@ BaseType_t UsbBase :: irq_handler(void)
 			}
 		}
 	}
-	PROFILER_SUB = 0;
+	PROFILER_MARK_ISR(0);
 	return xHigherPriorityTaskWoken;
 }
 
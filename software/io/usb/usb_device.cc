@@ -108,7 +108,7 @@ UsbDevice :: ~UsbDevice()
 		}
 	}
 	if(config_descriptor) {
-		delete config_descriptor;
+		delete[] config_descriptor;
 	}
 }
 
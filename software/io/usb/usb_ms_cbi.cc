@@ -49,7 +49,7 @@ UsbCbiDriver :: UsbCbiDriver(UsbInterface *intf) : UsbScsiDriver(intf)
 
 UsbCbiDriver :: ~UsbCbiDriver()
 {
-
+    vSemaphoreDelete(mutex);
 }
 
 UsbDriver *UsbCbiDriver :: test_driver(UsbInterface *intf)
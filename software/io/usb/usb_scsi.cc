@@ -50,7 +50,7 @@ UsbScsiDriver :: UsbScsiDriver(UsbInterface *intf) : UsbDriver(intf)
 
 UsbScsiDriver :: ~UsbScsiDriver()
 {
-
+    vSemaphoreDelete(mutex);
 }
 
 UsbDriver *UsbScsiDriver :: test_driver(UsbInterface *intf)
@@ -91,7 +91,7 @@ int UsbScsiDriver :: get_max_lun(UsbDevice *dev)
                                    c_scsi_getmaxlun, 8,
                                    dummy_buffer, 8);
 
-    if(!i)
+    if(i <= 0)
         return 0;
 
     //printf("Got %d bytes. Max lun: %b\n", i, dummy_buffer[0]);
@@ -233,10 +233,12 @@ UsbScsi :: UsbScsi(UsbScsiDriver *drv, int unit, int ml)
     block_size = 512;
     capacity = 0;
     no_more = false;
+    readahead_mutex = xSemaphoreCreateMutex();
 }
 
 UsbScsi :: ~UsbScsi()
 {
+    vSemaphoreDelete(readahead_mutex);
 }
 
 void UsbScsi :: reset(void)
@@ -279,7 +281,7 @@ int UsbScsiDriver :: status_transport(bool do_bulk_in=true)
 
 	if (len == -4) { // Pipe stalled
 		printf("Stall detected on status read. Clearing stall condition.\n");
-		len = device->unstall_pipe((uint8_t)(bulk_in.DevEP & 0xFF));
+		len = device->unstall_pipe(0x80 | (bulk_in.DevEP & 0x0F));
 	    bulk_in.Command = 0; // reset toggle
 		if (len < 0) {
 			printf("Clear stall condition failed. %d\n", len);
@@ -349,6 +351,7 @@ int UsbScsiDriver :: request_sense(int lun, bool debug, bool handle)
     int outResult = host->bulk_out(&bulk_out, &cbw, 31);
     if (outResult != 31) {
         printf("Request sense command could not be sent.\n");
+        xSemaphoreGive(mutex);
         return -11;
     }
     int len = host->bulk_in(&bulk_in, sense_data, 18);
@@ -456,7 +459,7 @@ int UsbScsiDriver :: exec_command(int lun, int cmdlen, bool out, uint8_t *cmd, i
 			}
 			if (len == -4) {
 				printf("In Pipe stalled. Unstalling pipe, and reading status.\n");
-			    device->unstall_pipe((uint8_t)(bulk_in.DevEP & 0xFF));
+			    device->unstall_pipe(0x80 | (bulk_in.DevEP & 0x0F));
 			    bulk_in.Command = 0; // reset toggle
 			} else if (len < 0) {
 				xSemaphoreGive(mutex);
@@ -477,7 +480,7 @@ int UsbScsiDriver :: exec_command(int lun, int cmdlen, bool out, uint8_t *cmd, i
     st = status_transport(read_status);
     if (st == -4) {
     	printf("Stalled. Unstalling Endpoint\n");
-    	device->unstall_pipe((uint8_t)(bulk_in.DevEP & 0xFF));
+    	device->unstall_pipe(0x80 | (bulk_in.DevEP & 0x0F));
 	    bulk_in.Command = 0; // reset toggle
     }
 
@@ -591,6 +594,10 @@ DRESULT UsbScsi :: read_capacity(uint32_t *num_blocks, uint32_t *blk_size)
         if ((this->block_size < 0) || (this->block_size > 4096)) {
             return RES_PARERR;
         }
+        // a new medium, or a new mount: nothing of what we read before can be trusted
+        xSemaphoreTake(readahead_mutex, portMAX_DELAY);
+        readahead.set_geometry(this->block_size, this->capacity);
+        xSemaphoreGive(readahead_mutex);
         return RES_OK;
     } else { // command failed
         printf("Read capacity failed.\n");
@@ -853,6 +860,22 @@ DSTATUS UsbScsi :: status(void)
     return RES_OK;
 }
 
+DRESULT UsbScsi :: read_sectors(void *context, uint8_t *buf, uint32_t sector, int num_sectors)
+{
+    UsbScsi *scsi = (UsbScsi *)context;
+
+	uint8_t read_10_command[] = { 0x28, uint8_t(scsi->lun << 5), 0,0,0,0, 0x00, 0, 0, 0 };
+    read_10_command[8] = (uint8_t)num_sectors;
+    read_10_command[7] = (uint8_t)(num_sectors >> 8);
+    ST_DWORD_BE(&read_10_command[2], sector);
+
+    int len = scsi->block_size * num_sectors;
+    if (scsi->driver->exec_command(scsi->lun, 10, false, read_10_command, len, buf, false) != len) {
+        return RES_ERROR;
+    }
+    return RES_OK;
+}
+
 DRESULT UsbScsi :: read(uint8_t *buf, uint32_t sector, int num_sectors)
 {
     if(!initialized)
@@ -863,30 +886,12 @@ DRESULT UsbScsi :: read(uint8_t *buf, uint32_t sector, int num_sectors)
 
         // printf("Read USB sector: %d (%d).\n", sector, num_sectors);
 
-	uint8_t read_10_command[] = { 0x28, uint8_t(lun << 5), 0,0,0,0, 0x00, 0, 0, 0 };
-    read_10_command[8] = (uint8_t)num_sectors;
-    read_10_command[7] = (uint8_t)(num_sectors >> 8);
-    
-    int len, stat_len;
-
     ioWrite8(ITU_USB_BUSY, 1);
-//    for(int s=0;s<num_sectors;s++) {
-        ST_DWORD_BE(&read_10_command[2], sector);
-        
-        for(int retry=0;retry<10;retry++) {
-            if(driver->exec_command(lun, 10, false, read_10_command, block_size*num_sectors, buf, false) != block_size*num_sectors) {
-            	ioWrite8(ITU_USB_BUSY, 0);
-                return RES_ERROR;
-            } else
-                break;
-        }
-        
-//        buf += block_size;
-//        sector ++;
-//    }
-
+    xSemaphoreTake(readahead_mutex, portMAX_DELAY);
+    DRESULT res = readahead.read(buf, sector, num_sectors, read_sectors, this);
+    xSemaphoreGive(readahead_mutex);
 	ioWrite8(ITU_USB_BUSY, 0);
-    return RES_OK;
+    return res;
 }
 
 DRESULT UsbScsi :: write(const uint8_t *buf, uint32_t sector, int num_sectors)
@@ -898,31 +903,41 @@ DRESULT UsbScsi :: write(const uint8_t *buf, uint32_t sector, int num_sectors)
         return RES_NOTRDY;
 
     uint8_t write_10_command[] = { 0x2A, uint8_t(lun << 5), 0,0,0,0, 0x00, 0, 0, 0 };
-    write_10_command[8] = (uint8_t)num_sectors;
-    write_10_command[7] = (uint8_t)(num_sectors >> 8);
     
     int len, stat_len;
 
+    // The read-ahead lock is held until the data is on the device; a read in
+    // between could otherwise put the old contents back in the cache.
+    xSemaphoreTake(readahead_mutex, portMAX_DELAY);
+    readahead.written(sector, num_sectors);
+
     ioWrite8(ITU_USB_BUSY, 1);
 
     //printf("USB: Writing %d sectors from %d.\n", num_sectors, sector);
-//    for(int s=0;s<num_sectors;s++) {
+    // the partitions pass any count; one command takes at most as many as a read does
+    while(num_sectors) {
+        int n = (num_sectors > USB_SCSI_MAX_TRANSFER) ? USB_SCSI_MAX_TRANSFER : num_sectors;
+        write_10_command[8] = (uint8_t)n;
+        write_10_command[7] = (uint8_t)(n >> 8);
         ST_DWORD_BE(&write_10_command[2], sector);
 
         for(int retry=0;retry<10;retry++) {
-        	len = driver->exec_command(lun, 10, true, write_10_command, block_size*num_sectors, (uint8_t *)buf, false);
-        	if(len != block_size*num_sectors) {
+        	len = driver->exec_command(lun, 10, true, write_10_command, block_size*n, (uint8_t *)buf, false);
+        	if(len != block_size*n) {
         		printf("Error %d.\n", len);
         		ioWrite8(ITU_USB_BUSY, 0);
+        		xSemaphoreGive(readahead_mutex);
                 return RES_ERROR;
         	} else
                 break;
         }
         
-//        buf += block_size;
-//        sector ++;
-//    }
+        buf += block_size * n;
+        sector += n;
+        num_sectors -= n;
+    }
 	ioWrite8(ITU_USB_BUSY, 0);
+    xSemaphoreGive(readahead_mutex);
     return RES_OK;
 }
 
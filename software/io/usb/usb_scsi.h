@@ -5,6 +5,7 @@
 #include "usb_device.h"
 #include "blockdev.h"
 #include "file_device.h"
+#include "usb_scsi_readahead.h"
 #include "FreeRTOS.h"
 #include "queue.h"
 #include "semphr.h"
@@ -84,7 +85,10 @@ class UsbScsi : public BlockDevice
 
     char	   name[16];
     char       disp_name[32];
-    
+
+    ScsiReadAhead readahead;
+    SemaphoreHandle_t readahead_mutex;
+    static DRESULT read_sectors(void *context, uint8_t *, uint32_t, int);
 public:
     UsbScsi(UsbScsiDriver *drv, int unit, int max_lun);
     ~UsbScsi();
@@ -0,0 +1,94 @@
+#include <string.h>
+#include "usb_scsi_readahead.h"
+
+ScsiReadAhead :: ScsiReadAhead(int window, int max_transfer)
+{
+    this->window = (window > max_transfer) ? max_transfer : window;
+    this->max_transfer = max_transfer;
+    buffer = NULL;
+    block_size = 0;
+    capacity = 0;
+    first = 0;
+    count = 0;
+    next[0] = next[1] = 0xFFFFFFFF;
+    requests = 0;
+    hits = 0;
+    commands = 0;
+}
+
+ScsiReadAhead :: ~ScsiReadAhead()
+{
+    delete[] buffer;
+}
+
+void ScsiReadAhead :: set_geometry(int size, uint32_t num_blocks)
+{
+    count = 0;
+    next[0] = next[1] = 0xFFFFFFFF;
+    capacity = num_blocks;
+    if (size == block_size)
+        return;
+    delete[] buffer;
+    buffer = NULL;
+    block_size = size;
+    if (window && size)
+        buffer = new uint8_t[window * size];
+}
+
+void ScsiReadAhead :: written(uint32_t sector, int num_sectors)
+{
+    if (count && (sector < first + count) && (sector + num_sectors > first))
+        count = 0;
+}
+
+DRESULT ScsiReadAhead :: read(uint8_t *buf, uint32_t sector, int num_sectors, scsi_read_t raw, void *context)
+{
+    bool sequential = (sector == next[0]) || (sector == next[1]);
+    if (sector != next[0])
+        next[1] = next[0];
+    next[0] = sector + num_sectors;
+    requests++;
+
+    // what is already here
+    if (count && (sector >= first) && (sector < first + count)) {
+        int n = first + count - sector;
+        if (n > num_sectors)
+            n = num_sectors;
+        memcpy(buf, buffer + (sector - first) * block_size, n * block_size);
+        hits += n;
+        buf += n * block_size;
+        sector += n;
+        num_sectors -= n;
+        sequential = true; // the stream is running
+    }
+    if (!num_sectors)
+        return RES_OK;
+
+    // small request of a sequential reader: fill the window, and give out the first part of it
+    int fill = window;
+    if (sector + fill > capacity)
+        fill = (sector < capacity) ? capacity - sector : 0;
+    if (buffer && sequential && (num_sectors < fill)) {
+        count = 0;
+        commands++;
+        DRESULT res = raw(context, buffer, sector, fill);
+        if (res != RES_OK)
+            return res;
+        first = sector;
+        count = fill;
+        memcpy(buf, buffer, num_sectors * block_size);
+        return RES_OK;
+    }
+
+    while (num_sectors) {
+        int n = (num_sectors > max_transfer) ? max_transfer : num_sectors;
+        commands++;
+        DRESULT res = raw(context, buf, sector, n);
+        if (res != RES_OK)
+            return res;
+        buf += n * block_size;
+        sector += n;
+        num_sectors -= n;
+    }
+    return RES_OK;
+}
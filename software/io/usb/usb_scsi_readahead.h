@@ -0,0 +1,51 @@
+#ifndef USB_SCSI_READAHEAD_H
+#define USB_SCSI_READAHEAD_H
+
+#include <stdint.h>
+#include "diskio.h"
+
+// Sectors read ahead once a LUN is read sequentially, and the largest READ(10) that is issued.
+// 240 sectors is what Linux uses for usb-storage by default; not every stick takes more.
+#define USB_SCSI_READAHEAD_SECTORS   64
+#define USB_SCSI_MAX_TRANSFER       240
+
+// Reads 'num_sectors' from the device with one command; returns RES_OK when all of them arrived
+typedef DRESULT (*scsi_read_t)(void *context, uint8_t *buf, uint32_t sector, int num_sectors);
+
+/*
+ * Read-ahead window for one LUN of a bulk-only mass storage device. Every
+ * command costs a CBW, a data phase and a CSW, and the bulk-only transport
+ * cannot queue a second command while one is in flight. So the only way
+ * to get more out of a stick is to ask for more per command: a request
+ * that continues where the previous one ended is extended to the window
+ * size, and the rest is kept for the requests that follow. Large requests
+ * go straight to the caller's buffer, split at the maximum transfer length.
+ */
+class ScsiReadAhead
+{
+    uint8_t *buffer;
+    int      window;
+    int      max_transfer;
+    int      block_size;
+    uint32_t capacity;
+
+    uint32_t first;      // first sector in the buffer
+    int      count;      // number of valid sectors in the buffer
+    uint32_t next[2];    // sectors that a sequential reader would ask for next; FatFs reads
+                         // the FAT in between the data, so two streams are followed
+public:
+    uint32_t requests;
+    uint32_t hits;       // sectors served from the buffer
+    uint32_t commands;
+
+    ScsiReadAhead(int window = USB_SCSI_READAHEAD_SECTORS, int max_transfer = USB_SCSI_MAX_TRANSFER);
+    ~ScsiReadAhead();
+
+    void set_geometry(int size, uint32_t num_blocks); // also drops the buffered data
+    void invalidate(void) { count = 0; }
+    void written(uint32_t sector, int num_sectors);
+
+    DRESULT read(uint8_t *buf, uint32_t sector, int num_sectors, scsi_read_t raw, void *context);
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * mem_ranges.cc
+ *
+ *  Sends a list of memory ranges to a socket client (SOCKET_CMD_READMEM_RANGES).
+ */
+
+#include "mem_ranges.h"
+#include <string.h>
+#include "lz_image.h"
+#include "crc32.h"
+
+// Collects the small pieces of the reply, so that they do not end up in separate packets
+class MemRangesOutput
+{
+    int socket;
+    mem_ranges_write_t write;
+    uint8_t buffer[MEM_RANGES_OUT_SIZE];
+    int fill;
+public:
+    int sent;
+
+    MemRangesOutput(int socket, mem_ranges_write_t write) {
+        this->socket = socket;
+        this->write = write;
+        fill = 0;
+        sent = 0;
+    }
+
+    bool flush(void) {
+        if (fill) {
+            int n = write(socket, buffer, fill);
+            if (n != fill) {
+                return false;
+            }
+            sent += n;
+            fill = 0;
+        }
+        return true;
+    }
+
+    bool put(const uint8_t *data, uint32_t length) {
+        while(length) {
+            if ((fill == 0) && (length >= MEM_RANGES_OUT_SIZE)) {
+                // large pieces go out directly
+                int n = write(socket, (void *)data, length);
+                if (n != (int)length) {
+                    return false;
+                }
+                sent += n;
+                return true;
+            }
+            uint32_t now = MEM_RANGES_OUT_SIZE - fill;
+            if (now > length) {
+                now = length;
+            }
+            memcpy(buffer + fill, data, now);
+            fill += now;
+            data += now;
+            length -= now;
+            if ((fill == MEM_RANGES_OUT_SIZE) && !flush()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool put_le32(uint32_t value) {
+        uint8_t tmp[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+        return put(tmp, 4);
+    }
+};
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int mem_ranges_send(int socket, const uint8_t *params, int length, mem_ranges_map_t map, mem_ranges_write_t write)
+{
+    if (length < 1) {
+        return 0;
+    }
+    uint8_t flags = params[0];
+    MemRangesOutput *out = new MemRangesOutput(socket, write);
+    uint8_t *snapshot = 0;
+    uint8_t *block = 0;
+    uint16_t *hash = 0;
+    bool ok = true;
+
+    // The memory may change while it is read. Take a copy of each block, so that the CRC
+    // and the compressed data describe the same bytes.
+    if (flags & (MEM_RANGES_FLAG_PACK | MEM_RANGES_FLAG_CRC)) {
+        snapshot = new uint8_t[LZ_IMAGE_BLOCK_SIZE];
+    }
+    if (flags & MEM_RANGES_FLAG_PACK) {
+        block = new uint8_t[LZ_IMAGE_BLOCK_SIZE];
+        hash = new uint16_t[LZ_IMAGE_HASH_SIZE];
+    }
+
+    for(int i = 1; ok && (i + 8 <= length); i += 8) {
+        uint32_t address = get_le32(params + i);
+        uint32_t size = get_le32(params + i + 4);
+        const uint8_t *mem = 0;
+        if (size <= MEM_RANGES_MAX_LENGTH) {
+            mem = map(address, size);
+        }
+        if (!mem) {
+            size = 0;
+        }
+        ok = out->put_le32(size);
+
+        uint32_t crc = 0;
+        for(uint32_t pos = 0; ok && (pos < size); pos += LZ_IMAGE_BLOCK_SIZE) {
+            uint32_t now = size - pos;
+            if (now > LZ_IMAGE_BLOCK_SIZE) {
+                now = LZ_IMAGE_BLOCK_SIZE;
+            }
+            const uint8_t *data = mem + pos;
+            if (snapshot) {
+                memcpy(snapshot, data, now);
+                data = snapshot;
+            }
+            if (flags & MEM_RANGES_FLAG_CRC) {
+                crc = crc32_update(crc, data, now);
+            }
+            if (!(flags & MEM_RANGES_FLAG_PACK)) {
+                ok = out->put(data, now);
+                continue;
+            }
+            int packed = lz_image_pack_block(data, now, block, hash);
+            if (packed) {
+                ok = out->put_le32(packed) && out->put(block, packed);
+            } else {
+                ok = out->put_le32(now | LZ_IMAGE_BLOCK_RAW) && out->put(data, now);
+            }
+        }
+        if (ok && (flags & MEM_RANGES_FLAG_CRC)) {
+            ok = out->put_le32(crc);
+        }
+    }
+    if (ok) {
+        ok = out->flush();
+    }
+    int sent = out->sent;
+    delete out;
+    delete[] snapshot;
+    delete[] block;
+    delete[] hash;
+    return ok ? sent : -1;
+}
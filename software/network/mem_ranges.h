@@ -0,0 +1,34 @@
+/*
+ * mem_ranges.h
+ *
+ *  Sends a list of memory ranges to a socket client, optionally compressed
+ *  and with a CRC per range (SOCKET_CMD_READMEM_RANGES).
+ *
+ *  Request: flags (1 byte), then for each range the address and the length
+ *  (4 bytes each, little endian).
+ *  Reply, for each range:
+ *    - the number of bytes in the range (4 bytes); 0 when it cannot be read
+ *    - the data; with MEM_RANGES_FLAG_PACK in blocks of LZ_IMAGE_BLOCK_SIZE
+ *      bytes, each with a 32-bit size word in front, as in lz_image.h
+ *    - with MEM_RANGES_FLAG_CRC: the CRC32 of the (unpacked) data, 4 bytes
+ */
+
+#ifndef NETWORK_MEM_RANGES_H_
+#define NETWORK_MEM_RANGES_H_
+
+#include <stdint.h>
+
+#define MEM_RANGES_FLAG_PACK  0x01
+#define MEM_RANGES_FLAG_CRC   0x02
+
+#define MEM_RANGES_MAX_LENGTH 0x1000000
+#define MEM_RANGES_OUT_SIZE   4096
+
+typedef int (*mem_ranges_write_t)(int socket, void *buffer, int length);
+// Returns a pointer to the memory at 'address', or NULL when the range shall not be read
+typedef const uint8_t *(*mem_ranges_map_t)(uint32_t address, uint32_t length);
+
+// Returns the number of bytes sent, or a negative value when the client went away
+int mem_ranges_send(int socket, const uint8_t *params, int length, mem_ranges_map_t map, mem_ranges_write_t write);
+
+#endif /* NETWORK_MEM_RANGES_H_ */
@@ -0,0 +1,58 @@
+/*
+ * reu_stream.cc
+ *
+ *  Receives a data stream from a socket directly into REU memory.
+ */
+
+#include "reu_stream.h"
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+extern "C" {
+    #include "crc32.h"
+}
+
+int reu_stream_receive(int socket, uint8_t *reu, uint32_t mask, uint32_t offset, uint32_t length, uint32_t *crc)
+{
+    uint32_t received = 0;
+    offset &= mask;
+
+    while(received < length) {
+        // never beyond the end of the REU, nor beyond the next chunk boundary
+        uint32_t current = REU_STREAM_CHUNK - (offset & (REU_STREAM_CHUNK - 1));
+        if (current > mask + 1 - offset) {
+            current = mask + 1 - offset;
+        }
+        if (current > length - received) {
+            current = length - received;
+        }
+        int n = recv(socket, reu + offset, current, 0);
+        if (n < 0) {
+            return n;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (crc) {
+            *crc = crc32_update(*crc, reu + offset, n);
+        }
+        offset = (offset + n) & mask;
+        received += n;
+    }
+    return (int)received;
+}
+
+void reu_stream_copy(uint8_t *reu, uint32_t mask, uint32_t offset, const uint8_t *buf, uint32_t length)
+{
+    offset &= mask;
+    while(length) {
+        uint32_t current = mask + 1 - offset;
+        if (current > length) {
+            current = length;
+        }
+        memcpy(reu + offset, buf, current);
+        buf += current;
+        length -= current;
+        offset = (offset + current) & mask;
+    }
+}
@@ -0,0 +1,30 @@
+/*
+ * reu_stream.h
+ *
+ *  Receives a data stream from a socket directly into REU memory,
+ *  without staging it in the socket buffer first.
+ */
+
+#ifndef NETWORK_REU_STREAM_H_
+#define NETWORK_REU_STREAM_H_
+
+#include <stdint.h>
+
+// Pieces are received up to the next multiple of this size, so that after the
+// first piece every recv targets an aligned block of REU memory.
+#define REU_STREAM_CHUNK 0x8000
+
+// Flags byte of SOCKET_CMD_REUWRITE_STREAM
+#define REU_STREAM_FLAG_CRC 0x01 // reply with the CRC32 of the received data (4 bytes, little endian)
+
+// Receives 'length' bytes from the socket and writes them to reu[(offset + i) & mask].
+// mask + 1 shall be a power of two. When crc is not NULL, the running CRC32
+// (zlib / PNG) of the stream is returned in it; start with *crc = 0.
+// Returns the number of bytes received, which is less than length when the
+// connection broke, or a negative value on a socket error.
+int reu_stream_receive(int socket, uint8_t *reu, uint32_t mask, uint32_t offset, uint32_t length, uint32_t *crc);
+
+// Copies a buffer into REU memory, wrapping around at mask + 1.
+void reu_stream_copy(uint8_t *reu, uint32_t mask, uint32_t offset, const uint8_t *buf, uint32_t length);
+
+#endif /* NETWORK_REU_STREAM_H_ */
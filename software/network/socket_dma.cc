@@ -17,6 +17,9 @@
 #include "u64.h"
 #include "c1541.h"
 #include "data_streamer.h"
+#include "reu_stream.h"
+#include "mem_ranges.h"
+#include "sw_trace.h"
 
 // "Ok ok, use them then..."
 #define SOCKET_CMD_DMA         0xFF01
@@ -30,6 +33,8 @@
 #define SOCKET_CMD_DMAJUMP     0xFF09
 #define SOCKET_CMD_MOUNT_IMG   0xFF0A
 #define SOCKET_CMD_RUN_IMG     0xFF0B
+#define SOCKET_CMD_REUWRITE_STREAM 0xFF0C // params: offset (3 bytes), length (4 bytes), flags (1 byte); data follows
+#define SOCKET_CMD_READMEM_RANGES  0xFF0D // params: flags (1 byte), (address, length) pairs; see mem_ranges.h
 
 // Only available on U64
 #define SOCKET_CMD_VICSTREAM_ON    0xFF20
@@ -45,12 +50,58 @@
 #define SOCKET_CMD_READMEM      0xFF74
 #define SOCKET_CMD_READFLASH    0xFF75
 #define SOCKET_CMD_DEBUG_REG    0xFF76
+#define SOCKET_CMD_SWTRACE      0xFF77 // params: 0 = stop, 1 = start, 2 = send (length, 4 bytes; then the trace)
 
 SocketDMA socket_dma; // global that causes the object to exist
 
 extern cart_def sid_cart;
 extern cart_def boot_cart;
 
+#define READMEM_WINDOW_BASE 0x2000000 // the area that SOCKET_CMD_READMEM sends
+#define READMEM_WINDOW_SIZE 0x800000
+#define C64_MEMORY_SIZE     0x10000
+
+static bool inRegion(uint32_t address, uint32_t length, uint32_t base, uint32_t size)
+{
+    return (address >= base) && (length <= size) && ((address - base) <= (size - length));
+}
+
+// Only memory that can be read without side effects: the REU, the window of the
+// old READMEM command, and the C64 RAM while the C64 is stopped. Anything else,
+// I/O space in particular, could hang the bus.
+static const uint8_t *mapMemory(uint32_t address, uint32_t length)
+{
+    if (address + length < address) {
+        return NULL;
+    }
+    if (inRegion(address, length, REU_MEMORY_BASE, REU_MAX_SIZE) ||
+        inRegion(address, length, READMEM_WINDOW_BASE, READMEM_WINDOW_SIZE)) {
+        return (const uint8_t *)address;
+    }
+    if (inRegion(address, length, C64_MEMORY_BASE, C64_MEMORY_SIZE) && (C64_STOP & C64_HAS_STOPPED)) {
+        return (const uint8_t *)address;
+    }
+    return NULL;
+}
+
+#ifdef U64
+// The stream off commands reply with the statistics of the stream when bit 0 of their
+// first parameter byte is set: starts, ticks on, CPU frames sent, deferred, dropped.
+static int streamStatistics(int id, uint8_t *buf)
+{
+    stream_stats_t stats;
+    dataStreamer.getStatistics(id, &stats);
+    uint32_t values[5] = { stats.starts, stats.active_ticks, stats.tx_sent, stats.tx_deferred, stats.tx_dropped };
+    for (int i=0; i < 5; i++) {
+        buf[4*i + 0] = (uint8_t)values[i];
+        buf[4*i + 1] = (uint8_t)(values[i] >> 8);
+        buf[4*i + 2] = (uint8_t)(values[i] >> 16);
+        buf[4*i + 3] = (uint8_t)(values[i] >> 24);
+    }
+    return 20;
+}
+#endif
+
 SocketDMA::SocketDMA() {
 	load_buffer = new uint8_t[SOCKET_BUFFER_SIZE];
 	if (load_buffer) {
@@ -69,6 +120,8 @@ void SocketDMA :: performCommand(int socket, void *load_buffer, int length, uint
 
     uint16_t offs;
     uint32_t offs32;
+    uint32_t stream_len;
+    uint32_t crc;
     uint16_t i;
     uint16_t size;
     const char *name = "";
@@ -109,8 +162,29 @@ void SocketDMA :: performCommand(int socket, void *load_buffer, int length, uint
         break;
     case SOCKET_CMD_REUWRITE:
         offs32 = (uint32_t)buf[0] | (((uint32_t)buf[1]) << 8) | (((uint32_t)buf[2]) << 16);
-        for (i=3; i<len; i++)
-           *(uint8_t *)(REU_MEMORY_BASE+ ((offs32+i-3)&0xffffff)) = buf[i];
+        if (len > 3) {
+            reu_stream_copy((uint8_t *)REU_MEMORY_BASE, REU_MAX_SIZE - 1, offs32, buf + 3, len - 3);
+        }
+        break;
+    case SOCKET_CMD_REUWRITE_STREAM:
+        if (len < 8) {
+            break;
+        }
+        offs32 = (uint32_t)buf[0] | (((uint32_t)buf[1]) << 8) | (((uint32_t)buf[2]) << 16);
+        stream_len = (uint32_t)buf[3] | (((uint32_t)buf[4]) << 8) | (((uint32_t)buf[5]) << 16) | (((uint32_t)buf[6]) << 24);
+        crc = 0;
+        if (reu_stream_receive(socket, (uint8_t *)REU_MEMORY_BASE, REU_MAX_SIZE - 1, offs32, stream_len,
+                               (buf[7] & REU_STREAM_FLAG_CRC) ? &crc : NULL) != (int)stream_len) {
+            printf("REU stream broken.\n");
+            break;
+        }
+        if (buf[7] & REU_STREAM_FLAG_CRC) {
+            buf[0] = crc;
+            buf[1] = crc >> 8;
+            buf[2] = crc >> 16;
+            buf[3] = crc >> 24;
+            writeSocket(socket, buf, 4);
+        }
         break;
     case SOCKET_CMD_KERNALWRITE:
         /* GZW: Actually a driver for the cartridge mapping should be called here. */
@@ -140,6 +214,28 @@ void SocketDMA :: performCommand(int socket, void *load_buffer, int length, uint
         printf("Sending data...");
         writeSocket(socket, (void *)0x2000000, 0x800000);
         break;
+    case SOCKET_CMD_READMEM_RANGES:
+        mem_ranges_send(socket, buf, len, mapMemory, writeSocket);
+        break;
+    case SOCKET_CMD_SWTRACE:
+        if (len < 1) {
+            break;
+        }
+        if (buf[0] == 1) {
+            sw_trace_start();
+        } else if (buf[0] == 2) {
+            uint32_t size = (uint32_t)sw_trace_export_size();
+            buf[0] = (uint8_t)size;
+            buf[1] = (uint8_t)(size >> 8);
+            buf[2] = (uint8_t)(size >> 16);
+            buf[3] = (uint8_t)(size >> 24);
+            if (writeSocket(socket, buf, 4) == 4) {
+                sw_trace_export(writeTrace, (void *)socket);
+            }
+        } else {
+            sw_trace_stop();
+        }
+        break;
     case SOCKET_CMD_MOUNT_IMG:
     case SOCKET_CMD_RUN_IMG:
         if (cmd == SOCKET_CMD_MOUNT_IMG) {
@@ -210,18 +306,27 @@ void SocketDMA :: performCommand(int socket, void *load_buffer, int length, uint
         c64_command = new SubsysCommand(NULL, -1, (int)&dataStreamer, 0, "", "");
         c64_command->direct_call = DataStreamer :: S_stopStream;
         c64_command->execute();
+        if ((len > 0) && (buf[0] & 1)) {
+            writeSocket(socket, buf, streamStatistics(0, buf));
+        }
         break;
 
     case SOCKET_CMD_AUDIOSTREAM_OFF:
         c64_command = new SubsysCommand(NULL, -1, (int)&dataStreamer, 1, "", "");
         c64_command->direct_call = DataStreamer :: S_stopStream;
         c64_command->execute();
+        if ((len > 0) && (buf[0] & 1)) {
+            writeSocket(socket, buf, streamStatistics(1, buf));
+        }
         break;
 
     case SOCKET_CMD_DEBUGSTREAM_OFF:
         c64_command = new SubsysCommand(NULL, -1, (int)&dataStreamer, 2, "", "");
         c64_command->direct_call = DataStreamer :: S_stopStream;
         c64_command->execute();
+        if ((len > 0) && (buf[0] & 1)) {
+            writeSocket(socket, buf, streamStatistics(2, buf));
+        }
         break;
 
     case SOCKET_CMD_DEBUG_REG:
@@ -315,6 +420,11 @@ int SocketDMA::writeSocket(int socket, void *buffer, int length)
     return sent;
 }
 
+int SocketDMA::writeTrace(void *context, const void *buffer, int length)
+{
+    return writeSocket((int)context, (void *)buffer, length);
+}
+
 void SocketDMA::dmaThread(void *load_buffer)
 {
 	int sockfd, newsockfd, portno;
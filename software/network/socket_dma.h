@@ -19,6 +19,7 @@ class SocketDMA {
 	static void performCommand(int socket, void *load_buffer, int length, uint16_t cmd, uint32_t len, struct in_addr *client_ip);
 	static int  readSocket(int socket, void *buffer, int max_remain);
 	static int  writeSocket(int socket, void *buffer, int length);
+	static int  writeTrace(void *context, const void *buffer, int length);
 
 	uint8_t *load_buffer;
 public:
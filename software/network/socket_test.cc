@@ -10,6 +10,9 @@
 #include "socket_test.h"
 #include "socket.h"
 #include "profiler.h"
+#include "sw_trace.h"
+#include "memory.h"
+#include "pool.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "dump_hex.h"
@@ -34,7 +37,17 @@ int  SocketTest::fetch_task_items(Path *path, IndexedList<Action*> &item_list)
 	item_list.append(new Action("Start BUS Trace", SocketTest :: profiler, 2, 1));
 	item_list.append(new Action("Stop BUS Trace", SocketTest :: profiler, 2, 0));
 	item_list.append(new Action("Save BUS Trace", SocketTest :: saveTrace, 3, 0));
-    return 3;
+	item_list.append(new Action("Start SW Trace", SocketTest :: swTrace, 4, 1));
+	item_list.append(new Action("Stop SW Trace", SocketTest :: swTrace, 4, 0));
+	item_list.append(new Action("Save SW Trace", SocketTest :: saveSwTrace, 5, 0));
+	item_list.append(new Action("Dump Heap Profile", SocketTest :: heapProfile, 6, 0));
+#if USE_MEM_TRACE
+	item_list.append(new Action("Record Allocations", SocketTest :: heapProfile, 6, 1));
+	item_list.append(new Action("Stop Recording", SocketTest :: heapProfile, 6, 2));
+    return 9;
+#else
+    return 7;
+#endif
 #endif
     return 0;
 }
@@ -49,6 +62,71 @@ int SocketTest :: profiler(SubsysCommand *cmd) {
 	return 0;
 }
 
+int SocketTest :: swTrace(SubsysCommand *cmd) {
+	if (cmd->mode) {
+		sw_trace_start();
+	} else {
+		sw_trace_stop();
+	}
+	return 0;
+}
+
+// The recording goes to the console; replay it on the PC with test/mem_profile
+int SocketTest :: heapProfile(SubsysCommand *cmd) {
+	switch (cmd->mode) {
+#if USE_MEM_TRACE
+	case 1:
+		mem_manager.record(true);
+		break;
+	case 2:
+		mem_manager.record(false);
+		break;
+#endif
+	default:
+#if USE_MEM_TRACE
+		mem_manager.dump();
+#endif
+		FixedPool :: dump_all();
+		break;
+	}
+	return 0;
+}
+
+static int write_trace_file(void *context, const void *buffer, int length)
+{
+	uint32_t transferred = 0;
+	if (((File *)context)->write(buffer, length, &transferred) != FR_OK) {
+		return -1;
+	}
+	return (int)transferred;
+}
+
+// Convert on the PC with tools/sw_trace_json, and load the result in chrome://tracing
+int SocketTest :: saveSwTrace(SubsysCommand *cmd)
+{
+	File *f;
+	FileManager *fm = FileManager :: getFileManager();
+
+	sw_trace_stop();
+
+	static char buffer[32] = {0};
+	strcpy(buffer, "swtrace.bin");
+	int res = cmd->user_interface->string_box("Give name for trace file..", buffer, 24);
+	if(res <= 0) {
+		return 0;
+	}
+
+	FRESULT fres = fm->fopen(cmd->path.c_str(), buffer, FA_WRITE | FA_CREATE_NEW | FA_CREATE_ALWAYS, &f);
+	if(fres != FR_OK) {
+		printf("Couldn't open file..\n");
+		return -1;
+	}
+	int written = sw_trace_export(write_trace_file, f);
+	fm->fclose(f);
+	printf("Software trace: %d bytes written.\n", written);
+	return (written < 0) ? -1 : 0;
+}
+
 int SocketTest :: saveTrace(SubsysCommand *cmd)
 {
 	File *f;
@@ -17,6 +17,9 @@ class SocketTest : public ObjectWithMenu {
 	static int doTest2(SubsysCommand *cmd);
 	static int profiler(SubsysCommand *cmd);
 	static int saveTrace(SubsysCommand *cmd);
+	static int swTrace(SubsysCommand *cmd);
+	static int saveSwTrace(SubsysCommand *cmd);
+	static int heapProfile(SubsysCommand *cmd);
 	static int sendTrace(int size);
 	static void restartThread(void *a);
 public:
@@ -0,0 +1,34 @@
+#include "crc32.h"
+
+/* CRC32 with the reflected polynomial 0xEDB88320, table built on first use */
+
+static uint32_t crc32tab[256];
+static int crc32tab_valid = 0;
+
+static void crc32_init(void)
+{
+    int i, b;
+    uint32_t c;
+    for(i=0;i<256;i++) {
+        c = (uint32_t)i;
+        for(b=0;b<8;b++) {
+            c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+        }
+        crc32tab[i] = c;
+    }
+    crc32tab_valid = 1;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *buf, int len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    if (!crc32tab_valid) {
+        crc32_init();
+    }
+    crc = ~crc;
+    while(len-- > 0) {
+        crc = crc32tab[(crc ^ *(p++)) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
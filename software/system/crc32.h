@@ -0,0 +1,17 @@
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Standard (zlib / PNG) CRC32. Start with crc = 0; the result can be passed in again to continue. */
+uint32_t crc32_update(uint32_t crc, const void *buf, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CRC32_H_ */
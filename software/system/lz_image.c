@@ -0,0 +1,226 @@
+#include "lz_image.h"
+#include "crc32.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t lz_get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int lz_image_header(const uint8_t *buffer, lz_image_header_t *header)
+{
+    if ((buffer[0] != 'U') || (buffer[1] != 'L') || (buffer[2] != 'Z') || (buffer[3] != '1')) {
+        return LZ_IMAGE_NOT_PACKED;
+    }
+    header->length = lz_get_le32(buffer + 4);
+    header->packed = lz_get_le32(buffer + 8);
+    header->crc    = lz_get_le32(buffer + 12);
+    return LZ_IMAGE_OK;
+}
+
+int lz_image_block(const uint8_t *src, int src_len, uint8_t *dest, int dest_len, const uint8_t *window)
+{
+    const uint8_t *src_end = src + src_len;
+    uint8_t *d = dest;
+    uint8_t *dest_end = dest + dest_len;
+    uint32_t len, offset;
+    const uint8_t *m;
+    uint8_t token, b;
+
+    while (src < src_end) {
+        token = *(src++);
+
+        // literals
+        len = token >> 4;
+        if (len == 15) {
+            do {
+                if (src >= src_end)
+                    return LZ_IMAGE_CORRUPT;
+                b = *(src++);
+                len += b;
+            } while (b == 255);
+        }
+        if ((len > (uint32_t)(src_end - src)) || (len > (uint32_t)(dest_end - d)))
+            return LZ_IMAGE_CORRUPT;
+        memcpy(d, src, len);
+        d += len;
+        src += len;
+
+        if (src == src_end)
+            break; // last sequence has no match
+
+        // match
+        if (src_end - src < 2)
+            return LZ_IMAGE_CORRUPT;
+        offset = (uint32_t)src[0] | ((uint32_t)src[1] << 8);
+        src += 2;
+        if ((offset == 0) || (offset > (uint32_t)(d - window)))
+            return LZ_IMAGE_CORRUPT;
+
+        len = token & 15;
+        if (len == 15) {
+            do {
+                if (src >= src_end)
+                    return LZ_IMAGE_CORRUPT;
+                b = *(src++);
+                len += b;
+            } while (b == 255);
+        }
+        len += 4;
+        if (len > (uint32_t)(dest_end - d))
+            return LZ_IMAGE_CORRUPT;
+
+        // byte by byte, because source and destination may overlap
+        m = d - offset;
+        while (len--) {
+            *(d++) = *(m++);
+        }
+    }
+    return (int)(d - dest);
+}
+
+static uint8_t *lz_put_length(uint8_t *out, uint32_t len)
+{
+    while (len >= 255) {
+        *(out++) = 255;
+        len -= 255;
+    }
+    *(out++) = (uint8_t)len;
+    return out;
+}
+
+static uint32_t lz_get32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+int lz_image_pack_block(const uint8_t *src, int src_len, uint8_t *dest, uint16_t *hash)
+{
+    const uint8_t *end = src + src_len;
+    const uint8_t *limit = (src_len > 5) ? end - 5 : src; // like LZ4, the last bytes are always literals
+    const uint8_t *anchor = src;
+    const uint8_t *p = src;
+    const uint8_t *cand;
+    uint8_t *o = dest;
+    uint8_t *o_end = dest + src_len;
+    uint8_t *token;
+    uint32_t v, h, lit, len;
+    uint32_t misses = 0;
+
+    memset(hash, 0, LZ_IMAGE_HASH_SIZE * sizeof(uint16_t));
+
+    while (p + 4 <= limit) {
+        v = lz_get32(p);
+        h = (v * 2654435761U) >> 20;
+        cand = src + hash[h];
+        hash[h] = (uint16_t)(p - src);
+        if ((cand >= p) || (lz_get32(cand) != v)) {
+            p += 1 + (misses++ >> 6); // skip faster through data that does not compress
+            continue;
+        }
+        misses = 0;
+        len = 4;
+        while ((p + len < limit) && (cand[len] == p[len]))
+            len++;
+
+        lit = (uint32_t)(p - anchor);
+        if (o + lit + (lit / 255) + (len / 255) + 5 >= o_end)
+            return 0;
+        token = o++;
+        *token = (uint8_t)(((lit < 15) ? lit : 15) << 4);
+        if (lit >= 15)
+            o = lz_put_length(o, lit - 15);
+        memcpy(o, anchor, lit);
+        o += lit;
+        *(o++) = (uint8_t)(p - cand);
+        *(o++) = (uint8_t)((p - cand) >> 8);
+        len -= 4;
+        *token |= (len < 15) ? len : 15;
+        if (len >= 15)
+            o = lz_put_length(o, len - 15);
+        p += len + 4;
+        anchor = p;
+    }
+
+    lit = (uint32_t)(end - anchor);
+    if (o + lit + (lit / 255) + 2 >= o_end)
+        return 0;
+    token = o++;
+    *token = (uint8_t)(((lit < 15) ? lit : 15) << 4);
+    if (lit >= 15)
+        o = lz_put_length(o, lit - 15);
+    memcpy(o, anchor, lit);
+    o += lit;
+    return (int)(o - dest);
+}
+
+int lz_image_load(const lz_image_header_t *header, lz_image_read_t read, void *context,
+                  uint8_t *dest, uint32_t max_length)
+{
+    uint8_t size_buf[4];
+    uint32_t remaining = header->packed;
+    uint32_t done = 0;
+    uint32_t crc = 0;
+    uint32_t size, expect;
+    int result = LZ_IMAGE_OK;
+
+    if (header->length > max_length) {
+        return LZ_IMAGE_TOO_LARGE;
+    }
+
+    uint8_t *block = (uint8_t *)malloc(LZ_IMAGE_BLOCK_SIZE);
+    if (!block) {
+        return LZ_IMAGE_NO_MEMORY;
+    }
+
+    while (done < header->length) {
+        expect = header->length - done;
+        if (expect > LZ_IMAGE_BLOCK_SIZE)
+            expect = LZ_IMAGE_BLOCK_SIZE;
+
+        if ((remaining < 4) || (read(context, size_buf, 4) != 4)) {
+            result = LZ_IMAGE_READ_ERROR;
+            break;
+        }
+        size = lz_get_le32(size_buf);
+        remaining -= 4;
+
+        if (size & LZ_IMAGE_BLOCK_RAW) {
+            // stored block: read it straight to its final place
+            size &= ~LZ_IMAGE_BLOCK_RAW;
+            if ((size != expect) || (size > remaining)) {
+                result = LZ_IMAGE_CORRUPT;
+                break;
+            }
+            if (read(context, dest + done, size) != size) {
+                result = LZ_IMAGE_READ_ERROR;
+                break;
+            }
+        } else {
+            if ((size > LZ_IMAGE_BLOCK_SIZE) || (size > remaining)) {
+                result = LZ_IMAGE_CORRUPT;
+                break;
+            }
+            if (read(context, block, size) != size) {
+                result = LZ_IMAGE_READ_ERROR;
+                break;
+            }
+            if (lz_image_block(block, (int)size, dest + done, (int)expect, dest) != (int)expect) {
+                result = LZ_IMAGE_CORRUPT;
+                break;
+            }
+        }
+        remaining -= size;
+        crc = crc32_update(crc, dest + done, (int)expect);
+        done += expect;
+    }
+    free(block);
+
+    if ((result == LZ_IMAGE_OK) && (crc != header->crc)) {
+        result = LZ_IMAGE_CRC_ERROR;
+    }
+    return result;
+}
@@ -0,0 +1,70 @@
+#ifndef LZ_IMAGE_H
+#define LZ_IMAGE_H
+
+#include <stdint.h>
+
+/*
+ * Compressed application image, as produced by tools/lzpack.
+ *
+ * Header (16 bytes, all fields little endian):
+ *   0: 'U' 'L' 'Z' '1'
+ *   4: length of the uncompressed image
+ *   8: length of the block data that follows the header
+ *  12: CRC32 of the uncompressed image
+ *
+ * The block data is a sequence of blocks, each decompressing to LZ_IMAGE_BLOCK_SIZE bytes,
+ * except for the last one. Every block starts with a 32-bit little endian size. When bit 31
+ * is set, the block is stored as is. Otherwise it is an LZ4 block: a token with the number of
+ * literals (high nibble) and the match length - 4 (low nibble), extended with 255-bytes when
+ * the nibble is 15, followed by the literals and a 16-bit little endian match offset. Matches
+ * may refer back into previous blocks. The last sequence of a block has no match.
+ */
+
+#define LZ_IMAGE_HEADER_SIZE  16
+#define LZ_IMAGE_BLOCK_SIZE   16384
+#define LZ_IMAGE_BLOCK_RAW    0x80000000
+#define LZ_IMAGE_HASH_SIZE    4096 // entries of the scratch table of lz_image_pack_block
+
+#define LZ_IMAGE_OK            0
+#define LZ_IMAGE_NOT_PACKED   -1
+#define LZ_IMAGE_TOO_LARGE    -2
+#define LZ_IMAGE_READ_ERROR   -3
+#define LZ_IMAGE_CORRUPT      -4
+#define LZ_IMAGE_CRC_ERROR    -5
+#define LZ_IMAGE_NO_MEMORY    -6
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t length;      // uncompressed
+    uint32_t packed;      // block data only
+    uint32_t crc;
+} lz_image_header_t;
+
+// Reads 'length' bytes from the source of the image; returns the number of bytes actually read
+typedef uint32_t (*lz_image_read_t)(void *context, void *buffer, uint32_t length);
+
+// Returns LZ_IMAGE_OK when the 16 bytes at 'buffer' form a valid header
+int lz_image_header(const uint8_t *buffer, lz_image_header_t *header);
+
+// Decompresses one LZ4 block to 'dest'. Data before 'dest', down to 'window', may be referenced.
+// Returns the number of bytes produced, or a negative value when the block is corrupt.
+int lz_image_block(const uint8_t *src, int src_len, uint8_t *dest, int dest_len, const uint8_t *window);
+
+// Compresses 'src_len' bytes (at most LZ_IMAGE_BLOCK_SIZE) to one self-contained LZ4 block, with a
+// fast greedy parse. 'dest' shall hold src_len bytes and 'hash' LZ_IMAGE_HASH_SIZE entries.
+// Returns the size of the block, or 0 when it would not be smaller than the input.
+int lz_image_pack_block(const uint8_t *src, int src_len, uint8_t *dest, uint16_t *hash);
+
+// Reads the block data through 'read' and decompresses it to 'dest', block by block.
+// The header has already been read by the caller.
+int lz_image_load(const lz_image_header_t *header, lz_image_read_t read, void *context,
+                  uint8_t *dest, uint32_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,122 +5,283 @@ extern "C" {
     #include "dump_hex.h"
     #include "small_printf.h"
 }
-#define USE_MEM_TRACE 0
-#define MEM_VERBOSE 1
 
-MemManager :: MemManager()
+static inline uint32_t mem_hash(void *p)
 {
-    printf("*** CREATING MEMORY MANAGER ***\n");
-	for(int i=0;i<NUM_MALLOCS;i++) {
-		mem_locations[i] = 0;
-		mem_lengths[i] = 0;
-    	mem_freed[i] = -2;
-	}
-	total_alloc = 0;
-	last_alloc = 0;
-    free_count = 0;
-    enabled = false;
-    dump();
+    return (((uint32_t)((uintptr_t)p >> 3)) * 2654435761U) >> 16;
 }
 
-MemManager :: ~MemManager()
+int MemManager :: size_class(uint32_t value)
 {
-	printf("\nTotal leak: %d bytes.", total_alloc);
-	for(int i=0;i<NUM_MALLOCS;i++) {
-		if(mem_lengths[i]) {
-    		printf("NF %4d: Size: %7d  Loc: %p. Total = %d\n", i, mem_lengths[i], mem_locations[i], total_alloc);
-    		dump_hex(mem_locations[i], mem_lengths[i]);
-    		total_alloc -= mem_lengths[i];
-		}
-	}
+    int c = 0;
+    while ((value > 1) && (c < MEM_PROF_CLASSES - 1)) {
+        value >>= 1;
+        c++;
+    }
+    return c;
 }
 
-void MemManager :: dump()
+int MemManager :: find(void *p)
 {
-    printf("The memory manager is currently %s\n", enabled?"enabled":"disabled");
-	printf("Total allocated: %d bytes.", total_alloc);
-    for(int i=0;i<last_alloc;i++) {
-		printf("%4d: Size: %7d  Loc: %p. Freed: %4d\n", i, mem_lengths[i], mem_locations[i], mem_freed[i]);
+    int i = mem_hash(p) & (MEM_PROF_SLOTS - 1);
+    while (objects[i].ptr) {
+        if (objects[i].ptr == p) {
+            return i;
+        }
+        i = (i + 1) & (MEM_PROF_SLOTS - 1);
     }
+    return -1;
 }
-    
-void *MemManager :: qalloc(size_t size)
+
+uint16_t MemManager :: site_of(void *caller)
 {
-    void *p = malloc(size);
-    if(!p) {
-    	printf("alloc failed.\n");
-    	while(1)
-    		;
-    }
-    memset(p, 0xCC, size);
-
-/*
-    for(int i=0;i<NUM_MALLOCS;i++) {
-    	if(!mem_lengths[i]) {
-    		mem_lengths[i] = size;
-    		mem_locations[i] = p;
-    		total_alloc += size;
-#if MEM_VERBOSE > 0
-    		printf("++ %4d: Size: %7d  Loc: %p. Total = %d\n", i, size, p, total_alloc);
-#endif
-    		return p;
-    	}
-    }
-    printf("No space in the alloc list..\n");
-    while(1)
-    	;
-*/
-    if(last_alloc < NUM_MALLOCS) {
-    	mem_lengths[last_alloc] = size;
-    	mem_locations[last_alloc] = p;
-    	mem_freed[last_alloc] = -1;
-    	total_alloc += size;
-#if MEM_VERBOSE > 0
-		printf("++ %4d: Size: %7d  Loc: %p. Total = %d\n", last_alloc, size, p, total_alloc);
-#endif
-		last_alloc ++;
-		return p;
+    int i = mem_hash(caller) & (MEM_PROF_SITES - 1);
+    for (int n = 0; n < MEM_PROF_SITES; n++) {
+        if (i) { // site 0 is the overflow
+            if (sites[i].caller == caller) {
+                return i;
+            }
+            if (!sites[i].caller) {
+                sites[i].caller = caller;
+                return i;
+            }
+        }
+        i = (i + 1) & (MEM_PROF_SITES - 1);
     }
+    return 0;
+}
 
-    printf("No space in the alloc list..\n");
-	while(1);
+void MemManager :: allocated(void *p, size_t size, void *caller)
+{
+    if (disabled || !p) {
+        return;
+    }
+    // keep the table at most 7/8 full, or the probes get long
+    if (live_objects >= MEM_PROF_SLOTS - MEM_PROF_SLOTS / 8) {
+        untracked++;
+        return;
+    }
+    alloc_count++;
+    total_alloc += size;
+    live_objects++;
+    if (total_alloc > peak_alloc) {
+        peak_alloc = total_alloc;
+    }
+    if (live_objects > peak_objects) {
+        peak_objects = live_objects;
+    }
+
+    mem_class_t *c = &classes[size_class(size)];
+    c->allocs++;
+    c->live++;
+    c->live_bytes += size;
+
+    uint16_t s = site_of(caller);
+    mem_site_t *site = &sites[s];
+    site->allocs++;
+    site->live++;
+    site->live_bytes += size;
+    if (site->live_bytes > site->peak_bytes) {
+        site->peak_bytes = site->live_bytes;
+    }
+
+    int i = mem_hash(p) & (MEM_PROF_SLOTS - 1);
+    while (objects[i].ptr) {
+        i = (i + 1) & (MEM_PROF_SLOTS - 1);
+    }
+    objects[i].ptr  = p;
+    objects[i].size = size;
+    objects[i].born = alloc_count;
+    objects[i].site = s;
+}
+
+void MemManager :: freed(void *p)
+{
+    // also while disabled; the address may be handed out again
+    if (!p) {
+        return;
+    }
+    int i = find(p);
+    if (i < 0) {
+        unknown_frees++;
+        return;
+    }
+    mem_object_t *o = &objects[i];
+    uint32_t lifetime = alloc_count - o->born;
+
+    free_count++;
+    total_alloc -= o->size;
+    live_objects--;
+
+    mem_class_t *c = &classes[size_class(o->size)];
+    c->live--;
+    c->live_bytes -= o->size;
+    classes[size_class(lifetime)].lifetimes++;
+
+    mem_site_t *site = &sites[o->site];
+    site->frees++;
+    site->live--;
+    site->live_bytes -= o->size;
+    site->lifetime += lifetime;
+
+    // Remove from the table; entries further on in the same run move back when their
+    // home slot does not lie between the hole and themselves.
+    int j = i;
+    while (1) {
+        j = (j + 1) & (MEM_PROF_SLOTS - 1);
+        if (!objects[j].ptr) {
+            break;
+        }
+        int k = mem_hash(objects[j].ptr) & (MEM_PROF_SLOTS - 1);
+        if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) {
+            continue;
+        }
+        objects[i] = objects[j];
+        i = j;
+    }
+    objects[i].ptr = NULL;
+}
+
+void *MemManager :: qalloc(size_t size, void *caller)
+{
+    mem_lock();
+    void *p = malloc(size);
+    allocated(p, size, caller);
+    mem_unlock();
+    if (recording) {
+        printf("M+ %p %d %p\n", p, (int)size, caller);
+    }
+    return p;
 }
 
 void MemManager :: qfree(void *p)
 {
-	for(int i=0;i<NUM_MALLOCS;i++) {
-		if((mem_locations[i] == p)&&(mem_freed[i] < 0)) {
-			total_alloc -= mem_lengths[i];
-#if MEM_VERBOSE > 0
-    		printf("-- %4d: Size: %7d  Loc: %p. Total = %d\n", i, mem_lengths[i], p, total_alloc);
-#endif
-    		memset(p, i, mem_lengths[i]);
-			mem_freed[i] = free_count++;
-			free(p);
-			return;
-		}
-	}
-	printf("Trying to free a location that is not in the alloc list: %p\n", p);
-//	while(1)
-//		;
+    mem_lock();
+    freed(p);
+    free(p);
+    mem_unlock();
+    if (recording) {
+        printf("M- %p\n", p);
+    }
+}
+
+// Heap sort of the occupied slots by address, into order[]
+void MemManager :: sort_by_address(int count)
+{
+    for (int start = count / 2 - 1, end = count; end > 1; ) {
+        int root;
+        if (start >= 0) {
+            root = start--;
+        } else {
+            end--;
+            uint16_t t = order[0]; order[0] = order[end]; order[end] = t;
+            root = 0;
+        }
+        while (2 * root + 1 < end) {
+            int child = 2 * root + 1;
+            if ((child + 1 < end) && (objects[order[child]].ptr < objects[order[child + 1]].ptr)) {
+                child++;
+            }
+            if (objects[order[root]].ptr >= objects[order[child]].ptr) {
+                break;
+            }
+            uint16_t t = order[root]; order[root] = order[child]; order[child] = t;
+            root = child;
+        }
+    }
+}
+
+void MemManager :: fragmentation(mem_frag_t *frag)
+{
+    memset(frag, 0, sizeof(mem_frag_t));
+
+    mem_lock();
+    int count = 0;
+    for (int i = 0; i < MEM_PROF_SLOTS; i++) {
+        if (objects[i].ptr) {
+            order[count++] = (uint16_t)i;
+        }
+    }
+    sort_by_address(count);
+    for (int n = 0; n + 1 < count; n++) {
+        const mem_object_t *o = &objects[order[n]];
+        uintptr_t end = (uintptr_t)o->ptr + o->size;
+        uintptr_t next = (uintptr_t)objects[order[n + 1]].ptr;
+        if (next <= end + MEM_HEAP_OVERHEAD) {
+            continue;
+        }
+        uint32_t gap = (uint32_t)(next - end);
+        frag->free_blocks++;
+        frag->free_bytes += gap;
+        frag->blocks[size_class(gap)]++;
+        if (gap > frag->largest) {
+            frag->largest = gap;
+        }
+    }
+    if (count) {
+        const mem_object_t *last = &objects[order[count - 1]];
+        frag->span = (uint32_t)((uintptr_t)last->ptr + last->size - (uintptr_t)objects[order[0]].ptr);
+    }
+    mem_unlock();
+    frag->percent = (frag->free_bytes) ? 100 - (int)((100ULL * frag->largest) / frag->free_bytes) : 0;
 }
 
+void MemManager :: dump()
+{
+    printf("Heap: %d bytes in %d objects, peak %d bytes / %d objects\n", total_alloc, live_objects, peak_alloc, peak_objects);
+    printf("      %d allocations, %d frees, %d untracked, %d unknown frees\n", alloc_count, free_count, untracked, unknown_frees);
+
+    printf("Call sites by live bytes:\n");
+    bool shown[MEM_PROF_SITES];
+    memset(shown, 0, sizeof(shown));
+    for (int n = 0; n < 16; n++) {
+        int best = -1;
+        for (int i = 0; i < MEM_PROF_SITES; i++) {
+            if (!shown[i] && sites[i].allocs && ((best < 0) || (sites[i].live_bytes > sites[best].live_bytes))) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        shown[best] = true;
+        const mem_site_t *s = &sites[best];
+        printf("  %p: %7d bytes in %5d live (peak %7d), %6d allocs, avg lifetime %d\n", s->caller, s->live_bytes,
+                s->live, s->peak_bytes, s->allocs, (s->frees) ? (s->lifetime / s->frees) : 0);
+    }
+
+    printf("Size class   allocs     live  live bytes  lifetime (allocations)\n");
+    for (int i = 0; i < MEM_PROF_CLASSES; i++) {
+        const mem_class_t *c = &classes[i];
+        if (c->allocs || c->lifetimes) {
+            printf("  < %7d %8d %8d %11d  %d\n", 2 << i, c->allocs, c->live, c->live_bytes, c->lifetimes);
+        }
+    }
+
+    mem_frag_t frag;
+    fragmentation(&frag);
+    printf("Free between objects: %d bytes in %d blocks, largest %d, fragmentation %d%%, span %d bytes\n",
+            frag.free_bytes, frag.free_blocks, frag.largest, frag.percent, frag.span);
+    for (int i = 0; i < MEM_PROF_CLASSES; i++) {
+        if (frag.blocks[i]) {
+            printf("  < %7d: %d\n", 2 << i, frag.blocks[i]);
+        }
+    }
+}
+
+#if !RUNS_ON_PC
 #if USE_MEM_TRACE > 0
 MemManager mem_manager;
 #endif
 
 extern char _heap[];
 
-void * get_mem(size_t size) 
+static void * get_mem(size_t size, void *caller)
 {
     //printf("New operator for size = %d, returned: \n", size);
     void *ret;
 #if USE_MEM_TRACE == 1
-    if(mem_manager.enabled) {
-        ret = mem_manager.qalloc(size);
-    } else {
-        ret = malloc(size);
-    }
+    ret = mem_manager.qalloc(size, caller);
 #else
 	ret = malloc(size);
 #endif
@@ -133,55 +294,39 @@ void * get_mem(size_t size)
     return ret;
 }
 
-void * operator new(size_t size)
-{
-    return get_mem(size);
-}
-
-void operator delete(void *p)
+static void put_mem(void *p)
 {
 #if USE_MEM_TRACE == 1
-    if(mem_manager.enabled) {
-    	mem_manager.qfree(p);
-    } else {
-    	free(p);
-    }
+    mem_manager.qfree(p);
 #else
     //printf("Freeing %p\n", p);
     free(p);
 #endif
 }
 
+void * operator new(size_t size)
+{
+    return get_mem(size, __builtin_return_address(0));
+}
+
+void operator delete(void *p)
+{
+    put_mem(p);
+}
+
 void operator delete(void *p, unsigned int something)
 {
-#if USE_MEM_TRACE == 1
-    if(mem_manager.enabled) {
-        mem_manager.qfree(p);
-    } else {
-        free(p);
-    }
-#else
-    //printf("Freeing %p\n", p);
-    free(p);
-#endif
+    put_mem(p);
 }
 
 void * operator new[](size_t size)
 {
-    return get_mem(size);
+    return get_mem(size, __builtin_return_address(0));
 }
 
 void operator delete[](void *p)
 {
-#if USE_MEM_TRACE == 1
-    if(mem_manager.enabled) {
-    	mem_manager.qfree(p);
-    } else {
-    	free(p);
-    }
-#else
-	free(p);
-#endif
+    put_mem(p);
 }
 
 extern "C" void __cxa_pure_virtual()
@@ -192,3 +337,4 @@ void *__dso_handle = 0;
 extern "C" void  __cxa_atexit()
 {
 }
+#endif
@@ -8,27 +8,120 @@
 #ifndef MEMORY_H_
 #define MEMORY_H_
 
-#define NUM_MALLOCS 4000
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation profiler. Every new/delete goes through the MemManager, which keeps the live
+// objects in a hash table, and per call site, size class and lifetime the counts and bytes.
+// The bookkeeping is a few table lookups per allocation, but the tables take about 155 KB
+// and every allocation suspends the scheduler, so it is only built in for profiling:
+// make MEM_TRACE=1, which defines USE_MEM_TRACE. Without it, new and delete go to malloc.
+// The fragmentation report walks the live objects in address order: what lies between two
+// of them is free heap, as far as the profiler can see.
+
+#ifndef USE_MEM_TRACE
+#define USE_MEM_TRACE 0
+#endif
+
+#define MEM_PROF_SLOTS      8192 // live objects that can be tracked; a power of two
+#define MEM_PROF_SITES      256  // call sites; a power of two. Site 0 collects what does not fit
+#define MEM_PROF_CLASSES    24   // sizes and lifetimes in powers of two
+#define MEM_HEAP_OVERHEAD   (4 * sizeof(void *)) // smaller gaps between objects are chunk headers
+
+#if defined(OS) && !RUNS_ON_PC
+#include "FreeRTOS.h"
+#include "task.h"
+
+// The same lock as newlib's malloc uses; it nests, and new is never called from an interrupt
+static inline void mem_lock(void)
+{
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        vTaskSuspendAll();
+    }
+}
+
+static inline void mem_unlock(void)
+{
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        xTaskResumeAll();
+    }
+}
+#else
+static inline void mem_lock(void) { }
+static inline void mem_unlock(void) { }
+#endif
+
+struct mem_object_t {
+    void     *ptr;
+    uint32_t  size;
+    uint32_t  born;  // number of the allocation
+    uint16_t  site;
+};
+
+struct mem_site_t {
+    void     *caller;
+    uint32_t  allocs;
+    uint32_t  frees;
+    uint32_t  live;
+    uint32_t  live_bytes;
+    uint32_t  peak_bytes;
+    uint32_t  lifetime;  // sum of the lifetimes of the freed objects, in allocations
+};
+
+struct mem_class_t {
+    uint32_t  allocs;
+    uint32_t  live;
+    uint32_t  live_bytes;
+    uint32_t  lifetimes; // freed objects whose lifetime falls in this class
+};
+
+struct mem_frag_t {
+    uint32_t  free_blocks;
+    uint32_t  free_bytes;
+    uint32_t  largest;
+    uint32_t  span;                           // from the lowest to the end of the highest object
+    uint32_t  blocks[MEM_PROF_CLASSES];       // free blocks per size class
+    int       percent;                        // 100 - 100 * largest / free_bytes
+};
 
 class MemManager
 {
+    // Zero initialized, so that the allocations of the static constructors are seen too
+    mem_object_t objects[MEM_PROF_SLOTS];
+    mem_site_t   sites[MEM_PROF_SITES];
+    mem_class_t  classes[MEM_PROF_CLASSES];
+    uint16_t     order[MEM_PROF_SLOTS];      // scratch for the fragmentation report
+
+    int      find(void *p);
+    uint16_t site_of(void *caller);
+    static int size_class(uint32_t value);
+    void sort_by_address(int count);
 public:
-	void   *mem_locations[NUM_MALLOCS];
-	size_t  mem_lengths[NUM_MALLOCS];
-	int     mem_freed[NUM_MALLOCS];
-	size_t  total_alloc;
-	int     last_alloc;
-    int     free_count;
-    bool    enabled;
-    
-	MemManager();
-	~MemManager();
-	void *qalloc(size_t size);
-	void qfree(void *p);
-    void dump();
-    void enable()  { enabled = true; }
-    void disable() { enabled = false; }
-    void toggle()  { enabled = !enabled; }
+	uint32_t total_alloc;    // live bytes
+	uint32_t peak_alloc;
+	uint32_t live_objects;
+	uint32_t peak_objects;
+	uint32_t alloc_count;
+	uint32_t free_count;
+	uint32_t untracked;      // allocations that did not fit in the table; not in the figures
+	uint32_t unknown_frees;  // frees of objects that were not tracked
+	bool     disabled;
+	bool     recording;      // prints every allocation and free, for tools like test/mem_profile
+
+	void  allocated(void *p, size_t size, void *caller);
+	void  freed(void *p);
+	void *qalloc(size_t size, void *caller);
+	void  qfree(void *p);
+
+	void  fragmentation(mem_frag_t *frag);
+	const mem_site_t  *get_site(int i)  { return &sites[i]; }
+	const mem_class_t *get_class(int i) { return &classes[i]; }
+	void  dump();
+
+    void enable()  { disabled = false; }
+    void disable() { disabled = true; }
+    void toggle()  { disabled = !disabled; }
+    void record(bool on) { recording = on; }
 };
 
 extern MemManager mem_manager;
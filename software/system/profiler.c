@@ -10,7 +10,7 @@
 void *profiled_memcpy(void *str1, const void *str2, size_t n)
 {
 	uint8_t tmp = PROFILER_SUB;
-	PROFILER_SUB = 14;
+	PROFILER_MARK(14);
 //	memcpy(str1, str2, n);
 	uint32_t src_addr = (uint32_t)str2;
 	uint32_t dest_addr = (uint32_t)str1;
@@ -51,5 +51,5 @@ void *profiled_memcpy(void *str1, const void *str2, size_t n)
 			*(dest++) = *(src++);
 		}
 	}
-	PROFILER_SUB = tmp;
+	PROFILER_MARK(tmp);
 }
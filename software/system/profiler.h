@@ -8,6 +8,7 @@ extern "C" {
 #include "integer.h"
 #include "iomap.h"
 #include <stddef.h>
+#include "sw_trace.h"
 
 #define PROFILER_SUB   *((volatile uint8_t *)(TRACE_BASE + 0x04))
 #define PROFILER_TASK  *((volatile uint8_t *)(TRACE_BASE + 0x05))
@@ -16,6 +17,10 @@ extern "C" {
 #define PROFILER_ADDR *((volatile uint32_t *)(TRACE_BASE + 0x00))
 #define PROFILER_MODE  *((volatile uint8_t *)(TRACE_BASE + 0x08))
 
+// Sets the marker of the trace hardware and records it in the software trace as well
+#define PROFILER_MARK(x)      do { PROFILER_SUB = (x); sw_trace_sub(x); } while(0)
+#define PROFILER_MARK_ISR(x)  do { PROFILER_SUB = (x); sw_trace_sub_isr(x); } while(0)
+
 void *profiled_memcpy(void *str1, const void *str2, size_t n);
 
 #ifdef __cplusplus
@@ -9,45 +9,111 @@ void _diag_write_char(char c, void **param);
 void _string_write_char(char c, void **param);
 
 static const char hexchar[] = "0123456789ABCDEF";
+static const char decpairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
-static int
-_cvt(int val, char *buf, int radix, const char *digits, int leading_zeros, int width, bool signd)
+// The formatter hands whole runs of characters to a sink: the literal text between
+// two conversions, a converted number, the padding. It is a template on the sink, so
+// that the console gets a copy of its own that calls outbyte directly; through a
+// function pointer, the call per run cost more than it saved on the short runs that
+// most lines are made of.
+
+// Memory, or a putc function. Without an end, the memory is unbounded (sprintf);
+// otherwise, what does not fit is dropped, but still counted (snprintf).
+struct print_sink_t {
+    char *pnt;
+    char *end;
+    void (*putc)(char c, void **param);
+    void **param;
+    int   count;
+
+    void write(const char *src, int len);
+    void fill(char c, int len);
+};
+
+void print_sink_t :: write(const char *src, int len)
 {
-    char temp[80];
-    char *cp = temp;
-    int length = 0;
+    count += len;
+    if (putc) {
+        while (len--)
+            (*putc)(*(src++), param);
+        return;
+    }
+    if ((end) && (len > end - pnt)) {
+        len = end - pnt;
+    }
+    if (len > 16) {
+        memcpy(pnt, src, len);
+        pnt += len;
+    } else {
+        char *p = pnt; // most runs are short: a call to memcpy would cost more than the copy
+        while (len--)
+            *p++ = *src++;
+        pnt = p;
+    }
+}
 
-    unsigned int v;
-	if((signd) && (val < 0)) {
-		*buf++ = '-';
-		length++;
-		v = -val;
-	} else {
-        v = val;
+void print_sink_t :: fill(char c, int len)
+{
+    if (len <= 0)
+        return;
+    count += len;
+    if (putc) {
+        while (len--)
+            (*putc)(c, param);
+        return;
+    }
+    if ((end) && (len > end - pnt)) {
+        len = end - pnt;
     }
+    memset(pnt, c, len);
+    pnt += len;
+}
 
-    if (v == 0) {
-        /* Special case */
-        *cp++ = '0';
-        length++;
-    } else {
-        while (v) {
-            *cp++ = digits[v % radix];
-            length++;
-            v /= radix;
+// The console, as diag_printf: a newline goes out as CR LF
+struct console_sink_t {
+    int count;
+
+    void write(const char *src, int len) {
+        count += len;
+        while (len--) {
+            if (*src == '\n')
+                outbyte('\r');
+            outbyte(*(src++));
         }
     }
-    if(leading_zeros) {
-    	while(length < width) {
-    		*cp++ = '0';
-			length++;
-    	}
+    void fill(char c, int len) { // padding, never a newline
+        if (len <= 0)
+            return;
+        count += len;
+        while (len--)
+            outbyte(c);
+    }
+};
+
+// Writes the digits of v backwards, ending just before 'p'; returns the first digit.
+// Two digits per division, by a constant, so it never needs a generic divide.
+static char *
+_dec(unsigned int v, char *p)
+{
+    while (v >= 100) {
+        unsigned int q = v / 100;
+        unsigned int r = (v - q * 100) * 2;
+        *--p = decpairs[r + 1];
+        *--p = decpairs[r];
+        v = q;
     }
-    while (cp != temp) {
-        *buf++ = *--cp;
+    if (v >= 10) {
+        *--p = decpairs[2 * v + 1];
+        *--p = decpairs[2 * v];
+    } else {
+        *--p = '0' + v;
     }
-    *buf = '\0';
-    return (length);
+    return p;
 }
 
 static void
@@ -55,14 +121,14 @@ _hex(int val, char *buf, int len)
 {
     if(!len)
         return;
-        
+
     do {
         len--;
         buf[len] = hexchar[val & 15];
         val >>= 4;
     } while(len);
 }
-    
+
 static void
 _bin(int val, char *buf, int len)
 {
@@ -76,115 +142,120 @@ _bin(int val, char *buf, int len)
     } while(len);
 }
 
-#define is_digit(c) ((c >= '0') && (c <= '9'))
+template <class sink_t>
+static int
+_format(sink_t &sink, const char *fmt, va_list ap)
+{
+    char buf[16];
+    char c, *cp;
+    const char *lit;
+    unsigned int v;
+    int ival, length, width, zeros;
+    int leading_zeros;
+    bool neg;
 
+    sink.count = 0;
+    for(;;) {
+        // copy the literal text up to the next conversion in one go
+        lit = fmt;
+        while ((*fmt != '%') && (*fmt != '\0'))
+            fmt++;
+        if (fmt != lit)
+            sink.write(lit, fmt - lit);
+        if (*fmt == '\0')
+            break;
+        fmt++;
 
-extern "C" int
-_my_vprintf(void (*putc)(char c, void **param), void **param, const char *fmt, va_list ap)
-{
-    char buf[128];
-    char c, *cp=buf;
-    long long val = 0;
-    int res = 0, length, width;
-    int prepad, postpad, leading_zeros;
-    int addr;
-    
-    while ((c = *fmt++) != '\0') {
-        if (c == '%') {
+        c = *fmt++;
+        leading_zeros = (c == '0')?1:0;
+        width = 0;
+        if (c == '-') { // accepted, but all fields are left aligned anyway, except numbers
             c = *fmt++;
-            leading_zeros = (c == '0')?1:0;
-            width = 0;
-            prepad = 0;
-            postpad = 0;
-            bool nega = false;
-            if (c == '-') {
-            	nega = true;
-            	c = *fmt++;
-            }
-            if (c == '#') {
-            	width = va_arg(ap, int); // take width parameter from stack
-				c = *fmt++;
-            } else {
-				while((c >= '0')&&(c <= '9')) {
-					width = (width * 10) + (int)(c-'0');
-					c = *fmt++;
-				}
-            }
-            // Process output
-            switch (c) {
-            case 'd':
-            case 'u':
-            case 'i':
-                val = va_arg(ap, int); // up to dword
-                length = _cvt(val, buf, 10, hexchar, leading_zeros, width, (c != 'u'));
-                if(length < width)
-                    prepad = width - length;
-                cp = buf;
-                break;
-            case 's':
-                cp = va_arg(ap, char *);
-                length = 0;
-                while (cp[length] != '\0') length++;
-                if(length < width)
-                    postpad = width - length;
-                if((width) && (length > width))
-                    length = width; // truncate
-                break;
-            case 'c':
-                c = va_arg(ap, int /*char*/);
-                (*putc)(c, param);
-                res++;
-                continue;
-            case 'p': // pointer
-                addr = va_arg(ap, int);
-                length = 8;
-                _hex(addr, buf, length);
-                cp = buf;
-                break;
-            case 'x': // any hex length
-            case 'X': // any hex length
-                addr = va_arg(ap, int); // up to dword
-                _hex(addr, buf, width);
-                length = width;
-                cp = buf;
-                break;
-            case 'b': // byte
-                addr = va_arg(ap, int); // byte
-                length = 2;
-                _hex(addr, buf, length);
-                cp = buf;
-                break;
-            case 'B': // bits of a byte
-                addr = va_arg(ap, int); // byte
-                length = 8;
-                _bin(addr, buf, length);
-                cp = buf;
-                break;
-            default:
-                (*putc)('%', param);
-                (*putc)(c, param);
-                res += 2;
-                continue;
+        }
+        if (c == '#') {
+            width = va_arg(ap, int); // take width parameter from stack
+            c = *fmt++;
+        } else {
+            while((c >= '0')&&(c <= '9')) {
+                width = (width * 10) + (int)(c-'0');
+                c = *fmt++;
             }
-            while (prepad-- > 0) {
-                (*putc)(' ', param);
-                res++;
-            }    
-            while (length-- > 0) {
-                c = *cp++;
-                (*putc)(c, param);
-                res++;
+        }
+        switch (c) {
+        case 'd':
+        case 'u':
+        case 'i':
+            ival = va_arg(ap, int); // up to dword
+            neg = (c != 'u') && (ival < 0);
+            v = (neg) ? -(unsigned int)ival : (unsigned int)ival;
+            cp = _dec(v, buf + sizeof(buf));
+            length = (buf + sizeof(buf)) - cp;
+            if (neg)
+                length++;
+            zeros = (leading_zeros && (length < width)) ? width - length : 0;
+            sink.fill(' ', width - length - zeros);
+            if (neg)
+                sink.write("-", 1);
+            sink.fill('0', zeros);
+            sink.write(cp, (buf + sizeof(buf)) - cp);
+            break;
+        case 's':
+            cp = va_arg(ap, char *);
+            length = strlen(cp);
+            if((width) && (length > width))
+                length = width; // truncate
+            sink.write(cp, length);
+            sink.fill(' ', width - length);
+            break;
+        case 'c':
+            c = va_arg(ap, int /*char*/);
+            sink.write(&c, 1);
+            break;
+        case 'p': // pointer
+            ival = va_arg(ap, int);
+            _hex(ival, buf, 8);
+            sink.write(buf, 8);
+            break;
+        case 'x': // any hex length
+        case 'X': // any hex length
+            ival = va_arg(ap, int); // up to dword
+            if (width > 8) { // nothing left but the sign
+                sink.fill((ival < 0) ? 'F' : '0', width - 8);
+                width = 8;
             }
-            while (postpad-- > 0) {
-                (*putc)(' ', param);
-                res++;
-            }    
-        } else {
-            (*putc)(c, param);
-            res++;
+            _hex(ival, buf, width);
+            sink.write(buf, width);
+            break;
+        case 'b': // byte
+            ival = va_arg(ap, int); // byte
+            _hex(ival, buf, 2);
+            sink.write(buf, 2);
+            break;
+        case 'B': // bits of a byte
+            ival = va_arg(ap, int); // byte
+            _bin(ival, buf, 8);
+            sink.write(buf, 8);
+            break;
+        case '\0':
+            sink.write("%", 1);
+            return sink.count;
+        default:
+            buf[0] = '%';
+            buf[1] = c;
+            sink.write(buf, 2);
+            break;
         }
     }
-    return (res);
+    return sink.count;
+}
+
+extern "C" int
+_my_vprintf(void (*putc)(char c, void **param), void **param, const char *fmt, va_list ap)
+{
+    print_sink_t sink;
+    sink.putc = putc;
+    sink.param = param;
+    return _format(sink, fmt, ap);
 }
 
 // Default wrapper function used by diag_printf
@@ -206,21 +277,32 @@ _string_write_char(char c, void **param)
 	(*pnt)++;
 }
 
+extern "C" int vprintf(const char *fmt, va_list ap)
+{
+    console_sink_t sink;
+    return _format(sink, fmt, ap);
+}
+
 extern "C" int printf(const char *fmt, ...)
 {
     va_list ap;
     int ret;
 
     va_start(ap, fmt);
-    ret = _my_vprintf(_diag_write_char, (void **)0, fmt, ap);
+    ret = vprintf(fmt, ap);
     va_end(ap);
     return (ret);
 }
 
 extern "C" int vsprintf(char *dest, const char *fmt, va_list ap)
 {
-    int ret = _my_vprintf(_string_write_char, (void **)&dest, fmt, ap);
-    _string_write_char(0, (void **)&dest);
+    print_sink_t sink;
+    sink.putc = 0;
+    sink.pnt = dest;
+    sink.end = 0;
+
+    int ret = _format(sink, fmt, ap);
+    *sink.pnt = 0;
     return ret;
 }
 
@@ -228,11 +310,35 @@ extern "C" int sprintf(char *str, const char *fmt, ...)
 {
     va_list ap;
     int ret;
-	char *pnt = str;
-	
+
+    va_start(ap, fmt);
+    ret = vsprintf(str, fmt, ap);
+    va_end(ap);
+    return (ret);
+}
+
+// Writes at most size-1 characters and always terminates, when size > 0.
+// Returns the length the whole string would have had, like the standard one.
+extern "C" int vsnprintf(char *dest, size_t size, const char *fmt, va_list ap)
+{
+    print_sink_t sink;
+    sink.putc = 0;
+    sink.pnt = dest;
+    sink.end = (size) ? dest + size - 1 : dest;
+
+    int ret = _format(sink, fmt, ap);
+    if (size)
+        *sink.pnt = 0;
+    return ret;
+}
+
+extern "C" int snprintf(char *str, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
     va_start(ap, fmt);
-    ret = _my_vprintf(_string_write_char, (void **)&pnt, fmt, ap);
-    _string_write_char(0, (void **)&pnt);
+    ret = vsnprintf(str, size, fmt, ap);
     va_end(ap);
     return (ret);
 }
@@ -6,9 +6,13 @@ extern "C" {
 #endif
 
 #include <stdarg.h>
+#include <stddef.h>
 
 int printf(const char *fmt, ...);
+int vprintf(const char *fmt, va_list ap);
 int sprintf(char *, const char *fmt, ...);
+int snprintf(char *, size_t size, const char *fmt, ...);
+int vsnprintf(char *dest, size_t size, const char *fmt, va_list ap);
 
 int _my_vprintf(void (*putc)(char c, void **param), void **param, const char *fmt, va_list ap);
 
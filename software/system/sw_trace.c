@@ -0,0 +1,429 @@
+/*
+ * sw_trace.c
+ *
+ * Ring of trace events in RAM; see sw_trace.h for the event types and the export format.
+ */
+
+#include "sw_trace.h"
+#include "itu.h"
+#include <string.h>
+#if !RUNS_ON_PC
+#include "FreeRTOS.h"
+#include "task.h"
+#endif
+
+#if (SW_TRACE_EVENTS & (SW_TRACE_EVENTS - 1))
+#error "SW_TRACE_EVENTS must be a power of two"
+#endif
+
+static sw_trace_event_t sw_trace_ring[SW_TRACE_EVENTS];
+static volatile uint32_t sw_trace_head; // events recorded since the start, including the overwritten ones
+static volatile uint8_t sw_trace_active;
+static uint8_t sw_trace_task;
+
+static const char *sw_trace_names[SW_TRACE_MAX_NAMES]; // index = id - 1
+static int sw_trace_num_names;
+static char sw_trace_task_names[SW_TRACE_MAX_TASKS][SW_TRACE_TASK_NAME];
+
+#if !RUNS_ON_PC
+static void sw_trace_calibrate(void);
+#endif
+
+// Called with interrupts disabled
+static void sw_trace_record(uint8_t type, uint16_t id, uint32_t value)
+{
+    sw_trace_event_t *e = &sw_trace_ring[sw_trace_head & (SW_TRACE_EVENTS - 1)];
+    sw_trace_head++;
+    e->stamp = sw_trace_now();
+    e->type  = type;
+    e->task  = sw_trace_task;
+    e->id    = id;
+    e->value = value;
+}
+
+static void sw_trace_locked(uint8_t type, uint16_t id, uint32_t value)
+{
+    if (!sw_trace_active) {
+        return;
+    }
+    ENTER_SAFE_SECTION
+    sw_trace_record(type, id, value);
+    LEAVE_SAFE_SECTION
+}
+
+void sw_trace_start(void)
+{
+#if !RUNS_ON_PC
+    sw_trace_calibrate();
+#endif
+    ENTER_SAFE_SECTION
+    sw_trace_head = 0;
+    sw_trace_active = 1;
+    // the task that is running now has not been switched in since
+    sw_trace_record(SW_TRACE_TASK, sw_trace_task, 0);
+    LEAVE_SAFE_SECTION
+}
+
+void sw_trace_stop(void)
+{
+    sw_trace_active = 0;
+}
+
+int sw_trace_running(void)
+{
+    return sw_trace_active;
+}
+
+uint16_t sw_trace_name(const char *name)
+{
+    uint16_t id = 0;
+    ENTER_SAFE_SECTION
+    for (int i = 0; i < sw_trace_num_names; i++) {
+        if (strcmp(sw_trace_names[i], name) == 0) {
+            id = (uint16_t)(i + 1);
+            break;
+        }
+    }
+    if (!id && (sw_trace_num_names < SW_TRACE_MAX_NAMES)) {
+        sw_trace_names[sw_trace_num_names++] = name;
+        id = (uint16_t)sw_trace_num_names;
+    }
+    LEAVE_SAFE_SECTION
+    return id;
+}
+
+uint16_t sw_trace_id(uint16_t *id, const char *name)
+{
+    if (!*id) {
+        *id = sw_trace_name(name);
+    }
+    return *id;
+}
+
+void sw_trace_begin(uint16_t id)
+{
+    sw_trace_locked(SW_TRACE_BEGIN, id, 0);
+}
+
+void sw_trace_end(uint16_t id)
+{
+    sw_trace_locked(SW_TRACE_END, id, 0);
+}
+
+void sw_trace_counter(uint16_t id, uint32_t value)
+{
+    sw_trace_locked(SW_TRACE_COUNTER, id, value);
+}
+
+void sw_trace_instant(uint16_t id)
+{
+    sw_trace_locked(SW_TRACE_INSTANT, id, 0);
+}
+
+void sw_trace_sub(uint8_t value)
+{
+    sw_trace_locked(SW_TRACE_SUB, 0, value);
+}
+
+void sw_trace_sub_isr(uint8_t value)
+{
+    if (sw_trace_active) {
+        sw_trace_record(SW_TRACE_SUB, 0, value);
+    }
+}
+
+void sw_trace_task_switched_in(uint8_t task, const char *name)
+{
+    if (task == sw_trace_task) {
+        return;
+    }
+    sw_trace_task = task;
+    if ((task < SW_TRACE_MAX_TASKS) && !sw_trace_task_names[task][0]) {
+        strncpy(sw_trace_task_names[task], name, SW_TRACE_TASK_NAME - 1);
+    }
+    if (sw_trace_active) {
+        sw_trace_record(SW_TRACE_TASK, task, 0);
+    }
+}
+
+/*
+ * Time base. The tick hook counts system ticks; within a tick, the interrupt timer of the
+ * ITU tells how many clock cycles are left until the next one. Only the low 16 bits of that
+ * down counter can be read, while a tick lasts 250000 cycles or more. The candidates that
+ * share those 16 bits lie 65536 cycles apart, and the millisecond timer tells them apart: for
+ * each, it is known what that timer should show, once sw_trace_start has measured where it
+ * steps relative to the start of a tick. With clocks above 65.536 MHz (U64), two candidates
+ * can fall within the same millisecond; the earlier one is taken, so now and then a stamp
+ * comes out 65536 cycles (about 1 ms) early.
+ */
+static uint32_t sw_trace_tick_cycles; // 0 until calibrated
+static uint32_t sw_trace_ms_cycles;
+static uint32_t sw_trace_tick_us;
+static volatile uint32_t sw_trace_ticks;
+static volatile uint32_t sw_trace_phase; // cycles from the start of this tick to the first step of the ms timer in it
+static volatile uint16_t sw_trace_ms;    // value of the ms timer after that step
+static volatile uint8_t sw_trace_skip;   // the hook of the tick that was calibrated on has not run yet
+
+void sw_trace_clock_init(uint32_t tick_cycles, uint32_t ms_cycles, uint32_t tick_us, uint32_t phase, uint16_t ms)
+{
+    sw_trace_tick_cycles = tick_cycles;
+    sw_trace_ms_cycles = ms_cycles;
+    sw_trace_tick_us = tick_us;
+    sw_trace_ticks = 0;
+    sw_trace_phase = phase;
+    sw_trace_ms = ms;
+    sw_trace_skip = 1;
+}
+
+// Moves the state on to the next tick
+static void sw_trace_advance(uint32_t *ticks, uint32_t *phase, uint16_t *ms)
+{
+    uint32_t p = *phase;
+    uint16_t m = *ms;
+    while (p < sw_trace_tick_cycles) {
+        p += sw_trace_ms_cycles;
+        m++;
+    }
+    *ticks += 1;
+    *phase = p - sw_trace_tick_cycles;
+    *ms = m;
+}
+
+// Called with interrupts disabled, once per tick
+void sw_trace_clock_tick(void)
+{
+    if (!sw_trace_tick_cycles) {
+        return;
+    }
+    if (sw_trace_skip) {
+        sw_trace_skip = 0;
+        return;
+    }
+    uint32_t ticks = sw_trace_ticks;
+    uint32_t phase = sw_trace_phase;
+    uint16_t ms = sw_trace_ms;
+    sw_trace_advance(&ticks, &phase, &ms);
+    sw_trace_ticks = ticks;
+    sw_trace_phase = phase;
+    sw_trace_ms = ms;
+}
+
+// 'count' is the low half of the down counter, 'ms' the millisecond timer, read together;
+// 'pending' tells that the counter has reloaded, but the tick hook did not run yet.
+uint32_t sw_trace_clock_stamp(uint16_t count, uint16_t ms, int pending)
+{
+    if (!sw_trace_tick_cycles) {
+        return 0;
+    }
+    uint32_t ticks = sw_trace_ticks;
+    uint32_t phase = sw_trace_phase;
+    uint16_t first = sw_trace_ms;
+    if (pending && !sw_trace_skip) {
+        sw_trace_advance(&ticks, &phase, &first);
+    }
+
+    uint32_t best = 0;
+    int best_diff = 0x10000;
+    for (uint32_t e = (uint16_t)(sw_trace_tick_cycles - 1 - count); e < sw_trace_tick_cycles; e += 0x10000) {
+        uint16_t expect = (e < phase) ? (uint16_t)(first - 1) : (uint16_t)(first + (e - phase) / sw_trace_ms_cycles);
+        int diff = (int16_t)(ms - expect);
+        if (diff < 0) {
+            diff = -diff;
+        }
+        if (diff < best_diff) {
+            best_diff = diff;
+            best = e;
+        }
+    }
+    uint32_t us = (best * 1000) / sw_trace_ms_cycles;
+    if (us >= sw_trace_tick_us) {
+        us = sw_trace_tick_us - 1;
+    }
+    return ticks * sw_trace_tick_us + us;
+}
+
+#if !RUNS_ON_PC
+#ifndef CLOCK_FREQ
+#define CLOCK_FREQ 50000000
+#endif
+
+// As the ports program the interrupt timer: it reloads with (value + 1) * 256 cycles
+#ifdef NIOS
+#define SW_TRACE_TICK_CYCLES (((CLOCK_FREQ >> 8) / 200) << 8)  // portable/nios/nios_main.c
+#else
+#define SW_TRACE_TICK_CYCLES ((0x03D0 + 1) << 8)               // FreeRTOS/Source/portable/microblaze/port.c
+#endif
+
+static uint16_t sw_trace_count(void)
+{
+    uint8_t hi, lo;
+    do {
+        hi = ioRead8(ITU_IRQ_TIMER_HI);
+        lo = ioRead8(ITU_IRQ_TIMER_LO);
+    } while (hi != ioRead8(ITU_IRQ_TIMER_HI));
+    return ((uint16_t)hi << 8) | lo;
+}
+
+// Finds where the ms timer steps within a tick. Waits for a tick first, so that the next one
+// is not pending yet; then, with interrupts disabled, for that one and the step after it.
+static void sw_trace_calibrate(void)
+{
+    for (;;) {
+        vTaskDelay(1);
+        ENTER_SAFE_SECTION
+        if (!(ioRead8(ITU_IRQ_ACTIVE) & 0x01)) {
+            break;
+        }
+        LEAVE_SAFE_SECTION
+    }
+    while (!(ioRead8(ITU_IRQ_ACTIVE) & 0x01))
+        ;
+    uint16_t prev = sw_trace_count();
+    uint32_t elapsed = (uint16_t)(SW_TRACE_TICK_CYCLES - 1 - prev);
+    uint16_t ms = getMsTimer();
+    uint16_t now;
+    while ((now = getMsTimer()) == ms) {
+        uint16_t count = sw_trace_count();
+        elapsed += (uint16_t)(prev - count);
+        prev = count;
+    }
+    sw_trace_clock_init(SW_TRACE_TICK_CYCLES, CLOCK_FREQ / 1000, 1000000 / configTICK_RATE_HZ, elapsed, now);
+    LEAVE_SAFE_SECTION
+}
+
+void vApplicationTickHook(void)
+{
+    sw_trace_clock_tick();
+}
+
+// Only called with interrupts disabled
+uint32_t sw_trace_now(void)
+{
+    uint8_t pending;
+    uint16_t count, ms;
+    do {
+        pending = ioRead8(ITU_IRQ_ACTIVE) & 0x01;
+        count = sw_trace_count();
+        ms = getMsTimer();
+    } while (pending != (ioRead8(ITU_IRQ_ACTIVE) & 0x01));
+    return sw_trace_clock_stamp(count, ms, pending);
+}
+#endif
+
+static uint8_t *sw_trace_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    return p + 2;
+}
+
+static uint8_t *sw_trace_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+}
+
+static int sw_trace_num_tasks(void)
+{
+    int n = 0;
+    for (int i = 0; i < SW_TRACE_MAX_TASKS; i++) {
+        if (sw_trace_task_names[i][0]) {
+            n++;
+        }
+    }
+    return n;
+}
+
+int sw_trace_export_size(void)
+{
+    uint32_t count = (sw_trace_head > SW_TRACE_EVENTS) ? SW_TRACE_EVENTS : sw_trace_head;
+    int size = 16 + 1 + (int)count * SW_TRACE_EVENT_SIZE;
+    for (int i = 0; i < sw_trace_num_names; i++) {
+        size += 3 + (int)strlen(sw_trace_names[i]);
+    }
+    for (int i = 0; i < SW_TRACE_MAX_TASKS; i++) {
+        if (sw_trace_task_names[i][0]) {
+            size += 2 + (int)strlen(sw_trace_task_names[i]);
+        }
+    }
+    return size;
+}
+
+int sw_trace_export(sw_trace_write_t write, void *context)
+{
+    // names and task names are at most 258 and 17 bytes; a block of events is 384
+    uint8_t buffer[32 * SW_TRACE_EVENT_SIZE];
+    uint8_t *p = buffer;
+    int total = 0;
+
+    uint8_t was_active = sw_trace_active;
+    sw_trace_active = 0;
+
+    uint32_t head = sw_trace_head;
+    uint32_t count = (head > SW_TRACE_EVENTS) ? SW_TRACE_EVENTS : head;
+
+    p[0] = 'S'; p[1] = 'W'; p[2] = 'T'; p[3] = 'R';
+    p = sw_trace_le16(p + 4, SW_TRACE_VERSION);
+    p = sw_trace_le16(p, (uint16_t)sw_trace_num_names);
+    p = sw_trace_le32(p, count);
+    p = sw_trace_le32(p, head - count);
+
+#define SW_TRACE_FLUSH(needed) \
+    if (p + (needed) > buffer + sizeof(buffer)) { \
+        if (write(context, buffer, (int)(p - buffer)) != (int)(p - buffer)) { total = -1; goto done; } \
+        total += (int)(p - buffer); \
+        p = buffer; \
+    }
+
+    for (int i = 0; i < sw_trace_num_names; i++) {
+        int len = (int)strlen(sw_trace_names[i]);
+        if (len > 255) {
+            len = 255;
+        }
+        SW_TRACE_FLUSH(3 + len);
+        p = sw_trace_le16(p, (uint16_t)(i + 1));
+        *(p++) = (uint8_t)len;
+        memcpy(p, sw_trace_names[i], len);
+        p += len;
+    }
+
+    SW_TRACE_FLUSH(1);
+    *(p++) = (uint8_t)sw_trace_num_tasks();
+    for (int i = 0; i < SW_TRACE_MAX_TASKS; i++) {
+        int len = (int)strlen(sw_trace_task_names[i]);
+        if (!len) {
+            continue;
+        }
+        SW_TRACE_FLUSH(2 + len);
+        *(p++) = (uint8_t)i;
+        *(p++) = (uint8_t)len;
+        memcpy(p, sw_trace_task_names[i], len);
+        p += len;
+    }
+
+    for (uint32_t n = head - count; n != head; n++) {
+        const sw_trace_event_t *e = &sw_trace_ring[n & (SW_TRACE_EVENTS - 1)];
+        SW_TRACE_FLUSH(SW_TRACE_EVENT_SIZE);
+        p = sw_trace_le32(p, e->stamp);
+        *(p++) = e->type;
+        *(p++) = e->task;
+        p = sw_trace_le16(p, e->id);
+        p = sw_trace_le32(p, e->value);
+    }
+
+    if (p != buffer) {
+        if (write(context, buffer, (int)(p - buffer)) != (int)(p - buffer)) {
+            total = -1;
+            goto done;
+        }
+        total += (int)(p - buffer);
+    }
+#undef SW_TRACE_FLUSH
+
+done:
+    sw_trace_active = was_active;
+    return total;
+}
@@ -0,0 +1,123 @@
+#ifndef SW_TRACE_H
+#define SW_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Software trace: a ring of events in RAM, recorded without any trace hardware.
+ *
+ * Every event carries a time stamp in microseconds, the number of the task that was
+ * running and a type:
+ *   BEGIN / END  a named operation starts or ends; the converter pairs them per task
+ *   COUNTER      a named value, such as a queue depth or a number of bytes
+ *   INSTANT      a named moment
+ *   SUB          a value written to the PROFILER_SUB marker of the hardware profiler
+ *   TASK         the scheduler switched to another task (id = task number)
+ *
+ * When the ring is full, the oldest events are overwritten. Recording only costs the
+ * test of a flag while the trace is stopped.
+ *
+ * Export format (all fields little endian), as read by tools/sw_trace_json:
+ *   0: 'S' 'W' 'T' 'R'
+ *   4: version (16 bits), number of names (16 bits)
+ *   8: number of events (32 bits), number of events lost by overwriting (32 bits)
+ *  16: names: id (16 bits), length (8 bits), characters
+ *      tasks: number of tasks (8 bits), then per task: number (8 bits), length (8 bits), characters
+ *      events: time stamp (32 bits), type (8 bits), task (8 bits), id (16 bits), value (32 bits)
+ */
+
+#ifndef SW_TRACE_EVENTS
+#define SW_TRACE_EVENTS     4096 // 48 KB
+#endif
+#define SW_TRACE_MAX_NAMES  128
+#define SW_TRACE_MAX_TASKS  32
+#define SW_TRACE_TASK_NAME  16
+#define SW_TRACE_VERSION    1
+#define SW_TRACE_EVENT_SIZE 12
+
+typedef enum {
+    SW_TRACE_BEGIN = 1,
+    SW_TRACE_END,
+    SW_TRACE_COUNTER,
+    SW_TRACE_INSTANT,
+    SW_TRACE_SUB,
+    SW_TRACE_TASK,
+} sw_trace_type_t;
+
+typedef struct {
+    uint32_t stamp;
+    uint8_t  type;
+    uint8_t  task;
+    uint16_t id;
+    uint32_t value;
+} sw_trace_event_t;
+
+// returns the number of bytes written, or a negative value to abort the export
+typedef int (*sw_trace_write_t)(void *context, const void *buf, int len);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sw_trace_start(void);   // clears the ring and starts recording
+void sw_trace_stop(void);
+int  sw_trace_running(void);
+
+// Registers a name and returns its id; the string must stay valid. Returns 0 when the table is full.
+uint16_t sw_trace_name(const char *name);
+// Caches the id of a name in *id; used by the macros below
+uint16_t sw_trace_id(uint16_t *id, const char *name);
+
+// Task context; these disable interrupts for the few instructions that take a slot
+void sw_trace_begin(uint16_t id);
+void sw_trace_end(uint16_t id);
+void sw_trace_counter(uint16_t id, uint32_t value);
+void sw_trace_instant(uint16_t id);
+void sw_trace_sub(uint8_t value);
+
+// With interrupts already disabled: interrupt handlers and the scheduler hooks
+void sw_trace_sub_isr(uint8_t value);
+void sw_trace_task_switched_in(uint8_t task, const char *name);
+
+// Time stamp source in microseconds, counted from sw_trace_start; the target combines the
+// system ticks with the interrupt timer of the ITU (see sw_trace.c)
+uint32_t sw_trace_now(void);
+
+// The arithmetic behind sw_trace_now, apart from the hardware so that it can be tested.
+// init: cycles per tick and per millisecond, microseconds per tick, and, for the tick that
+// has just started, the cycles until the first step of the ms timer and its value after it.
+void     sw_trace_clock_init(uint32_t tick_cycles, uint32_t ms_cycles, uint32_t tick_us, uint32_t phase, uint16_t ms);
+void     sw_trace_clock_tick(void); // from the tick hook; the first call after init is the tick calibrated on
+uint32_t sw_trace_clock_stamp(uint16_t count, uint16_t ms, int pending);
+
+// Writes the recorded events in the export format; recording is paused meanwhile.
+// Returns the number of bytes written, or -1 when 'write' failed.
+int sw_trace_export(sw_trace_write_t write, void *context);
+// Number of bytes sw_trace_export will write
+int sw_trace_export_size(void);
+
+#ifdef __cplusplus
+}
+
+class SwTraceScope
+{
+    uint16_t id;
+public:
+    SwTraceScope(uint16_t i) : id(i) { sw_trace_begin(id); }
+    ~SwTraceScope() { sw_trace_end(id); }
+};
+
+// Traces the rest of the enclosing block as one operation
+#define SW_TRACE_SCOPE(name) \
+    static uint16_t sw_trace_scope_id; \
+    SwTraceScope sw_trace_scope(sw_trace_id(&sw_trace_scope_id, name))
+#endif
+
+#define SW_TRACE_BEGIN(name) \
+    do { static uint16_t sw_trace_begin_id; sw_trace_begin(sw_trace_id(&sw_trace_begin_id, name)); } while(0)
+#define SW_TRACE_END(name) \
+    do { static uint16_t sw_trace_end_id; sw_trace_end(sw_trace_id(&sw_trace_end_id, name)); } while(0)
+#define SW_TRACE_COUNTER(name, value) \
+    do { static uint16_t sw_trace_counter_id; sw_trace_counter(sw_trace_id(&sw_trace_counter_id, name), value); } while(0)
+
+#endif
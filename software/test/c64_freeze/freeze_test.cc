@@ -0,0 +1,346 @@
+/*
+ * freeze_test.cc
+ *
+ * Host test for C64IoBackup. A model of the C64 as seen through the cartridge
+ * port (RAM, colour RAM, VIC registers, write-only SIDs and the two CIAs with
+ * their port and timer A semantics) is frozen and unfrozen; the state must
+ * come back exactly. All bus accesses are given the time they take on the
+ * real machine, so the test also reports how long the C64 stays frozen, next
+ * to the same numbers for the sequence with the console output that it
+ * replaces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c64_io_backup.h"
+
+#define CYCLE_NS    1015    // PAL C64 cycle
+#define ITU_TICK_NS 5000
+#define UART_CHAR_NS 86806  // 115200 baud, 10 bits per character
+
+struct Cia
+{
+    uint8_t  pr[2];
+    uint8_t  ddr[2];
+    uint8_t  cra, crb;
+    uint8_t  icr;
+    uint16_t latch, counter;
+
+    void run(uint64_t cycles) {
+        if (!(cra & 0x01) || !cycles)
+            return;
+        if (cycles <= counter) {
+            counter -= cycles;
+            return;
+        }
+        cycles -= counter + 1;
+        counter = latch;
+        icr |= 0x01;
+        if (cra & 0x08) { // one shot
+            cra &= ~0x01;
+            return;
+        }
+        counter -= cycles % ((uint64_t)latch + 1);
+    }
+
+    uint8_t read(int reg) {
+        switch (reg) {
+        case 0x0:
+        case 0x1:
+            return (pr[reg] & ddr[reg]) | (uint8_t)~ddr[reg]; // nothing is pulling the inputs
+        case 0x2:
+        case 0x3:
+            return ddr[reg - 2];
+        case 0x4:
+            return (uint8_t)counter;
+        case 0x5:
+            return (uint8_t)(counter >> 8);
+        case 0xD: {
+            uint8_t r = icr;
+            icr = 0;
+            return r;
+        }
+        case 0xE:
+            return cra & ~0x10;
+        case 0xF:
+            return crb & ~0x10;
+        }
+        return 0;
+    }
+
+    void write(int reg, uint8_t data) {
+        switch (reg) {
+        case 0x0:
+        case 0x1:
+            pr[reg] = data;
+            break;
+        case 0x2:
+        case 0x3:
+            ddr[reg - 2] = data;
+            break;
+        case 0x4:
+            latch = (latch & 0xFF00) | data;
+            break;
+        case 0x5:
+            latch = (latch & 0x00FF) | (data << 8);
+            if (!(cra & 0x01))
+                counter = latch;
+            break;
+        case 0xE:
+            if (data & 0x10)
+                counter = latch;
+            cra = data & ~0x10;
+            break;
+        case 0xF:
+            crb = data & ~0x10;
+            break;
+        }
+    }
+
+    bool operator==(const Cia &b) const {
+        return !memcmp(pr, b.pr, 2) && !memcmp(ddr, b.ddr, 2) && (cra == b.cra) && (crb == b.crb) && (latch == b.latch);
+    }
+};
+
+struct Machine
+{
+    uint8_t ram[65536];
+    uint8_t color[1024];
+    uint8_t vic[64];
+    uint8_t sid_volume[3];
+    Cia cia1, cia2;
+};
+
+class ModelBus
+{
+    uint64_t cycles_run;
+    uint64_t itu_deadline;
+public:
+    Machine m;
+    uint64_t ns;
+    uint32_t accesses;
+
+    ModelBus() : cycles_run(0), itu_deadline(0), ns(0), accesses(0) { }
+
+    void spend(uint64_t t) {
+        ns += t;
+        uint64_t cycles = ns / CYCLE_NS;
+        m.cia1.run(cycles - cycles_run);
+        m.cia2.run(cycles - cycles_run);
+        cycles_run = cycles;
+    }
+
+    uint8_t read(uint16_t addr) {
+        spend(CYCLE_NS);
+        accesses++;
+        if ((addr & 0xFC00) == 0xD000)
+            return m.vic[addr & 0x3F];
+        if ((addr & 0xFC00) == 0xD800)
+            return m.color[addr & 0x3FF];
+        if ((addr & 0xFF00) == 0xDC00)
+            return m.cia1.read(addr & 0x0F);
+        if ((addr & 0xFF00) == 0xDD00)
+            return m.cia2.read(addr & 0x0F);
+        if ((addr & 0xFC00) == 0xD400)
+            return 0; // SIDs are write only, for what we touch
+        return m.ram[addr];
+    }
+
+    void write(uint16_t addr, uint8_t data) {
+        spend(CYCLE_NS);
+        accesses++;
+        if ((addr & 0xFC00) == 0xD000)
+            m.vic[addr & 0x3F] = data;
+        else if ((addr & 0xFC00) == 0xD800)
+            m.color[addr & 0x3FF] = data;
+        else if ((addr & 0xFF00) == 0xDC00)
+            m.cia1.write(addr & 0x0F, data);
+        else if ((addr & 0xFF00) == 0xDD00)
+            m.cia2.write(addr & 0x0F, data);
+        else if ((addr & 0xFC00) == 0xD400) {
+            if ((addr & 0x1F) == 0x18)
+                m.sid_volume[(addr == 0xD418) ? 0 : (addr == 0xD438) ? 1 : 2] = data;
+        } else
+            m.ram[addr] = data;
+    }
+
+    // one word is four cycles on the C64 bus
+    void read_block(uint16_t addr, uint32_t *dest, int words) {
+        uint8_t *d = (uint8_t *)dest;
+        for (int i = 0; i < words * 4; i++)
+            d[i] = read(addr + i);
+    }
+
+    void write_block(uint16_t addr, const uint32_t *src, int words) {
+        const uint8_t *s = (const uint8_t *)src;
+        for (int i = 0; i < words * 4; i++)
+            write(addr + i, s[i]);
+    }
+
+    void timer_start(uint8_t ticks) {
+        spend(100);
+        itu_deadline = ns + (uint64_t)ticks * ITU_TICK_NS;
+    }
+
+    bool timer_expired(void) {
+        spend(100);
+        return ns >= itu_deadline;
+    }
+};
+
+// The old sequence: everything per byte, with the console output as its pauses
+static void old_save(ModelBus &bus, const uint8_t *char_set, uint8_t *backup)
+{
+    int i;
+    for (i = 0; i < NUM_VICREGS; i++)
+        backup[i] = bus.read(0xD000 + i);
+    bus.write(0xD011, 0);
+    bus.write(0xD020, 0);
+    bus.write(0xD021, 0);
+    bus.write(0xD418, 0);
+    bus.write(0xD438, 0);
+    bus.write(0xD518, 0);
+    for (i = 0; i < 13; i++)
+        bus.read(0xDC00 + i);
+    bus.spend((uint64_t)(16 + 13 * 3 + 1) * UART_CHAR_NS); // "CIA1 registers: xx xx .. \n"
+    for (i = 0; i < COLOR_SIZE + BACKUP_SIZE; i++)
+        backup[64 + i] = bus.read(0x0400 + i);
+    for (i = 0; i < COLOR_SIZE; i++)
+        backup[64 + 3072 + i] = bus.read(0xD800 + i);
+    for (i = 0; i < CHARSET_SIZE; i++)
+        bus.write(0x0800 + i, char_set[i]);
+    for (i = 0; i < 12; i++)
+        bus.read(0xDC00); // the CIA sequence
+}
+
+static void old_restore(ModelBus &bus, const uint8_t *backup)
+{
+    int i;
+    bus.write(0xD011, 0);
+    for (i = 0; i < COLOR_SIZE + BACKUP_SIZE; i++)
+        bus.write(0x0400 + i, backup[64 + i]);
+    for (i = 0; i < COLOR_SIZE; i++)
+        bus.write(0xD800 + i, backup[64 + 3072 + i]);
+    for (i = 0; i < 7; i++)
+        bus.read(0xDC00);
+    bus.spend((uint64_t)(9 + 6 * 3) * UART_CHAR_NS); // "Set CIA1 xx xx xx xx xx xx\n"
+    for (i = 0; i < NUM_VICREGS; i++)
+        bus.write(0xD000 + i, backup[i]);
+    for (i = 0; i < 6; i++)
+        bus.write(0xD41F, 0);
+}
+
+static void setup(Machine &m, bool timer_running, uint16_t latch)
+{
+    memset(&m, 0, sizeof(m));
+    for (int i = 0; i < 65536; i++)
+        m.ram[i] = (uint8_t)(rand() >> 4);
+    for (int i = 0; i < 1024; i++)
+        m.color[i] = (uint8_t)(rand() & 0x0F);
+    for (int i = 0; i < NUM_VICREGS; i++)
+        m.vic[i] = (uint8_t)(rand() >> 4);
+    m.vic[0x11] |= 0x10; // screen on
+    m.sid_volume[0] = m.sid_volume[1] = m.sid_volume[2] = 15;
+
+    m.cia1.ddr[0] = 0xFF;
+    m.cia1.ddr[1] = 0x00;
+    m.cia1.pr[0] = 0x7F;
+    m.cia1.pr[1] = 0x5A; // not visible on the port: all inputs
+    m.cia1.latch = latch;
+    m.cia1.counter = latch / 3;
+    m.cia1.cra = timer_running ? 0x01 : 0x00;
+    m.cia1.crb = 0x08;
+
+    m.cia2.ddr[0] = 0x3F;
+    m.cia2.pr[0] = 0x97;
+    m.cia2.latch = 0xFFFF;
+    m.cia2.counter = 0xFFFF;
+}
+
+static int check(const char *what, bool ok)
+{
+    if (!ok)
+        printf("  FAIL: %s\n", what);
+    return ok ? 0 : 1;
+}
+
+static int run(const char *name, bool timer_running, uint16_t latch, const uint8_t *char_set)
+{
+    static C64IoBackup backup;
+    static ModelBus bus;
+    static Machine before;
+    int errors = 0;
+
+    setup(bus.m, timer_running, latch);
+    bus.m.cia1.icr = 0x02; // a timer B interrupt the program has not acknowledged yet
+    before = bus.m;
+    bus.ns = 0;
+    bus.accesses = 0;
+
+    backup.save(bus, char_set);
+    uint64_t save_ns = bus.ns;
+    uint32_t save_acc = bus.accesses;
+
+    errors += check("charset at $0800", !memcmp(bus.m.ram + 0x0800, char_set, CHARSET_SIZE));
+    errors += check("screen blanked", (bus.m.vic[0x11] == 0) && (bus.m.vic[0x20] == 0));
+    errors += check("sound muted", !bus.m.sid_volume[0] && !bus.m.sid_volume[1] && !bus.m.sid_volume[2]);
+    errors += check("keyboard ports", (bus.m.cia1.ddr[0] == 0xFF) && (bus.m.cia1.ddr[1] == 0x00));
+    errors += check("CIA1 interrupts pending", (bus.m.cia1.icr & before.cia1.icr) == before.cia1.icr);
+
+    // the menu scribbles over the screen, the colours and the charset area
+    memset(bus.m.ram + 0x0400, 0x20, 0x0400);
+    memset(bus.m.ram + 0x0800, 0xAA, 0x0800);
+    memset(bus.m.color, 0x01, 0x0400);
+    bus.m.cia1.ddr[0] = 0xFF;
+    bus.m.cia1.ddr[1] = 0x00;
+    bus.m.cia1.pr[0] = 0xFE;
+    bus.m.vic[0x18] = 0x14;
+    bus.m.vic[0x20] = 0x0B;
+    bus.spend(250000000ULL); // a while in the menu
+    bus.ns = 0;
+    bus.accesses = 0;
+
+    backup.restore(bus);
+    uint64_t restore_ns = bus.ns;
+    uint32_t restore_acc = bus.accesses;
+
+    errors += check("RAM", !memcmp(bus.m.ram, before.ram, sizeof(before.ram)));
+    errors += check("colour RAM", !memcmp(bus.m.color, before.color, sizeof(before.color)));
+    errors += check("VIC registers", !memcmp(bus.m.vic, before.vic, NUM_VICREGS));
+    errors += check("CIA1", bus.m.cia1 == before.cia1);
+    errors += check("CIA2", bus.m.cia2 == before.cia2);
+    errors += check("SID volume", (bus.m.sid_volume[0] == 15) && (bus.m.sid_volume[1] == 15) && (bus.m.sid_volume[2] == 15));
+
+    printf("%-28s save %6.2f ms (%4u accesses, waited %2d ms)  restore %6.2f ms (%4u accesses, waited %2d ms)  %s\n",
+           name, save_ns / 1e6, save_acc, backup.settle_ms[0], restore_ns / 1e6, restore_acc, backup.settle_ms[1],
+           errors ? "FAIL" : "ok");
+    return errors;
+}
+
+int main()
+{
+    static uint8_t char_set[CHARSET_SIZE];
+    static uint8_t old_backup[64 + 4096];
+    static ModelBus bus;
+    int errors = 0;
+
+    for (int i = 0; i < CHARSET_SIZE; i++)
+        char_set[i] = (uint8_t)(i * 7 + (i >> 3));
+
+    srand(1541);
+    errors += run("timer A running (60 Hz)", true, 0x4025, char_set);
+    errors += run("timer A running (fast)", true, 0x0100, char_set);
+    errors += run("timer A running (slowest)", true, 0xFFFF, char_set);
+    errors += run("timer A stopped", false, 0x4025, char_set);
+
+    setup(bus.m, true, 0x4025);
+    old_save(bus, char_set, old_backup);
+    uint64_t save_ns = bus.ns;
+    bus.ns = 0;
+    old_restore(bus, old_backup);
+    printf("%-28s save %6.2f ms                               restore %6.2f ms\n", "old sequence", save_ns / 1e6, bus.ns / 1e6);
+
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1 @@
+g++ -O2 -o freeze_test -I../../io/c64 -I../../system freeze_test.cc && ./freeze_test
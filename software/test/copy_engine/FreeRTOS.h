@@ -0,0 +1,48 @@
+// host build: the parts of FreeRTOS that the file manager and the copy engine use,
+// on top of pthreads, so that the reader task of the copy engine is a real thread.
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef struct sim_queue *QueueHandle_t;
+typedef struct sim_mutex *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE          1
+#define pdFALSE         0
+#define pdPASS          1
+#define portMAX_DELAY   0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define configMINIMAL_STACK_SIZE 1024
+#define tskIDLE_PRIORITY 0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t, const void *item, TickType_t);
+BaseType_t xQueueReceive(QueueHandle_t, void *item, TickType_t);
+void vQueueDelete(QueueHandle_t);
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+void vSemaphoreDelete(SemaphoreHandle_t);
+#define xSemaphoreTakeRecursive xSemaphoreTake
+#define xSemaphoreGiveRecursive xSemaphoreGive
+
+BaseType_t xTaskCreate(TaskFunction_t, const char *name, uint16_t stack, void *param, UBaseType_t prio, TaskHandle_t *);
+void vTaskDelete(TaskHandle_t);
+void vTaskDelay(TickType_t);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
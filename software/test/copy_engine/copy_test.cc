@@ -0,0 +1,398 @@
+/*
+ * copy_test.cc
+ *
+ * Runs the copy engine of filemanager/copy_engine.cc with the real FileManager and FAT
+ * code, between two FAT16 volumes in RAM. Every access to a volume sleeps for a fixed
+ * time per command and per sector, like a USB stick or an SD card would take, so the
+ * reader task overlaps for real. The engine is compared against the 32K loop that
+ * FileManager :: fcopy had before, and checked for correct data, progress in bytes,
+ * cancellation and verify.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "filemanager.h"
+#include "file_device.h"
+#include "blockdev.h"
+#include "copy_engine.h"
+
+#define IMAGE_BLOCKS    65536   // 32 MB
+#define BIG_FILE        (3 * 1024 * 1024 + 1234)
+
+static int errors;
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); errors++; } } while(0)
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static uint8_t pattern(uint32_t offset, int seed)
+{
+    return (uint8_t)((offset * 7) ^ (offset >> 9) ^ seed);
+}
+
+/*********************************************************************
+ * A RAM disk with the latency of a real one
+ *********************************************************************/
+class SlowRam : public BlockDevice
+{
+    uint8_t *memory;
+    int command_us;
+    int sector_us;
+public:
+    int reads, writes;
+    int corrupt_next_write; // flips a byte of the next write of this many sectors or more, for the verify test
+
+    SlowRam(uint8_t *mem, int command_us, int sector_us) : memory(mem), command_us(command_us),
+        sector_us(sector_us), reads(0), writes(0), corrupt_next_write(0)
+    {
+        set_state(e_device_ready);
+    }
+
+    DSTATUS init(void)   { return 0; }
+    DSTATUS status(void) { return 0; }
+
+    DRESULT read(uint8_t *buffer, uint32_t sector, int count)
+    {
+        if (sector + count > IMAGE_BLOCKS)
+            return RES_PARERR;
+        reads++;
+        usleep(command_us + count * sector_us);
+        memcpy(buffer, memory + sector * 512, count * 512);
+        return RES_OK;
+    }
+
+    DRESULT write(const uint8_t *buffer, uint32_t sector, int count)
+    {
+        if (sector + count > IMAGE_BLOCKS)
+            return RES_PARERR;
+        writes++;
+        usleep(command_us + count * sector_us);
+        memcpy(memory + sector * 512, buffer, count * 512);
+        if (corrupt_next_write && (count >= corrupt_next_write)) {
+            corrupt_next_write = 0;
+            memory[sector * 512 + 100] ^= 0x20;
+        }
+        return RES_OK;
+    }
+
+    DRESULT ioctl(uint8_t command, void *data)
+    {
+        switch (command) {
+            case GET_SECTOR_COUNT:
+                *(uint32_t *)data = IMAGE_BLOCKS;
+                return RES_OK;
+            case GET_SECTOR_SIZE:
+            case GET_BLOCK_SIZE:
+                *(uint32_t *)data = 512;
+                return RES_OK;
+            case CTRL_SYNC:
+                return RES_OK;
+        }
+        return RES_PARERR;
+    }
+};
+
+// An empty FAT16 file system of 2K clusters, without partition table
+static uint8_t *make_image(const char *label)
+{
+    uint8_t *image = new uint8_t[IMAGE_BLOCKS * 512];
+    memset(image, 0, IMAGE_BLOCKS * 512);
+
+    static const uint8_t boot[] = { 0xEB, 0x3C, 0x90, 'M', 'S', 'W', 'I', 'N', '4', '.', '1',
+                                    0x00, 0x02,     // bytes per sector
+                                    4,              // sectors per cluster
+                                    1, 0,           // reserved sectors
+                                    2,              // FATs
+                                    0x00, 0x02,     // root directory entries
+                                    0, 0,           // total sectors: see below
+                                    0xF8,
+                                    64, 0,          // sectors per FAT
+                                    63, 0, 255, 0,
+                                    0, 0, 0, 0,
+                                    0x00, 0x00, 0x01, 0x00, // total sectors
+                                    0x80, 0, 0x29, 0x41, 0x15, 0x00, 0x00,
+                                    ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+                                    'F', 'A', 'T', '1', '6', ' ', ' ', ' ' };
+    memcpy(image, boot, sizeof(boot));
+    memcpy(image + 43, label, strlen(label));
+    image[510] = 0x55;
+    image[511] = 0xAA;
+    for (int fat = 0; fat < 2; fat++) {
+        uint8_t *f = image + (1 + fat * 64) * 512;
+        f[0] = 0xF8;
+        f[1] = f[2] = f[3] = 0xFF;
+    }
+    return image;
+}
+
+/*********************************************************************
+ * Helpers on top of the FileManager
+ *********************************************************************/
+static FileManager *fm;
+
+static bool write_file(const char *path, const char *name, uint32_t size, int seed)
+{
+    File *f;
+    if (fm->fopen(path, name, FA_WRITE | FA_CREATE_ALWAYS, &f) != FR_OK) {
+        return false;
+    }
+    uint8_t *data = new uint8_t[size + 1];
+    for (uint32_t i = 0; i < size; i++) {
+        data[i] = pattern(i, seed);
+    }
+    uint32_t written = 0;
+    FRESULT res = f->write(data, size, &written);
+    fm->fclose(f);
+    delete[] data;
+    return (res == FR_OK) && (written == size);
+}
+
+static bool check_file(const char *path, const char *name, uint32_t size, int seed)
+{
+    File *f;
+    if (fm->fopen(path, name, FA_READ, &f) != FR_OK) {
+        return false;
+    }
+    uint8_t *data = new uint8_t[size + 100];
+    uint32_t transferred = 0;
+    FRESULT res = f->read(data, size + 100, &transferred);
+    fm->fclose(f);
+    bool ok = (res == FR_OK) && (transferred == size);
+    for (uint32_t i = 0; ok && (i < size); i++) {
+        ok = (data[i] == pattern(i, seed));
+    }
+    delete[] data;
+    return ok;
+}
+
+static bool exists(const char *path, const char *name)
+{
+    FileInfo info(INFO_SIZE);
+    return fm->fstat(path, name, info) == FR_OK;
+}
+
+// What FileManager :: fcopy did for a file, before the copy engine
+static FRESULT old_copy(const char *path, const char *filename, const char *dest)
+{
+    File *fi = 0, *fo = 0;
+    FRESULT ret = fm->fopen(path, filename, FA_READ, &fi);
+    if (ret != FR_OK) {
+        return ret;
+    }
+    ret = fm->fopen(dest, filename, FA_CREATE_NEW | FA_WRITE, &fo);
+    if (ret != FR_OK) {
+        fm->fclose(fi);
+        return ret;
+    }
+    uint8_t *buffer = new uint8_t[32768];
+    uint32_t transferred, written;
+    do {
+        ret = fi->read(buffer, 32768, &transferred);
+        if (ret == FR_OK) {
+            ret = fo->write(buffer, transferred, &written);
+        }
+    } while ((ret == FR_OK) && (transferred > 0));
+    delete[] buffer;
+    fm->fclose(fo);
+    fm->fclose(fi);
+    return ret;
+}
+
+/*********************************************************************
+ * Progress
+ *********************************************************************/
+struct Progress {
+    int calls;
+    uint64_t last_done;
+    uint64_t last_total;
+    uint64_t cancel_at; // 0 = never
+    bool backwards;
+};
+
+static bool on_progress(void *context, uint64_t done, uint64_t total)
+{
+    Progress *p = (Progress *)context;
+    if (done < p->last_done) {
+        p->backwards = true;
+    }
+    p->calls++;
+    p->last_done = done;
+    p->last_total = total;
+    return !p->cancel_at || (done < p->cancel_at);
+}
+
+/*********************************************************************
+ * Tests
+ *********************************************************************/
+struct TreeFile {
+    const char *dir;
+    const char *name;
+    uint32_t size;
+};
+
+static const TreeFile tree[] = {
+    { "/src/tree",      "EMPTY.BIN",  0 },
+    { "/src/tree",      "ONE.BIN",    1 },
+    { "/src/tree",      "SECTOR.BIN", 511 },
+    { "/src/tree",      "BLOCK.BIN",  8192 },
+    { "/src/tree",      "MEDIUM.BIN", 100000 },
+    { "/src/tree/sub",  "DEEPER.PRG", 70001 },
+    { "/src/tree/sub",  "BIG.BIN",    BIG_FILE },
+};
+#define TREE_FILES (int)(sizeof(tree) / sizeof(tree[0]))
+
+static void make_tree(void)
+{
+    CHECK(fm->create_dir("/src/tree") == FR_OK, "create /src/tree");
+    CHECK(fm->create_dir("/src/tree/sub") == FR_OK, "create /src/tree/sub");
+    for (int i = 0; i < TREE_FILES; i++) {
+        CHECK(write_file(tree[i].dir, tree[i].name, tree[i].size, i), "write %s", tree[i].name);
+    }
+}
+
+static void test_tree(void)
+{
+    printf("Tree copy:\n");
+    Progress p;
+    memset(&p, 0, sizeof(p));
+    uint64_t expected = 0;
+    for (int i = 0; i < TREE_FILES; i++) {
+        expected += tree[i].size;
+    }
+
+    CopyEngine engine(fm);
+    CHECK(engine.measure("/src", "tree") == FR_OK, "measure");
+    CHECK(engine.get_total() == expected, "measured %llu, expected %llu", (unsigned long long)engine.get_total(),
+            (unsigned long long)expected);
+    engine.set_progress(on_progress, &p);
+    FRESULT res = engine.copy("/src", "tree", "/dst");
+    CHECK(res == FR_OK, "copy: %s", FileSystem :: get_error_string(res));
+    CHECK((p.last_done == expected) && (p.last_total == expected), "progress ended at %llu of %llu",
+            (unsigned long long)p.last_done, (unsigned long long)p.last_total);
+    CHECK(!p.backwards, "progress went backwards");
+    CHECK(p.calls > 10, "only %d progress calls", p.calls);
+    printf("  %d files, %llu bytes, %d progress calls, buffers of %u bytes\n", TREE_FILES,
+            (unsigned long long)expected, p.calls, engine.get_block_size());
+
+    for (int i = 0; i < TREE_FILES; i++) {
+        char dir[64];
+        sprintf(dir, "/dst%s", tree[i].dir + 4);
+        CHECK(check_file(dir, tree[i].name, tree[i].size, i), "contents of %s/%s", dir, tree[i].name);
+    }
+    // a second copy finds the directory in place
+    res = engine.copy("/src", "tree", "/dst");
+    CHECK(res == FR_EXIST, "copy onto itself: %s", FileSystem :: get_error_string(res));
+}
+
+static void test_speed(SlowRam *src, SlowRam *dst)
+{
+    printf("Speed, %d KB file:\n", BIG_FILE / 1024);
+    CHECK(fm->create_dir("/dst/old") == FR_OK, "create /dst/old");
+    CHECK(fm->create_dir("/dst/new") == FR_OK, "create /dst/new");
+
+    int r0 = src->reads, w0 = dst->writes;
+    double t0 = now();
+    CHECK(old_copy("/src/tree/sub", "BIG.BIN", "/dst/old") == FR_OK, "old copy");
+    double t_old = now() - t0;
+    printf("  32K loop    : %6.1f ms, %5.2f MB/s, %4d reads, %4d writes\n", t_old * 1e3,
+            BIG_FILE / t_old / 1e6, src->reads - r0, dst->writes - w0);
+
+    r0 = src->reads;
+    w0 = dst->writes;
+    t0 = now();
+    CopyEngine engine(fm);
+    CHECK(engine.copy("/src/tree/sub", "BIG.BIN", "/dst/new") == FR_OK, "engine copy");
+    double t_new = now() - t0;
+    printf("  copy engine : %6.1f ms, %5.2f MB/s, %4d reads, %4d writes\n", t_new * 1e3,
+            BIG_FILE / t_new / 1e6, src->reads - r0, dst->writes - w0);
+    CHECK(check_file("/dst/old", "BIG.BIN", BIG_FILE, 6), "old copy contents");
+    CHECK(check_file("/dst/new", "BIG.BIN", BIG_FILE, 6), "engine copy contents");
+    CHECK(t_new < t_old * 0.8, "no gain from the reader: %.1f ms against %.1f ms", t_new * 1e3, t_old * 1e3);
+
+    // on one file system, there is no reader; it must still work
+    CHECK(fm->create_dir("/dst/same") == FR_OK, "create /dst/same");
+    CHECK(engine.copy("/dst/new", "BIG.BIN", "/dst/same") == FR_OK, "copy on one volume");
+    CHECK(check_file("/dst/same", "BIG.BIN", BIG_FILE, 6), "contents after copy on one volume");
+}
+
+static void test_cancel(void)
+{
+    printf("Cancel:\n");
+    CHECK(fm->create_dir("/dst/cancel") == FR_OK, "create /dst/cancel");
+    Progress p;
+    memset(&p, 0, sizeof(p));
+    p.cancel_at = BIG_FILE + 70001 + 8192 + 50000; // in the middle of MEDIUM.BIN; sub comes first
+
+    CopyEngine engine(fm);
+    engine.measure("/src", "tree");
+    engine.set_progress(on_progress, &p);
+    FRESULT res = engine.copy("/src", "tree", "/dst/cancel");
+    CHECK(res == FR_ABORTED, "copy: %s", FileSystem :: get_error_string(res));
+    CHECK((p.last_done >= p.cancel_at) && (p.last_done < p.last_total), "stopped at %llu of %llu",
+            (unsigned long long)p.last_done, (unsigned long long)p.last_total);
+    CHECK(!exists("/dst/cancel/tree", "MEDIUM.BIN"), "the partial file was left behind");
+    CHECK(!exists("/dst/cancel/tree", "ONE.BIN"), "copied on after the cancel");
+    CHECK(check_file("/dst/cancel/tree/sub", "BIG.BIN", BIG_FILE, 6), "what was copied before the cancel is gone");
+    CHECK(engine.copy("/src", "tree", "/dst/cancel") == FR_ABORTED, "a cancelled engine copies again");
+    printf("  stopped after %llu of %llu bytes\n", (unsigned long long)p.last_done, (unsigned long long)p.last_total);
+}
+
+static void test_verify(SlowRam *dst)
+{
+    printf("Verify:\n");
+    CHECK(fm->create_dir("/dst/verify") == FR_OK, "create /dst/verify");
+    Progress p;
+    memset(&p, 0, sizeof(p));
+
+    CopyEngine engine(fm);
+    engine.set_verify(true);
+    engine.measure("/src/tree/sub", "BIG.BIN");
+    engine.set_progress(on_progress, &p);
+    FRESULT res = engine.copy("/src/tree/sub", "BIG.BIN", "/dst/verify");
+    CHECK(res == FR_OK, "copy with verify: %s", FileSystem :: get_error_string(res));
+    CHECK((p.last_done == 2 * (uint64_t)BIG_FILE) && (p.last_total == p.last_done), "progress ended at %llu of %llu",
+            (unsigned long long)p.last_done, (unsigned long long)p.last_total);
+
+    dst->corrupt_next_write = 4; // FatFs writes up to a cluster at a time
+    res = engine.copy("/src/tree", "MEDIUM.BIN", "/dst/verify");
+    CHECK(dst->corrupt_next_write == 0, "nothing was corrupted");
+    CHECK(res == FR_VERIFY_FAILED, "copy with a bad write: %s", FileSystem :: get_error_string(res));
+    CHECK(exists("/dst/verify", "MEDIUM.BIN"), "the copy that differs should stay");
+}
+
+int main(int argc, char **argv)
+{
+    fm = FileManager :: getFileManager();
+
+    // source like a USB stick, destination like an SD card that writes slower
+    SlowRam *src = new SlowRam(make_image("SOURCE"), 250, 4);
+    SlowRam *dst = new SlowRam(make_image("DEST"), 250, 6);
+    FileDevice *src_dev = new FileDevice(src, "src", "Source");
+    FileDevice *dst_dev = new FileDevice(dst, "dst", "Destination");
+    src_dev->attach_disk(512);
+    dst_dev->attach_disk(512);
+    fm->add_root_entry(src_dev);
+    fm->add_root_entry(dst_dev);
+    src_dev->probe();
+    dst_dev->probe();
+
+    make_tree();
+    test_tree();
+    test_speed(src, dst);
+    test_cancel();
+    test_verify(dst);
+
+    fm->remove_root_entry(src_dev);
+    fm->remove_root_entry(dst_dev);
+    delete src_dev;
+    delete dst_dev;
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+gcc -c -O2 -DOS -DRUNS_ON_PC -I. -I../../system -I../../chan_fat -I../../chan_fat/full -I../../filesystem -I../../components ../../chan_fat/ff2.c ../../chan_fat/option/ffsyscall.c ../../chan_fat/option/ccsbcs.c ../../system/dump_hex.c ../../system/crc32.c && \
+g++ -O2 -o copy_test -DOS -DRUNS_ON_PC -Wno-write-strings -I. -I../../filemanager -I../../filesystem -I../../components -I../../infra -I../../system -I../../chan_fat -I../../chan_fat/full \
+    copy_test.cc rtos_sim.cc ../../filemanager/copy_engine.cc ../../filemanager/filemanager.cc ../../filemanager/path.cc ../../filemanager/file_device.cc ../../filemanager/file_partition.cc \
+    ../../filesystem/blockdev.cc ../../filesystem/disk.cc ../../filesystem/partition.cc ../../filesystem/diskio.cc ../../filesystem/file_system.cc \
+    ../../filesystem/directory.cc ../../filesystem/file.cc ../../filesystem/filesystem_root.cc ../../filesystem/filesystem_fat.cc \
+    ../../components/mystring.cc ../../components/pool.cc ../../components/pattern.cc ../../components/size_str.cc \
+    ff2.o ffsyscall.o ccsbcs.o dump_hex.o crc32.o -lpthread && \
+rm -f ff2.o ffsyscall.o ccsbcs.o dump_hex.o crc32.o && ./copy_test
@@ -0,0 +1 @@
+// host build: see FreeRTOS.h
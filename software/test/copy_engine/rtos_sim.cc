@@ -0,0 +1,158 @@
+// host build: FreeRTOS queues, mutexes and tasks on top of pthreads. Timeouts other
+// than zero are treated as forever; nothing in this test relies on them.
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "FreeRTOS.h"
+
+struct sim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    uint8_t *items;
+    UBaseType_t item_size;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct sim_mutex {
+    pthread_mutex_t lock;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    sim_queue *q = new sim_queue;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    q->items = new uint8_t[length * item_size];
+    q->item_size = item_size;
+    q->length = length;
+    q->head = 0;
+    q->count = 0;
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->length) {
+        if (!ticks) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    memcpy(q->items + ((q->head + q->count) % q->length) * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&q->lock);
+    while (!q->count) {
+        if (!ticks) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->changed);
+    delete[] q->items;
+    delete q;
+}
+
+static SemaphoreHandle_t create_mutex(void)
+{
+    sim_mutex *m = new sim_mutex;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&m->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return m;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)          { return create_mutex(); }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) { return create_mutex(); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t ticks)
+{
+    if (!ticks) {
+        return (pthread_mutex_trylock(&m->lock) == 0) ? pdTRUE : pdFALSE;
+    }
+    pthread_mutex_lock(&m->lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t m)
+{
+    pthread_mutex_unlock(&m->lock);
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t m)
+{
+    pthread_mutex_destroy(&m->lock);
+    delete m;
+}
+
+struct task_start {
+    TaskFunction_t func;
+    void *param;
+};
+
+static void *task_entry(void *a)
+{
+    task_start s = *(task_start *)a;
+    delete (task_start *)a;
+    s.func(s.param);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint16_t stack, void *param, UBaseType_t prio,
+                       TaskHandle_t *handle)
+{
+    pthread_t thread;
+    task_start *s = new task_start;
+    s->func = func;
+    s->param = param;
+    if (pthread_create(&thread, NULL, task_entry, s)) {
+        delete s;
+        return pdFALSE;
+    }
+    pthread_detach(thread);
+    if (handle) {
+        *handle = (TaskHandle_t)thread;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    pthread_exit(NULL); // only ever called by a task on itself
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep(ticks * 1000 * portTICK_PERIOD_MS);
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    return tskIDLE_PRIORITY + 1;
+}
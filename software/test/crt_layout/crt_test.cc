@@ -0,0 +1,430 @@
+/*
+ * crt_test.cc
+ *
+ * Host test for the CRT loader (crt_layout). For every cartridge type that
+ * FileTypeCRT implements, a synthetic CRT file is built and loaded three
+ * ways: with the chip packet loop of the old loader, with the one-pass parse
+ * and from the cached layout. The ROM images must be identical. The file is
+ * served by a model of FatFs on a mass storage device, which counts calls,
+ * device commands and sectors, so that the time to load can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "crt_layout.h"
+
+#define ROM_SIZE      0x1000000
+#define SECTOR        512
+#define CLUSTER       (64 * SECTOR)
+
+// costs in microseconds, roughly those of a USB stick on the Ultimate
+#define CALL_US       8.0    // File::read / seek through the file manager and FatFs
+#define COMMAND_US    400.0  // one mass storage command
+#define SECTOR_US     50.0   // 512 bytes at ~10 MB/s
+#define COPY_US_PER_K 20.0   // memcpy, ~50 MB/s
+
+// f_read / f_lseek as FatFs does them: whole sectors go straight to the caller's buffer, at most
+// up to the end of a cluster per command. Partial sectors go through the one-sector window.
+class ModelFile
+{
+    const std::vector<uint8_t> &data;
+    uint32_t fptr;
+    int32_t window;
+public:
+    int calls, commands, sectors;
+    uint32_t copied;
+
+    ModelFile(const std::vector<uint8_t> &d) : data(d), fptr(0), window(-1), calls(0), commands(0), sectors(0), copied(0) { }
+
+    double time_us(void) {
+        return calls * CALL_US + commands * COMMAND_US + sectors * SECTOR_US + (copied / 1024.0) * COPY_US_PER_K;
+    }
+
+    void disk_read(int n) {
+        commands++;
+        sectors += n;
+    }
+
+    __attribute__((noinline)) uint32_t read(void *buffer, uint32_t len) {
+        uint8_t *d = (uint8_t *)buffer;
+        uint32_t done = 0;
+        calls++;
+        if (len > data.size() - fptr)
+            len = data.size() - fptr;
+        while (done < len) {
+            uint32_t remain = len - done;
+            if (!(fptr % SECTOR) && (remain >= SECTOR)) {
+                uint32_t cc = remain / SECTOR;
+                uint32_t csect = (fptr % CLUSTER) / SECTOR;
+                if (csect + cc > CLUSTER / SECTOR)
+                    cc = CLUSTER / SECTOR - csect;
+                disk_read(cc);
+                memcpy(d + done, &data[fptr], cc * SECTOR);
+                fptr += cc * SECTOR;
+                done += cc * SECTOR;
+            } else {
+                if (window != (int32_t)(fptr / SECTOR)) {
+                    window = fptr / SECTOR;
+                    disk_read(1);
+                }
+                uint32_t n = SECTOR - (fptr % SECTOR);
+                if (n > remain)
+                    n = remain;
+                memcpy(d + done, &data[fptr], n);
+                copied += n;
+                fptr += n;
+                done += n;
+            }
+        }
+        return done;
+    }
+
+    bool seek(uint32_t pos) {
+        calls++;
+        if (pos > data.size())
+            return false;
+        fptr = pos;
+        return true;
+    }
+};
+
+static uint32_t model_read(void *context, void *buffer, uint32_t length)
+{
+    return ((ModelFile *)context)->read(buffer, length);
+}
+
+static bool model_seek(void *context, uint32_t pos)
+{
+    return ((ModelFile *)context)->seek(pos);
+}
+
+static uint16_t get_word(uint8_t *p)
+{
+    return (uint16_t(p[0]) << 8) + p[1];
+}
+
+static uint32_t get_dword(uint8_t *p)
+{
+    return uint32_t(get_word(p) << 16) + get_word(p + 2);
+}
+
+// FileTypeCRT::read_chip_packet as it was, minus the console output
+struct OldLoader
+{
+    uint8_t  chip_header[0x10];
+    uint16_t type_select;
+    uint16_t max_bank;
+    uint32_t total_read;
+    bool     load_at_a000;
+    int      chips;
+
+    bool read_chip_packet(ModelFile *f, uint8_t *rom)
+    {
+        uint32_t bytes_read = f->read(chip_header, 0x10);
+        if (!bytes_read)
+            return false;
+        if (strncmp((char*) chip_header, "CHIP", 4))
+            return false;
+        uint16_t bank = get_word(chip_header + 10);
+        uint16_t load = get_word(chip_header + 12);
+        uint16_t size = get_word(chip_header + 14);
+
+        if (bank > 0x7f)
+            return false;
+
+        if ((type_select == CART_OCEAN) && (load == 0xA000))
+            bank &= 0xEF; // max 128k per region
+
+        if (bank > max_bank)
+            max_bank = bank;
+
+        bool split = false;
+        if (size > 0x2000)
+            if ((type_select == CART_OCEAN) || (type_select == CART_EASYFLASH) || (type_select == CART_DOMARK)
+                    || (type_select == CART_SYSTEM3))
+                split = true;
+
+        uint32_t mem_addr = 0;
+
+        if (type_select == CART_KCS) {
+            mem_addr += load - 0x8000;
+        } else if (type_select == CART_NORMAL) {
+            mem_addr += (load & 0x2000);
+        } else if (type_select == CART_FINAL3) {
+            mem_addr += 0x4000 * uint32_t(bank) + (load & 0x2000);
+        } else if (split) {
+            mem_addr += 0x2000 * uint32_t(bank);
+        } else {
+            mem_addr += uint32_t(size) * uint32_t(bank);
+        }
+
+        if (load == 0xA000 && type_select != CART_KCS && type_select != CART_FINAL3) {
+            mem_addr += 512 * 1024;
+            load_at_a000 = true;
+        }
+        chips++;
+
+        if (size) {
+            if (split) {
+                bytes_read = f->read(rom + mem_addr, 0x2000);
+                total_read += bytes_read;
+                if (bytes_read != 0x2000)
+                    return false;
+                mem_addr += 512 * 1024;
+                bytes_read = f->read(rom + mem_addr, size - 0x2000);
+                total_read += bytes_read;
+            } else {
+                bytes_read = f->read(rom + mem_addr, size);
+                total_read += bytes_read;
+                if (bytes_read != size)
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct Chip
+{
+    uint16_t bank, load, size;
+};
+
+struct TestCart
+{
+    const char *name;
+    uint8_t hw_type;
+    uint16_t type_select;
+    std::vector<Chip> chips;
+};
+
+static void put_word(std::vector<uint8_t> &f, int pos, uint16_t w)
+{
+    f[pos] = w >> 8;
+    f[pos + 1] = w & 0xFF;
+}
+
+static void put_dword(std::vector<uint8_t> &f, int pos, uint32_t d)
+{
+    put_word(f, pos, d >> 16);
+    put_word(f, pos + 2, d & 0xFFFF);
+}
+
+static std::vector<uint8_t> build_crt(const TestCart &cart)
+{
+    std::vector<uint8_t> f(0x40, 0);
+    memcpy(&f[0], "C64 CARTRIDGE   ", 16);
+    put_dword(f, 0x10, 0x40);
+    put_word(f, 0x14, 0x0100);
+    put_word(f, 0x16, cart.hw_type);
+    f[0x18] = 0;
+    f[0x19] = 0;
+    strcpy((char *)&f[0x20], cart.name);
+
+    for (size_t i = 0; i < cart.chips.size(); i++) {
+        const Chip &c = cart.chips[i];
+        int pos = f.size();
+        f.resize(pos + 0x10 + c.size);
+        memcpy(&f[pos], "CHIP", 4);
+        put_dword(f, pos + 4, 0x10 + c.size);
+        put_word(f, pos + 8, 0);
+        put_word(f, pos + 10, c.bank);
+        put_word(f, pos + 12, c.load);
+        put_word(f, pos + 14, c.size);
+        for (int j = 0; j < c.size; j++)
+            f[pos + 0x10 + j] = (uint8_t)(rand() >> 4);
+    }
+    return f;
+}
+
+static std::vector<Chip> banks(int n, uint16_t load, uint16_t size, int first = 0)
+{
+    std::vector<Chip> v;
+    for (int i = 0; i < n; i++) {
+        Chip c = { (uint16_t)(first + i), load, size };
+        v.push_back(c);
+    }
+    return v;
+}
+
+static std::vector<Chip> easyflash(int n, uint16_t size)
+{
+    std::vector<Chip> v;
+    for (int i = 0; i < n; i++) {
+        Chip lo = { (uint16_t)i, 0x8000, size };
+        Chip hi = { (uint16_t)i, 0xA000, 0x2000 };
+        v.push_back(lo);
+        if (size == 0x2000)
+            v.push_back(hi);
+    }
+    return v;
+}
+
+static std::vector<Chip> join(std::vector<Chip> a, const std::vector<Chip> &b)
+{
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+static uint8_t rom_old[ROM_SIZE];
+static uint8_t rom_new[ROM_SIZE];
+static uint8_t rom_hit[ROM_SIZE];
+static uint8_t rom_chg[ROM_SIZE];
+static uint8_t buffer[CRT_READ_CHUNK];
+
+static int run(const TestCart &cart, uint32_t truncate, double *t_old, double *t_new, double *t_hit)
+{
+    std::vector<uint8_t> file = build_crt(cart);
+    if (truncate)
+        file.resize(file.size() - truncate);
+    uint8_t *hdr = &file[0];
+    int errors = 0;
+
+    memset(rom_old, 0, ROM_SIZE);
+    memset(rom_new, 0, ROM_SIZE);
+    memset(rom_hit, 0, ROM_SIZE);
+
+    // old
+    ModelFile f_old(file);
+    uint8_t crt_header[0x20];
+    f_old.read(crt_header, 0x20);
+    OldLoader old = { };
+    old.type_select = cart.type_select;
+    f_old.seek(get_dword(crt_header + 16));
+    while (old.read_chip_packet(&f_old, rom_old))
+        ;
+
+    // new: one pass
+    ModelFile f_new(file);
+    f_new.read(crt_header, 0x20);
+    CrtLayout *layout = new CrtLayout(cart.type_select, crt_header, "/Usb0/carts/test.crt", file.size(), 0x5321, 0x6000);
+    layout->parse(model_read, model_seek, &f_new, buffer, rom_new);
+    CrtLayout::store(layout);
+
+    // new: from the cache
+    ModelFile f_hit(file);
+    f_hit.read(crt_header, 0x20);
+    CrtLayout *cached = CrtLayout::find("/Usb0/carts/test.crt", file.size(), 0x5321, 0x6000, crt_header);
+    if (cached != layout) {
+        printf("  FAIL: layout not found in the cache\n");
+        errors++;
+    } else if (!cached->load(model_read, model_seek, &f_hit, buffer, rom_hit)) {
+        printf("  FAIL: loading from the cached layout\n");
+        errors++;
+    }
+
+    // another file with the same size, time stamp and CRT header
+    if (CrtLayout::find("/Usb0/carts/other.crt", file.size(), 0x5321, 0x6000, crt_header)) {
+        printf("  FAIL: layout found for another path\n");
+        errors++;
+    }
+
+    if (memcmp(rom_old, rom_new, ROM_SIZE)) {
+        printf("  FAIL: ROM image of the one-pass parse differs\n");
+        errors++;
+    }
+    if (memcmp(rom_old, rom_hit, ROM_SIZE)) {
+        printf("  FAIL: ROM image of the cached layout differs\n");
+        errors++;
+    }
+    if ((old.total_read != layout->total_read) || (old.max_bank != layout->max_bank) ||
+            (old.load_at_a000 != layout->load_at_a000)) {
+        printf("  FAIL: total %x/%x, max bank %d/%d, $A000 %d/%d\n", old.total_read, layout->total_read,
+                old.max_bank, layout->max_bank, old.load_at_a000, layout->load_at_a000);
+        errors++;
+    }
+
+    // the same file, rewritten with the same time stamp: the last chip moved to another bank
+    std::vector<uint8_t> changed = file;
+    changed[layout->chips[layout->num_chips - 1].file_offset + 11] ^= 0x01;
+    ModelFile f_changed(changed);
+    if (layout->load(model_read, model_seek, &f_changed, buffer, rom_chg)) {
+        printf("  FAIL: cached layout accepted a different chip header\n");
+        errors++;
+    }
+
+    *t_old = f_old.time_us() / 1000.0;
+    *t_new = f_new.time_us() / 1000.0;
+    *t_hit = f_hit.time_us() / 1000.0;
+    printf("%-30s %4d chips %7d bytes | old %4d calls %4d cmds %7.1f ms | parse %3d calls %3d cmds %7.1f ms | cached %4d calls %4d cmds %7.1f ms %s\n",
+            cart.name, old.chips, (int)file.size(),
+            f_old.calls, f_old.commands, *t_old,
+            f_new.calls, f_new.commands, *t_new,
+            f_hit.calls, f_hit.commands, *t_hit,
+            errors ? "FAIL" : "ok");
+    return errors;
+}
+
+int main()
+{
+    srand(64);
+    std::vector<TestCart> carts;
+
+    TestCart normal8 = { "Normal 8K", 0, CART_NORMAL, banks(1, 0x8000, 0x2000) };
+    TestCart normal16 = { "Normal 16K", 0, CART_NORMAL, join(banks(1, 0x8000, 0x2000), banks(1, 0xA000, 0x2000)) };
+    TestCart action = { "Action Replay", 1, CART_ACTION, banks(4, 0x8000, 0x2000) };
+    TestCart kcs = { "KCS Power Cartridge", 2, CART_KCS, join(banks(1, 0x8000, 0x2000), banks(1, 0xA000, 0x2000)) };
+    TestCart final3 = { "Final Cartridge III", 3, CART_FINAL3, banks(4, 0x8000, 0x4000) };
+    TestCart sbasic = { "Simons Basic", 4, CART_SBASIC, join(banks(1, 0x8000, 0x2000), banks(1, 0xA000, 0x2000)) };
+    TestCart ocean128 = { "Ocean 128K", 5, CART_OCEAN, banks(16, 0x8000, 0x2000) };
+    TestCart ocean256 = { "Ocean 256K", 5, CART_OCEAN, join(banks(16, 0x8000, 0x2000), banks(16, 0xA000, 0x2000, 16)) };
+    TestCart ocean512 = { "Ocean 512K", 5, CART_OCEAN, banks(64, 0x8000, 0x2000) };
+    TestCart supergames = { "Super Games", 8, CART_SUPERGAMES, banks(4, 0x8000, 0x4000) };
+    TestCart nordic = { "Atomic Power", 9, CART_NORDIC, banks(4, 0x8000, 0x2000) };
+    TestCart epyx = { "Epyx Fastload", 10, CART_EPYX, banks(1, 0x8000, 0x2000) };
+    TestCart westermann = { "Westermann", 11, CART_WESTERMANN, banks(1, 0x8000, 0x4000) };
+    TestCart final12 = { "Final Cartridge I", 13, CART_FINAL12, banks(1, 0x8000, 0x4000) };
+    TestCart system3 = { "C64 Game System", 15, CART_SYSTEM3, banks(64, 0x8000, 0x2000) };
+    TestCart domark = { "Magic Desk", 19, CART_DOMARK, banks(128, 0x8000, 0x2000) };
+    TestCart supersnap = { "Super Snapshot 5", 20, CART_SUPERSNAP, banks(4, 0x8000, 0x4000) };
+    TestCart comal = { "COMAL 80", 21, CART_COMAL80, banks(4, 0x8000, 0x4000) };
+    TestCart ef = { "EasyFlash 1M", 32, CART_EASYFLASH, easyflash(64, 0x2000) };
+    TestCart ef16 = { "EasyFlash 1M, 16K chips", 32, CART_EASYFLASH, easyflash(64, 0x4000) };
+    TestCart retro = { "Retro Replay", 36, CART_RETRO, banks(8, 0x8000, 0x2000) };
+    TestCart exos = { "EXOS", 44, CART_EXOS, banks(1, 0xE000, 0x2000) };
+    TestCart pagefox = { "Pagefox", 53, CART_PAGEFOX, banks(4, 0x8000, 0x4000) };
+    TestCart bbasic = { "Business Basic", 54, CART_BBASIC, join(banks(1, 0x8000, 0x2000), banks(1, 0xA000, 0x2000)) };
+
+    carts.push_back(normal8);
+    carts.push_back(normal16);
+    carts.push_back(action);
+    carts.push_back(kcs);
+    carts.push_back(final3);
+    carts.push_back(sbasic);
+    carts.push_back(ocean128);
+    carts.push_back(ocean256);
+    carts.push_back(ocean512);
+    carts.push_back(supergames);
+    carts.push_back(nordic);
+    carts.push_back(epyx);
+    carts.push_back(westermann);
+    carts.push_back(final12);
+    carts.push_back(system3);
+    carts.push_back(domark);
+    carts.push_back(supersnap);
+    carts.push_back(comal);
+    carts.push_back(ef);
+    carts.push_back(ef16);
+    carts.push_back(retro);
+    carts.push_back(exos);
+    carts.push_back(pagefox);
+    carts.push_back(bbasic);
+
+    int errors = 0;
+    double t_old, t_new, t_hit;
+    double s_old = 0, s_new = 0, s_hit = 0;
+    for (size_t i = 0; i < carts.size(); i++) {
+        errors += run(carts[i], 0, &t_old, &t_new, &t_hit);
+        s_old += t_old;
+        s_new += t_new;
+        s_hit += t_hit;
+    }
+    TestCart ef_cut = ef;
+    ef_cut.name = "EasyFlash 1M, truncated";
+    errors += run(ef_cut, 0x3000, &t_old, &t_new, &t_hit);
+
+    printf("All types: old %.1f ms, one-pass parse %.1f ms, cached layout %.1f ms\n", s_old, s_new, s_hit);
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1 @@
+g++ -O2 -o crt_test -I../../filetypes crt_test.cc ../../filetypes/crt_layout.cc && ./crt_test
@@ -0,0 +1,386 @@
+/*
+ * stream_rx.cc
+ *
+ * Receiver for the U64 data streams. Uses the sequence numbers in the packets
+ * to count lost and late packets, reassembles VIC frames and keeps the
+ * interarrival jitter (RFC 3550 style).
+ *
+ *   stream_rx             runs a simulation of the transmitter, which is shared by
+ *                         the stream generators and the CPU, and checks the receiver
+ *                         against it
+ *   stream_rx <port>      receives a live stream and reports once per second
+ *
+ * Packet formats (UDP payload, little endian):
+ *   VIC:   seq(2) frame(2) line(2, bit 15 = last line of frame) width(2)
+ *          lines per packet(1) bits per pixel(1) encoding(2), pixel data; 780 bytes
+ *   Audio: seq(2), 192 stereo samples; 770 bytes
+ *   Debug: seq(2), 360 bus cycles of 32 bits; 1442 bytes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <vector>
+
+#define VIC_PACKET_SIZE   780
+#define AUDIO_PACKET_SIZE 770
+#define DEBUG_PACKET_SIZE 1442
+
+class StreamReceiver
+{
+    bool started;
+    uint16_t expect;
+    double last_arrival;
+    uint16_t last_seq;
+    double period;  // estimated time between two sequence numbers
+
+    int frame;
+    int frame_lines;
+    int frame_height;
+public:
+    uint32_t next_seq(void) { return expect; }
+    uint32_t received;
+    uint32_t lost;
+    uint32_t late;
+    double jitter;
+    double max_gap;
+    uint32_t frames_complete;
+    uint32_t frames_incomplete;
+
+    StreamReceiver() {
+        started = false;
+        expect = 0;
+        last_arrival = 0;
+        last_seq = 0;
+        period = 0;
+        frame = -1;
+        frame_lines = 0;
+        frame_height = 0;
+        received = lost = late = 0;
+        jitter = 0;
+        max_gap = 0;
+        frames_complete = frames_incomplete = 0;
+    }
+
+    void packet(const uint8_t *p, int len, double arrival_us) {
+        uint16_t seq = p[0] | (p[1] << 8);
+        received++;
+        if (!started) {
+            started = true;
+        } else {
+            int16_t diff = (int16_t)(seq - expect);
+            if (diff < 0) {
+                late++; // a packet that was counted lost already, or a duplicate
+                if (lost) {
+                    lost--;
+                }
+                return;
+            }
+            lost += diff;
+
+            // jitter: the difference in transit time of consecutive packets
+            uint16_t steps = seq - last_seq;
+            double gap = arrival_us - last_arrival;
+            if (gap > max_gap) {
+                max_gap = gap;
+            }
+            if (steps == 1) {
+                period = (period == 0) ? gap : period + (gap - period) / 64;
+            }
+            double d = fabs(gap - steps * period);
+            jitter += (d - jitter) / 16;
+        }
+        expect = seq + 1;
+        last_seq = seq;
+        last_arrival = arrival_us;
+
+        if (len == VIC_PACKET_SIZE) {
+            vic_packet(p);
+        }
+    }
+
+    void vic_packet(const uint8_t *p) {
+        int fr = p[2] | (p[3] << 8);
+        int line = (p[4] | (p[5] << 8)) & 0x7FFF;
+        bool last = (p[5] & 0x80);
+        int lines = p[8];
+        if (fr != frame) {
+            if (frame >= 0) {
+                frame_done();
+            }
+            frame = fr;
+            frame_lines = 0;
+        }
+        frame_lines += lines;
+        if (last) {
+            frame_height = line + lines;
+            frame_done();
+            frame = -1;
+        }
+    }
+
+    void frame_done(void) {
+        if (frame_height && (frame_lines == frame_height)) {
+            frames_complete++;
+        } else {
+            frames_incomplete++;
+        }
+    }
+};
+
+/*
+ * Simulation of the transmitter. The hardware generators have room for one packet each;
+ * a packet that is not out by the time the next one is ready, is lost. The CPU offers
+ * bulk TCP frames; its transmitter is busy until the previous frame is out.
+ */
+
+#define SIM_STREAMS 3
+
+typedef struct {
+    const char *name;
+    int size;            // UDP payload
+    double period_us;
+    bool on;
+    // state
+    double next;
+    uint16_t seq;
+    bool pending;
+    double pending_since;
+    uint8_t packet[DEBUG_PACKET_SIZE];
+    uint32_t generated;
+    uint32_t dropped;
+    std::vector<uint16_t> *dropped_seq;
+    int frame, line;
+} generator_t;
+
+typedef struct {
+    uint32_t offered, sent, deferred, dropped;
+} cpu_stats_t;
+
+static double wire_time(int payload, double mbit)
+{
+    // ethernet + IP + UDP headers, FCS, preamble and inter frame gap
+    return (payload + 42 + 4 + 8 + 12) * 8.0 / mbit;
+}
+
+static void make_packet(generator_t *g)
+{
+    uint8_t *p = g->packet;
+    memset(p, 0, g->size);
+    p[0] = (uint8_t)g->seq;
+    p[1] = (uint8_t)(g->seq >> 8);
+    if (g->size == VIC_PACKET_SIZE) {
+        int last = (g->line + 4 >= 272) ? 0x8000 : 0;
+        p[2] = (uint8_t)g->frame; p[3] = (uint8_t)(g->frame >> 8);
+        p[4] = (uint8_t)g->line; p[5] = (uint8_t)((g->line | last) >> 8);
+        p[6] = 384 & 0xFF; p[7] = 384 >> 8;
+        p[8] = 4; p[9] = 4;
+        g->line += 4;
+        if (last) {
+            g->line = 0;
+            g->frame++;
+        }
+    }
+    g->seq++;
+}
+
+static int simulate(const char *title, double mbit, bool vic, bool audio, bool debug,
+                    double cpu_period, bool wait_when_busy, bool report)
+{
+    generator_t gen[SIM_STREAMS] = {
+        { "VIC",   VIC_PACKET_SIZE,   1e6 / (50.125 * 68), vic },
+        { "Audio", AUDIO_PACKET_SIZE, 192e6 / 47982.9,     audio },
+        { "Debug", DEBUG_PACKET_SIZE, 360e6 / 985248.0,    debug },
+    };
+    StreamReceiver rx[SIM_STREAMS];
+    cpu_stats_t cpu = { 0, 0, 0, 0 };
+
+    const double duration = 2e6;
+    const double wait_limit = 1000.0; // RMII_TX_WAIT_MS; the shortest the wait can be
+    double link_free = 0;       // time at which the current frame is out
+    int link_owner = -1;        // generator index, or SIM_STREAMS for the CPU
+    bool cpu_pending = false;   // a CPU frame is in the transmitter
+    double cpu_next = 0;        // time at which the CPU offers its next frame
+    double cpu_wait_until = -1; // CPU is blocked waiting for the transmitter
+    int rr = 0;
+    uint8_t tx_packet[DEBUG_PACKET_SIZE]; // the transmitter reads the packet while the generator prepares the next
+
+    for(int i = 0; i < SIM_STREAMS; i++) {
+        gen[i].next = i * 37.0;
+        gen[i].seq = 0; gen[i].pending = false; gen[i].generated = gen[i].dropped = 0;
+        gen[i].frame = 0; gen[i].line = 0;
+        gen[i].dropped_seq = new std::vector<uint16_t>;
+    }
+
+    for(double t = 0; t < duration; t += 1.0) {
+        // generators
+        for(int i = 0; i < SIM_STREAMS; i++) {
+            generator_t *g = &gen[i];
+            if (!g->on || (t < g->next)) {
+                continue;
+            }
+            g->next += g->period_us;
+            if (g->pending) {
+                g->dropped++; // overwritten before it could be sent
+                g->dropped_seq->push_back(g->seq - 1);
+            }
+            make_packet(g);
+            g->generated++;
+            g->pending = true;
+            g->pending_since = g->next - g->period_us;
+        }
+
+        // CPU side: offer a frame, wait for the transmitter, or give up
+        if (cpu_period > 0) {
+            if (cpu_wait_until >= 0) {
+                if (!cpu_pending) {
+                    cpu_pending = true;
+                    cpu.sent++;
+                    cpu_wait_until = -1;
+                    cpu_next = t + cpu_period;
+                } else if (t >= cpu_wait_until) {
+                    cpu.dropped++;
+                    cpu_wait_until = -1;
+                    cpu_next = t + cpu_period;
+                }
+            } else if (t >= cpu_next) {
+                cpu.offered++;
+                if (!cpu_pending) {
+                    cpu_pending = true;
+                    cpu.sent++;
+                    cpu_next = t + cpu_period;
+                } else if (wait_when_busy) {
+                    cpu.deferred++;
+                    cpu_wait_until = t + wait_limit;
+                } else {
+                    cpu.dropped++;
+                    cpu_next = t + cpu_period;
+                }
+            }
+        }
+
+        // link
+        if ((link_owner >= 0) && (t >= link_free)) {
+            if (link_owner == SIM_STREAMS) {
+                cpu_pending = false;
+            } else {
+                rx[link_owner].packet(tx_packet, gen[link_owner].size, t);
+            }
+            link_owner = -1;
+        }
+        if (link_owner < 0) {
+            for(int n = 0; n <= SIM_STREAMS; n++) {
+                int i = (rr + n) % (SIM_STREAMS + 1);
+                if ((i < SIM_STREAMS) && gen[i].pending) {
+                    gen[i].pending = false;
+                    memcpy(tx_packet, gen[i].packet, gen[i].size);
+                    link_owner = i;
+                    link_free = t + wire_time(gen[i].size, mbit);
+                } else if ((i == SIM_STREAMS) && cpu_pending) {
+                    link_owner = i;
+                    link_free = t + wire_time(1472, mbit);
+                } else {
+                    continue;
+                }
+                rr = i + 1;
+                break;
+            }
+        }
+    }
+
+    int errors = 0;
+    if (report) {
+        printf("%s (%g Mbit/s)\n", title, mbit);
+    }
+    for(int i = 0; i < SIM_STREAMS; i++) {
+        generator_t *g = &gen[i];
+        if (!g->on) {
+            continue;
+        }
+        // drops after the last packet that got through cannot be seen by the receiver
+        uint32_t visible = 0;
+        for(size_t d = 0; d < g->dropped_seq->size(); d++) {
+            if ((*g->dropped_seq)[d] < rx[i].next_seq()) {
+                visible++;
+            }
+        }
+        if ((rx[i].lost != visible) || rx[i].late || (rx[i].received + rx[i].lost != rx[i].next_seq())) {
+            printf("  %s: receiver counted %u lost and %u late, generator dropped %u\n", g->name, rx[i].lost, rx[i].late, visible);
+            errors++;
+        }
+        delete g->dropped_seq;
+        if (report) {
+            printf("  %-5s %6u sent, %6u received, %5u lost, jitter %6.1f us, max gap %7.1f us",
+                   g->name, g->generated, rx[i].received, rx[i].lost, rx[i].jitter, rx[i].max_gap);
+            if (g->size == VIC_PACKET_SIZE) {
+                printf(", frames %u complete, %u incomplete", rx[i].frames_complete, rx[i].frames_incomplete);
+            }
+            printf("\n");
+        }
+    }
+    if (report && (cpu_period > 0)) {
+        printf("  CPU   %6u offered, %6u sent, %5u deferred, %5u dropped (%s)\n", cpu.offered, cpu.sent,
+               cpu.deferred, cpu.dropped, wait_when_busy ? "wait when busy" : "drop when busy");
+    }
+    return errors;
+}
+
+static double now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int live(int port)
+{
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    StreamReceiver rx;
+    uint8_t buffer[2048];
+    double next_report = now_us() + 1e6;
+    while(1) {
+        int n = recv(s, buffer, sizeof(buffer), 0);
+        double t = now_us();
+        if (n >= 2) {
+            rx.packet(buffer, n, t);
+        }
+        if (t >= next_report) {
+            next_report += 1e6;
+            printf("%u received, %u lost, %u late, jitter %.1f us, max gap %.1f us, frames %u/%u\n",
+                   rx.received, rx.lost, rx.late, rx.jitter, rx.max_gap, rx.frames_complete, rx.frames_incomplete);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        return live(atoi(argv[1]));
+    }
+    int errors = 0;
+    for(int w = 0; w < 2; w++) {
+        errors += simulate("VIC + audio, bulk TCP", 100, true, true, false, 150, w, true);
+        errors += simulate("VIC + audio + debug, bulk TCP", 100, true, true, true, 150, w, true);
+        errors += simulate("Audio only, bulk TCP", 10, false, true, false, 150, w, true);
+        errors += simulate("VIC + audio, bulk TCP", 10, true, true, false, 150, w, true);
+    }
+    printf(errors ? "FAILED\n" : "All OK\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1 @@
+g++ -O2 -o stream_rx stream_rx.cc && ./stream_rx $@
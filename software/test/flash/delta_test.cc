@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file_flash.h"
+#include "flash_delta.h"
+
+#define FLASH_PAGES  4096
+#define IMAGE_START  (8 * 256) // halfway a sector, so the first sector is shared
+#define IMAGE_SIZE   (300 * 1024 + 100)
+
+static int errors = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        errors++;
+    }
+}
+
+// The old way: erase everything in range, then program each page and read it back
+static void full_flash(FileFlash *flash, int address, uint8_t *data, int length)
+{
+    int page_size = flash->get_page_size();
+    int page = address / page_size;
+    int last_sector = -1;
+    uint8_t *verify = new uint8_t[page_size];
+    while(length > 0) {
+        int sector = flash->page_to_sector(page);
+        if (sector != last_sector) {
+            last_sector = sector;
+            flash->erase_sector(sector);
+        }
+        flash->write_page(page, data);
+        flash->read_page(page, verify);
+        if (memcmp(verify, data, (length < page_size) ? length : page_size)) {
+            printf("Verify error on page %d\n", page);
+        }
+        page++;
+        data += page_size;
+        length -= page_size;
+    }
+    delete[] verify;
+}
+
+static bool flash_equals(FileFlash *flash, int address, uint8_t *data, int length)
+{
+    uint8_t *readback = new uint8_t[length];
+    flash->read_linear_addr(address, length, readback);
+    bool ok = (memcmp(readback, data, length) == 0);
+    delete[] readback;
+    return ok;
+}
+
+static void delta_flash(FileFlash *flash, const char *title, uint8_t *data, int length)
+{
+    flash->reset_counters();
+    FlashDeltaWriter writer(flash);
+    int ret = writer.write(IMAGE_START, data, length);
+    check(ret == 0, "delta write returned error");
+    flash->report(title);
+    printf("%-24s skipped: %d, erased: %d, written: %d, verify errors: %d\n", "",
+            writer.stats.sectors_skipped, writer.stats.sectors_erased,
+            writer.stats.pages_written, writer.stats.verify_errors);
+    check(flash_equals(flash, IMAGE_START, data, length), "image contents");
+}
+
+int main(int argc, char **argv)
+{
+    const char *filename = "flash_delta_test.bin";
+    remove(filename);
+    FileFlash *flash = new FileFlash(filename, FLASH_PAGES);
+
+    uint8_t *image = new uint8_t[IMAGE_SIZE + 256];
+    srand(1234);
+    for(int i=0;i<IMAGE_SIZE;i++) {
+        image[i] = (uint8_t)rand();
+    }
+    memset(image + IMAGE_SIZE, 0xFF, 256);
+
+    // something that shares the first sector with the image, which should survive
+    uint8_t other[IMAGE_START];
+    for(int i=0;i<IMAGE_START;i++) {
+        other[i] = (uint8_t)(i * 7);
+    }
+    for(int p=0;p<IMAGE_START/256;p++) {
+        flash->write_page(p, other + p * 256);
+    }
+
+    delta_flash(flash, "Delta, blank flash:", image, IMAGE_SIZE);
+    check(flash_equals(flash, 0, other, IMAGE_START), "data before the image is preserved");
+
+    delta_flash(flash, "Delta, unchanged:", image, IMAGE_SIZE);
+    check(flash->erase_count == 0, "unchanged image should not erase");
+    check(flash->program_count == 0, "unchanged image should not program");
+
+    image[0] ^= 0x55;
+    image[IMAGE_SIZE / 2] ^= 0x01;
+    image[IMAGE_SIZE - 1] ^= 0x80;
+    delta_flash(flash, "Delta, three bytes:", image, IMAGE_SIZE);
+    check(flash->erase_count == 3, "three changed sectors");
+    check(flash_equals(flash, 0, other, IMAGE_START), "data before the image is preserved");
+
+    for(int i=0;i<IMAGE_SIZE;i+=3) {
+        image[i] ^= 0xFF;
+    }
+    delta_flash(flash, "Delta, all changed:", image, IMAGE_SIZE);
+    check(flash_equals(flash, 0, other, IMAGE_START), "data before the image is preserved");
+
+    delete flash;
+    remove(filename);
+
+    // For comparison, the same image on a blank flash, done the old way
+    flash = new FileFlash(filename, FLASH_PAGES);
+    full_flash(flash, IMAGE_START, image, IMAGE_SIZE);
+    flash->report("Full erase/program:");
+    check(flash_equals(flash, IMAGE_START, image, IMAGE_SIZE), "image contents after full flash");
+
+    delete flash;
+    delete[] image;
+    remove(filename);
+
+    if (errors) {
+        printf("%d errors.\n", errors);
+        return 1;
+    }
+    printf("All OK.\n");
+    return 0;
+}
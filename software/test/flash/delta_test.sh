@@ -0,0 +1 @@
+g++ -o delta_test -DENTER_SAFE_SECTION= -DLEAVE_SAFE_SECTION= -I../../system -I../../components -I../../io/flash delta_test.cc file_flash.cc ../../io/flash/flash_delta.cc ../../system/crc32.c && ./delta_test
@@ -0,0 +1,106 @@
+#include "file_flash.h"
+#include <string.h>
+#include <sys/time.h>
+
+FileFlash :: FileFlash(const char *filename, int pages, int page_size, int pages_per_sector)
+{
+    this->page_size = page_size;
+    this->pages_per_sector = pages_per_sector;
+    num_pages = pages;
+
+    f = fopen(filename, "r+b");
+    if (!f) {
+        // new file: completely erased
+        f = fopen(filename, "w+b");
+        uint8_t *blank = new uint8_t[page_size];
+        memset(blank, 0xFF, page_size);
+        for(int i=0;i<pages;i++) {
+            fwrite(blank, page_size, 1, f);
+        }
+        delete[] blank;
+    }
+    reset_counters();
+}
+
+FileFlash :: ~FileFlash()
+{
+    if (f) {
+        fclose(f);
+    }
+}
+
+double FileFlash :: now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void FileFlash :: reset_counters(void)
+{
+    erase_count = program_count = read_count = 0;
+    time_spent = 0.0;
+}
+
+void FileFlash :: report(const char *title)
+{
+    printf("%-24s erases: %5d, programs: %6d, reads: %6d, time: %.3f ms\n", title,
+            erase_count, program_count, read_count, time_spent * 1000.0);
+}
+
+void FileFlash :: read_linear_addr(int addr, int len, void *buffer)
+{
+    fseek(f, addr, SEEK_SET);
+    fread(buffer, len, 1, f);
+}
+
+void FileFlash :: get_image_addresses(int image_id, t_flash_address *addr)
+{
+    addr->id = (uint8_t)image_id;
+    addr->has_header = 0;
+    addr->start = 0;
+    addr->device_addr = 0;
+    addr->max_length = num_pages * page_size;
+}
+
+bool FileFlash :: erase_sector(int sector)
+{
+    double start = now();
+    int size = page_size * pages_per_sector;
+    uint8_t *blank = new uint8_t[size];
+    memset(blank, 0xFF, size);
+    fseek(f, sector * size, SEEK_SET);
+    fwrite(blank, size, 1, f);
+    delete[] blank;
+    erase_count++;
+    time_spent += now() - start;
+    return true;
+}
+
+bool FileFlash :: read_page(int page, void *buffer)
+{
+    double start = now();
+    fseek(f, page * page_size, SEEK_SET);
+    fread(buffer, page_size, 1, f);
+    read_count++;
+    time_spent += now() - start;
+    return true;
+}
+
+bool FileFlash :: write_page(int page, void *buffer)
+{
+    double start = now();
+    uint8_t *current = new uint8_t[page_size];
+    uint8_t *src = (uint8_t *)buffer;
+    fseek(f, page * page_size, SEEK_SET);
+    fread(current, page_size, 1, f);
+    for(int i=0;i<page_size;i++) {
+        current[i] &= src[i]; // NOR flash can only program zeros
+    }
+    fseek(f, page * page_size, SEEK_SET);
+    fwrite(current, page_size, 1, f);
+    delete[] current;
+    program_count++;
+    time_spent += now() - start;
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef FILE_FLASH_H
+#define FILE_FLASH_H
+
+#include <stdio.h>
+#include "flash.h"
+
+// Stand-in for a serial NOR flash, backed by a file on the PC. Programming can only
+// clear bits, so a page that is written without erasing its sector first reads back wrong.
+class FileFlash : public Flash
+{
+    FILE *f;
+    int page_size;
+    int pages_per_sector;
+    int num_pages;
+    double time_spent;
+
+    double now(void);
+public:
+    int erase_count;
+    int program_count;
+    int read_count;
+
+    FileFlash(const char *filename, int pages, int page_size = 256, int pages_per_sector = 16);
+    ~FileFlash();
+
+    void reset_counters(void);
+    double get_time(void) { return time_spent; } // seconds spent in flash operations
+    void report(const char *title);
+
+    const char *get_type_string(void) { return "File"; }
+    void read_linear_addr(int addr, int len, void *buffer);
+    void get_image_addresses(int image_id, t_flash_address *addr);
+
+    int  get_number_of_pages(void) { return num_pages; }
+    int  get_page_size(void) { return page_size; }
+    int  get_sector_size(int addr) { return page_size * pages_per_sector; }
+    bool erase_sector(int sector);
+    int  page_to_sector(int page) { return page / pages_per_sector; }
+    bool read_page(int page, void *buffer);
+    bool write_page(int page, void *buffer);
+    bool need_erase(void) { return true; }
+};
+
+#endif
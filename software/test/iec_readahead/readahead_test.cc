@@ -0,0 +1,179 @@
+/*
+ * readahead_test.cc
+ *
+ * Host test for IecReadAhead. A simulated slow File (fixed latency per read
+ * plus a transfer rate) is talked to a fake IEC bus, which takes one byte
+ * from a small transmit fifo every byte time, like the IEC hardware does.
+ *
+ * 'sync' is the behaviour of the old single 256 byte buffer: the buffer is
+ * refilled in the IEC task when the talker drained it. 'async' uses the
+ * ring of buffers, filled by a reader thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "iec_readahead.h"
+#include "file.h"
+
+#define FIFO_DEPTH 16
+
+static double now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static uint8_t pattern(uint32_t offset)
+{
+    return (uint8_t)(offset * 7 + (offset >> 8));
+}
+
+class SlowFile : public File
+{
+    uint32_t size;
+    uint32_t pos;
+    int latency_us;
+    double us_per_byte;
+public:
+    SlowFile(uint32_t size, int latency, double rate) : File(NULL, NULL) {
+        this->size = size;
+        pos = 0;
+        latency_us = latency;
+        us_per_byte = rate;
+    }
+    FRESULT read(void *buffer, uint32_t len, uint32_t *transferred) {
+        if (len > size - pos) {
+            len = size - pos;
+        }
+        usleep(latency_us + (int)(len * us_per_byte));
+        for(uint32_t i=0;i<len;i++) {
+            ((uint8_t *)buffer)[i] = pattern(pos + i);
+        }
+        pos += len;
+        *transferred = len;
+        return FR_OK;
+    }
+};
+
+static volatile bool reader_run;
+
+static void *reader_thread(void *a)
+{
+    IecReadAhead *ra = (IecReadAhead *)a;
+    while(reader_run) {
+        if (!ra->fill()) {
+            usleep(50); // on the target, the reader blocks on its request queue instead
+        }
+    }
+    return NULL;
+}
+
+static int run(const char *name, bool async, uint32_t size, int latency, double rate, double byte_us)
+{
+    SlowFile file(size, latency, rate);
+    IecReadAhead *ra = async ? new IecReadAhead() : new IecReadAhead(1, 256);
+    pthread_t reader;
+
+    if (ra->start(&file, size) != IEC_OK) {
+        printf("%s: start failed\n", name);
+        return 1;
+    }
+    if (async) {
+        reader_run = true;
+        pthread_create(&reader, NULL, reader_thread, ra);
+    }
+
+    uint8_t fifo[FIFO_DEPTH];
+    int fifo_count = 0, fifo_rd = 0;
+    bool last_queued = false;
+    uint32_t received = 0;
+    int errors = 0;
+    double worst = 0.0;
+    double t_start = now_us();
+    double t_due = t_start;
+
+    while(1) {
+        // IEC task: keep the transmit fifo filled
+        while(!last_queued && (fifo_count < FIFO_DEPTH)) {
+            uint8_t data;
+            int st = ra->prefetch_data(data);
+            if ((st != IEC_OK) && (st != IEC_LAST)) {
+                if ((st == IEC_BUFFER_END) && !async && (fifo_count == 0)) {
+                    ra->fill(); // old behaviour: read the next block in the IEC task
+                    continue;
+                }
+                if (st != IEC_BUFFER_END) {
+                    printf("%s: prefetch error %d\n", name, st);
+                    return 1;
+                }
+                break;
+            }
+            fifo[(fifo_rd + fifo_count) % FIFO_DEPTH] = data;
+            fifo_count++;
+            if (st == IEC_LAST) {
+                last_queued = true;
+            }
+        }
+
+        // bus: one byte per byte time, as long as there is something in the fifo
+        double t = now_us();
+        if (t < t_due) {
+            continue;
+        }
+        if (!fifo_count) {
+            continue; // stall; the wait shows up in the delay of the next byte
+        }
+        if (t - t_due > worst) {
+            worst = t - t_due;
+        }
+        uint8_t b = fifo[fifo_rd];
+        fifo_rd = (fifo_rd + 1) % FIFO_DEPTH;
+        fifo_count--;
+        if (b != pattern(received)) {
+            errors++;
+        }
+        received++;
+        int st = ra->pop_data();
+        t_due = ((t - t_due > byte_us) ? t : t_due) + byte_us;
+        if (st == IEC_LAST) {
+            break;
+        }
+    }
+    double elapsed = now_us() - t_start;
+
+    if (async) {
+        reader_run = false;
+        pthread_join(reader, NULL);
+    }
+    ra->stop();
+    delete ra;
+
+    printf("%-6s %7u bytes, %7.0f bytes/s (bus limit %6.0f), worst stall %7.0f us, %d errors\n", name,
+           received, received / (elapsed / 1e6), 1e6 / byte_us, worst, errors);
+    return (errors || (received != size)) ? 1 : 0;
+}
+
+int main()
+{
+    int fail = 0;
+
+    // 128K file; 3 ms access time, 2 MB/s; bus at 50 KB/s (fast loader speed)
+    printf("Slow medium, fast bus:\n");
+    fail |= run("sync",  false, 131072, 3000, 0.5, 20.0);
+    fail |= run("async", true,  131072, 3000, 0.5, 20.0);
+
+    // odd sized file, network like latency
+    printf("Odd size, 10 ms latency:\n");
+    fail |= run("sync",  false, 40001, 10000, 0.1, 20.0);
+    fail |= run("async", true,  40001, 10000, 0.1, 20.0);
+
+    // empty and one byte files
+    fail |= run("tiny", true, 1, 100, 0.0, 20.0);
+
+    printf(fail ? "FAILED\n" : "All OK\n");
+    return fail;
+}
@@ -0,0 +1 @@
+g++ -O2 -o readahead_test -DENTER_SAFE_SECTION= -DLEAVE_SAFE_SECTION= -I. -I../../io/iec -I../../filesystem -I../../filemanager -I../../components -I../../infra -I../../system -I../../chan_fat -I../../chan_fat/full readahead_test.cc ../../io/iec/iec_readahead.cc ../../filesystem/file.cc ../../components/mystring.cc ../../components/pool.cc -lpthread && ./readahead_test
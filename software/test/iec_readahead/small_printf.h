@@ -0,0 +1,2 @@
+// host build: use the C library printf instead of the target one
+#include <stdio.h>
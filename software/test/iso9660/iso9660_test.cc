@@ -0,0 +1,548 @@
+/*
+ * iso9660_test.cc
+ *
+ * Generates ISO9660 images in memory, with and without Joliet, and runs
+ * FileSystem_ISO9660 on them: every file is read back and compared, every directory
+ * listed, and every path looked up, both through the path table and the old way, by
+ * reading the directories from the root on. The block device counts the requests and
+ * charges a fixed time per request and per sector, like a USB stick would, so that the
+ * throughput and the lookups per second include what the device would take.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include "blockdev.h"
+#include "partition.h"
+#include "filesystem_iso9660.h"
+
+#define SECTOR          2048
+#define COMMAND_US      150     // per request
+#define SECTOR_US       20      // per sector: 100 MB/s
+#define BIG_FILE        (24 * 1024 * 1024 + 777)
+
+static int errors;
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); errors++; } } while(0)
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static uint8_t pattern(uint32_t offset, int seed)
+{
+    return (uint8_t)((offset * 13) ^ (offset >> 11) ^ seed);
+}
+
+/*********************************************************************
+ * Block device on the image
+ *********************************************************************/
+class ImageDevice : public BlockDevice
+{
+    std::vector<uint8_t> &image;
+public:
+    int requests;
+    int sectors;
+
+    ImageDevice(std::vector<uint8_t> &img) : image(img), requests(0), sectors(0)
+    {
+        set_state(e_device_ready);
+    }
+    DSTATUS init(void)   { return 0; }
+    DSTATUS status(void) { return 0; }
+    DRESULT read(uint8_t *buffer, uint32_t sector, int count)
+    {
+        if ((sector + count) * SECTOR > image.size())
+            return RES_PARERR;
+        requests++;
+        sectors += count;
+        memcpy(buffer, &image[sector * SECTOR], count * SECTOR);
+        return RES_OK;
+    }
+    DRESULT write(const uint8_t *buffer, uint32_t sector, int count) { return RES_WRPRT; }
+    DRESULT ioctl(uint8_t command, void *data)
+    {
+        switch (command) {
+            case GET_SECTOR_COUNT:
+                *(uint32_t *)data = image.size() / SECTOR;
+                return RES_OK;
+            case GET_SECTOR_SIZE:
+                *(uint32_t *)data = SECTOR;
+                return RES_OK;
+        }
+        return RES_PARERR;
+    }
+    void reset(void) { requests = sectors = 0; }
+    double device_time(void) { return (requests * COMMAND_US + sectors * SECTOR_US) / 1e6; }
+};
+
+/*********************************************************************
+ * Image generator
+ *********************************************************************/
+struct Node {
+    std::string name;      // as in the Joliet tree; the ISO9660 tree has it in upper case
+    bool dir;
+    uint32_t size;
+    uint32_t sector;       // of the file data
+    int seed;
+    Node *parent;
+    std::vector<Node *> children;
+    // per tree: 0 = ISO9660, 1 = Joliet
+    int number[2];         // in the path table, from 1
+    uint32_t dir_sector[2];
+    uint32_t dir_size[2];
+};
+
+static Node *add(Node *parent, const std::string &name, bool dir, uint32_t size)
+{
+    static int seeds;
+    Node *n = new Node();
+    n->name = name;
+    n->dir = dir;
+    n->size = size;
+    n->seed = ++seeds;
+    n->parent = parent;
+    if (parent) {
+        parent->children.push_back(n);
+    }
+    return n;
+}
+
+static void delete_tree(Node *n)
+{
+    for (size_t i = 0; i < n->children.size(); i++) {
+        delete_tree(n->children[i]);
+    }
+    delete n;
+}
+
+// The identifier as it is on disk
+static std::string ident(Node *n, int joliet)
+{
+    std::string s = n->name;
+    if (!joliet) {
+        for (size_t i = 0; i < s.size(); i++) {
+            s[i] = toupper(s[i]);
+            if (s[i] == ' ')
+                s[i] = '_';
+        }
+    }
+    if (!n->dir) {
+        s += ";1";
+    }
+    if (!joliet) {
+        return s;
+    }
+    std::string u;
+    for (size_t i = 0; i < s.size(); i++) {
+        u += '\0';
+        u += s[i];
+    }
+    return u;
+}
+
+static bool by_ident0(Node *a, Node *b) { return ident(a, 0) < ident(b, 0); }
+static bool by_ident1(Node *a, Node *b) { return ident(a, 1) < ident(b, 1); }
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 8; p[3] = v; }
+static void put32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = v >> (8 * i);
+        p[7 - i] = v >> (8 * i);
+    }
+}
+
+static int record_length(int ident_len)
+{
+    return 33 + ident_len + ((ident_len & 1) ? 0 : 1);
+}
+
+static int put_record(uint8_t *p, uint32_t sector, uint32_t size, bool dir, const std::string &id)
+{
+    int len = record_length(id.size());
+    memset(p, 0, len);
+    p[0] = len;
+    put32(p + 2, sector);
+    put32(p + 10, size);
+    p[18] = 124; p[19] = 1; p[20] = 1;
+    p[25] = dir ? 2 : 0;
+    put16(p + 28, 1);
+    p[32] = id.size();
+    memcpy(p + 33, id.data(), id.size());
+    return len;
+}
+
+struct Image {
+    std::vector<uint8_t> data;
+    std::vector<Node *> files;
+    std::vector<Node *> dirs[2]; // in path table order
+};
+
+static void sort_children(Node *n, int joliet)
+{
+    std::vector<Node *> &c = n->children;
+    std::sort(c.begin(), c.end(), joliet ? by_ident1 : by_ident0);
+}
+
+// Lays out the directories of one tree
+static void layout_tree(Image &img, Node *root, int joliet, uint32_t &next_sector)
+{
+    std::vector<Node *> &dirs = img.dirs[joliet];
+    dirs.clear();
+    dirs.push_back(root);
+    for (size_t i = 0; i < dirs.size(); i++) { // breadth first: by level, then parent, then name
+        Node *d = dirs[i];
+        d->number[joliet] = i + 1;
+        sort_children(d, joliet);
+        uint32_t bytes = 2 * 34; // '.' and '..'
+        uint32_t in_sector = bytes;
+        for (size_t c = 0; c < d->children.size(); c++) {
+            Node *ch = d->children[c];
+            int len = record_length(ident(ch, joliet).size());
+            if (in_sector + len > SECTOR) {
+                bytes += SECTOR - in_sector;
+                in_sector = 0;
+            }
+            bytes += len;
+            in_sector += len;
+            if (ch->dir) {
+                dirs.push_back(ch);
+            }
+        }
+        d->dir_size[joliet] = ((bytes + SECTOR - 1) / SECTOR) * SECTOR;
+        d->dir_sector[joliet] = next_sector;
+        next_sector += d->dir_size[joliet] / SECTOR;
+    }
+}
+
+static std::vector<uint8_t> path_table(Image &img, int joliet, bool little)
+{
+    std::vector<Node *> &dirs = img.dirs[joliet];
+    std::vector<uint8_t> table;
+    for (size_t i = 0; i < dirs.size(); i++) {
+        Node *d = dirs[i];
+        std::string id = (i == 0) ? std::string(1, '\0') : ident(d, joliet);
+        uint32_t sector = d->dir_sector[joliet];
+        uint16_t parent = (i == 0) ? 1 : d->parent->number[joliet];
+        uint8_t e[8] = { (uint8_t)id.size(), 0 };
+        for (int b = 0; b < 4; b++) {
+            e[2 + b] = little ? (sector >> (8 * b)) : (sector >> (24 - 8 * b));
+        }
+        e[6] = little ? parent : (parent >> 8);
+        e[7] = little ? (parent >> 8) : parent;
+        table.insert(table.end(), e, e + 8);
+        table.insert(table.end(), id.begin(), id.end());
+        if (id.size() & 1) {
+            table.push_back(0);
+        }
+    }
+    return table;
+}
+
+static void write_dirs(Image &img, int joliet)
+{
+    std::vector<Node *> &dirs = img.dirs[joliet];
+    for (size_t i = 0; i < dirs.size(); i++) {
+        Node *d = dirs[i];
+        Node *up = d->parent ? d->parent : d;
+        uint8_t *base = &img.data[d->dir_sector[joliet] * SECTOR];
+        uint32_t pos = put_record(base, d->dir_sector[joliet], d->dir_size[joliet], true, std::string(1, '\0'));
+        pos += put_record(base + pos, up->dir_sector[joliet], up->dir_size[joliet], true, std::string(1, '\1'));
+        for (size_t c = 0; c < d->children.size(); c++) {
+            Node *ch = d->children[c];
+            std::string id = ident(ch, joliet);
+            if ((pos % SECTOR) + record_length(id.size()) > SECTOR) {
+                pos = ((pos / SECTOR) + 1) * SECTOR;
+            }
+            if (ch->dir) {
+                pos += put_record(base + pos, ch->dir_sector[joliet], ch->dir_size[joliet], true, id);
+            } else {
+                pos += put_record(base + pos, ch->sector, ch->size, false, id);
+            }
+        }
+    }
+}
+
+static void collect_files(Node *n, std::vector<Node *> &files)
+{
+    for (size_t i = 0; i < n->children.size(); i++) {
+        if (n->children[i]->dir)
+            collect_files(n->children[i], files);
+        else
+            files.push_back(n->children[i]);
+    }
+}
+
+static void make_image(Image &img, Node *root, bool joliet)
+{
+    int trees = joliet ? 2 : 1;
+    uint32_t next = 16 + trees + 1; // descriptors and the terminator
+    std::vector<uint8_t> tables[2][2];
+    uint32_t table_sector[2][2];
+    for (int t = 0; t < trees; t++) {
+        layout_tree(img, root, t, next);
+        tables[t][0] = path_table(img, t, true);
+        tables[t][1] = path_table(img, t, false);
+    }
+    for (int t = 0; t < trees; t++) {
+        for (int e = 0; e < 2; e++) {
+            table_sector[t][e] = next;
+            next += (tables[t][e].size() + SECTOR - 1) / SECTOR;
+        }
+    }
+    img.files.clear();
+    collect_files(root, img.files);
+    for (size_t i = 0; i < img.files.size(); i++) {
+        img.files[i]->sector = next;
+        next += (img.files[i]->size + SECTOR - 1) / SECTOR;
+    }
+
+    img.data.assign((size_t)next * SECTOR, 0);
+    for (int t = 0; t < trees; t++) {
+        uint8_t *vd = &img.data[(16 + t) * SECTOR];
+        vd[0] = t ? 2 : 1;
+        memcpy(vd + 1, "CD001", 5);
+        vd[6] = 1;
+        memcpy(vd + 40, "GENERATED                       ", 32);
+        put32(vd + 80, next);
+        if (t) {
+            vd[88] = '%'; vd[89] = '/'; vd[90] = 'E'; // UCS-2 level 3
+        }
+        put16(vd + 120, 1);
+        put16(vd + 124, 1);
+        put16(vd + 128, SECTOR);
+        put32(vd + 132, tables[t][0].size());
+        for (int b = 0; b < 4; b++) {
+            vd[140 + b] = table_sector[t][0] >> (8 * b);
+            vd[148 + b] = table_sector[t][1] >> (24 - 8 * b);
+        }
+        put_record(vd + 156, root->dir_sector[t], root->dir_size[t], true, std::string(1, '\0'));
+        vd[881] = 1;
+        for (int e = 0; e < 2; e++) {
+            memcpy(&img.data[table_sector[t][e] * SECTOR], tables[t][e].data(), tables[t][e].size());
+        }
+        write_dirs(img, t);
+    }
+    uint8_t *term = &img.data[(16 + trees) * SECTOR];
+    term[0] = 0xFF;
+    memcpy(term + 1, "CD001", 5);
+    term[6] = 1;
+
+    for (size_t i = 0; i < img.files.size(); i++) {
+        Node *f = img.files[i];
+        uint8_t *p = &img.data[f->sector * SECTOR];
+        for (uint32_t j = 0; j < f->size; j++) {
+            p[j] = pattern(j, f->seed);
+        }
+    }
+}
+
+// A deep and wide tree: 'levels' deep, 'fan' subdirectories per directory up to the third
+// level, a few files everywhere, and one large file in the root
+static Node *make_tree(int levels, int fan)
+{
+    Node *root = add(NULL, "", true, 0);
+    add(root, "Big Movie.bin", false, BIG_FILE);
+    std::vector<Node *> level(1, root);
+    for (int l = 1; l <= levels; l++) {
+        std::vector<Node *> next;
+        for (size_t i = 0; i < level.size(); i++) {
+            int subs = (l <= 3) ? fan : 1;
+            char name[64];
+            for (int s = 0; s < subs; s++) {
+                sprintf(name, "Level %d Dir %d", l, s);
+                next.push_back(add(level[i], name, true, 0));
+            }
+            for (int f = 0; f < 3; f++) {
+                sprintf(name, "File %d.prg", f);
+                add(level[i], name, false, 100 + 1500 * f * l);
+            }
+        }
+        level = next;
+    }
+    return root;
+}
+
+static std::string path_of(Node *n, bool joliet)
+{
+    if (!n->parent)
+        return "";
+    std::string s = ident(n, 0);
+    if (joliet) {
+        s = n->name;
+    } else if (!n->dir) {
+        s = s.substr(0, s.size() - 2);
+    }
+    return path_of(n->parent, joliet) + "/" + s;
+}
+
+/*********************************************************************
+ * Tests
+ *********************************************************************/
+static bool read_file(FileSystem_ISO9660 *fs, Node *f, uint32_t chunk, uint8_t *buffer)
+{
+    FileInfo info(128);
+    info.fs = fs;
+    info.cluster = f->sector;
+    info.size = f->size;
+    File file(fs, NULL);
+    t_iso_handle *handle = new t_iso_handle;
+    handle->start = handle->sector = f->sector;
+    handle->remaining = f->size;
+    handle->offset = 0;
+    file.handle = handle;
+
+    uint32_t pos = 0, transferred;
+    bool ok = true;
+    do {
+        ok = (fs->file_read(&file, buffer, chunk, &transferred) == FR_OK);
+        for (uint32_t j = 0; ok && (j < transferred); j++) {
+            ok = (buffer[j] == pattern(pos + j, f->seed));
+        }
+        pos += transferred;
+    } while (ok && transferred);
+    delete handle;
+    return ok && (pos == f->size);
+}
+
+static int count_entries(FileSystem_ISO9660 *fs, FileInfo *dir_info)
+{
+    Directory *dir;
+    FileInfo info(128);
+    int count = 0;
+    fs->dir_open(NULL, &dir, dir_info);
+    while (fs->dir_read(dir, &info) == FR_OK) {
+        count++;
+    }
+    fs->dir_close(dir);
+    return count;
+}
+
+static PathStatus_t lookup(FileSystem_ISO9660 *fs, const std::string &path, bool path_table, FileInfo *result)
+{
+    PathInfo pi(fs);
+    pi.init(path.c_str());
+    PathStatus_t st = path_table ? fs->walk_path(pi) : fs->FileSystem :: walk_path(pi);
+    if (result) {
+        result->copyfrom(pi.getLastInfo());
+    }
+    return st;
+}
+
+static void run(const char *title, bool joliet)
+{
+    printf("%s:\n", title);
+    Node *root = make_tree(10, 5);
+    Image img;
+    make_image(img, root, joliet);
+    ImageDevice dev(img.data);
+    Partition prt(&dev, 0, img.data.size() / SECTOR, 0);
+    FileSystem_ISO9660 *fs = (FileSystem_ISO9660 *)FileSystem_ISO9660 :: test(&prt);
+    CHECK(fs && fs->init(), "not recognized");
+    if (!fs) {
+        return;
+    }
+    int t = joliet ? 1 : 0;
+    CHECK(fs->get_path_entries() == (int)img.dirs[t].size(), "path table has %d directories, expected %d",
+            fs->get_path_entries(), (int)img.dirs[t].size());
+    printf("  %d directories, %d files, image of %d MB\n", (int)img.dirs[t].size(), (int)img.files.size(),
+            (int)(img.data.size() >> 20));
+
+    // large file
+    uint8_t *buffer = new uint8_t[1024 * 1024];
+    Node *big = img.files[0];
+    for (int i = 0; i < (int)img.files.size(); i++) {
+        if (img.files[i]->size == BIG_FILE)
+            big = img.files[i];
+    }
+    uint32_t chunks[] = { 2048, 65536, 1024 * 1024 };
+    for (int c = 0; c < 3; c++) {
+        dev.reset();
+        double t0 = now();
+        CHECK(read_file(fs, big, chunks[c], buffer), "big file in %u byte reads", chunks[c]);
+        double t = now() - t0 + dev.device_time();
+        printf("  %4u KB reads: %6d requests, %6.1f MB/s\n", chunks[c] / 1024, dev.requests, BIG_FILE / t / 1e6);
+    }
+    dev.reset();
+    for (size_t i = 0; i < img.files.size(); i++) {
+        if (img.files[i] != big)
+            CHECK(read_file(fs, img.files[i], 1000, buffer), "file %s", path_of(img.files[i], joliet).c_str());
+    }
+    delete[] buffer;
+
+    // lookups: every directory and every file, both ways
+    std::vector<std::string> paths;
+    std::vector<Node *> nodes;
+    for (size_t i = 1; i < img.dirs[t].size(); i++) {
+        nodes.push_back(img.dirs[t][i]);
+    }
+    for (size_t i = 0; i < img.files.size(); i++) {
+        nodes.push_back(img.files[i]);
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        paths.push_back(path_of(nodes[i], joliet));
+    }
+    double rate[2];
+    int reads[2];
+    for (int way = 0; way < 2; way++) {
+        dev.reset();
+        double t0 = now();
+        for (size_t i = 0; i < paths.size(); i++) {
+            FileInfo info(128);
+            PathStatus_t st = lookup(fs, paths[i], way == 1, &info);
+            Node *n = nodes[i];
+            CHECK((st == e_EntryFound) && (info.cluster == (n->dir ? n->dir_sector[t] : n->sector)) &&
+                  (info.size == (n->dir ? n->dir_size[t] : n->size)) && (!(info.attrib & AM_DIR) == !n->dir),
+                  "%s lookup of %s: status %d, sector %u size %u", way ? "path table" : "directory", paths[i].c_str(),
+                  st, info.cluster, info.size);
+            if (n->dir && (i < 40)) {
+                CHECK(count_entries(fs, &info) == (int)n->children.size(), "listing of %s", paths[i].c_str());
+            }
+        }
+        double elapsed = now() - t0 + dev.device_time();
+        rate[way] = paths.size() / elapsed;
+        reads[way] = dev.requests;
+    }
+    printf("  %d lookups, reading directories: %8.0f /s, %6d requests\n", (int)paths.size(), rate[0], reads[0]);
+    printf("  %d lookups, with path table:     %8.0f /s, %6d requests\n", (int)paths.size(), rate[1], reads[1]);
+    CHECK(rate[1] > rate[0] * 2, "path table is not faster");
+
+    // what is not there, and wildcards, which the path table leaves to the directories
+    Node *deep = img.dirs[t].back()->parent; // the last level has no files
+    std::string dp = path_of(deep, joliet);
+    CHECK(lookup(fs, dp + "/nothing", true, NULL) == e_EntryNotFound, "missing file");
+    CHECK(lookup(fs, dp + "/nothing/deeper", true, NULL) == e_DirNotFound, "missing directory");
+    FileInfo info(128);
+    Node *file2 = NULL;
+    for (size_t i = 0; i < deep->children.size(); i++) {
+        if (deep->children[i]->name == "File 2.prg")
+            file2 = deep->children[i];
+    }
+    CHECK((lookup(fs, dp + "/*2.prg", true, &info) == e_EntryFound) && file2 && (info.cluster == file2->sector),
+            "wildcard gave %s", info.lfname);
+    std::string lower = path_of(img.dirs[t][20], joliet);
+    for (size_t i = 0; i < lower.size(); i++) {
+        lower[i] = tolower(lower[i]);
+    }
+    CHECK((lookup(fs, lower, true, &info) == e_EntryFound) && (info.cluster == img.dirs[t][20]->dir_sector[t]),
+            "lookup is case sensitive");
+    CHECK(lookup(fs, path_of(img.files[1], joliet) + "/inside", true, NULL) == e_TerminatedOnFile,
+            "path through a file");
+    delete fs;
+    delete_tree(root);
+}
+
+int main(int argc, char **argv)
+{
+    run("ISO9660", false);
+    run("Joliet", true);
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
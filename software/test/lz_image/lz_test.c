@@ -0,0 +1,110 @@
+/*
+ * Packs the given binaries with lzpack, and unpacks them again with the boot loader code.
+ * Reports the compression ratio and the decompression throughput.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "lz_image.h"
+
+uint32_t lz_pack_bound(uint32_t length);
+uint32_t lz_pack(const uint8_t *in, uint32_t length, uint8_t *out);
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t pos;
+    uint32_t chunk;   // maximum size of a single read, like a flash or SD access
+} mem_reader_t;
+
+static uint32_t read_mem(void *context, void *buffer, uint32_t length)
+{
+    mem_reader_t *r = (mem_reader_t *)context;
+    memcpy(buffer, r->data + r->pos, length);
+    r->pos += length;
+    return length;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int test_file(const char *name, uint32_t *total_in, uint32_t *total_out)
+{
+    FILE *f = fopen(name, "rb");
+    if (!f) {
+        printf("Can't open %s\n", name);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    uint32_t length = (uint32_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *in = (uint8_t *)malloc(length + 1);
+    if (fread(in, 1, length, f) != length) {
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    uint8_t *packed = (uint8_t *)malloc(lz_pack_bound(length));
+    uint8_t *out = (uint8_t *)malloc(length + 1);
+    uint32_t packed_size = lz_pack(in, length, packed);
+
+    lz_image_header_t header;
+    int result = lz_image_header(packed, &header);
+
+    int runs = 0;
+    double start = now(), elapsed;
+    do {
+        mem_reader_t reader = { packed, LZ_IMAGE_HEADER_SIZE };
+        if (result == LZ_IMAGE_OK)
+            result = lz_image_load(&header, read_mem, &reader, out, length);
+        runs++;
+        elapsed = now() - start;
+    } while ((result == LZ_IMAGE_OK) && (elapsed < 0.2));
+
+    if ((result != LZ_IMAGE_OK) || memcmp(in, out, length)) {
+        printf("%-32s FAILED (%d)\n", name, result);
+        return 1;
+    }
+
+    // A corrupted image should be rejected
+    int bad = LZ_IMAGE_OK;
+    if (packed_size > LZ_IMAGE_HEADER_SIZE + 8) {
+        packed[packed_size / 2] ^= 0x10;
+        mem_reader_t reader = { packed, LZ_IMAGE_HEADER_SIZE };
+        bad = lz_image_load(&header, read_mem, &reader, out, length);
+    }
+
+    printf("%-32s %8u -> %8u (%5.1f%%)  %7.1f MB/s  %s\n", name, length, packed_size,
+            100.0 * packed_size / (length ? length : 1),
+            (double)length * runs / elapsed / 1e6, (bad != LZ_IMAGE_OK) ? "" : "(corruption not detected)");
+
+    *total_in += length;
+    *total_out += packed_size;
+    free(in);
+    free(packed);
+    free(out);
+    return (bad != LZ_IMAGE_OK) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t total_in = 0, total_out = 0;
+    int errors = 0;
+
+    if (argc < 2) {
+        printf("Usage: lz_test <binary> [<binary> ...]\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        errors += test_file(argv[i], &total_in, &total_out);
+    }
+    printf("Total: %u -> %u bytes (%.1f%%), %d errors.\n", total_in, total_out,
+            100.0 * total_out / (total_in ? total_in : 1), errors);
+    return errors ? 1 : 0;
+}
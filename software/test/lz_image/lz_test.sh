@@ -0,0 +1 @@
+gcc -O2 -o lz_test -DLZPACK_NO_MAIN -I../../system lz_test.c ../../../tools/lzpack.c ../../system/lz_image.c ../../system/crc32.c && ./lz_test ${@:-../../../roms/*.bin}
@@ -0,0 +1,316 @@
+/*
+ * mem_profile_test.cc
+ *
+ * Replays an allocation trace through the MemManager profiler, and checks its figures
+ * against a plain model of the heap: live bytes and objects, the peaks, every call site
+ * and size class, and the free blocks between the objects.
+ *
+ * Without arguments, the trace is generated: a session in the file browser, entering
+ * and leaving directories of up to 400 entries, with the last few listings cached,
+ * next to long lived objects and short lived strings. With a file argument, the trace
+ * is read from the file, in the form that MemManager prints when recording is on:
+ *   M+ <address> <size> <caller>
+ *   M- <address>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "memory.h"
+
+static int errors;
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); errors++; } } while(0)
+
+struct TraceEntry
+{
+    bool     alloc;
+    uint64_t address;
+    uint32_t size;
+    uint64_t caller;
+};
+
+// Call sites of the browser session
+enum { SITE_FILEINFO = 0x1000, SITE_NAME = 0x1100, SITE_LIST = 0x1200, SITE_PATH = 0x1300,
+       SITE_STRING = 0x1400, SITE_CACHE = 0x1500, SITE_DISK = 0x1600 };
+
+class BrowserSession
+{
+    std::vector<TraceEntry> &trace;
+    uint64_t next_address;
+    unsigned seed;
+
+    int random(int n) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) % n;
+    }
+    uint64_t alloc(uint32_t size, uint64_t caller) {
+        TraceEntry e = { true, next_address, size, caller };
+        next_address += 16;
+        trace.push_back(e);
+        return e.address;
+    }
+    void free(uint64_t address) {
+        TraceEntry e = { false, address, 0, 0 };
+        trace.push_back(e);
+    }
+    struct Listing {
+        std::vector<uint64_t> objects;
+    };
+    void read_directory(Listing &l) {
+        int entries = 1 + random(400);
+        int capacity = 0;
+        uint64_t list = 0;
+        for (int i = 0; i < entries; i++) {
+            l.objects.push_back(alloc(56, SITE_FILEINFO));
+            l.objects.push_back(alloc(8 + random(40), SITE_NAME));
+            if (i >= capacity) { // the IndexedList grows
+                capacity = capacity ? 2 * capacity : 16;
+                uint64_t bigger = alloc(capacity * 4, SITE_LIST);
+                if (list) {
+                    free(list);
+                }
+                list = bigger;
+            }
+            if (random(8) == 0) { // a temporary string while sorting or filtering
+                free(alloc(16 + random(100), SITE_STRING));
+            }
+        }
+        l.objects.push_back(list);
+    }
+    void drop(Listing &l) {
+        for (size_t i = 0; i < l.objects.size(); i++) {
+            free(l.objects[i]);
+        }
+        l.objects.clear();
+    }
+public:
+    BrowserSession(std::vector<TraceEntry> &t) : trace(t), next_address(0x1000000), seed(1541) { }
+
+    void run(int visits) {
+        std::vector<uint64_t> long_lived;
+        for (int i = 0; i < 20; i++) {
+            long_lived.push_back(alloc(256 + random(8192), SITE_CACHE));
+        }
+        Listing cached[3];
+        std::vector<uint64_t> path;
+        for (int v = 0; v < visits; v++) {
+            Listing &l = cached[v % 3];
+            drop(l);
+            if ((random(3) == 0) && !path.empty()) { // up
+                free(path.back());
+                path.pop_back();
+            } else {                                 // down
+                path.push_back(alloc(16 + random(48), SITE_PATH));
+            }
+            read_directory(l);
+            if (random(50) == 0) { // a disk image is opened and closed again
+                uint64_t image = alloc(174848, SITE_DISK);
+                if (random(2)) {
+                    free(image);
+                } else {
+                    long_lived.push_back(image);
+                }
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            drop(cached[i]);
+        }
+    }
+};
+
+static bool read_trace(const char *name, std::vector<TraceEntry> &trace)
+{
+    FILE *f = fopen(name, "r");
+    if (!f) {
+        printf("Can't open %s\n", name);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char *p = strstr(line, "M+ ");
+        TraceEntry e;
+        if (p) {
+            char *end;
+            e.alloc = true;
+            e.address = strtoull(p + 3, &end, 16);
+            e.size = (uint32_t)strtoul(end, &end, 10);
+            e.caller = strtoull(end, &end, 16);
+            trace.push_back(e);
+        } else if ((p = strstr(line, "M- ")) != NULL) {
+            e.alloc = false;
+            e.address = strtoull(p + 3, NULL, 16);
+            e.size = 0;
+            e.caller = 0;
+            trace.push_back(e);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+// What the profiler should report, kept with standard containers
+struct Model
+{
+    struct Object { uint32_t size; uint64_t caller; };
+    std::map<void *, Object> live;
+    std::map<uint64_t, uint32_t> site_bytes;
+    uint32_t bytes, peak, peak_objects;
+
+    Model() : bytes(0), peak(0), peak_objects(0) { }
+};
+
+static MemManager manager; // too large for the stack
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void check(Model &m, const char *when)
+{
+    CHECK(manager.total_alloc == m.bytes, "%s: %u live bytes, expected %u", when, manager.total_alloc, m.bytes);
+    CHECK(manager.live_objects == m.live.size(), "%s: %u live objects, expected %u", when, manager.live_objects,
+            (unsigned)m.live.size());
+    CHECK(manager.peak_alloc == m.peak, "%s: peak %u, expected %u", when, manager.peak_alloc, m.peak);
+    CHECK(manager.peak_objects == m.peak_objects, "%s: peak of %u objects, expected %u", when, manager.peak_objects,
+            m.peak_objects);
+
+    for (int i = 0; i < MEM_PROF_SITES; i++) {
+        const mem_site_t *s = manager.get_site(i);
+        if (s->allocs) {
+            uint32_t expected = m.site_bytes[(uint64_t)(uintptr_t)s->caller];
+            CHECK(s->live_bytes == expected, "%s: site %p has %u live bytes, expected %u", when, s->caller,
+                    s->live_bytes, expected);
+        }
+    }
+    uint32_t class_bytes = 0, class_live = 0;
+    for (int i = 0; i < MEM_PROF_CLASSES; i++) {
+        class_bytes += manager.get_class(i)->live_bytes;
+        class_live += manager.get_class(i)->live;
+    }
+    CHECK((class_bytes == m.bytes) && (class_live == m.live.size()), "%s: size classes do not add up", when);
+
+    // the free blocks, from the sorted addresses
+    mem_frag_t frag;
+    manager.fragmentation(&frag);
+    uint32_t free_bytes = 0, blocks = 0, largest = 0;
+    std::map<void *, Model::Object>::iterator it = m.live.begin();
+    while (it != m.live.end()) {
+        uintptr_t end = (uintptr_t)it->first + it->second.size;
+        if (++it == m.live.end()) {
+            break;
+        }
+        uintptr_t gap = (uintptr_t)it->first - end;
+        if (gap > MEM_HEAP_OVERHEAD) {
+            free_bytes += gap;
+            blocks++;
+            largest = std::max(largest, (uint32_t)gap);
+        }
+    }
+    CHECK((frag.free_bytes == free_bytes) && (frag.free_blocks == blocks) && (frag.largest == largest),
+            "%s: free %u in %u blocks, largest %u; expected %u in %u, largest %u", when,
+            frag.free_bytes, frag.free_blocks, frag.largest, free_bytes, blocks, largest);
+}
+
+static void replay(const std::vector<TraceEntry> &trace)
+{
+    std::map<uint64_t, void *> address_map; // trace address to the one on this host
+    Model m;
+    int checks = 0;
+
+    for (size_t n = 0; n < trace.size(); n++) {
+        const TraceEntry &e = trace[n];
+        if (e.alloc) {
+            void *p = manager.qalloc(e.size, (void *)(uintptr_t)e.caller);
+            address_map[e.address] = p;
+            Model::Object o = { e.size, e.caller };
+            m.live[p] = o;
+            m.site_bytes[e.caller] += e.size;
+            m.bytes += e.size;
+            m.peak = std::max(m.peak, m.bytes);
+            m.peak_objects = std::max(m.peak_objects, (uint32_t)m.live.size());
+        } else {
+            std::map<uint64_t, void *>::iterator a = address_map.find(e.address);
+            if (a == address_map.end()) {
+                continue; // allocated before the recording started
+            }
+            void *p = a->second;
+            address_map.erase(a);
+            Model::Object o = m.live[p];
+            m.live.erase(p);
+            m.site_bytes[o.caller] -= o.size;
+            m.bytes -= o.size;
+            manager.qfree(p);
+        }
+        if ((n % 20000) == 19999) {
+            check(m, "during the replay");
+            checks++;
+        }
+    }
+    check(m, "at the end");
+    printf("%u allocations replayed, %d checks\n", manager.alloc_count, checks + 1);
+}
+
+// The table refuses objects beyond 7/8 of its slots; those are left out of all figures
+static void overflow(void)
+{
+    MemManager *full = (MemManager *)calloc(1, sizeof(MemManager));
+    std::vector<void *> objects;
+    for (int i = 0; i < MEM_PROF_SLOTS; i++) {
+        objects.push_back(full->qalloc(32, (void *)0x2000));
+    }
+    int tracked = MEM_PROF_SLOTS - MEM_PROF_SLOTS / 8;
+    CHECK((full->live_objects == (uint32_t)tracked) && (full->untracked == (uint32_t)(MEM_PROF_SLOTS - tracked)),
+            "full table: %u tracked, %u untracked", full->live_objects, full->untracked);
+    for (size_t i = 0; i < objects.size(); i++) {
+        full->qfree(objects[i]);
+    }
+    CHECK((full->live_objects == 0) && (full->total_alloc == 0) &&
+            (full->unknown_frees == (uint32_t)(MEM_PROF_SLOTS - tracked)), "full table emptied: %u objects, %u bytes",
+            full->live_objects, full->total_alloc);
+    free(full);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<TraceEntry> trace;
+    if (argc > 1) {
+        if (!read_trace(argv[1], trace)) {
+            return 2;
+        }
+    } else {
+        BrowserSession session(trace);
+        session.run(2000);
+    }
+    printf("Replaying %u trace entries\n", (unsigned)trace.size());
+    replay(trace);
+    manager.dump();
+    overflow();
+
+    // the cost, against malloc and free alone
+    const int n = 1000000;
+    std::vector<void *> p(64);
+    double t0 = now();
+    for (int i = 0; i < n; i++) {
+        int k = i & 63;
+        free(p[k]);
+        p[k] = malloc(16 + (i & 255));
+    }
+    double t1 = now();
+    for (int i = 0; i < n; i++) {
+        int k = i & 63;
+        manager.qfree(p[k]);
+        p[k] = manager.qalloc(16 + (i & 255), (void *)0x3000);
+    }
+    double t2 = now();
+    printf("malloc + free: %.1f ns, with the profiler: %.1f ns\n", (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n);
+
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1 @@
+g++ -O2 -o mem_profile_test -DRUNS_ON_PC -I. -I../../system mem_profile_test.cc ../../system/memory.cc && ./mem_profile_test
@@ -0,0 +1,263 @@
+/*
+ * mem_test.cc
+ *
+ * Host test for SOCKET_CMD_READMEM_RANGES. A server thread answers requests
+ * on a loopback TCP connection from a fake memory map (C64 RAM, colour RAM
+ * and an REU). The client decodes and checks every reply, and reports the
+ * bytes on the wire and the latency per request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "mem_ranges.h"
+#include "lz_image.h"
+#include "crc32.h"
+
+#define RAM_BASE    0x00000000
+#define COLOR_BASE  0x0000D800
+#define REU_BASE    0x01000000
+#define REU_SIZE    0x01000000
+
+static uint8_t ram[0x10000];
+static uint8_t color[0x400];
+static uint8_t *reu;
+static int port;
+
+static const uint8_t *fake_map(uint32_t address, uint32_t length)
+{
+    if ((address >= REU_BASE) && (address - REU_BASE + length <= REU_SIZE))
+        return reu + (address - REU_BASE);
+    if ((address >= COLOR_BASE) && (address - COLOR_BASE + length <= sizeof(color)))
+        return color + (address - COLOR_BASE);
+    if (address + length <= sizeof(ram))
+        return ram + address;
+    return NULL;
+}
+
+static double now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int send_all(int s, void *buffer, int len)
+{
+    uint8_t *buf = (uint8_t *)buffer;
+    int sent = 0;
+    while(sent < len) {
+        int n = send(s, buf + sent, len - sent, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+static int recv_all(int s, void *buffer, int len)
+{
+    uint8_t *buf = (uint8_t *)buffer;
+    int received = 0;
+    while(received < len) {
+        int n = recv(s, buf + received, len - received, 0);
+        if (n <= 0) {
+            return received;
+        }
+        received += n;
+    }
+    return received;
+}
+
+// The command loop of the DMA service, for the two read commands
+static void *server(void *a)
+{
+    int ls = *(int *)a;
+    int s = accept(ls, NULL, NULL);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    static uint8_t params[65536];
+    uint8_t hdr[4];
+    while(recv_all(s, hdr, 4) == 4) {
+        uint16_t cmd = hdr[0] | (hdr[1] << 8);
+        int len = hdr[2] | (hdr[3] << 8);
+        if (recv_all(s, params, len) != len) {
+            break;
+        }
+        if (cmd == 0xFF0D) {
+            mem_ranges_send(s, params, len, fake_map, send_all);
+        } else if (cmd == 0xFF74) {
+            send_all(s, reu, 0x800000); // the old SOCKET_CMD_READMEM: always 8 MB
+        }
+    }
+    close(s);
+    return NULL;
+}
+
+typedef struct {
+    uint32_t address;
+    uint32_t length;
+} range_t;
+
+static uint8_t *result;
+static uint32_t wire_bytes;
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Sends one request and decodes the reply into 'result'. Returns the number of errors.
+static int request(int s, uint8_t flags, const range_t *ranges, int count)
+{
+    uint8_t req[4 + 1 + 8 * 16];
+    int len = 1 + 8 * count;
+    req[0] = 0x0D; req[1] = 0xFF; req[2] = len; req[3] = len >> 8;
+    req[4] = flags;
+    for(int i = 0; i < count; i++) {
+        uint8_t *p = req + 5 + 8 * i;
+        for(int b = 0; b < 4; b++) {
+            p[b] = ranges[i].address >> (8 * b);
+            p[4 + b] = ranges[i].length >> (8 * b);
+        }
+    }
+    send_all(s, req, 4 + len);
+
+    int errors = 0;
+    uint8_t word[4];
+    static uint8_t block[LZ_IMAGE_BLOCK_SIZE];
+    wire_bytes = 0;
+    for(int i = 0; i < count; i++) {
+        recv_all(s, word, 4);
+        wire_bytes += 4;
+        uint32_t size = get_le32(word);
+        const uint8_t *expect = fake_map(ranges[i].address, ranges[i].length);
+        if (size != (expect ? ranges[i].length : 0)) {
+            printf("Range %d: size %u\n", i, size);
+            return errors + 1;
+        }
+        uint8_t *dest = result;
+        for(uint32_t pos = 0; pos < size; pos += LZ_IMAGE_BLOCK_SIZE) {
+            uint32_t now = (size - pos > LZ_IMAGE_BLOCK_SIZE) ? LZ_IMAGE_BLOCK_SIZE : size - pos;
+            if (!(flags & MEM_RANGES_FLAG_PACK)) {
+                wire_bytes += recv_all(s, dest + pos, now);
+                continue;
+            }
+            recv_all(s, word, 4);
+            uint32_t bsize = get_le32(word);
+            wire_bytes += 4 + (bsize & ~LZ_IMAGE_BLOCK_RAW);
+            if (bsize & LZ_IMAGE_BLOCK_RAW) {
+                recv_all(s, dest + pos, now);
+            } else {
+                recv_all(s, block, bsize);
+                if (lz_image_block(block, bsize, dest + pos, now, dest + pos) != (int)now) {
+                    errors++;
+                }
+            }
+        }
+        if (flags & MEM_RANGES_FLAG_CRC) {
+            recv_all(s, word, 4);
+            wire_bytes += 4;
+            if (get_le32(word) != crc32_update(0, dest, size)) {
+                errors++;
+            }
+        }
+        if (size && memcmp(dest, expect, size)) {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+static int run(int s, const char *name, uint8_t flags, const range_t *ranges, int count, int iterations)
+{
+    int errors = 0;
+    uint32_t payload = 0;
+    for(int i = 0; i < count; i++) {
+        payload += fake_map(ranges[i].address, ranges[i].length) ? ranges[i].length : 0;
+    }
+    double t0 = now_us();
+    for(int i = 0; i < iterations; i++) {
+        errors += request(s, flags, ranges, count);
+    }
+    double t = (now_us() - t0) / iterations;
+    printf("%-14s %-10s %8u bytes -> %8u on the wire, %8.0f us/request%s\n", name,
+           (flags & MEM_RANGES_FLAG_PACK) ? "pack+crc" : (flags & MEM_RANGES_FLAG_CRC) ? "crc" : "raw",
+           payload, wire_bytes, t, errors ? "  ERRORS" : "");
+    return errors;
+}
+
+int main()
+{
+    reu = new uint8_t[REU_SIZE];
+    result = new uint8_t[REU_SIZE];
+
+    // Something that looks like a C64 running a program: code and tables, a text screen
+    uint32_t x = 1;
+    for(int i = 0; i < 0x10000; i++) {
+        x = x * 1103515245 + 12345;
+        ram[i] = (i >= 0x0800 && i < 0x3000) ? (x >> 16) : (i >= 0x3000 && i < 0x8000) ? (i & 0x3F) : 0;
+    }
+    const char *text = "READY. LOAD\"*\",8,1 SEARCHING FOR * LOADING READY. RUN ";
+    for(int i = 0; i < 1000; i++) {
+        ram[0x0400 + i] = (i % 120 < 40) ? (text[i % 55] & 0x3F) : 0x20;
+        color[i] = 0xF0 | ((i / 40) & 0x0F);
+    }
+    for(uint32_t i = 0; i < REU_SIZE; i++) {
+        reu[i] = (i < 0x40000) ? ram[i & 0xFFFF] : 0;
+    }
+
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(ls, (struct sockaddr *)&addr, sizeof(addr));
+    listen(ls, 1);
+    getsockname(ls, (struct sockaddr *)&addr, &addrlen);
+    port = ntohs(addr.sin_port);
+    pthread_t thread;
+    pthread_create(&thread, NULL, server, &ls);
+
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    connect(s, (struct sockaddr *)&addr, sizeof(addr));
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    const range_t screen[] = { { 0x0400, 1000 }, { COLOR_BASE, 1000 } };
+    const range_t all_ram[] = { { 0, 0x10000 } };
+    const range_t reu_window[] = { { REU_BASE + 0x30000, 0x20000 } };
+    const range_t invalid[] = { { 0x0400, 40 }, { 0x00FFFFF0, 0x100 }, { REU_BASE, 0x1000001 } };
+
+    int errors = 0;
+    for(int f = 0; f < 3; f++) {
+        uint8_t flags = (f == 0) ? 0 : (f == 1) ? MEM_RANGES_FLAG_CRC : (MEM_RANGES_FLAG_CRC | MEM_RANGES_FLAG_PACK);
+        errors += run(s, "screen+color", flags, screen, 2, 500);
+        errors += run(s, "C64 RAM", flags, all_ram, 1, 100);
+        errors += run(s, "REU 128K", flags, reu_window, 1, 20);
+    }
+    errors += run(s, "invalid", MEM_RANGES_FLAG_CRC | MEM_RANGES_FLAG_PACK, invalid, 3, 1);
+
+    // reference: the old fixed 8 MB dump
+    uint8_t old_req[4] = { 0x74, 0xFF, 0, 0 };
+    double t0 = now_us();
+    send_all(s, old_req, 4);
+    uint32_t old_bytes = recv_all(s, result, 0x800000);
+    printf("%-14s %-10s %8s          %8u on the wire, %8.0f us/request\n", "READMEM", "raw", "", old_bytes, now_us() - t0);
+
+    close(s);
+    pthread_join(thread, NULL);
+    close(ls);
+
+    printf(errors ? "FAILED\n" : "All OK\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1 @@
+g++ -O2 -o mem_test -I../../network -I../../system mem_test.cc ../../network/mem_ranges.cc ../../system/lz_image.c ../../system/crc32.c -lpthread && ./mem_test
@@ -0,0 +1,142 @@
+/*
+ * mps_bench.cc
+ *
+ * Host benchmark for the MPS printer emulation (NOT_ULTIMATE build).
+ * Prints dense text pages and bit image graphics pages (Epson FX-80), on
+ * the greyscale printer and on the color printer. Reports interpreter
+ * throughput, time per page, heap usage and maximum resident size.
+ * Form feed time is the PNG output of the rows still in memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "mps_printer.h"
+
+static size_t heap_now  = 0;
+static size_t heap_peak = 0;
+
+void *operator new(size_t size)
+{
+    size_t *p = (size_t *)malloc(size + sizeof(size_t));
+    if (!p)
+        throw std::bad_alloc();
+    *p = size;
+    heap_now += size;
+    if (heap_now > heap_peak)
+        heap_peak = heap_now;
+    return p + 1;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    if (!ptr)
+        return;
+    size_t *p = (size_t *)ptr - 1;
+    heap_now -= *p;
+    free(p);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+static double now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* Dense text page: 56 lines of 80 characters */
+static int make_text_page(uint8_t *buf, int page, bool color, int *chars)
+{
+    int n = 0;
+    for (int line = 0; line < 56; line++) {
+        if (color) {
+            buf[n++] = 0x1B; buf[n++] = 'r'; buf[n++] = (uint8_t)(line % 7);
+        }
+        for (int i = 0; i < 80; i++) {
+            buf[n++] = (uint8_t)(0x21 + ((i + line + page) % 94));
+        }
+        *chars += 80;
+        buf[n++] = 0x0D;
+        buf[n++] = 0x0A;
+    }
+    return n;
+}
+
+/* Graphics page: ESC K lines of 480 columns, 8 dots high, no gap in between */
+static int make_graphics_page(uint8_t *buf, int page, bool color, int *chars)
+{
+    int n = 0;
+    buf[n++] = 0x1B; buf[n++] = 'A'; buf[n++] = 8;
+    for (int line = 0; line < 80; line++) {
+        if (color) {
+            buf[n++] = 0x1B; buf[n++] = 'r'; buf[n++] = (uint8_t)(line % 7);
+        }
+        buf[n++] = 0x1B; buf[n++] = 'K'; buf[n++] = 480 & 0xFF; buf[n++] = 480 >> 8;
+        for (int x = 0; x < 480; x++) {
+            buf[n++] = (uint8_t)((x * 7 + line * 13 + page) ^ (x >> 3));
+        }
+        *chars += 480;
+        buf[n++] = 0x0D;
+        buf[n++] = 0x0A;
+    }
+    buf[n++] = 0x1B; buf[n++] = '2';
+    return n;
+}
+
+static void run(MpsPrinter *mps, const char *name, bool color, bool graphics, int pages)
+{
+    static uint8_t buf[131072];
+    static const uint8_t form_feed = 0x0C;
+
+    mps->setColorMode(color);
+    heap_peak = heap_now;
+
+    double interpret = 0.0;
+    double print = 0.0;
+    int chars = 0;
+    for (int p = 0; p < pages; p++) {
+        int len = graphics ? make_graphics_page(buf, p, color, &chars) : make_text_page(buf, p, color, &chars);
+        double t = now_ms();
+        mps->Interpreter(buf, len);
+        double t2 = now_ms();
+        mps->Interpreter(&form_feed, 1);
+        interpret += t2 - t;
+        print += now_ms() - t2;
+    }
+    printf("%-16s %d pages, %9.0f %s/s, %7.1f ms/page total, %6.1f ms/page form feed, peak heap %5lu KB\n",
+           name, pages, chars / (interpret / 1000.0), graphics ? "columns" : "chars",
+           (interpret + print) / pages, print / pages, (unsigned long)(heap_peak / 1024));
+}
+
+int main(int argc, char **argv)
+{
+    int pages = (argc > 1) ? atoi(argv[1]) : 4;
+    char base[] = "mps_bench";
+
+    MpsPrinter *mps = MpsPrinter::getMpsPrinter();
+    mps->setFilename(base);
+    mps->setInterpreter(MPS_PRINTER_INTERPRETER_EPSONFX80);
+
+    run(mps, "text grey", false, false, pages);
+    run(mps, "graphics grey", false, true, pages);
+    run(mps, "text color", true, false, pages);
+    run(mps, "graphics color", true, true, pages);
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("max resident size %ld KB\n", ru.ru_maxrss);
+    return 0;
+}
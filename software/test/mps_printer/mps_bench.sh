@@ -0,0 +1,2 @@
+# CFLAGS=-DMPS_PRINTER_FULL_PAGE keeps PNG compression out of the interpreter timing
+g++ -O2 $CFLAGS -o mps_bench -DNOT_ULTIMATE -I../../io/iec -I../../system mps_bench.cc ../../io/iec/mps_printer*.cc ../../io/iec/mps_chargen.cc ../../io/iec/mps_charset.cc ../../io/iec/png_stream.cc ../../system/crc32.c && ./mps_bench $@
@@ -0,0 +1,261 @@
+/*
+ * pool_test.cc
+ *
+ * Checks the object pools of components/pool.cc, and measures what they do for a
+ * file browser session: directories of up to 2000 entries are listed, the context
+ * menu of many entries is opened, and the path strings are built, while now and then
+ * an object is kept for a long time. All allocations go through a MemManager, which
+ * gives the fragmentation of the heap at the end.
+ *
+ * pool_test.sh builds this twice: once with the pools, and once with heap_pool.cc,
+ * which passes every pool allocation to the heap, as before the pools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <new>
+#include "memory.h"
+#include "pool.h"
+#include "file_info.h"
+#include "action.h"
+#include "mystring.h"
+
+static MemManager manager;
+
+void *operator new(size_t size)
+{
+    return manager.qalloc(size, __builtin_return_address(0));
+}
+
+void *operator new[](size_t size)
+{
+    return manager.qalloc(size, __builtin_return_address(0));
+}
+
+void operator delete(void *p) noexcept
+{
+    manager.qfree(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    manager.qfree(p);
+}
+
+void operator delete(void *p, size_t size) noexcept
+{
+    manager.qfree(p);
+}
+
+void operator delete[](void *p, size_t size) noexcept
+{
+    manager.qfree(p);
+}
+
+static int errors;
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); errors++; } } while(0)
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static unsigned seed = 64;
+static int random(int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % n;
+}
+
+static void list_directory(IndexedList<FileInfo *> &target, int entries)
+{
+    // as FileManager :: get_directory
+    FileInfo info(128);
+    for (int i = 0; i < entries; i++) {
+        int len = sprintf(info.lfname, "%s %d", (i & 7) ? "GAME" : "SOME LONGER DEMO NAME", random(100000));
+        while (len < (i % 40)) {
+            info.lfname[len++] = 'X';
+        }
+        info.lfname[len] = 0;
+        info.size = random(200000);
+        info.attrib = (i % 20) ? 0 : AM_DIR;
+        target.append(new FileInfo(info));
+    }
+    target.sort(FileInfo :: compare);
+}
+
+static void clear_directory(IndexedList<FileInfo *> &target)
+{
+    for (int i = 0; i < target.get_elements(); i++) {
+        delete target[i];
+    }
+    target.clear_list();
+}
+
+static void context_menu(FileInfo *info, mstring &path)
+{
+    // what the context menu and the action of a D64 file take
+    static const char *names[] = { "Run Disk", "Mount Disk", "Mount Disk Read Only", "Mount Disk Unlinked",
+                                   "Rename", "Delete", "View", "Copy" };
+    IndexedList<Action *> items(8, NULL);
+    for (int i = 0; i < 8; i++) {
+        items.append(new Action(names[i], 1, i, 0));
+    }
+    mstring full(path);
+    full += "/";
+    full += info->lfname;
+    for (int i = 0; i < items.get_elements(); i++) {
+        delete items[i];
+    }
+}
+
+static double session(int visits, int menus)
+{
+    IndexedList<FileInfo *> cache[2] = { IndexedList<FileInfo *>(16, NULL), IndexedList<FileInfo *>(16, NULL) };
+    IndexedList<mstring *> kept(16, NULL);
+    mstring path("/Usb0/Games");
+
+    double t0 = now();
+    for (int v = 0; v < visits; v++) {
+        IndexedList<FileInfo *> &dir = cache[v & 1];
+        clear_directory(dir);
+        list_directory(dir, 200 + random(1801));
+        for (int m = 0; m < menus; m++) {
+            FileInfo *info = dir[random(dir.get_elements())];
+            context_menu(info, path);
+            if (random(40) == 0) { // something that stays, like an entry in a history
+                mstring *s = new mstring(path);
+                (*s) += info->lfname;
+                kept.append(s);
+            }
+        }
+        path += "/";
+        path += dir[0]->lfname;
+        if (path.length() > 200) {
+            path = "/Usb0";
+        }
+    }
+    double t1 = now();
+    clear_directory(cache[0]);
+    clear_directory(cache[1]);
+    for (int i = 0; i < kept.get_elements(); i++) {
+        delete kept[i];
+    }
+    return t1 - t0;
+}
+
+#ifndef HEAP_ONLY
+static void test_pool(void)
+{
+    static FixedPool pool("Test", 20, 8);
+    void *p[40];
+
+    CHECK(pool.get_block_size() == 24, "block size %d", pool.get_block_size());
+    for (int i = 0; i < 40; i++) {
+        p[i] = pool.alloc(20);
+        memset(p[i], i, 20);
+    }
+    CHECK((pool.live == 40) && (pool.slab_count == 5) && (pool.peak == 40), "40 blocks: %u live in %u slabs",
+            pool.live, pool.slab_count);
+    for (int i = 0; i < 40; i++) {
+        uint8_t *b = (uint8_t *)p[i];
+        CHECK((b[0] == i) && (b[19] == i), "block %d overwritten", i);
+        for (int j = 0; j < i; j++) {
+            CHECK(p[i] != p[j], "block %d handed out twice", i);
+        }
+    }
+    void *large = pool.alloc(100);
+    CHECK(!pool.owns(large) && (pool.heap_allocs == 1), "a large object did not come from the heap");
+    pool.release(large);
+
+    // every slab but one goes back to the heap when it is empty
+    for (int i = 0; i < 40; i++) {
+        pool.release(p[i]);
+    }
+    CHECK((pool.live == 0) && (pool.slab_count == 1), "all freed: %u live in %u slabs", pool.live, pool.slab_count);
+    pool.release(p[0]); // its slab is the one that was kept
+    CHECK(pool.frees == 40, "a double free was counted");
+
+    // a freed block is handed out again first
+    void *a = pool.alloc(20);
+    pool.release(a);
+    CHECK(pool.alloc(20) == a, "freed block not reused");
+    CHECK(pool.leaks(false) == 1, "%d leaks, expected 1", pool.leaks(false));
+    pool.release(a);
+    CHECK(pool.leaks(false) == 0, "no leaks expected");
+
+    // strings come from the size classes
+    for (int size = 1; size <= POOL_MAX_STRING + 8; size++) {
+        char *s = pool_alloc_string(size);
+        memset(s, 'x', size);
+        pool_free_string(s, size);
+    }
+    mstring m("A");
+    for (int i = 0; i < 150; i++) {
+        m += "B";
+    }
+    CHECK(m.length() == 151, "mstring length %d", m.length());
+}
+
+static void test_leak_report(void)
+{
+    // a pool that is destroyed with objects in it reports them and keeps its slabs
+    void *mem = calloc(1, sizeof(FixedPool)); // zeroed, like a global
+    FixedPool *pool = new (mem) FixedPool("Leaky", 16, 4);
+    void *p = pool->alloc(16);
+    void *q = pool->alloc(16);
+    pool->release(p);
+    printf("Expect one object of Leaky not freed:\n");
+    pool->~FixedPool();
+    free(mem);
+    memset(q, 0, 16); // still valid memory
+}
+#endif
+
+int main(int argc, char **argv)
+{
+#ifndef HEAP_ONLY
+    test_pool();
+    test_leak_report();
+#endif
+    uint32_t before = manager.live_objects;
+    double t = session(40, 100);
+#ifdef HEAP_ONLY
+    CHECK(manager.live_objects == before, "%d objects not freed", manager.live_objects - before);
+#else
+    CHECK(!file_info_pool.leaks(true) && !action_pool.leaks(true), "objects not freed");
+#endif
+
+    // what a session leaves behind, with a long lived object in between now and then
+    IndexedList<FileInfo *> dir(16, NULL);
+    list_directory(dir, 2000);
+    IndexedList<mstring *> kept(16, NULL);
+    for (int i = 0; i < dir.get_elements(); i += 50) {
+        kept.append(new mstring(dir[i]->lfname));
+    }
+    clear_directory(dir);
+    list_directory(dir, 300);
+
+    mem_frag_t frag;
+    manager.fragmentation(&frag);
+#ifdef HEAP_ONLY
+    const char *what = "heap";
+#else
+    const char *what = "pools";
+    FixedPool :: dump_all();
+#endif
+    printf("%-5s: %.0f us per directory, heap has %u bytes in %u objects, free between them %u bytes in %u blocks, "
+           "fragmentation %d%%\n", what, t * 1e6 / 40, manager.total_alloc, manager.live_objects,
+           frag.free_bytes, frag.free_blocks, frag.percent);
+
+    clear_directory(dir);
+    for (int i = 0; i < kept.get_elements(); i++) {
+        delete kept[i];
+    }
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,5 @@
+g++ -O2 -o pool_test -DRUNS_ON_PC -I. -I../../system -I../../components -I../../filesystem -I../../infra pool_test.cc \
+    ../../components/pool.cc ../../components/mystring.cc ../../system/memory.cc && \
+g++ -O2 -o heap_test -DRUNS_ON_PC -DHEAP_ONLY -I. -I../../system -I../../components -I../../filesystem -I../../infra pool_test.cc \
+    heap_pool.cc ../../components/mystring.cc ../../system/memory.cc && \
+./heap_test && ./pool_test
@@ -0,0 +1,330 @@
+/*
+ * partition_test.cc
+ *
+ * Builds disk images in memory, with an MBR and with a GUID partition table, and checks
+ * the partitions that Disk finds on them: where they start, how long they are, their
+ * type, and whether the file system on them mounts. The GPT images are also damaged in
+ * several ways, to see that the backup table is used. Last, it checks that large
+ * transfers pass the Partition and the FatFs glue as one request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "disk.h"
+#include "partition.h"
+#include "file_system.h"
+#include "crc32.h"
+
+#define SECTOR      512
+#define FAT_SECTORS 65536
+
+static int errors;
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); errors++; } } while(0)
+
+extern "C" DRESULT disk_read(void *pdrv, uint8_t *buff, uint32_t sector, uint32_t count);
+
+/*********************************************************************
+ * Block device on the image
+ *********************************************************************/
+class ImageDevice : public BlockDevice
+{
+public:
+    std::vector<uint8_t> image;
+    int requests;
+    int largest;
+
+    ImageDevice(uint32_t sectors) : image((size_t)sectors * SECTOR, 0), requests(0), largest(0)
+    {
+        set_state(e_device_ready);
+    }
+    DSTATUS init(void)   { return 0; }
+    DSTATUS status(void) { return 0; }
+    DRESULT read(uint8_t *buffer, uint32_t sector, int count)
+    {
+        if ((uint64_t)(sector + count) * SECTOR > image.size())
+            return RES_PARERR;
+        requests++;
+        if (count > largest)
+            largest = count;
+        memcpy(buffer, &image[(size_t)sector * SECTOR], count * SECTOR);
+        return RES_OK;
+    }
+    DRESULT write(const uint8_t *buffer, uint32_t sector, int count)
+    {
+        if ((uint64_t)(sector + count) * SECTOR > image.size())
+            return RES_PARERR;
+        requests++;
+        if (count > largest)
+            largest = count;
+        memcpy(&image[(size_t)sector * SECTOR], buffer, count * SECTOR);
+        return RES_OK;
+    }
+    DRESULT ioctl(uint8_t command, void *data)
+    {
+        switch (command) {
+            case GET_SECTOR_COUNT:
+                *(uint32_t *)data = image.size() / SECTOR;
+                return RES_OK;
+            case GET_SECTOR_SIZE:
+                *(uint32_t *)data = SECTOR;
+                return RES_OK;
+        }
+        return RES_PARERR;
+    }
+    uint8_t *sector(uint32_t s) { return &image[(size_t)s * SECTOR]; }
+    void reset(void) { requests = largest = 0; }
+};
+
+/*********************************************************************
+ * Image contents
+ *********************************************************************/
+static void put32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (8 * i);
+}
+
+// Every sector of a partition, except for the FAT one, says where it is
+static void stamp(ImageDevice &dev, uint32_t start, uint32_t length)
+{
+    for (uint32_t s = 0; s < length; s++) {
+        uint8_t *p = dev.sector(start + s);
+        sprintf((char *)p, "sector %u of partition at %u", s, start);
+        put32(p + 64, start + s);
+    }
+}
+
+static void fat16(ImageDevice &dev, uint32_t start)
+{
+    static const uint8_t boot[] = { 0xEB, 0x3C, 0x90, 'M', 'S', 'W', 'I', 'N', '4', '.', '1',
+                                    0x00, 0x02, 4, 1, 0, 2, 0x00, 0x02, 0, 0, 0xF8, 64, 0,
+                                    63, 0, 255, 0, 0, 0, 0, 0, 0x00, 0x00, 0x01, 0x00,
+                                    0x80, 0, 0x29, 0x41, 0x15, 0x00, 0x00,
+                                    'G', 'P', 'T', ' ', 'V', 'O', 'L', 'U', 'M', 'E', ' ',
+                                    'F', 'A', 'T', '1', '6', ' ', ' ', ' ' };
+    uint8_t *b = dev.sector(start);
+    memcpy(b, boot, sizeof(boot));
+    b[510] = 0x55;
+    b[511] = 0xAA;
+    for (int fat = 0; fat < 2; fat++) {
+        uint8_t *f = dev.sector(start + 1 + fat * 64);
+        f[0] = 0xF8;
+        f[1] = f[2] = f[3] = 0xFF;
+    }
+}
+
+static void mbr_entry(ImageDevice &dev, int index, uint8_t type, uint32_t start, uint32_t length, uint32_t sector = 0)
+{
+    uint8_t *e = dev.sector(sector) + MBR_PTable + 16 * index;
+    e[4] = type;
+    put32(e + 8, start);
+    put32(e + 12, length);
+    dev.sector(sector)[510] = 0x55;
+    dev.sector(sector)[511] = 0xAA;
+}
+
+struct GptPart {
+    const char *guid;   // as text
+    uint32_t first;
+    uint32_t length;
+    bool high;          // start beyond 32 bits
+};
+
+static const char *basic_data = "EBD0A0A2-B9E5-4433-87C0-68B6B72699C7";
+static const char *linux_data = "0FC63DAF-8483-4772-8E79-3D69D8477DE4";
+static const char *efi_system = "C12A7328-F81F-11D2-BA4B-00A0C93EC93B";
+static const char *apple_hfs  = "48465300-0000-11AA-AA11-00306543ECAC";
+
+static void put_guid(uint8_t *p, const char *s)
+{
+    uint8_t raw[16];
+    int n = 0;
+    for (const char *c = s; *c && n < 16; c += 2) {
+        if (*c == '-')
+            c++;
+        unsigned v;
+        sscanf(c, "%2x", &v);
+        raw[n++] = v;
+    }
+    // the first three fields are little endian
+    static const int order[16] = { 3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15 };
+    for (int i = 0; i < 16; i++)
+        p[i] = raw[order[i]];
+}
+
+static void gpt_header(ImageDevice &dev, uint32_t lba, uint32_t alternate, uint32_t entries, uint32_t entries_crc)
+{
+    uint8_t *h = dev.sector(lba);
+    memset(h, 0, SECTOR);
+    memcpy(h, "EFI PART", 8);
+    put32(h + 8, 0x00010000);
+    put32(h + 12, 92);
+    put32(h + 24, lba);
+    put32(h + 32, alternate);
+    put32(h + 40, 34);
+    put32(h + 48, dev.image.size() / SECTOR - 34);
+    put_guid(h + 56, "12345678-9ABC-DEF0-1234-56789ABCDEF0");
+    put32(h + 72, entries);
+    put32(h + 80, 128);
+    put32(h + 84, 128);
+    put32(h + 88, entries_crc);
+    put32(h + 16, crc32_update(0, h, 92));
+}
+
+static void make_gpt(ImageDevice &dev, const std::vector<GptPart> &parts)
+{
+    uint32_t last = dev.image.size() / SECTOR - 1;
+    mbr_entry(dev, 0, 0xEE, 1, last);
+    uint8_t table[128 * 128];
+    memset(table, 0, sizeof(table));
+    for (size_t i = 0; i < parts.size(); i++) {
+        uint8_t *e = table + 128 * i;
+        put_guid(e, parts[i].guid);
+        put_guid(e + 16, "00000000-0000-0000-0000-00000000000A");
+        e[16] = i;
+        put32(e + 32, parts[i].first);
+        put32(e + 36, parts[i].high ? 1 : 0);
+        put32(e + 40, parts[i].first + parts[i].length - 1);
+        put32(e + 44, parts[i].high ? 1 : 0);
+        const char *name = "partition";
+        for (int c = 0; name[c]; c++)
+            e[56 + 2 * c] = name[c];
+    }
+    uint32_t crc = crc32_update(0, table, sizeof(table));
+    memcpy(dev.sector(2), table, sizeof(table));
+    memcpy(dev.sector(last - 32), table, sizeof(table));
+    gpt_header(dev, 1, last, 2, crc);
+    gpt_header(dev, last, 1, last - 32, crc);
+}
+
+/*********************************************************************
+ * Checks
+ *********************************************************************/
+struct Expected {
+    uint32_t start;
+    uint32_t length;
+    uint8_t type;
+    bool fat;
+};
+
+static void check_partitions(const char *title, ImageDevice &dev, const Expected *exp, int count)
+{
+    Disk disk(&dev, SECTOR);
+    int found = disk.Init(false);
+    CHECK(found == count, "%s: %d partitions, expected %d", title, found, count);
+    Partition *prt = disk.partition_list;
+    uint8_t buffer[SECTOR];
+    for (int i = 0; (i < count) && prt; i++, prt = prt->next_partition) {
+        uint32_t length = 0;
+        prt->ioctl(GET_SECTOR_COUNT, &length);
+        CHECK(length == exp[i].length && prt->get_type() == exp[i].type, "%s: partition %d has %u sectors, type %02x",
+                title, i + 1, length, prt->get_type());
+        if (exp[i].fat) {
+            FileSystem *fs = prt->attach_filesystem();
+            CHECK(fs != NULL, "%s: partition %d does not mount", title, i + 1);
+            delete fs;
+        } else {
+            CHECK(prt->read(buffer, 0, 1) == RES_OK && buffer[64] == uint8_t(exp[i].start) &&
+                  buffer[65] == uint8_t(exp[i].start >> 8) && buffer[66] == uint8_t(exp[i].start >> 16),
+                  "%s: partition %d does not start at %u", title, i + 1, exp[i].start);
+        }
+    }
+}
+
+static void test_mbr(void)
+{
+    printf("MBR with an extended partition:\n");
+    ImageDevice dev(8192);
+    mbr_entry(dev, 0, 0x06, 64, 1024);
+    mbr_entry(dev, 1, 0x83, 1088, 2048);
+    mbr_entry(dev, 2, 0x0F, 4096, 4096);
+    mbr_entry(dev, 0, 0x0C, 1, 2000, 4096); // logical, relative to the EBR
+    stamp(dev, 64, 1024);
+    stamp(dev, 1088, 2048);
+    stamp(dev, 4097, 2000);
+    Expected exp[] = { { 64, 1024, 0x06 }, { 1088, 2048, 0x83 }, { 4097, 2000, 0x0C } };
+    check_partitions("MBR", dev, exp, 3);
+}
+
+static void test_gpt(void)
+{
+    printf("GPT:\n");
+    uint32_t sectors = 2048 + FAT_SECTORS + 3 * 2048 + 64;
+    std::vector<GptPart> parts;
+    GptPart p[] = { { basic_data, 2048, FAT_SECTORS, false },
+                    { linux_data, 2048 + FAT_SECTORS, 2048, false },
+                    { efi_system, 4096 + FAT_SECTORS, 2048, false },
+                    { basic_data, 1000, 1000, true },
+                    { apple_hfs,  6144 + FAT_SECTORS, 2048, false } };
+    parts.assign(p, p + 5);
+    Expected exp[] = { { 2048, FAT_SECTORS, 0x0C, true },
+                       { 2048 + FAT_SECTORS, 2048, 0x83 },
+                       { 4096 + FAT_SECTORS, 2048, 0xEF },
+                       { 6144 + FAT_SECTORS, 2048, 0xEE } };
+
+    ImageDevice dev(sectors);
+    fat16(dev, 2048);
+    for (int i = 1; i < 5; i++) {
+        if (!p[i].high)
+            stamp(dev, p[i].first, p[i].length);
+    }
+    make_gpt(dev, parts);
+    std::vector<uint8_t> good = dev.image;
+
+    dev.reset();
+    check_partitions("GPT", dev, exp, 4);
+    printf("  read with %d requests, the largest %d sectors\n", dev.requests, dev.largest);
+
+    dev.sector(1)[40] ^= 1; // primary header
+    check_partitions("GPT, damaged header", dev, exp, 4);
+
+    dev.image = good;
+    dev.sector(5)[3] ^= 1; // primary entries
+    check_partitions("GPT, damaged entries", dev, exp, 4);
+
+    dev.sector(sectors - 1)[16] ^= 1; // and the backup header
+    Disk disk(&dev, SECTOR);
+    CHECK(disk.Init(false) == 1 && disk.partition_list->get_type() == 0xEE, "both tables damaged");
+
+    dev.image = good;
+    memcpy(dev.sector(1), "EFI PARS", 8); // not a GPT header at all
+    check_partitions("GPT, no primary header", dev, exp, 4);
+}
+
+static void test_large_transfers(void)
+{
+    printf("Large transfers:\n");
+    ImageDevice dev(8192);
+    stamp(dev, 100, 8000);
+    Partition prt(&dev, 100, 8000, 0x83);
+    std::vector<uint8_t> buffer(4000 * SECTOR);
+
+    dev.reset();
+    CHECK(prt.read(&buffer[0], 10, 1000) == RES_OK, "read 1000");
+    bool ok = true;
+    for (int s = 0; s < 1000; s++)
+        ok = ok && (buffer[s * SECTOR + 64] == uint8_t(110 + s)) && (buffer[s * SECTOR + 65] == uint8_t((110 + s) >> 8));
+    CHECK(ok && dev.requests == 1 && dev.largest == 1000, "1000 sectors: %d requests, data %s", dev.requests, ok ? "right" : "wrong");
+    printf("  1000 sectors from the partition: %d request(s) of %d sectors\n", dev.requests, dev.largest);
+
+    dev.reset();
+    for (size_t i = 0; i < 300 * SECTOR; i++)
+        buffer[i] = uint8_t(i * 7);
+    CHECK(prt.write(&buffer[0], 4000, 300) == RES_OK && dev.requests == 1, "write 300");
+    CHECK(!memcmp(dev.sector(4100), &buffer[0], 300 * SECTOR), "written data");
+
+    dev.reset();
+    CHECK(disk_read(&prt, &buffer[0], 0, 4000) == RES_OK && dev.requests == 1 && dev.largest == 4000, "FatFs glue");
+    printf("  4000 sectors through disk_read: %d request(s)\n", dev.requests);
+}
+
+int main(int argc, char **argv)
+{
+    test_mbr();
+    test_gpt();
+    test_large_transfers();
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
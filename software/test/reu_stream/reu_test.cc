@@ -0,0 +1,213 @@
+/*
+ * reu_test.cc
+ *
+ * Host test for the REU stream receiver of the socket DMA service. A sender
+ * thread uploads a full 16 MB REU image over a loopback TCP connection,
+ * once with the old SOCKET_CMD_REUWRITE (staged in the socket buffer, then
+ * copied per byte) and once as a single SOCKET_CMD_REUWRITE_STREAM.
+ * A RAM buffer stands in for REU memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "reu_stream.h"
+extern "C" {
+    #include "crc32.h"
+}
+
+#define REU_SIZE    0x1000000
+#define IMAGE_SIZE  0x1000000
+#define START_OFFS  0x0F0123 // unaligned, so the stream wraps around the end of the REU
+#define STAGE_SIZE  200000   // SOCKET_BUFFER_SIZE
+
+static uint8_t *image;
+static uint8_t *reu;
+static int port;
+static int mode; // 0 = REUWRITE, 1 = stream, 2 = stream + crc
+static uint32_t sent_crc;
+
+static double now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static void send_all(int s, const uint8_t *buf, int len)
+{
+    while(len > 0) {
+        int n = send(s, buf, len, 0);
+        if (n <= 0) {
+            perror("send");
+            exit(1);
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static int recv_all(int s, uint8_t *buf, int len)
+{
+    int received = 0;
+    while(received < len) {
+        int n = recv(s, buf + received, len - received, 0);
+        if (n <= 0) {
+            return received;
+        }
+        received += n;
+    }
+    return received;
+}
+
+static void *sender(void *a)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    uint8_t hdr[12];
+    if (mode == 0) {
+        // as many commands as needed, each with 65532 data bytes
+        for(uint32_t pos = 0; pos < IMAGE_SIZE; pos += 65532) {
+            uint32_t chunk = (IMAGE_SIZE - pos > 65532) ? 65532 : IMAGE_SIZE - pos;
+            uint32_t offs = START_OFFS + pos;
+            hdr[0] = 0x07; hdr[1] = 0xFF;
+            hdr[2] = (chunk + 3); hdr[3] = (chunk + 3) >> 8;
+            hdr[4] = offs; hdr[5] = offs >> 8; hdr[6] = offs >> 16;
+            send_all(s, hdr, 7);
+            send_all(s, image + pos, chunk);
+        }
+    } else {
+        uint32_t offs = START_OFFS;
+        uint32_t size = IMAGE_SIZE;
+        hdr[0] = 0x0C; hdr[1] = 0xFF;
+        hdr[2] = 8; hdr[3] = 0;
+        hdr[4] = offs; hdr[5] = offs >> 8; hdr[6] = offs >> 16;
+        hdr[7] = size; hdr[8] = size >> 8; hdr[9] = size >> 16; hdr[10] = size >> 24;
+        hdr[11] = (mode == 2) ? REU_STREAM_FLAG_CRC : 0;
+        send_all(s, hdr, 12);
+        for(uint32_t pos = 0; pos < IMAGE_SIZE; pos += 1460) { // one TCP segment at a time, like a client would
+            send_all(s, image + pos, (IMAGE_SIZE - pos > 1460) ? 1460 : IMAGE_SIZE - pos);
+        }
+        if (mode == 2) {
+            uint8_t reply[4];
+            recv_all(s, reply, 4);
+            sent_crc = reply[0] | (reply[1] << 8) | (reply[2] << 16) | ((uint32_t)reply[3] << 24);
+        }
+    }
+    close(s);
+    return NULL;
+}
+
+// The receiving end, as dmaThread and performCommand do it
+static void receive(int s, uint8_t *stage)
+{
+    uint8_t hdr[4];
+    while(recv_all(s, hdr, 4) == 4) {
+        uint16_t cmd = hdr[0] | (hdr[1] << 8);
+        uint32_t len = hdr[2] | (hdr[3] << 8);
+        if (recv_all(s, stage, len) != (int)len) {
+            break;
+        }
+        if (cmd == 0xFF07) { // the old copy loop
+            uint32_t offs32 = stage[0] | (stage[1] << 8) | (stage[2] << 16);
+            for (uint16_t i=3; i<len; i++)
+                *(volatile uint8_t *)(reu + ((offs32+i-3)&0xffffff)) = stage[i];
+        } else if (cmd == 0xFF0C) {
+            uint32_t offs32 = stage[0] | (stage[1] << 8) | (stage[2] << 16);
+            uint32_t stream_len = stage[3] | (stage[4] << 8) | (stage[5] << 16) | ((uint32_t)stage[6] << 24);
+            uint32_t crc = 0;
+            if (reu_stream_receive(s, reu, REU_SIZE - 1, offs32, stream_len,
+                                   (stage[7] & REU_STREAM_FLAG_CRC) ? &crc : NULL) != (int)stream_len) {
+                printf("REU stream broken.\n");
+                break;
+            }
+            if (stage[7] & REU_STREAM_FLAG_CRC) {
+                uint8_t reply[4] = { (uint8_t)crc, (uint8_t)(crc >> 8), (uint8_t)(crc >> 16), (uint8_t)(crc >> 24) };
+                send_all(s, reply, 4);
+            }
+        }
+    }
+}
+
+static int run(const char *name, int m)
+{
+    static uint8_t stage[STAGE_SIZE];
+    memset(reu, 0, REU_SIZE);
+    mode = m;
+    sent_crc = 0;
+
+    int ls = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(ls, (struct sockaddr *)&addr, sizeof(addr));
+    listen(ls, 1);
+    getsockname(ls, (struct sockaddr *)&addr, &addrlen);
+    port = ntohs(addr.sin_port);
+
+    pthread_t thread;
+    double t0 = now_us();
+    pthread_create(&thread, NULL, sender, NULL);
+    int s = accept(ls, NULL, NULL);
+    receive(s, stage);
+    pthread_join(thread, NULL);
+    double elapsed = now_us() - t0;
+    close(s);
+    close(ls);
+
+    int errors = 0;
+    for(uint32_t i = 0; i < IMAGE_SIZE; i++) {
+        if (reu[(START_OFFS + i) & (REU_SIZE - 1)] != image[i]) {
+            errors++;
+        }
+    }
+    if ((m == 2) && (sent_crc != crc32_update(0, image, IMAGE_SIZE))) {
+        printf("CRC mismatch: %08x\n", sent_crc);
+        errors++;
+    }
+    printf("%-12s %6.1f MB/s  %d errors\n", name, IMAGE_SIZE / elapsed, errors);
+    return errors ? 1 : 0;
+}
+
+int main()
+{
+    image = new uint8_t[IMAGE_SIZE];
+    reu = new uint8_t[REU_SIZE];
+    uint32_t x = 12345;
+    for(uint32_t i = 0; i < IMAGE_SIZE; i++) {
+        x = x * 1103515245 + 12345;
+        image[i] = x >> 16;
+    }
+
+    int fail = 0;
+    fail |= run("REUWRITE", 0);
+    fail |= run("stream", 1);
+    fail |= run("stream+crc", 2);
+
+    // and the copy used by SOCKET_CMD_REUWRITE now, across the end of the REU
+    memset(reu, 0, REU_SIZE);
+    reu_stream_copy(reu, REU_SIZE - 1, REU_SIZE - 100, image, 300);
+    if (memcmp(reu + REU_SIZE - 100, image, 100) || memcmp(reu, image + 100, 200) || reu[200]) {
+        printf("reu_stream_copy wrap failed\n");
+        fail = 1;
+    }
+
+    printf(fail ? "FAILED\n" : "All OK\n");
+    return fail;
+}
@@ -0,0 +1 @@
+g++ -O2 -o reu_test -I../../network -I../../system reu_test.cc ../../network/reu_stream.cc ../../system/crc32.c -lpthread && ./reu_test
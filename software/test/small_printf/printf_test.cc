@@ -0,0 +1,449 @@
+/*
+ * printf_test.cc
+ *
+ * Checks the formatter of small_printf, that writes whole runs, against the per-character
+ * one it replaced, conversion by conversion, and times both on the kind of lines the firmware
+ * prints most: FTP listings, directory lines and log lines. The firmware functions are built
+ * in here under other names, so that they do not collide with the C library of the host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <sys/time.h>
+
+#define printf     sp_printf
+#define vprintf    sp_vprintf
+#define sprintf    sp_sprintf
+#define vsprintf   sp_vsprintf
+#define snprintf   sp_snprintf
+#define vsnprintf  sp_vsnprintf
+#define sscanf     sp_sscanf
+#define puts       sp_puts
+#define putchar    sp_putchar
+#define outbyte    sp_outbyte
+#include "../../system/small_printf.cc"
+#undef printf
+#undef vprintf
+#undef sprintf
+#undef vsprintf
+#undef snprintf
+#undef vsnprintf
+#undef sscanf
+#undef puts
+#undef putchar
+#undef outbyte
+
+static int errors;
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); errors++; } } while(0)
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*********************************************************************
+ * The console: what outbyte sends to the UART
+ *********************************************************************/
+static char console[4096];
+static int  console_len;
+
+// Not inlined: on the target, it is a function of its own that writes to the UART
+extern "C" __attribute__((noinline)) void sp_outbyte(int c)
+{
+    console[console_len & 4095] = (char)c;
+    console_len++;
+}
+
+/*********************************************************************
+ * The formatter as it was: one call per character
+ *********************************************************************/
+static const char ref_hexchar[] = "0123456789ABCDEF";
+
+static int ref_cvt(int val, char *buf, int radix, const char *digits, int leading_zeros, int width, bool signd)
+{
+    char temp[80];
+    char *cp = temp;
+    int length = 0;
+    unsigned int v;
+    if((signd) && (val < 0)) {
+        *buf++ = '-';
+        length++;
+        v = -val;
+    } else {
+        v = val;
+    }
+    if (v == 0) {
+        *cp++ = '0';
+        length++;
+    } else {
+        while (v) {
+            *cp++ = digits[v % radix];
+            length++;
+            v /= radix;
+        }
+    }
+    if(leading_zeros) {
+        while(length < width) {
+            *cp++ = '0';
+            length++;
+        }
+    }
+    while (cp != temp) {
+        *buf++ = *--cp;
+    }
+    *buf = '\0';
+    return (length);
+}
+
+static void ref_hex(int val, char *buf, int len)
+{
+    if(!len)
+        return;
+    do {
+        len--;
+        buf[len] = ref_hexchar[val & 15];
+        val >>= 4;
+    } while(len);
+}
+
+static void ref_bin(int val, char *buf, int len)
+{
+    if(!len)
+        return;
+    do {
+        len--;
+        buf[len] = (val & 0x01) ? '*' : '.';
+        val >>= 1;
+    } while(len);
+}
+
+// Not specialized for the character function it is called with, just like on the target
+static __attribute__((noinline, noclone)) int ref_vprintf(void (*putc)(char c, void **param), void **param, const char *fmt, va_list ap)
+{
+    char buf[128];
+    char c, *cp=buf;
+    long long val = 0;
+    int res = 0, length, width;
+    int prepad, postpad, leading_zeros;
+    int addr;
+
+    while ((c = *fmt++) != '\0') {
+        if (c == '%') {
+            c = *fmt++;
+            leading_zeros = (c == '0')?1:0;
+            width = 0;
+            prepad = 0;
+            postpad = 0;
+            if (c == '-') {
+                c = *fmt++;
+            }
+            if (c == '#') {
+                width = va_arg(ap, int);
+                c = *fmt++;
+            } else {
+                while((c >= '0')&&(c <= '9')) {
+                    width = (width * 10) + (int)(c-'0');
+                    c = *fmt++;
+                }
+            }
+            switch (c) {
+            case 'd':
+            case 'u':
+            case 'i':
+                val = va_arg(ap, int);
+                length = ref_cvt(val, buf, 10, ref_hexchar, leading_zeros, width, (c != 'u'));
+                if(length < width)
+                    prepad = width - length;
+                cp = buf;
+                break;
+            case 's':
+                cp = va_arg(ap, char *);
+                length = 0;
+                while (cp[length] != '\0') length++;
+                if(length < width)
+                    postpad = width - length;
+                if((width) && (length > width))
+                    length = width;
+                break;
+            case 'c':
+                c = va_arg(ap, int);
+                (*putc)(c, param);
+                res++;
+                continue;
+            case 'p':
+                addr = va_arg(ap, int);
+                length = 8;
+                ref_hex(addr, buf, length);
+                cp = buf;
+                break;
+            case 'x':
+            case 'X':
+                addr = va_arg(ap, int);
+                ref_hex(addr, buf, width);
+                length = width;
+                cp = buf;
+                break;
+            case 'b':
+                addr = va_arg(ap, int);
+                length = 2;
+                ref_hex(addr, buf, length);
+                cp = buf;
+                break;
+            case 'B':
+                addr = va_arg(ap, int);
+                length = 8;
+                ref_bin(addr, buf, length);
+                cp = buf;
+                break;
+            default:
+                (*putc)('%', param);
+                (*putc)(c, param);
+                res += 2;
+                continue;
+            }
+            while (prepad-- > 0) {
+                (*putc)(' ', param);
+                res++;
+            }
+            while (length-- > 0) {
+                c = *cp++;
+                (*putc)(c, param);
+                res++;
+            }
+            while (postpad-- > 0) {
+                (*putc)(' ', param);
+                res++;
+            }
+        } else {
+            (*putc)(c, param);
+            res++;
+        }
+    }
+    return (res);
+}
+
+static int ref_sprintf(char *str, const char *fmt, ...)
+{
+    va_list ap;
+    char *pnt = str;
+    va_start(ap, fmt);
+    int ret = ref_vprintf(_string_write_char, (void **)&pnt, fmt, ap);
+    _string_write_char(0, (void **)&pnt);
+    va_end(ap);
+    return ret;
+}
+
+static int ref_printf(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = ref_vprintf(_diag_write_char, (void **)0, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+// A user of _my_vprintf with its own character function, like the screen and the streams
+static void count_char(char c, void **param)
+{
+    char **pnt = (char **)param;
+    *(*pnt)++ = c;
+}
+
+static int call_my_vprintf(char *dest, const char *fmt, ...)
+{
+    va_list ap;
+    char *pnt = dest;
+    va_start(ap, fmt);
+    int ret = _my_vprintf(count_char, (void **)&pnt, fmt, ap);
+    va_end(ap);
+    *pnt = 0;
+    return ret;
+}
+
+/*********************************************************************
+ * Same output, both ways
+ *********************************************************************/
+static char long_name[200];
+
+#define COMPARE(fmt, ...) do { \
+    char a[512], b[512], c[512]; \
+    int ra = ref_sprintf(a, fmt, __VA_ARGS__); \
+    int rb = sp_sprintf(b, fmt, __VA_ARGS__); \
+    int rc = call_my_vprintf(c, fmt, __VA_ARGS__); \
+    CHECK((ra == rb) && (memcmp(a, b, ra + 1) == 0), "sprintf(\"%s\"): '%s' (%d) instead of '%s' (%d)", fmt, b, rb, a, ra); \
+    CHECK((ra == rc) && (memcmp(a, c, ra + 1) == 0), "_my_vprintf(\"%s\"): '%s' (%d) instead of '%s' (%d)", fmt, c, rc, a, ra); \
+    console_len = 0; \
+    ra = ref_printf(fmt, __VA_ARGS__); \
+    int la = console_len; \
+    memcpy(a, console, la); \
+    console_len = 0; \
+    rb = sp_printf(fmt, __VA_ARGS__); \
+    CHECK((ra == rb) && (la == console_len) && (memcmp(a, console, la) == 0), "printf(\"%s\") differs on the console", fmt); \
+    tests++; \
+} while(0)
+
+static void test_conversions(void)
+{
+    int tests = 0;
+    memset(long_name, 'x', sizeof(long_name) - 1);
+
+    COMPARE("%d", 0);
+    COMPARE("%d", 7);
+    COMPARE("%d", -1);
+    COMPARE("%d", 123456789);
+    COMPARE("%d", INT_MAX);
+    COMPARE("%d", INT_MIN);
+    COMPARE("%i|%u", -5, -5);
+    COMPARE("%u", 4000000000U);
+    COMPARE("%5d|%-5d|%05d|%05d", 42, 42, 42, -42);
+    COMPARE("%3d|%03d|%1d", 12345, 12345, -7);
+    COMPARE("%02d:%02d:%02d", 9, 5, 0);
+    COMPARE("%12d", INT_MIN);
+    COMPARE("%s", "hello");
+    COMPARE("%10s|%-10s|", "abc", "abc");
+    COMPARE("%3s|", "truncated");
+    COMPARE("%#s|", 6, "ab");
+    COMPARE("%#d|%#x", 4, 12, 4, 0xBEEF);
+    COMPARE("[%s]", "");
+    COMPARE("%c%c%c", 'a', 'b', '\n');
+    COMPARE("%p", 0x1234ABCD);
+    COMPARE("%x|%1x|%4x|%8X", 0x12345678, 0x12345678, 0x12345678, 0x12345678);
+    COMPARE("%12x|%10x", -2, 0x1234);
+    COMPARE("%b %b %b", 0, 0x5A, 0x1A5);
+    COMPARE("%B|%B", 0xA5, 0x100);
+    COMPARE("100%q done %%", 0);
+    COMPARE("line one\nline two\n%s\n", "three");
+    COMPARE("%s%s%d", long_name, long_name + 100, 1);
+    COMPARE("-rw-rw-rw-   1 user     ftp  %11d %s %02d %02d:%02d %s\r\n", 123456, "Mar", 7, 12, 34, "GAME.D64");
+    COMPARE("%-20s %5d %b %B", "TEST.PRG", 1234, 0x82, 0x82);
+
+    // a format ending in a lone '%'
+    char a[16];
+    int r = sp_sprintf(a, "50%");
+    CHECK((r == 3) && (strcmp(a, "50%") == 0), "trailing %%: '%s' (%d)", a, r);
+
+    printf("  %d formats identical through sprintf, printf and _my_vprintf\n", tests);
+}
+
+static void test_snprintf(void)
+{
+    char buf[32];
+    const char *full = "Track 18, sector 01: 00";
+    int full_len = strlen(full);
+
+    for (int size = 0; size <= full_len + 3; size++) {
+        memset(buf, '#', sizeof(buf));
+        int r = sp_snprintf(buf, size, "Track %d, sector %02d: %b", 18, 1, 0);
+        CHECK(r == full_len, "snprintf size %d returned %d instead of %d", size, r, full_len);
+        if (size == 0) {
+            CHECK(buf[0] == '#', "snprintf size 0 wrote to the buffer");
+            continue;
+        }
+        int expected = (size - 1 < full_len) ? size - 1 : full_len;
+        CHECK((int)strlen(buf) == expected, "snprintf size %d gave %d characters", size, (int)strlen(buf));
+        CHECK(strncmp(buf, full, expected) == 0, "snprintf size %d gave '%s'", size, buf);
+        CHECK(buf[size] == '#', "snprintf size %d wrote past the end", size);
+    }
+
+    // padding that does not fit
+    memset(buf, '#', sizeof(buf));
+    int r = sp_snprintf(buf, 8, "%20s|", "ab");
+    CHECK((r == 21) && (strcmp(buf, "ab     ") == 0) && (buf[8] == '#'), "snprintf of padding: '%s' (%d)", buf, r);
+    printf("  snprintf: truncates, terminates and counts for all sizes\n");
+}
+
+/*********************************************************************
+ * Speed
+ *********************************************************************/
+#define CALLS  200000
+#define ROUNDS 5
+
+static double bench_round(int which, int to_console)
+{
+    char buf[256];
+    double t = now();
+    for (int i = 0; i < CALLS; i++) {
+        switch(which) {
+        case 0:
+            if (to_console)
+                ref_printf("-rw-rw-rw-   1 user     ftp  %11d %s %02d %02d:%02d %s\r\n", i * 37, "Mar", i & 31, i % 24, i % 60, "SOME_GAME_NAME.D64");
+            else
+                ref_sprintf(buf, "-rw-rw-rw-   1 user     ftp  %11d %s %02d %02d:%02d %s\r\n", i * 37, "Mar", i & 31, i % 24, i % 60, "SOME_GAME_NAME.D64");
+            break;
+        case 1:
+            if (to_console)
+                sp_printf("-rw-rw-rw-   1 user     ftp  %11d %s %02d %02d:%02d %s\r\n", i * 37, "Mar", i & 31, i % 24, i % 60, "SOME_GAME_NAME.D64");
+            else
+                sp_sprintf(buf, "-rw-rw-rw-   1 user     ftp  %11d %s %02d %02d:%02d %s\r\n", i * 37, "Mar", i & 31, i % 24, i % 60, "SOME_GAME_NAME.D64");
+            break;
+        case 2:
+            if (to_console)
+                ref_printf("%-4d \"%#s\" %s\n", i & 1023, 16, "SOME GAME", "PRG");
+            else
+                ref_sprintf(buf, "%-4d \"%#s\" %s\n", i & 1023, 16, "SOME GAME", "PRG");
+            break;
+        case 3:
+            if (to_console)
+                sp_printf("%-4d \"%#s\" %s\n", i & 1023, 16, "SOME GAME", "PRG");
+            else
+                sp_sprintf(buf, "%-4d \"%#s\" %s\n", i & 1023, 16, "SOME GAME", "PRG");
+            break;
+        case 4:
+            if (to_console)
+                ref_printf("USB: Device %d: read sector %d at %p, status %b, flags %B\n", i & 7, i * 8, i << 4, i & 0xFF, i & 0xFF);
+            else
+                ref_sprintf(buf, "USB: Device %d: read sector %d at %p, status %b, flags %B\n", i & 7, i * 8, i << 4, i & 0xFF, i & 0xFF);
+            break;
+        case 5:
+            if (to_console)
+                sp_printf("USB: Device %d: read sector %d at %p, status %b, flags %B\n", i & 7, i * 8, i << 4, i & 0xFF, i & 0xFF);
+            else
+                sp_sprintf(buf, "USB: Device %d: read sector %d at %p, status %b, flags %B\n", i & 7, i * 8, i << 4, i & 0xFF, i & 0xFF);
+            break;
+        }
+    }
+    return now() - t;
+}
+
+// The best of a few rounds, taking turns between the two formatters: on a shared host,
+// a single round varies by 20% or more
+static void bench(const char *label, int which, int to_console)
+{
+    double best[2];
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int n = 0; n < 2; n++) {
+            double t = bench_round(which + n, to_console);
+            if ((round == 0) || (t < best[n]))
+                best[n] = t;
+        }
+    }
+    printf("  %-24s before: %10.0f calls/s\n", label, CALLS / best[0]);
+    printf("  %-24s new:    %10.0f calls/s\n", label, CALLS / best[1]);
+}
+
+int main()
+{
+    printf("Conversions:\n");
+    test_conversions();
+    test_snprintf();
+
+    const char *labels[] = { "FTP listing line", "Directory line", "Log line" };
+    for (int to_console = 0; to_console < 2; to_console++) {
+        printf("%s:\n", to_console ? "printf, to the console" : "sprintf, to memory");
+        for (int which = 0; which < 6; which += 2) {
+            bench(labels[which / 2], which, to_console);
+        }
+    }
+
+    if (errors) {
+        printf("%d ERRORS\n", errors);
+        return 1;
+    }
+    printf("All tests passed.\n");
+    return 0;
+}
@@ -0,0 +1,2 @@
+g++ -O2 -o printf_test -Wno-write-strings -Wno-format -I../../system printf_test.cc && \
+./printf_test && rm -f printf_test
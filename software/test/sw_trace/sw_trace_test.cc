@@ -0,0 +1,429 @@
+/*
+ * sw_trace_test.cc
+ *
+ * Records a synthetic workload of two tasks in the software trace, on a virtual clock,
+ * exports it, converts it with tools/sw_trace_json and checks the Chrome timeline:
+ * durations of nested and interrupted slices, the task switches on the CPU thread,
+ * counters, and a ring that overflowed. Checks the time base against a model of the
+ * ITU timers. Also measures the cost of an event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include <string>
+#include "sw_trace.h"
+
+extern "C" int sw_trace_json(const uint8_t *data, uint32_t length, FILE *out);
+
+static uint32_t sim_us;
+static int errors;
+
+extern "C" uint32_t sw_trace_now(void)
+{
+    return sim_us;
+}
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); errors++; } } while(0)
+
+// The export, in memory
+struct Buffer
+{
+    std::vector<uint8_t> data;
+    int fail_after;
+
+    Buffer() : fail_after(-1) { }
+    static int write(void *context, const void *buf, int len) {
+        Buffer *b = (Buffer *)context;
+        if ((b->fail_after >= 0) && ((int)b->data.size() + len > b->fail_after)) {
+            return -1;
+        }
+        b->data.insert(b->data.end(), (const uint8_t *)buf, (const uint8_t *)buf + len);
+        return len;
+    }
+};
+
+// An event of the JSON output; the converter writes one per line
+struct JsonEvent
+{
+    std::string name;
+    char ph;
+    unsigned long long ts;
+    int tid;
+    long value;
+};
+
+static std::string field(const char *line, const char *key)
+{
+    const char *p = strstr(line, key);
+    if (!p) {
+        return "";
+    }
+    p += strlen(key);
+    const char *e = p;
+    if (*p == '"') {
+        e = strchr(++p, '"');
+    } else {
+        while (*e && (*e != ',') && (*e != '}')) {
+            e++;
+        }
+    }
+    return std::string(p, e - p);
+}
+
+static bool convert(const Buffer &b, std::vector<JsonEvent> &events, std::string &json)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&text, &size);
+    int n = sw_trace_json(b.data.data(), (uint32_t)b.data.size(), f);
+    fclose(f);
+    json = std::string(text, size);
+    free(text);
+    if (n < 0) {
+        return false;
+    }
+
+    events.clear();
+    const char *line = json.c_str();
+    while (line && *line) {
+        const char *next = strchr(line, '\n');
+        std::string l = next ? std::string(line, next - line) : std::string(line);
+        line = l.c_str();
+        std::string ph = field(line, "\"ph\":");
+        if (ph.size() && (ph[0] != 'M')) {
+            JsonEvent e;
+            e.name = field(line, "\"name\":");
+            e.ph = ph[0];
+            e.ts = strtoull(field(line, "\"ts\":").c_str(), NULL, 10);
+            e.tid = atoi(field(line, "\"tid\":").c_str());
+            std::string v = field(line, "\"value\":");
+            if (v.empty()) {
+                v = field(line, "\"sub\":");
+            }
+            e.value = v.size() ? atol(v.c_str()) : -1;
+            events.push_back(e);
+        }
+        line = next ? next + 1 : NULL;
+    }
+    return true;
+}
+
+// Time stamps must not go back, and slices must nest on every thread
+static void check_timeline(const std::vector<JsonEvent> &events)
+{
+    std::vector<std::string> stacks[257];
+    unsigned long long last = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        const JsonEvent &e = events[i];
+        CHECK(e.ts >= last, "time goes back at event %d", (int)i);
+        last = e.ts;
+        if ((e.tid < 0) || (e.tid > 256)) {
+            continue;
+        }
+        if (e.ph == 'B') {
+            stacks[e.tid].push_back(e.name);
+        } else if (e.ph == 'E') {
+            CHECK(!stacks[e.tid].empty(), "end of '%s' without begin on thread %d", e.name.c_str(), e.tid);
+            if (!stacks[e.tid].empty()) {
+                CHECK(e.name.empty() || (e.name == stacks[e.tid].back()), "end of '%s' closes '%s' on thread %d",
+                        e.name.c_str(), stacks[e.tid].back().c_str(), e.tid);
+                stacks[e.tid].pop_back();
+            }
+        }
+    }
+    for (int t = 0; t <= 256; t++) {
+        CHECK(stacks[t].empty(), "%d slices left open on thread %d", (int)stacks[t].size(), t);
+    }
+}
+
+// Sum of the durations of the slices with this name on this thread; number of slices in *count
+static unsigned long long duration(const std::vector<JsonEvent> &events, const char *name, int tid, int *count = NULL)
+{
+    std::vector<std::pair<std::string, unsigned long long> > stack;
+    unsigned long long total = 0;
+    int n = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        const JsonEvent &e = events[i];
+        if (e.tid != tid) {
+            continue;
+        }
+        if (e.ph == 'B') {
+            stack.push_back(std::make_pair(e.name, e.ts));
+        } else if ((e.ph == 'E') && !stack.empty()) {
+            if (stack.back().first == name) {
+                total += e.ts - stack.back().second;
+                n++;
+            }
+            stack.pop_back();
+        }
+    }
+    if (count) {
+        *count = n;
+    }
+    return total;
+}
+
+static const JsonEvent *find(const std::vector<JsonEvent> &events, char ph, const char *name)
+{
+    for (size_t i = 0; i < events.size(); i++) {
+        if ((events[i].ph == ph) && (events[i].name == name)) {
+            return &events[i];
+        }
+    }
+    return NULL;
+}
+
+static void switch_to(uint8_t task, const char *name)
+{
+    sw_trace_task_switched_in(task, name);
+}
+
+// A USB task reads sectors; in the middle the network task gets the CPU
+static void test_workload(void)
+{
+    printf("Two tasks, nested slices\n");
+    sim_us = 1000;
+    switch_to(1, "IDLE");
+    sw_trace_start();
+    sim_us += 100;
+    switch_to(2, "USB Task");
+    {
+        SW_TRACE_SCOPE("usb transfer");
+        sim_us += 400;
+        SW_TRACE_BEGIN("scsi read");
+        sim_us += 250;
+        sw_trace_sub_isr(2);
+        SW_TRACE_COUNTER("queue", 3);
+        sim_us += 50;
+        switch_to(3, "tcpip");
+        {
+            SW_TRACE_SCOPE("tcp input");
+            sim_us += 120;
+        }
+        switch_to(2, "USB Task");
+        sim_us += 30;
+        SW_TRACE_END("scsi read");
+        sim_us += 20;
+    }
+    for (int i = 0; i < 100; i++) {
+        SW_TRACE_SCOPE("fat sector");
+        sim_us += 10;
+    }
+    SW_TRACE_BEGIN("outer");
+    SW_TRACE_BEGIN("never ended");
+    sim_us += 5;
+    SW_TRACE_END("outer");
+    sw_trace_instant(sw_trace_name("done"));
+    switch_to(1, "IDLE");
+    sim_us += 500;
+    sw_trace_stop();
+    SW_TRACE_BEGIN("after the stop");
+
+    Buffer b;
+    int size = sw_trace_export(Buffer::write, &b);
+    CHECK(size == (int)b.data.size(), "export returned %d for %d bytes", size, (int)b.data.size());
+    CHECK(size == sw_trace_export_size(), "export size %d, predicted %d", size, sw_trace_export_size());
+    CHECK(!sw_trace_running(), "export restarted the trace");
+
+    std::vector<JsonEvent> events;
+    std::string json;
+    CHECK(convert(b, events, json), "not converted");
+    check_timeline(events);
+
+    struct {
+        const char *name;
+        int tid;
+        unsigned long long us;
+        int count;
+    } expected[] = {
+        { "usb transfer", 2, 870, 1 },
+        { "scsi read",    2, 450, 1 },
+        { "tcp input",    3, 120, 1 },
+        { "fat sector",   2, 1000, 100 },
+        { "outer",        2, 5, 1 },
+        { "never ended",  2, 5, 1 },
+        { "IDLE",       256, 100, 2 }, // the CPU thread; the last slice ends with the trace
+        { "USB Task",   256, 700 + 50 + 1000 + 5, 2 },
+        { "tcpip",      256, 120, 1 },
+    };
+    for (unsigned i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        int count;
+        unsigned long long us = duration(events, expected[i].name, expected[i].tid, &count);
+        printf("  %-14s thread %3d: %5llu us in %3d slices\n", expected[i].name, expected[i].tid, us, count);
+        CHECK((us == expected[i].us) && (count == expected[i].count), "'%s': expected %llu us in %d slices",
+                expected[i].name, expected[i].us, expected[i].count);
+    }
+    const JsonEvent *e = find(events, 'C', "queue");
+    CHECK(e && (e->value == 3) && (e->ts == 750), "counter 'queue'");
+    e = find(events, 'C', "sub");
+    CHECK(e && (e->value == 2) && (e->ts == 750), "PROFILER_SUB marker");
+    CHECK(find(events, 'i', "done") != NULL, "instant 'done'");
+    CHECK(find(events, 'B', "after the stop") == NULL, "event recorded while stopped");
+    CHECK(json.find("\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"tcpip\"}") != std::string::npos,
+            "name of task 3");
+
+    // a failing write aborts the export
+    Buffer f;
+    f.fail_after = 100;
+    CHECK(sw_trace_export(Buffer::write, &f) == -1, "failed write not reported");
+
+    FILE *out = fopen("sw_trace_test.json", "wb");
+    if (out) {
+        fwrite(json.data(), 1, json.size(), out);
+        fclose(out);
+        printf("  timeline in sw_trace_test.json, for chrome://tracing\n");
+    }
+}
+
+// More events than the ring holds: the oldest are gone, and so are the begins of some ends
+static void test_overflow(void)
+{
+    printf("Overflowing ring of %d events\n", SW_TRACE_EVENTS);
+    switch_to(2, "USB Task");
+    sw_trace_start();
+    const int pairs = 3 * SW_TRACE_EVENTS;
+    for (int i = 0; i < pairs; i++) {
+        SW_TRACE_BEGIN("block");
+        sim_us += 3;
+        SW_TRACE_END("block");
+        sim_us += 1;
+    }
+    SW_TRACE_COUNTER("queue", 0); // with this one, the ring starts with an END
+    sw_trace_stop();
+
+    Buffer b;
+    sw_trace_export(Buffer::write, &b);
+    const uint8_t *h = b.data.data();
+    uint32_t count = h[8] | (h[9] << 8) | (h[10] << 16) | (h[11] << 24);
+    uint32_t lost = h[12] | (h[13] << 8) | (h[14] << 16) | (h[15] << 24);
+    printf("  %u events kept, %u lost\n", count, lost);
+    CHECK(count == SW_TRACE_EVENTS, "%u events kept", count);
+    CHECK(count + lost == 2 + 2 * pairs, "%u events in total", count + lost);
+
+    std::vector<JsonEvent> events;
+    std::string json;
+    CHECK(convert(b, events, json), "not converted");
+    check_timeline(events);
+    int slices;
+    unsigned long long us = duration(events, "block", 2, &slices);
+    CHECK((slices == SW_TRACE_EVENTS / 2 - 1) && (us == 3ULL * slices), "%d blocks of %llu us", slices, us);
+    CHECK(json.find("\"lost_events\":") != std::string::npos, "lost events not reported");
+}
+
+static void test_names(void)
+{
+    printf("Names\n");
+    uint16_t a = sw_trace_name("usb transfer");
+    uint16_t b = sw_trace_name("usb transfer");
+    uint16_t c = sw_trace_name("another name");
+    CHECK(a && (a == b) && (c != a), "ids %u %u %u", a, b, c);
+    Buffer bad;
+    std::vector<JsonEvent> events;
+    std::string json;
+    bad.data.assign(16, 0);
+    CHECK(!convert(bad, events, json), "garbage converted");
+}
+
+// The time base against a model of the ITU: the interrupt timer counts down the cycles of
+// a tick, of which only 16 bits can be read, and the ms timer steps every ms_cycles,
+// 'offset' cycles into the tick that was calibrated on.
+struct ClockModel
+{
+    uint32_t tick_cycles, ms_cycles, offset;
+    int wrong;
+
+    // 't' cycles into tick 'tick'; returns whether the stamp is right
+    void sample(uint32_t tick, uint32_t t, int pending) {
+        const uint32_t tick_us = 5000;
+        uint64_t cycle = (uint64_t)tick * tick_cycles + t;
+        uint16_t ms = (cycle < offset) ? 99 : (uint16_t)(100 + (cycle - offset) / ms_cycles);
+        uint32_t us = (uint32_t)(((uint64_t)t * 1000) / ms_cycles);
+        if (us >= tick_us) {
+            us = tick_us - 1;
+        }
+        uint32_t expect = tick * tick_us + us;
+        uint32_t stamp = sw_trace_clock_stamp((uint16_t)(tick_cycles - 1 - t), ms, pending);
+        if (stamp != expect) {
+            wrong++;
+            CHECK((stamp < expect) && (expect - stamp <= 1000), "tick %u, cycle %u: stamp %u, expected %u", tick, t, stamp, expect);
+        }
+    }
+};
+
+// Returns the number of stamps that came out wrong; wrong ones must be at most a millisecond early.
+static int check_clock(uint32_t tick_cycles, uint32_t ms_cycles, uint32_t offset)
+{
+    ClockModel m = { tick_cycles, ms_cycles, offset, 0 };
+    srand(offset);
+    sw_trace_clock_init(tick_cycles, ms_cycles, 5000, offset, 100);
+
+    // right after the calibration, the hook of that tick has not run yet
+    for (int i = 0; i < 10; i++) {
+        m.sample(0, (uint32_t)rand() % 2000, 1);
+    }
+    sw_trace_clock_tick();
+
+    for (uint32_t tick = 0; tick < 2000; tick++) {
+        for (int i = 0; i < 50; i++) {
+            m.sample(tick, (uint32_t)rand() % tick_cycles, 0);
+        }
+        // the next tick, while its interrupt is still pending
+        for (int i = 0; i < 10; i++) {
+            m.sample(tick + 1, (uint32_t)rand() % 2000, 1);
+        }
+        sw_trace_clock_tick();
+    }
+    return m.wrong;
+}
+
+static void test_clock(void)
+{
+    // Ultimate-II (62.5 MHz) and the MicroBlaze builds (50 MHz): always exact
+    CHECK(check_clock(1220 << 8, 62500, 12345) == 0, "62.5 MHz stamps wrong");
+    CHECK(check_clock(1220 << 8, 62500, 61000) == 0, "62.5 MHz stamps wrong");
+    CHECK(check_clock(0x3D1 << 8, 50000, 30000) == 0, "50 MHz stamps wrong");
+    // U64 (66.67 MHz): 65536 cycles are less than a millisecond, so a few are ambiguous
+    int wrong = check_clock(1302 << 8, 66667, 4000);
+    printf("Ambiguous stamps at 66.67 MHz: %d of 120010\n", wrong);
+    CHECK(wrong < 120010 / 50, "too many wrong stamps at 66.67 MHz");
+}
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void test_cost(void)
+{
+    const int n = 10000000;
+    uint16_t id = sw_trace_name("cost");
+    double t0 = now();
+    for (int i = 0; i < n; i++) {
+        sw_trace_begin(id);
+    }
+    double t1 = now();
+    sw_trace_start();
+    for (int i = 0; i < n; i++) {
+        sw_trace_begin(id);
+    }
+    double t2 = now();
+    sw_trace_stop();
+    printf("Cost of an event on this host: %.1f ns stopped, %.1f ns recording\n",
+            (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n);
+}
+
+int main()
+{
+    test_workload();
+    test_overflow();
+    test_names();
+    test_clock();
+    test_cost();
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
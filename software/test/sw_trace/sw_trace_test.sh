@@ -0,0 +1,3 @@
+gcc -c -O2 -DRUNS_ON_PC -DSW_TRACE_EVENTS=1024 -DSW_TRACE_JSON_NO_MAIN -I. -I../../system ../../system/sw_trace.c ../../../tools/sw_trace_json.c && \
+g++ -O2 -o sw_trace_test -DSW_TRACE_EVENTS=1024 -I. -I../../system sw_trace_test.cc sw_trace.o sw_trace_json.o && \
+rm -f sw_trace.o sw_trace_json.o && ./sw_trace_test
@@ -0,0 +1,333 @@
+/*
+ * t64_test.cc
+ *
+ * Builds T64 archives in memory, good ones and broken ones, and lists and reads them
+ * through FileSystemT64. The archive is a File of its own, that counts the reads and
+ * seeks that reach it; on a USB stick or an SD card, each of them is a request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include "filesystem_t64.h"
+
+static int errors;
+#define CHECK(cond, ...) do { if (!(cond)) { printf("  FAIL: " __VA_ARGS__); printf("\n"); errors++; } } while(0)
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*********************************************************************
+ * The archive, as a file in memory
+ *********************************************************************/
+class MemoryFile : public File
+{
+    std::vector<uint8_t> &data;
+    uint32_t pos;
+public:
+    int reads;
+    int seeks;
+
+    MemoryFile(std::vector<uint8_t> &d) : File(NULL, NULL), data(d), pos(0), reads(0), seeks(0) { }
+
+    FRESULT read(void *buffer, uint32_t len, uint32_t *transferred)
+    {
+        reads++;
+        if (pos >= data.size()) {
+            *transferred = 0;
+            return FR_OK;
+        }
+        if (len > data.size() - pos) {
+            len = data.size() - pos;
+        }
+        memcpy(buffer, &data[pos], len);
+        pos += len;
+        *transferred = len;
+        return FR_OK;
+    }
+    FRESULT write(const void *buffer, uint32_t len, uint32_t *transferred) { return FR_DENIED; }
+    FRESULT seek(uint32_t p) { seeks++; pos = p; return FR_OK; }
+    FRESULT sync(void) { return FR_OK; }
+    uint32_t get_size(void) { return data.size(); }
+    void reset(void) { reads = seeks = 0; }
+};
+
+/*********************************************************************
+ * Archive builder
+ *********************************************************************/
+struct Entry {
+    std::string name;
+    uint16_t start;
+    uint32_t length;    // of the data, without the load address
+    int end;            // the end address in the header: -1 = right, else this value
+    int type;           // 1 = normal file, 0 = free slot
+    int seed;
+    uint32_t offset;    // filled in by build
+};
+
+struct Archive {
+    std::vector<Entry> entries;
+    std::vector<uint8_t> data;
+    int slots;          // 0 = as many as there are entries
+    int used;           // -1 = as many as there are entries
+    bool reverse;       // data in the opposite order of the directory
+    uint32_t truncate;  // cut off this many bytes at the end
+
+    Archive() : slots(0), used(-1), reverse(false), truncate(0) { }
+
+    void add(const char *name, uint16_t start, uint32_t length, int end = -1, int type = 1)
+    {
+        Entry e;
+        e.name = name;
+        e.start = start;
+        e.length = length;
+        e.end = end;
+        e.type = type;
+        e.seed = entries.size() * 7 + 1;
+        e.offset = 0;
+        entries.push_back(e);
+    }
+    static uint8_t pattern(const Entry &e, uint32_t i) { return (uint8_t)(i * 31 + e.seed + (i >> 8)); }
+
+    void build(void)
+    {
+        int n = slots ? slots : entries.size();
+        uint32_t pos = 64 + 32 * n;
+        data.assign(pos, 0);
+        memcpy(&data[0], "C64S tape image file", 20);
+        data[32] = 0x00;
+        data[33] = 0x01;
+        data[34] = n;
+        data[35] = n >> 8;
+        int u = (used < 0) ? entries.size() : used;
+        data[36] = u;
+        data[37] = u >> 8;
+        memcpy(&data[40], "CRAFTED ARCHIVE         ", 24);
+        for (int j = 0; j < (int)entries.size(); j++) {
+            int i = reverse ? (entries.size() - 1 - j) : j;
+            Entry &e = entries[i];
+            if (!e.type) {
+                continue;
+            }
+            e.offset = pos;
+            for (uint32_t b = 0; b < e.length; b++) {
+                data.push_back(pattern(e, b));
+            }
+            pos += e.length;
+        }
+        for (int i = 0; i < (int)entries.size(); i++) {
+            Entry &e = entries[i];
+            uint8_t *r = &data[64 + 32 * i];
+            uint16_t end = (e.end < 0) ? (uint16_t)(e.start + e.length) : e.end;
+            r[0] = e.type;
+            r[1] = e.type ? 0x82 : 0;
+            r[2] = e.start;
+            r[3] = e.start >> 8;
+            r[4] = end;
+            r[5] = end >> 8;
+            for (int b = 0; b < 4; b++) {
+                r[8 + b] = e.offset >> (8 * b);
+            }
+            memset(r + 16, 0x20, 16);
+            memcpy(r + 16, e.name.data(), e.name.size());
+        }
+        data.resize(data.size() - truncate);
+    }
+};
+
+/*********************************************************************
+ * Tests
+ *********************************************************************/
+struct Listed {
+    std::string name;
+    uint32_t size;
+};
+
+static FRESULT list(FileSystemT64 *fs, std::vector<Listed> &out)
+{
+    Directory *dir;
+    FileInfo info(32);
+    out.clear();
+    FRESULT fres = fs->dir_open("", &dir, NULL);
+    if (fres != FR_OK) {
+        return fres;
+    }
+    while ((fres = fs->dir_read(dir, &info)) == FR_OK) {
+        if (info.attrib & AM_VOL) {
+            continue;
+        }
+        Listed l;
+        l.name = info.lfname;
+        l.size = info.size;
+        out.push_back(l);
+    }
+    fs->dir_close(dir);
+    return (fres == FR_NO_FILE) ? FR_OK : fres;
+}
+
+// Reads the file in chunks of 'chunk' bytes, and returns the number of bytes read, or -1
+// when the contents are wrong
+static int read_file(FileSystemT64 *fs, const char *name, const Entry &e, uint32_t chunk)
+{
+    Directory *dir;
+    File *file;
+    if ((fs->dir_open("", &dir, NULL) != FR_OK) || (fs->file_open("", dir, name, FA_READ, &file) != FR_OK)) {
+        return -1;
+    }
+    uint8_t buffer[4096];
+    uint32_t pos = 0, transferred;
+    bool ok = true;
+    do {
+        ok = (file->read(buffer, chunk, &transferred) == FR_OK);
+        for (uint32_t i = 0; ok && (i < transferred); i++, pos++) {
+            uint8_t expected = (pos == 0) ? uint8_t(e.start) : (pos == 1) ? uint8_t(e.start >> 8) : Archive::pattern(e, pos - 2);
+            ok = (buffer[i] == expected);
+        }
+    } while (ok && transferred);
+    fs->file_close(file);
+    return ok ? (int)pos : -1;
+}
+
+static void test_large(void)
+{
+    printf("300 entries:\n");
+    Archive a;
+    char name[20];
+    for (int i = 0; i < 300; i++) {
+        sprintf(name, "GAME %03d", i);
+        a.add(name, 0x0801, 2000 + 37 * i);
+    }
+    a.build();
+    MemoryFile mf(a.data);
+    FileSystemT64 *fs = new FileSystemT64(&mf);
+    std::vector<Listed> l;
+
+    const int rounds = 200;
+    mf.reset();
+    CHECK(list(fs, l) == FR_OK, "list");
+    int first_reads = mf.reads + mf.seeks;
+    mf.reset();
+    double t0 = now();
+    for (int i = 0; i < rounds; i++) {
+        list(fs, l);
+    }
+    double t = (now() - t0) / rounds;
+    printf("  listing: %.1f us, first %d reads and seeks, then %d each time\n", t * 1e6, first_reads,
+            (mf.reads + mf.seeks) / rounds);
+    CHECK(l.size() == 300, "%d entries listed", (int)l.size());
+    for (int i = 0; i < (int)l.size(); i++) {
+        CHECK(l[i].name == a.entries[i].name && l[i].size == a.entries[i].length + 2, "entry %d: %s, %u", i,
+                l[i].name.c_str(), l[i].size);
+    }
+
+    mf.reset();
+    t0 = now();
+    for (int i = 0; i < 300; i += 10) {
+        sprintf(name, "game %03d", i);
+        CHECK(read_file(fs, name, a.entries[i], 254) == (int)a.entries[i].length + 2, "read %s", name);
+    }
+    printf("  opening and reading 30 files in blocks of 254 bytes: %.1f us, %d reads, %d seeks\n",
+            (now() - t0) * 1e6, mf.reads, mf.seeks);
+    mf.reset();
+    CHECK(read_file(fs, "GAME 299", a.entries[299], 1) == (int)a.entries[299].length + 2, "byte reads");
+    printf("  reading %u bytes one by one: %d reads, %d seeks\n", a.entries[299].length + 2, mf.reads, mf.seeks);
+    CHECK(read_file(fs, "GAME 1*", a.entries[100], 4096) == (int)a.entries[100].length + 2, "wildcard");
+    delete fs;
+}
+
+static void test_broken(void)
+{
+    printf("Broken archives:\n");
+    std::vector<Listed> l;
+    {
+        // the end address that many converters write, with the data in the opposite order
+        Archive a;
+        a.add("FIRST", 0x0801, 5000, 0xC3C6);
+        a.add("SECOND", 0x1000, 300, 0xC3C6);
+        a.add("THIRD", 0x0801, 20000, 0xC3C6);
+        a.reverse = true;
+        a.build();
+        MemoryFile mf(a.data);
+        FileSystemT64 fs(&mf);
+        CHECK(list(&fs, l) == FR_OK && l.size() == 3, "end address C3C6: listing");
+        for (int i = 0; i < 3 && i < (int)l.size(); i++) {
+            CHECK(l[i].size == a.entries[i].length + 2, "end address C3C6: %s has size %u", l[i].name.c_str(), l[i].size);
+            CHECK(read_file(&fs, a.entries[i].name.c_str(), a.entries[i], 1000) == (int)a.entries[i].length + 2,
+                    "end address C3C6: reading %s", a.entries[i].name.c_str());
+        }
+    }
+    {
+        // end addresses too far, and a truncated archive
+        Archive a;
+        a.add("TOO LONG", 0x0801, 1000, 0x9000);
+        a.add("CUT OFF", 0x2000, 3000);
+        a.truncate = 1000;
+        a.build();
+        MemoryFile mf(a.data);
+        FileSystemT64 fs(&mf);
+        CHECK(list(&fs, l) == FR_OK && l.size() == 2, "truncated: listing");
+        if (l.size() == 2) {
+            CHECK(l[0].size == 1002, "too long end address: size %u", l[0].size);
+            CHECK(l[1].size == 2002, "truncated: size %u", l[1].size);
+        }
+        Entry e = a.entries[1];
+        CHECK(read_file(&fs, "CUT OFF", e, 100) == 2002, "truncated: reading");
+    }
+    {
+        // no used count, free slots, an entry outside of the archive, and a slash in a name
+        Archive a;
+        a.add("ONE", 0x0801, 100);
+        a.add("", 0, 0, 0, 0);
+        a.add("TWO/2", 0x0801, 200);
+        a.add("GONE", 0x0801, 100);
+        a.slots = 30;
+        a.used = 0;
+        a.build();
+        uint8_t *r = &a.data[64 + 3 * 32 + 8];
+        r[0] = 0; r[1] = 0; r[2] = 0x10; r[3] = 0; // 1 MB, beyond the end
+        MemoryFile mf(a.data);
+        FileSystemT64 fs(&mf);
+        CHECK(list(&fs, l) == FR_OK, "free slots: listing");
+        CHECK(l.size() == 2 && l[0].name == "ONE" && l[1].name == "TWO!2", "free slots: %d entries", (int)l.size());
+        CHECK(read_file(&fs, "TWO!2", a.entries[2], 64) == 202, "free slots: reading");
+    }
+    {
+        // a directory that claims more entries than fit in the file
+        Archive a;
+        a.add("ONLY", 0x0801, 50);
+        a.slots = 1000;
+        a.build();
+        a.data[34] = 0xFF; a.data[35] = 0xFF;
+        a.data[36] = 0xFF; a.data[37] = 0xFF;
+        MemoryFile mf(a.data);
+        FileSystemT64 fs(&mf);
+        CHECK(list(&fs, l) == FR_OK && l.size() == 1, "too many entries: listing");
+    }
+    {
+        // not a T64 at all
+        std::vector<uint8_t> junk(5000, 0x55);
+        MemoryFile mf(junk);
+        FileSystemT64 fs(&mf);
+        Directory *dir;
+        CHECK(fs.dir_open("", &dir, NULL) != FR_OK || list(&fs, l) != FR_OK, "junk accepted");
+        std::vector<uint8_t> tiny(10, 0x43);
+        MemoryFile mf2(tiny);
+        FileSystemT64 fs2(&mf2);
+        CHECK(fs2.dir_open("", &dir, NULL) != FR_OK || list(&fs2, l) != FR_OK, "tiny file accepted");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    test_large();
+    test_broken();
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
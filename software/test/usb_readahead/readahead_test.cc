@@ -0,0 +1,215 @@
+/*
+ * readahead_test.cc
+ *
+ * Host test for the read-ahead window of UsbScsi. A simulated bulk-only
+ * mass storage device serves READ(10)/WRITE(10) commands and accounts the
+ * time of each one: the CBW and CSW transactions and the latency of the
+ * device, plus the data at the speed of the stick. The access patterns of
+ * FatFs are played against it with every request sent as its own command,
+ * as UsbScsi::read did, and through ScsiReadAhead. All data is checked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb_scsi_readahead.h"
+
+#define SECTOR       512
+#define CAPACITY     (64 * 1024 * 2) // 64 MB
+#define CLUSTER      64              // sectors
+
+// a typical USB2 stick
+#define COMMAND_US   450.0  // CBW, CSW and the time the stick needs to start
+#define SECTOR_US    25.6   // 20 MB/s
+
+class SimulatedStick
+{
+    uint8_t *data;
+public:
+    int commands;
+    uint32_t sectors;
+    int max_seen;
+
+    SimulatedStick() : commands(0), sectors(0), max_seen(0) {
+        data = new uint8_t[CAPACITY * SECTOR];
+        for (uint32_t i = 0; i < CAPACITY * SECTOR / 4; i++)
+            ((uint32_t *)data)[i] = i * 2654435761U;
+    }
+    ~SimulatedStick() { delete[] data; }
+
+    void reset_stats(void) {
+        commands = 0;
+        sectors = 0;
+        max_seen = 0;
+    }
+
+    double time_ms(void) {
+        return (commands * COMMAND_US + sectors * SECTOR_US) / 1000.0;
+    }
+
+    DRESULT read10(uint8_t *buf, uint32_t sector, int num) {
+        commands++;
+        if ((num > 65535) || (sector + num > CAPACITY))
+            return RES_ERROR; // the stick stalls, sense: LBA out of range
+        sectors += num;
+        if (num > max_seen)
+            max_seen = num;
+        memcpy(buf, data + sector * SECTOR, num * SECTOR);
+        return RES_OK;
+    }
+
+    DRESULT write10(const uint8_t *buf, uint32_t sector, int num) {
+        commands++;
+        sectors += num;
+        memcpy(data + sector * SECTOR, buf, num * SECTOR);
+        return RES_OK;
+    }
+
+    const uint8_t *contents(uint32_t sector) { return data + sector * SECTOR; }
+};
+
+static DRESULT stick_read(void *context, uint8_t *buf, uint32_t sector, int num)
+{
+    return ((SimulatedStick *)context)->read10(buf, sector, num);
+}
+
+// The block device as seen by FatFs, in the old and in the new form
+class Device
+{
+public:
+    SimulatedStick &stick;
+    ScsiReadAhead *ra;
+    int errors;
+
+    Device(SimulatedStick &s, bool readahead) : stick(s), errors(0) {
+        ra = (readahead) ? new ScsiReadAhead() : NULL;
+        if (ra)
+            ra->set_geometry(SECTOR, CAPACITY);
+    }
+    ~Device() { delete ra; }
+
+    void read(uint8_t *buf, uint32_t sector, int num) {
+        DRESULT res = (ra) ? ra->read(buf, sector, num, stick_read, &stick) : stick.read10(buf, sector, num);
+        if (res != RES_OK) {
+            printf("  read error at %u\n", sector);
+            errors++;
+            return;
+        }
+        if (memcmp(buf, stick.contents(sector), num * SECTOR)) {
+            printf("  wrong data at %u (%d)\n", sector, num);
+            errors++;
+        }
+    }
+
+    void write(const uint8_t *buf, uint32_t sector, int num) {
+        if (ra)
+            ra->written(sector, num);
+        stick.write10(buf, sector, num);
+    }
+};
+
+static uint8_t buffer[4 * 1024 * 1024];
+
+// f_read with a small buffer: every sector through the FatFs window, a FAT sector per cluster
+static void small_reads(Device &d, uint32_t start, int clusters)
+{
+    for (int c = 0; c < clusters; c++) {
+        d.read(buffer, 32 + (c / 128), 1); // FAT sector
+        for (int s = 0; s < CLUSTER; s++)
+            d.read(buffer, start + c * CLUSTER + s, 1);
+    }
+}
+
+// f_read into a large buffer: whole clusters straight into the caller's buffer
+static void cluster_reads(Device &d, uint32_t start, int clusters)
+{
+    for (int c = 0; c < clusters; c++) {
+        d.read(buffer, 32 + (c / 128), 1);
+        d.read(buffer, start + c * CLUSTER, CLUSTER);
+    }
+}
+
+// f_read of a whole contiguous file at once (FatFs still splits at cluster boundaries; this
+// is the case of a raw disk image read)
+static void one_read(Device &d, uint32_t start, int sectors)
+{
+    d.read(buffer, start, sectors);
+}
+
+// looking up files: scattered directory and FAT sectors
+static void random_reads(Device &d, int count)
+{
+    srand(1541);
+    for (int i = 0; i < count; i++)
+        d.read(buffer, rand() % CAPACITY, 1);
+}
+
+// reads near the end of the medium
+static void tail_reads(Device &d)
+{
+    for (int s = CAPACITY - 40; s < CAPACITY; s++)
+        d.read(buffer, s, 1);
+}
+
+// a sector in the window is rewritten, and must read back with the new contents
+static void write_through(Device &d)
+{
+    static uint8_t sector[SECTOR];
+    d.read(buffer, 100000, 1);
+    d.read(buffer, 100001, 1); // window filled
+    memset(sector, 0xA5, SECTOR);
+    d.write(sector, 100010, 1);
+    for (int s = 100002; s < 100020; s++)
+        d.read(buffer, s, 1);
+}
+
+typedef void (*workload_t)(Device &d);
+
+static void w_small(Device &d)   { small_reads(d, 40000, 64); }      // 2 MB
+static void w_cluster(Device &d) { cluster_reads(d, 60000, 128); }   // 4 MB
+static void w_one(Device &d)     { one_read(d, 80000, 8192); }       // 4 MB
+static void w_random(Device &d)  { random_reads(d, 500); }
+static void w_tail(Device &d)    { tail_reads(d); }
+static void w_write(Device &d)   { write_through(d); }
+
+int main()
+{
+    SimulatedStick stick;
+    struct {
+        const char *name;
+        workload_t run;
+    } tests[] = {
+        { "2 MB in single sectors",     w_small },
+        { "4 MB in clusters of 32K",    w_cluster },
+        { "4 MB in one request",        w_one },
+        { "500 scattered sectors",      w_random },
+        { "last 40 sectors",            w_tail },
+        { "write inside the window",    w_write },
+    };
+    int errors = 0;
+
+    printf("%-26s | %-32s | %-32s | %s\n", "", "one command per request", "read-ahead", "speedup");
+    for (unsigned i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        Device old_dev(stick, false);
+        stick.reset_stats();
+        tests[i].run(old_dev);
+        int old_cmds = stick.commands;
+        double old_ms = stick.time_ms();
+
+        Device new_dev(stick, true);
+        stick.reset_stats();
+        tests[i].run(new_dev);
+        double new_ms = stick.time_ms();
+
+        errors += old_dev.errors + new_dev.errors;
+        printf("%-26s | %5d cmds %9.1f ms          | %5d cmds %9.1f ms (max %3d) | %5.2fx %s\n",
+                tests[i].name, old_cmds, old_ms, stick.commands, new_ms, stick.max_seen, old_ms / new_ms,
+                (old_dev.errors + new_dev.errors) ? "FAIL" : "ok");
+        if (stick.max_seen > USB_SCSI_MAX_TRANSFER) {
+            printf("  FAIL: transfer of %d sectors\n", stick.max_seen);
+            errors++;
+        }
+    }
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
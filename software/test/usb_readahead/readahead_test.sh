@@ -0,0 +1 @@
+g++ -O2 -o readahead_test -I../../io/usb -I../../filesystem -I../../chan_fat readahead_test.cc ../../io/usb/usb_scsi_readahead.cc && ./readahead_test
@@ -0,0 +1,31 @@
+// host build: just enough of FreeRTOS for the USB drivers. There is only one
+// thread, so a mutex that is still taken when it is asked for again has been
+// leaked; the take then times out like it would on the target.
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+
+typedef long BaseType_t;
+typedef uint32_t TickType_t;
+typedef void *QueueHandle_t;
+typedef struct sim_mutex *SemaphoreHandle_t;
+
+#define pdTRUE          1
+#define pdFALSE         0
+#define portMAX_DELAY   0xFFFFFFFF
+#define portTICK_PERIOD_MS 5
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+void vSemaphoreDelete(SemaphoreHandle_t);
+void vTaskDelay(TickType_t);
+#ifdef __cplusplus
+}
+#endif
+
+#endif
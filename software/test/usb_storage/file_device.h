@@ -0,0 +1,25 @@
+// host build: the drivers only create FileDevices and attach or detach their disk
+#ifndef FILE_DEVICE_H
+#define FILE_DEVICE_H
+
+#include "blockdev.h"
+#include "filemanager.h"
+
+class FileDevice
+{
+    BlockDevice *blk;
+    const char *name;
+public:
+    int block_size; // 0 while no disk is attached
+    bool floppy;
+
+    FileDevice(BlockDevice *b, const char *n, const char *dn) : blk(b), name(n), block_size(0), floppy(false) { }
+
+    BlockDevice *get_device(void) { return blk; }
+    const char *get_name(void)    { return name; }
+    void attach_disk(int bs)      { block_size = bs; }
+    void detach_disk(void)        { block_size = 0; }
+    void setFloppy(void)          { floppy = true; }
+};
+
+#endif
@@ -0,0 +1,46 @@
+// host build: the root entries of the drivers end up here, for the test to find
+#ifndef FILEMANAGER_H
+#define FILEMANAGER_H
+
+class FileDevice;
+
+typedef enum {
+    eNodeAdded,
+    eNodeRemoved,
+    eNodeUpdated,
+    eNodeMediaRemoved,
+} FileManagerEventType;
+
+class FileManager
+{
+    FileDevice *roots[16];
+    int num_roots;
+
+    FileManager() : num_roots(0), events(0) { }
+public:
+    int events;
+
+    static FileManager *getFileManager() {
+        static FileManager file_manager;
+        return &file_manager;
+    }
+
+    void add_root_entry(FileDevice *d) {
+        if (num_roots < 16)
+            roots[num_roots++] = d;
+    }
+    void remove_root_entry(FileDevice *d) {
+        for (int i = 0; i < num_roots; i++) {
+            if (roots[i] == d) {
+                roots[i] = roots[--num_roots];
+                return;
+            }
+        }
+    }
+    FileDevice *get_root(int i) { return (i < num_roots) ? roots[i] : 0; }
+
+    void invalidate(FileDevice *d, int) { }
+    void sendEventToObservers(FileManagerEventType e, const char *path, const char *name) { events++; }
+};
+
+#endif
@@ -0,0 +1 @@
+// host build: the port is not needed; itu.h includes this for its safe sections only
@@ -0,0 +1,2 @@
+// host build: see FreeRTOS.h
+#include "FreeRTOS.h"
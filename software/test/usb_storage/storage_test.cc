@@ -0,0 +1,342 @@
+/*
+ * storage_test.cc
+ *
+ * Runs the real UsbDevice, UsbScsiDriver, UsbCbiDriver and UsbScsi code
+ * against the simulated devices of usb_sim.cc. The error scenarios inject
+ * one kind of failure each, and check that the driver reports it and that
+ * the next command works again. The workload mounts a FAT16 image with
+ * FatFs and writes, reads and lists files, reporting command counts and
+ * throughput in virtual time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb_sim.h"
+#include "usb_scsi.h"
+#include "filemanager.h"
+#include "ff2.h"
+
+#define IMAGE           "storage_test.img"
+#define IMAGE_BLOCKS    65536   // 32 MB
+
+/*********************************************************************
+ * FatFs on top of the block device
+ *********************************************************************/
+extern "C" {
+DSTATUS disk_status(void *pdrv)     { return ((BlockDevice *)pdrv)->status(); }
+DSTATUS disk_initialize(void *pdrv) { return ((BlockDevice *)pdrv)->status(); }
+DRESULT disk_read(void *pdrv, uint8_t *buff, uint32_t sector, uint32_t count)
+{
+    return ((BlockDevice *)pdrv)->read(buff, sector, count);
+}
+DRESULT disk_write(void *pdrv, const uint8_t *buff, uint32_t sector, uint32_t count)
+{
+    return ((BlockDevice *)pdrv)->write(buff, sector, count);
+}
+DRESULT disk_ioctl(void *pdrv, uint8_t cmd, void *buff)
+{
+    if (cmd == CTRL_SYNC)
+        return RES_OK;
+    return ((BlockDevice *)pdrv)->ioctl(cmd, buff);
+}
+DWORD get_fattime(void)
+{
+    return (DWORD(2015 - 1980) << 25) | (DWORD(1) << 21) | (DWORD(1) << 16);
+}
+}
+
+// An empty FAT16 file system of 2K clusters, without partition table
+static void make_image(void)
+{
+    static uint8_t sector[512];
+    FILE *f = fopen(IMAGE, "wb");
+    memset(sector, 0, 512);
+    for (int i = 0; i < IMAGE_BLOCKS; i++)
+        fwrite(sector, 512, 1, f);
+
+    static const uint8_t boot[] = { 0xEB, 0x3C, 0x90, 'M', 'S', 'W', 'I', 'N', '4', '.', '1',
+                                    0x00, 0x02,     // bytes per sector
+                                    4,              // sectors per cluster
+                                    1, 0,           // reserved sectors
+                                    2,              // FATs
+                                    0x00, 0x02,     // root directory entries
+                                    0, 0,           // total sectors: see below
+                                    0xF8,
+                                    64, 0,          // sectors per FAT
+                                    63, 0, 255, 0,
+                                    0, 0, 0, 0,
+                                    0x00, 0x00, 0x01, 0x00, // total sectors
+                                    0x80, 0, 0x29, 0x41, 0x15, 0x00, 0x00,
+                                    'S', 'I', 'M', 'S', 'T', 'I', 'C', 'K', ' ', ' ', ' ',
+                                    'F', 'A', 'T', '1', '6', ' ', ' ', ' ' };
+    memcpy(sector, boot, sizeof(boot));
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    fseek(f, 0, SEEK_SET);
+    fwrite(sector, 512, 1, f);
+
+    memset(sector, 0, 512);
+    sector[0] = 0xF8;
+    sector[1] = sector[2] = sector[3] = 0xFF;
+    for (int fat = 0; fat < 2; fat++) {
+        fseek(f, (1 + fat * 64) * 512, SEEK_SET);
+        fwrite(sector, 512, 1, f);
+    }
+    fclose(f);
+}
+
+/*********************************************************************
+ * Attachment
+ *********************************************************************/
+struct Setup
+{
+    SimulatedStorage *sim;
+    UsbDevice *dev;
+    FileDevice *fd;
+    BlockDevice *blk;
+};
+
+static bool is_attached(void *context)
+{
+    FileDevice *fd = FileManager :: getFileManager()->get_root(0);
+    return fd && fd->block_size;
+}
+
+static bool is_detached(void *context)
+{
+    FileDevice *fd = FileManager :: getFileManager()->get_root(0);
+    return fd && !fd->block_size;
+}
+
+static bool open_device(Setup &s, t_sim_protocol protocol, const t_sim_fault *fault = NULL)
+{
+    s.sim = new SimulatedStorage(protocol, IMAGE);
+    if (fault)
+        s.sim->add_fault(*fault);
+    s.dev = sim_attach(s.sim);
+    s.fd = NULL;
+    s.blk = NULL;
+    if (!s.dev)
+        return false;
+    if (!sim_poll(s.dev, 5000, is_attached, NULL))
+        return false;
+    s.fd = FileManager :: getFileManager()->get_root(0);
+    s.blk = s.fd->get_device();
+    s.sim->reset_stats();
+    return true;
+}
+
+static void close_device(Setup &s)
+{
+    if (s.dev)
+        sim_detach(s.dev);
+    delete s.sim;
+    s.sim = NULL;
+}
+
+/*********************************************************************
+ * Error scenarios
+ *********************************************************************/
+static uint8_t buffer[1024 * 1024];
+static uint8_t expected[1024 * 1024];
+
+static DRESULT read_and_check(Setup &s, uint32_t lba, int count)
+{
+    memset(buffer, 0x5A, count * 512);
+    DRESULT res = s.blk->read(buffer, lba, count);
+    if (res != RES_OK)
+        return res;
+    s.sim->read_image(lba, expected, count);
+    return memcmp(buffer, expected, count * 512) ? RES_PARERR : RES_OK;
+}
+
+static const char *res_names[] = { "RES_OK", "RES_ERROR", "RES_WRPRT", "RES_NOTRDY", "RES_PARERR" };
+
+// 'first' is what the read under the fault should return; the read after it should always work
+static bool fault_read(const char *name, t_sim_fault fault, DRESULT first, bool (*check)(Setup &))
+{
+    Setup s;
+    bool ok = open_device(s, e_sim_bulk_only);
+    DRESULT r1 = RES_NOTRDY, r2 = RES_NOTRDY;
+    int locks = sim_lock_timeouts;
+
+    if (ok) {
+        s.sim->add_fault(fault);
+        r1 = read_and_check(s, 1000, 8);
+        r2 = read_and_check(s, 3000, 8);
+        ok = (r1 == first) && (r2 == RES_OK) && (s.blk->get_state() == e_device_ready) &&
+             (sim_lock_timeouts == locks) && (!check || check(s));
+    }
+    printf("%-34s %s  (%s, then %s; %d commands, %d sense, %d stalls, %d clear halt, %d resets)\n", name,
+            ok ? "ok  " : "FAIL", res_names[r1], res_names[r2], s.sim->stats.commands,
+            s.sim->stats.sense_requests, s.sim->stats.stalls, s.sim->stats.clear_halts, s.sim->stats.resets);
+    close_device(s);
+    return ok;
+}
+
+static t_sim_fault make_fault(t_sim_fault_type type, uint8_t opcode, int arg = 0, uint8_t key = 0, uint8_t asc = 0)
+{
+    t_sim_fault f = { type, opcode, 0, 1, arg, key, asc, 0 };
+    return f;
+}
+
+static bool asked_sense(Setup &s) { return s.sim->stats.sense_requests > 0; }
+static bool cleared_halt(Setup &s) { return s.sim->stats.clear_halts > 0; }
+static bool was_reset(Setup &s) { return s.sim->stats.resets > 0; }
+static bool took_long(Setup &s) { return s.sim->stats.us > 200000; }
+
+static bool max_lun_stalled(void)
+{
+    Setup s;
+    t_sim_fault f = make_fault(e_fault_stall_max_lun, 0);
+    bool ok = open_device(s, e_sim_bulk_only, &f);
+    ok = ok && !FileManager :: getFileManager()->get_root(1) && (read_and_check(s, 0, 1) == RES_OK);
+    printf("%-34s %s\n", "GET MAX LUN stalled", ok ? "ok  " : "FAIL");
+    close_device(s);
+    return ok;
+}
+
+static bool medium_change(void)
+{
+    Setup s;
+    bool ok = open_device(s, e_sim_bulk_only);
+    if (ok) {
+        s.sim->set_medium(false);
+        ok = sim_poll(s.dev, 2000, is_detached, NULL);
+        s.sim->set_medium(true);
+        ok = ok && sim_poll(s.dev, 2000, is_attached, NULL);
+        ok = ok && (read_and_check(s, 5, 1) == RES_OK);
+    }
+    printf("%-34s %s\n", "medium removed and inserted", ok ? "ok  " : "FAIL");
+    close_device(s);
+    return ok;
+}
+
+static bool cbi_sense(void)
+{
+    Setup s;
+    bool ok = open_device(s, e_sim_cbi);
+    if (ok) {
+        s.sim->add_fault(make_fault(e_fault_sense, 0x28, 0, 0x03, 0x11));
+        ok = (read_and_check(s, 1000, 1) == RES_ERROR) && asked_sense(s) && (read_and_check(s, 1000, 1) == RES_OK);
+    }
+    printf("%-34s %s\n", "CBI: sense error on READ", ok ? "ok  " : "FAIL");
+    close_device(s);
+    return ok;
+}
+
+/*********************************************************************
+ * FatFs workload
+ *********************************************************************/
+static uint8_t pattern(uint32_t offset)
+{
+    return uint8_t((offset * 13) ^ (offset >> 9));
+}
+
+static void report(const char *what, SimulatedStorage *sim, uint32_t bytes)
+{
+    double ms = sim->stats.us / 1000.0;
+    printf("  %-26s %5d commands (%4d read, %4d write) %9.1f ms", what, sim->stats.commands,
+            sim->stats.reads, sim->stats.writes, ms);
+    if (bytes)
+        printf(" %8.0f KB/s", (bytes / 1024.0) / (ms / 1000.0));
+    printf("\n");
+    sim->reset_stats();
+}
+
+static bool workload(t_sim_protocol protocol, uint32_t size)
+{
+    Setup s;
+    FATFS fs;
+    FIL fil;
+    DIR dir;
+    FILINFO info;
+    char lfn[_MAX_LFN + 1];
+    uint32_t n;
+    bool ok = true;
+
+    info.lfname = lfn; // f_readdir writes the long name here
+    info.lfsize = sizeof(lfn);
+
+    make_image();
+    if (!open_device(s, protocol)) {
+        printf("workload: device did not attach\n");
+        close_device(s);
+        return false;
+    }
+    printf("%s, %d KB file:\n", (protocol == e_sim_cbi) ? "CBI floppy" : "bulk-only stick", size / 1024);
+
+    memset(&fs, 0, sizeof(fs));
+    fs.drv = s.blk;
+    ok = ok && (fs_init_volume(&fs, 1) == FR_OK);
+    report("mount", s.sim, 0);
+
+    for (uint32_t i = 0; i < size; i++)
+        expected[i] = pattern(i);
+    ok = ok && (fs_open(&fs, "DATA.BIN", FA_CREATE_ALWAYS | FA_WRITE, &fil) == FR_OK);
+    for (uint32_t pos = 0; ok && (pos < size); pos += 4096)
+        ok = (f_write(&fil, expected + pos, 4096, &n) == FR_OK) && (n == 4096);
+    ok = ok && (f_close(&fil) == FR_OK);
+    report("write, 4K at a time", s.sim, size);
+
+    ok = ok && (fs_open(&fs, "DATA.BIN", FA_READ, &fil) == FR_OK);
+    for (uint32_t pos = 0; ok && (pos < size); pos += 512)
+        ok = (f_read(&fil, buffer + pos, 512, &n) == FR_OK) && (n == 512);
+    ok = ok && !memcmp(buffer, expected, size);
+    f_close(&fil);
+    report("read, 512 bytes at a time", s.sim, size);
+
+    ok = ok && (fs_open(&fs, "DATA.BIN", FA_READ, &fil) == FR_OK);
+    memset(buffer, 0, size);
+    for (uint32_t pos = 0; ok && (pos < size); pos += 32768)
+        ok = (f_read(&fil, buffer + pos, 32768, &n) == FR_OK) && (n == 32768);
+    ok = ok && !memcmp(buffer, expected, size);
+    f_close(&fil);
+    report("read, 32K at a time", s.sim, size);
+
+    char name[16];
+    for (int i = 0; ok && (i < 32); i++) {
+        sprintf(name, "FILE%02d.TXT", i);
+        ok = (fs_open(&fs, name, FA_CREATE_ALWAYS | FA_WRITE, &fil) == FR_OK);
+        ok = ok && (f_write(&fil, name, 10, &n) == FR_OK) && (f_close(&fil) == FR_OK);
+    }
+    report("create 32 small files", s.sim, 0);
+
+    int entries = 0;
+    ok = ok && (fs_opendir(&fs, &dir, "") == FR_OK);
+    while (ok && (f_readdir(&dir, &info) == FR_OK) && info.fname[0])
+        entries++;
+    ok = ok && (entries == 33);
+    report("list the directory", s.sim, 0);
+
+    if (!ok)
+        printf("  workload FAILED\n");
+    fs_deinit(&fs);
+    close_device(s);
+    return ok;
+}
+
+int main()
+{
+    int errors = 0;
+
+    make_image();
+    errors += !fault_read("sense error on READ", make_fault(e_fault_sense, 0x28, 0, 0x03, 0x11), RES_ERROR, asked_sense);
+    errors += !fault_read("STALL in the data phase", make_fault(e_fault_stall_data, 0x28, 1024, 0x03, 0x11), RES_ERROR, cleared_halt);
+    errors += !fault_read("STALL on the status", make_fault(e_fault_stall_status, 0x28), RES_OK, cleared_halt);
+    errors += !fault_read("short read", make_fault(e_fault_short, 0x28, 512), RES_ERROR, NULL);
+    errors += !fault_read("invalid CSW", make_fault(e_fault_bad_status, 0x28), RES_OK, was_reset);
+    errors += !fault_read("slow command (200 ms)", make_fault(e_fault_latency, 0x28, 200000), RES_OK, took_long);
+    errors += !fault_read("READ beyond the end", make_fault(e_fault_sense, 0x28, 0, 0x05, 0x21), RES_ERROR, cleared_halt);
+    errors += !max_lun_stalled();
+    errors += !medium_change();
+    errors += !cbi_sense();
+
+    errors += !workload(e_sim_bulk_only, 1024 * 1024);
+    errors += !workload(e_sim_cbi, 256 * 1024);
+
+    remove(IMAGE);
+    printf(errors ? "FAILED\n" : "PASSED\n");
+    return errors ? 1 : 0;
+}
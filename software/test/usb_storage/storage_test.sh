@@ -0,0 +1,3 @@
+gcc -c -O2 -I. -I../../chan_fat -I../../chan_fat/full -I../../filesystem ../../chan_fat/ff2.c ../../chan_fat/option/ffsyscall.c ../../chan_fat/option/ccsbcs.c && \
+g++ -O2 -o storage_test -DNIOS -DRUNS_ON_PC -I. -I../../io/usb -I../../filesystem -I../../components -I../../system -I../../chan_fat -I../../chan_fat/full storage_test.cc usb_sim.cc ../../io/usb/usb_device.cc ../../io/usb/usb_scsi.cc ../../io/usb/usb_ms_cbi.cc ../../io/usb/usb_scsi_readahead.cc ../../filesystem/blockdev.cc ff2.o ffsyscall.o ccsbcs.o && \
+rm -f ff2.o ffsyscall.o ccsbcs.o && ./storage_test
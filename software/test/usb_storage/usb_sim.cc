@@ -0,0 +1,734 @@
+/*
+ * usb_sim.cc
+ *
+ * Simulated mass storage device, and the UsbBase functions that the USB
+ * drivers use, on top of it. See usb_sim.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "dump_hex.h"
+
+uint64_t sim_time_us = 0;
+int sim_lock_timeouts = 0;
+
+/*********************************************************************
+ * FreeRTOS and ITU
+ *********************************************************************/
+struct sim_mutex
+{
+    int taken;
+};
+
+extern "C" {
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t m = new sim_mutex;
+    m->taken = 0;
+    return m;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t ticks)
+{
+    if (m->taken) {
+        sim_lock_timeouts++;
+        if (ticks != portMAX_DELAY)
+            sim_time_us += uint64_t(ticks) * portTICK_PERIOD_MS * 1000;
+        return pdFALSE;
+    }
+    m->taken = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t m)
+{
+    m->taken = 0;
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t m)
+{
+    delete m;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    sim_time_us += uint64_t(ticks) * portTICK_PERIOD_MS * 1000;
+}
+
+uint16_t getMsTimer()
+{
+    return uint16_t(sim_time_us / 1000);
+}
+
+void ioWrite8(uint32_t addr, uint8_t value)
+{
+}
+
+void dump_hex_relative(void *p, int len)
+{
+    for (int i = 0; i < len; i++)
+        printf("%02x%c", ((uint8_t *)p)[i], ((i & 15) == 15) ? '\n' : ' ');
+    printf("\n");
+}
+
+void dump_hex(void *p, int len)
+{
+    dump_hex_relative(p, len);
+}
+
+}
+
+/*********************************************************************
+ * The host controller
+ *********************************************************************/
+UsbBase usb2;
+
+UsbBase :: UsbBase()
+{
+    initialized = true;
+    rootDevice = NULL;
+    max_current = 500;
+    remaining_current = 500;
+}
+
+UsbBase :: ~UsbBase()
+{
+}
+
+void UsbBase :: bus_reset()
+{
+}
+
+void UsbBase :: initialize_pipe(struct t_pipe *pipe, UsbDevice *dev, struct t_endpoint_descriptor *ep)
+{
+    int ep_addr = ep->endpoint_address & 0x0F;
+
+    pipe->device = dev;
+    pipe->DevEP  = ((dev->current_address) << 8) | ep_addr;
+    pipe->MaxTrans = ep->max_packet_size;
+    pipe->Command = 0;
+    pipe->SplitCtl = 0;
+    pipe->needPing = 0;
+    pipe->highSpeed = (dev->speed == 2) ? 1 : 0;
+    sprintf(pipe->name, "Usb|%d", ep_addr);
+}
+
+int UsbBase :: control_exchange(struct t_pipe *pipe, void *out, int outlen, void *in, int inlen)
+{
+    if (!SimulatedStorage :: attached)
+        return -1;
+    return SimulatedStorage :: attached->control((uint8_t *)out, (uint8_t *)in, inlen, NULL, 0);
+}
+
+int UsbBase :: control_write(struct t_pipe *pipe, void *setup_out, int setup_len, void *data_out, int data_len)
+{
+    if (!SimulatedStorage :: attached)
+        return -1;
+    return SimulatedStorage :: attached->control((uint8_t *)setup_out, NULL, 0, (uint8_t *)data_out, data_len);
+}
+
+// The pipes only carry the endpoint number; the direction follows from the call
+int UsbBase :: bulk_in(struct t_pipe *pipe, void *buf, int len, int timeout)
+{
+    if (!SimulatedStorage :: attached)
+        return -1;
+    return SimulatedStorage :: attached->bulk_in(0x80 | (pipe->DevEP & 0x0F), (uint8_t *)buf, len);
+}
+
+int UsbBase :: bulk_out(struct t_pipe *pipe, void *buf, int len, int timeout)
+{
+    if (!SimulatedStorage :: attached)
+        return -1;
+    return SimulatedStorage :: attached->bulk_out(pipe->DevEP & 0x0F, (uint8_t *)buf, len);
+}
+
+int UsbBase :: getReceivedLength(int index)
+{
+    return 0;
+}
+
+void UsbBase :: resume_input_pipe(int index)
+{
+}
+
+/*********************************************************************
+ * The device
+ *********************************************************************/
+#define EP_BULK_IN      0x81
+#define EP_BULK_OUT     0x02
+#define EP_IRQ_IN       0x83
+
+SimulatedStorage *SimulatedStorage :: attached = NULL;
+
+SimulatedStorage :: SimulatedStorage(t_sim_protocol p, const char *image_path, int block_size)
+{
+    protocol = p;
+    this->block_size = block_size;
+    image = fopen(image_path, "r+b");
+    num_blocks = 0;
+    if (image) {
+        fseek(image, 0, SEEK_END);
+        num_blocks = uint32_t(ftell(image) / block_size);
+    }
+    medium = (image != NULL);
+    unit_attention = true; // power on
+    memset(sense, 0, sizeof(sense));
+    num_faults = 0;
+    phase = e_cbw;
+    halted[0] = halted[1] = 0;
+    irq_pending = false;
+    data = NULL;
+    data_size = 0;
+    data_pos = 0;
+    data_len = 0;
+    host_len = 0;
+    active = NULL;
+    tag = 0;
+
+    // a USB 2.0 stick
+    command_us = 300;
+    transaction_us = 20;
+    control_us = 250;
+    bus_rate = 40;
+    read_rate = 25;
+    write_rate = 10;
+    if (protocol == e_sim_cbi) { // a full speed floppy drive
+        command_us = 2000;
+        bus_rate = 1;
+        read_rate = 1;
+        write_rate = 1;
+    }
+    reset_stats();
+}
+
+SimulatedStorage :: ~SimulatedStorage()
+{
+    if (image)
+        fclose(image);
+    delete[] data;
+    if (attached == this)
+        attached = NULL;
+}
+
+void SimulatedStorage :: reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void SimulatedStorage :: add_fault(const t_sim_fault &f)
+{
+    if (num_faults < SIM_MAX_FAULTS)
+        faults[num_faults++] = f;
+}
+
+void SimulatedStorage :: set_medium(bool present)
+{
+    if (present && !medium)
+        unit_attention = true; // medium may have changed
+    medium = present;
+}
+
+bool SimulatedStorage :: read_image(uint32_t lba, uint8_t *buf, int count)
+{
+    fseek(image, long(lba) * block_size, SEEK_SET);
+    return fread(buf, block_size, count, image) == size_t(count);
+}
+
+// A fault for opcode 0xFF hits any command but REQUEST SENSE, or the host could never recover
+t_sim_fault *SimulatedStorage :: fault_for(uint8_t opcode)
+{
+    for (int i = 0; i < num_faults; i++) {
+        t_sim_fault *f = &faults[i];
+        if ((f->type == e_fault_stall_max_lun) || !f->times)
+            continue;
+        if ((f->opcode != opcode) && ((f->opcode != 0xFF) || (opcode == 0x03)))
+            continue;
+        if (f->skip) {
+            f->skip--;
+            continue;
+        }
+        if (f->times > 0)
+            f->times--;
+        return f;
+    }
+    return NULL;
+}
+
+void SimulatedStorage :: spend(uint32_t bytes)
+{
+    stats.us += transaction_us + bytes / bus_rate;
+    sim_time_us += transaction_us + bytes / bus_rate;
+}
+
+bool SimulatedStorage :: is_halted(uint8_t ep)
+{
+    return (halted[0] == ep) || (halted[1] == ep);
+}
+
+void SimulatedStorage :: halt(uint8_t ep)
+{
+    if (is_halted(ep))
+        return;
+    if (!halted[0])
+        halted[0] = ep;
+    else
+        halted[1] = ep;
+}
+
+void SimulatedStorage :: fail(uint8_t key, uint8_t asc, uint8_t ascq)
+{
+    sense[0] = key;
+    sense[1] = asc;
+    sense[2] = ascq;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = uint8_t(v >> 24);
+    p[1] = uint8_t(v >> 16);
+    p[2] = uint8_t(v >> 8);
+    p[3] = uint8_t(v);
+}
+
+// Runs the command up to its data phase. 'host_length' is what a bulk-only
+// host announced in the CBW; CBI has no such thing, the command tells.
+void SimulatedStorage :: execute(const uint8_t *cdb, int host_length, bool host_out)
+{
+    uint8_t opcode = cdb[0];
+    int media_us = 0;
+    bool failed = false;
+
+    stats.commands++;
+    active = fault_for(opcode);
+    data_pos = 0;
+    data_len = 0;
+
+    if (!data) {
+        data_size = SIM_MAX_TRANSFER;
+        data = new uint8_t[data_size];
+    }
+
+    if (opcode == 0x03) { // REQUEST SENSE: reports, and clears, what went wrong last
+        stats.sense_requests++;
+        memset(data, 0, 18);
+        data[0] = 0x70;
+        data[2] = sense[0];
+        data[7] = 10;
+        data[12] = sense[1];
+        data[13] = sense[2];
+        data_len = (cdb[4] < 18) ? cdb[4] : 18;
+        memset(sense, 0, sizeof(sense));
+    } else if (unit_attention && (opcode != 0x12)) {
+        unit_attention = false;
+        fail(0x06, (medium) ? 0x28 : 0x29, 0x00);
+        failed = true;
+    } else if (!medium && ((opcode == 0x00) || (opcode == 0x25) || (opcode == 0x28) || (opcode == 0x2A))) {
+        fail(0x02, 0x3A, 0x00);
+        failed = true;
+    } else if (active && (active->type == e_fault_sense)) {
+        fail(active->key, active->asc, active->ascq);
+        failed = true;
+    } else {
+        memset(sense, 0, sizeof(sense));
+        uint32_t lba = (uint32_t(cdb[2]) << 24) | (uint32_t(cdb[3]) << 16) | (uint32_t(cdb[4]) << 8) | cdb[5];
+        int count = (int(cdb[7]) << 8) | cdb[8];
+
+        switch (opcode) {
+        case 0x12: // INQUIRY
+            memset(data, 0, 36);
+            data[1] = 0x80; // removable
+            data[2] = 0x04;
+            data[3] = 0x02;
+            data[4] = 31;
+            memcpy(data + 8, "Ultimate", 8);
+            memcpy(data + 16, (protocol == e_sim_cbi) ? "Simulated Floppy" : "Simulated Stick ", 16);
+            memcpy(data + 32, "1.00", 4);
+            data_len = (cdb[4] < 36) ? cdb[4] : 36;
+            break;
+        case 0x00: // TEST UNIT READY
+        case 0x1E: // PREVENT ALLOW MEDIUM REMOVAL
+            break;
+        case 0x1A: // MODE SENSE(6)
+            memset(data, 0, 4);
+            data[0] = 3;
+            data_len = (cdb[4] < 4) ? cdb[4] : 4;
+            break;
+        case 0x25: // READ CAPACITY(10)
+            put_be32(data, num_blocks - 1);
+            put_be32(data + 4, block_size);
+            data_len = 8;
+            break;
+        case 0x28: // READ(10)
+        case 0x2A: // WRITE(10)
+            if (lba + count > num_blocks) {
+                fail(0x05, 0x21, 0x00);
+                failed = true;
+                break;
+            }
+            if (count * block_size > data_size) {
+                fail(0x05, 0x24, 0x00);
+                failed = true;
+                break;
+            }
+            data_len = count * block_size;
+            out_lba = lba;
+            if (opcode == 0x28) {
+                stats.reads++;
+                read_image(lba, data, count);
+                media_us = data_len / read_rate;
+            } else {
+                stats.writes++;
+                media_us = data_len / write_rate;
+            }
+            break;
+        default:
+            fail(0x05, 0x20, 0x00);
+            failed = true;
+        }
+    }
+
+    stats.us += command_us + media_us;
+    sim_time_us += command_us + media_us;
+    if (active && (active->type == e_fault_latency)) {
+        stats.us += active->arg;
+        sim_time_us += active->arg;
+    }
+
+    bool device_out = (opcode == 0x2A);
+    if (protocol == e_sim_cbi)
+        host_length = data_len;
+    host_len = host_length;
+
+    if (active && (active->type == e_fault_short) && !device_out) {
+        data_len -= active->arg;
+        if (data_len < 0)
+            data_len = 0;
+    }
+    if (data_len > host_len)
+        data_len = host_len; // the host decides
+
+    if (active && (active->type == e_fault_stall_data)) {
+        fail(active->key, active->asc, active->ascq);
+        failed = true;
+        if (data_len > active->arg)
+            data_len = active->arg;
+    }
+
+    csw[12] = (failed) ? 1 : 0;
+    if (failed) {
+        irq_data[0] = sense[1];
+        irq_data[1] = sense[2];
+    } else {
+        irq_data[0] = irq_data[1] = 0;
+    }
+
+    if (host_out && host_len) {
+        data_len = host_len; // takes it all; a command that fails, takes it for nothing
+        phase = e_data_out;
+    } else if (host_len && !data_len && failed && (protocol == e_sim_bulk_only)) {
+        halt(EP_BULK_IN); // the host wanted data, but there is none
+        stats.stalls++;
+        finish_command();
+    } else if (data_len) {
+        phase = e_data_in;
+    } else {
+        finish_command();
+    }
+}
+
+void SimulatedStorage :: finish_command(void)
+{
+    if (phase == e_data_out) {
+        if (!csw[12] && (data_pos == data_len)) {
+            fseek(image, long(out_lba) * block_size, SEEK_SET);
+            fwrite(data, 1, data_len, image);
+        }
+    }
+    if (protocol == e_sim_cbi) {
+        irq_pending = true;
+        phase = e_cbw;
+        return;
+    }
+    make_csw(tag, host_len - data_pos, csw[12]);
+    phase = e_status;
+}
+
+void SimulatedStorage :: make_csw(uint32_t cbw_tag, int residue, uint8_t status)
+{
+    csw[0] = 'U';
+    csw[1] = 'S';
+    csw[2] = 'B';
+    csw[3] = 'S';
+    memcpy(csw + 4, &cbw_tag, 4);
+    uint32_t r = uint32_t(residue);
+    memcpy(csw + 8, &r, 4);
+    csw[12] = status;
+}
+
+int SimulatedStorage :: bulk_in(uint8_t ep, uint8_t *buf, int len)
+{
+    if (is_halted(ep)) {
+        stats.stalls++;
+        spend(0);
+        return -4;
+    }
+    if (ep == EP_IRQ_IN) {
+        spend(2);
+        if (!irq_pending)
+            return -1; // NAKs until the host gives up
+        irq_pending = false;
+        int n = (len < 2) ? len : 2;
+        memcpy(buf, irq_data, n);
+        return n;
+    }
+    if (ep != EP_BULK_IN)
+        return -1;
+
+    if (phase == e_data_in) {
+        int n = data_len - data_pos;
+        if (n > len)
+            n = len;
+        memcpy(buf, data + data_pos, n);
+        data_pos += n;
+        stats.bytes_in += n;
+        spend(n);
+        if (data_pos < data_len)
+            return n;
+        if (active && (active->type == e_fault_stall_data)) {
+            halt(EP_BULK_IN);
+            stats.stalls++;
+            finish_command();
+            return -4;
+        }
+        finish_command();
+        return n;
+    }
+
+    if (phase == e_status) {
+        spend(13);
+        if (active && (active->type == e_fault_stall_status)) {
+            active = NULL; // only once
+            halt(EP_BULK_IN);
+            stats.stalls++;
+            return -4;
+        }
+        phase = e_cbw;
+        if (active && (active->type == e_fault_bad_status)) {
+            memset(buf, 0xEE, (len < 13) ? len : 13);
+            return (len < 13) ? len : 13;
+        }
+        int n = (len < 13) ? len : 13;
+        memcpy(buf, csw, n);
+        return n;
+    }
+    spend(0);
+    return -1; // nothing to send: NAKs until the host gives up
+}
+
+int SimulatedStorage :: bulk_out(uint8_t ep, const uint8_t *buf, int len)
+{
+    if (is_halted(ep)) {
+        stats.stalls++;
+        spend(0);
+        return -4;
+    }
+    if (ep != (EP_BULK_OUT & 0x0F))
+        return -1;
+
+    if (phase == e_data_out) {
+        int n = data_len - data_pos;
+        if (n > len)
+            n = len;
+        memcpy(data + data_pos, buf, n);
+        data_pos += n;
+        stats.bytes_out += n;
+        spend(n);
+        if (data_pos >= data_len)
+            finish_command();
+        return n;
+    }
+
+    if ((protocol == e_sim_bulk_only) && (phase == e_cbw)) {
+        spend(len);
+        if ((len != 31) || memcmp(buf, "USBC", 4)) { // not a valid CBW: only a reset helps
+            halt(EP_BULK_IN);
+            halt(EP_BULK_OUT);
+            stats.stalls++;
+            return len;
+        }
+        uint32_t host_length;
+        memcpy(&tag, buf + 4, 4);
+        memcpy(&host_length, buf + 8, 4);
+        bool out = !(buf[12] & 0x80);
+        execute(buf + 15, int(host_length), out);
+        return len;
+    }
+    spend(0);
+    return -1;
+}
+
+static int put_string(const char *s, uint8_t *buf)
+{
+    int n = strlen(s);
+    buf[0] = uint8_t(2 + 2 * n);
+    buf[1] = DESCR_STRING;
+    for (int i = 0; i < n; i++) {
+        buf[2 + 2 * i] = uint8_t(s[i]);
+        buf[3 + 2 * i] = 0;
+    }
+    return buf[0];
+}
+
+int SimulatedStorage :: descriptor(uint8_t type, uint8_t index, uint8_t *buf, int len)
+{
+    static const uint8_t device[18] = { 18, DESCR_DEVICE, 0x00, 0x02, 0x00, 0x00, 0x00, 64,
+                                        0x41, 0x15, 0x01, 0x00, 0x00, 0x01, 1, 2, 3, 1 };
+    static const uint8_t config[] = { 9, DESCR_CONFIGURATION, 0, 0, 1, 1, 0, 0x80, 50,
+                                      9, DESCR_INTERFACE, 0, 0, 2, 0x08, 0x06, 0x50, 0,
+                                      7, DESCR_ENDPOINT, EP_BULK_IN,  0x02, 0x00, 0x02, 0,
+                                      7, DESCR_ENDPOINT, EP_BULK_OUT, 0x02, 0x00, 0x02, 0,
+                                      7, DESCR_ENDPOINT, EP_IRQ_IN,   0x03, 0x02, 0x00, 1 };
+    uint8_t tmp[64];
+    int n = 0;
+
+    switch (type) {
+    case DESCR_DEVICE:
+        memcpy(tmp, device, 18);
+        if (protocol == e_sim_cbi)
+            tmp[10] = 0x02;
+        n = 18;
+        break;
+    case DESCR_CONFIGURATION:
+        n = sizeof(config);
+        memcpy(tmp, config, n);
+        if (protocol == e_sim_cbi) {
+            tmp[9 + 4] = 3;       // endpoints
+            tmp[9 + 6] = 0x04;    // UFI
+            tmp[9 + 7] = 0x00;    // CBI with command completion interrupt
+        } else {
+            n -= 7;
+        }
+        tmp[2] = uint8_t(n);
+        break;
+    case DESCR_STRING:
+        if (!index) {
+            tmp[0] = 4;
+            tmp[1] = DESCR_STRING;
+            tmp[2] = 0x09;
+            tmp[3] = 0x04;
+            n = 4;
+        } else if (index == 1) {
+            n = put_string("Gideon's Logic", tmp);
+        } else if (index == 2) {
+            n = put_string((protocol == e_sim_cbi) ? "Simulated Floppy" : "Simulated Stick", tmp);
+        } else {
+            n = put_string("1541", tmp);
+        }
+        break;
+    default:
+        return -4;
+    }
+    if (n > len)
+        n = len;
+    memcpy(buf, tmp, n);
+    return n;
+}
+
+int SimulatedStorage :: control(const uint8_t *setup, uint8_t *in, int in_len, const uint8_t *out, int out_len)
+{
+    uint16_t value = setup[2] | (uint16_t(setup[3]) << 8);
+    uint16_t index = setup[4] | (uint16_t(setup[5]) << 8);
+    uint16_t length = setup[6] | (uint16_t(setup[7]) << 8);
+    int n;
+
+    stats.control++;
+    stats.us += control_us;
+    sim_time_us += control_us;
+
+    switch ((setup[0] << 8) | setup[1]) {
+    case 0x8006: // GET_DESCRIPTOR
+        n = descriptor(value >> 8, value & 0xFF, in, (length < in_len) ? length : in_len);
+        if (n < 0)
+            stats.stalls++;
+        return n;
+    case 0x0005: // SET_ADDRESS
+    case 0x0009: // SET_CONFIGURATION
+    case 0x010B: // SET_INTERFACE
+        return 0;
+    case 0x0201: // CLEAR_FEATURE(ENDPOINT_HALT): wIndex holds the endpoint address, direction included
+        index &= 0xFF;
+        if ((index != EP_BULK_IN) && (index != EP_BULK_OUT) && ((index != EP_IRQ_IN) || (protocol != e_sim_cbi))) {
+            stats.stalls++;
+            return -4;
+        }
+        stats.clear_halts++;
+        if (halted[0] == index)
+            halted[0] = 0;
+        if (halted[1] == index)
+            halted[1] = 0;
+        return 0;
+    case 0xA1FE: // GET MAX LUN
+        for (int i = 0; i < num_faults; i++) {
+            if ((faults[i].type == e_fault_stall_max_lun) && faults[i].times) {
+                if (faults[i].times > 0)
+                    faults[i].times--;
+                stats.stalls++;
+                return -4;
+            }
+        }
+        if (in_len < 1)
+            return 0;
+        in[0] = 0;
+        return 1;
+    case 0x21FF: // bulk-only mass storage reset; the halted endpoints stay halted
+        stats.resets++;
+        phase = e_cbw;
+        active = NULL;
+        return 0;
+    case 0x2100: // CBI accept device specific command
+        if ((protocol != e_sim_cbi) || (out_len < 12))
+            break;
+        execute(out, 0, (out[0] == 0x2A));
+        return 0;
+    }
+    stats.stalls++;
+    return -4;
+}
+
+/*********************************************************************
+ * Attachment, as the USB task does it
+ *********************************************************************/
+UsbDevice *sim_attach(SimulatedStorage *sim)
+{
+    SimulatedStorage :: attached = sim;
+    UsbDevice *dev = new UsbDevice(&usb2, 2);
+    if (!dev->init(1) || !dev->init2()) {
+        delete dev;
+        return NULL;
+    }
+    dev->install();
+    return dev;
+}
+
+void sim_detach(UsbDevice *dev)
+{
+    dev->deinstall();
+    delete dev;
+    SimulatedStorage :: attached = NULL;
+}
+
+bool sim_poll(UsbDevice *dev, int ms, bool (*done)(void *), void *context)
+{
+    for (int i = 0; i < ms; i++) {
+        if (done(context))
+            return true;
+        dev->poll();
+        sim_time_us += 1000;
+    }
+    return done(context);
+}
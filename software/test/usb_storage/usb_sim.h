@@ -0,0 +1,139 @@
+/*
+ * usb_sim.h
+ *
+ * Host stand-in for the USB host controller. UsbBase talks to one simulated
+ * mass storage device instead of to the nano CPU, so that the real
+ * UsbDevice, UsbScsiDriver and UsbCbiDriver code runs on a PC. The device
+ * speaks bulk-only or CBI, executes its SCSI commands on an image file, and
+ * can be told to fail commands in the ways that real sticks do.
+ *
+ * Time is virtual: the bus, the device and vTaskDelay all advance the same
+ * clock, which getMsTimer reads. Results do not depend on the host.
+ */
+
+#ifndef USB_SIM_H
+#define USB_SIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "usb_base.h"
+
+typedef enum {
+    e_sim_bulk_only,
+    e_sim_cbi,
+} t_sim_protocol;
+
+typedef enum {
+    e_fault_sense,          // the command fails with the given sense data
+    e_fault_stall_data,     // 'arg' bytes of the data phase, then a STALL; the command fails
+    e_fault_short,          // 'arg' bytes less than asked for; the command passes, with a residue
+    e_fault_stall_status,   // STALL on the first attempt to read the CSW
+    e_fault_bad_status,     // garbage instead of a CSW; only a reset brings the device back
+    e_fault_latency,        // the device needs 'arg' microseconds more for the command
+    e_fault_stall_max_lun,  // GET MAX LUN is not supported
+} t_sim_fault_type;
+
+struct t_sim_fault
+{
+    t_sim_fault_type type;
+    uint8_t opcode;         // SCSI operation code that triggers the fault; 0xFF for any
+    int     skip;           // number of matching commands that still pass
+    int     times;          // number of commands that fail; -1 for all of them
+    int     arg;
+    uint8_t key, asc, ascq; // sense data of a failing command
+};
+
+struct t_sim_stats
+{
+    int      commands;
+    int      reads;         // READ(10) commands
+    int      writes;        // WRITE(10) commands
+    int      sense_requests;
+    uint32_t bytes_in;      // data phase, device to host
+    uint32_t bytes_out;     // data phase, host to device
+    int      control;       // control transfers
+    int      stalls;
+    int      clear_halts;
+    int      resets;        // bulk-only mass storage resets
+    uint64_t us;            // virtual time spent on the bus
+};
+
+#define SIM_MAX_FAULTS     8
+#define SIM_MAX_TRANSFER   (1024 * 1024)   // larger commands fail with 'invalid field in CDB'
+
+class SimulatedStorage
+{
+    t_sim_protocol protocol;
+    FILE    *image;
+    int      block_size;
+    uint32_t num_blocks;
+    bool     medium;
+    bool     unit_attention;
+    uint8_t  sense[3];
+
+    t_sim_fault faults[SIM_MAX_FAULTS];
+    int      num_faults;
+
+    enum { e_cbw, e_data_in, e_data_out, e_status } phase;
+    uint8_t  halted[2];     // endpoint addresses that are halted; 0 = none
+    uint8_t  csw[13];
+    uint8_t  irq_data[2];
+    bool     irq_pending;
+    uint8_t  *data;
+    int      data_size;
+    int      data_pos;
+    int      data_len;      // what the device has to give or take
+    int      host_len;      // what the host announced
+    uint32_t out_lba;
+    t_sim_fault *active;    // fault that hits the current command
+
+    t_sim_fault *fault_for(uint8_t opcode);
+    void fail(uint8_t key, uint8_t asc, uint8_t ascq);
+    void execute(const uint8_t *cdb, int host_length, bool host_out);
+    void finish_command(void);
+    void make_csw(uint32_t cbw_tag, int residue, uint8_t status);
+    bool is_halted(uint8_t ep);
+    void halt(uint8_t ep);
+    void spend(uint32_t bytes);
+    int  descriptor(uint8_t type, uint8_t index, uint8_t *buf, int len);
+    uint32_t tag;
+public:
+    // timing of the bus and of the device, in microseconds and bytes per microsecond
+    int      command_us;        // from the command to the first data
+    int      transaction_us;    // per bulk or interrupt transfer
+    int      control_us;        // per control transfer
+    int      bus_rate;
+    int      read_rate;
+    int      write_rate;
+
+    t_sim_stats stats;
+
+    SimulatedStorage(t_sim_protocol p, const char *image_path, int block_size = 512);
+    ~SimulatedStorage();
+
+    void add_fault(const t_sim_fault &f);
+    void clear_faults(void) { num_faults = 0; }
+    void set_medium(bool present);
+    void reset_stats(void);
+    bool read_image(uint32_t lba, uint8_t *buf, int count);
+    uint32_t get_num_blocks(void) { return num_blocks; }
+
+    // the device side of the host controller
+    int  control(const uint8_t *setup, uint8_t *in, int in_len, const uint8_t *out, int out_len);
+    int  bulk_in(uint8_t ep, uint8_t *buf, int len);
+    int  bulk_out(uint8_t ep, const uint8_t *buf, int len);
+
+    static SimulatedStorage *attached;
+};
+
+// virtual clock
+extern uint64_t sim_time_us;
+extern int sim_lock_timeouts;   // takes of a mutex that was never given back
+
+// Enumerates the attached device and installs its driver, like the USB task does
+UsbDevice *sim_attach(SimulatedStorage *sim);
+void sim_detach(UsbDevice *dev);
+// Polls the driver every millisecond until 'done' returns true, or 'ms' have passed
+bool sim_poll(UsbDevice *dev, int ms, bool (*done)(void *), void *context);
+
+#endif
@@ -10,6 +10,7 @@
 #include "context_menu.h"
 #include "task_menu.h"
 #include "filemanager.h"
+#include "copy_engine.h"
 #include "editor.h"
 #include "userinterface.h"
 #include "browsable_root.h"
@@ -507,15 +508,50 @@ void TreeBrowser :: copy_selection(void)
 //	printf("Copied %d files in path %s\n", clipboard.getNumberOfFiles(), clipboard.getPath());
 }
 
+#define COPY_PROGRESS_STEPS 1024
+
+// Moves the progress bar with the bytes copied, and cancels the paste on RUN/STOP or ESC
+bool TreeBrowser :: copy_progress(void *context, uint64_t done, uint64_t total)
+{
+	TreeBrowser *tb = (TreeBrowser *)context;
+	if (total) {
+		if (done > total)
+			done = total;
+		int steps = (int)((done * COPY_PROGRESS_STEPS) / total);
+		if (steps > tb->copy_steps) {
+			tb->user_interface->update_progress(NULL, steps - tb->copy_steps);
+			tb->copy_steps = steps;
+		}
+	}
+	if (tb->keyb) {
+		int c = tb->keyb->getch();
+		if ((c == KEY_BREAK) || (c == KEY_ESCAPE))
+			return false;
+	}
+	return true;
+}
+
 void TreeBrowser :: paste(void)
 {
 	printf("Going to paste %d files from path %s\n", clipboard.getNumberOfFiles(), clipboard.getPath());
 
 	int items = clipboard.getNumberOfFiles();
-	user_interface->show_progress("Copying...", items);
+	CopyEngine engine(fm);
+	engine.set_verify(user_interface->cfg->get_value(CFG_USERIF_COPY_VERIFY) != 0);
+	for (int i=0;i<items;i++) {
+		engine.measure(clipboard.getPath(), clipboard.getFileNameByIndex(i)); // what cannot be found fails below
+	}
+	copy_steps = 0;
+	engine.set_progress(copy_progress, this);
+
+	user_interface->show_progress("Copying...", COPY_PROGRESS_STEPS);
 	for (int i=0;i<items;i++) {
 		const char *fn = clipboard.getFileNameByIndex(i);
-		FRESULT res = fm->fcopy(clipboard.getPath(), fn, this->getPath());  // from path, filename, dest path
+		FRESULT res = engine.copy(clipboard.getPath(), fn, this->getPath());  // from path, filename, dest path
+		if (res == FR_ABORTED) {
+			printf("Copy aborted by the user.\n");
+			break;
+		}
 		if (res != FR_OK) {
 	                screen->restore();
 			printf("Error while copying: %d %s to %s\n", res, fn, this->getPath());
@@ -524,7 +560,6 @@ void TreeBrowser :: paste(void)
 			if (resp == BUTTON_NO)
 				break;
 		}
-		user_interface->update_progress(0, 1);
 	}
 	user_interface->hide_progress();
 	state->refresh = true;
@@ -67,6 +67,7 @@ public:
     TreeBrowserState *state_root;
     TreeBrowserState *state;
     ClipBoard clipboard;
+    int copy_steps; // of the progress bar while pasting
 
     // link to temporary popup
     ContextMenu *contextMenu; // anchor for menu that pops up
@@ -94,6 +95,7 @@ public:
     void test_editor(void);
     void copy_selection(void);
     void paste(void);
+    static bool copy_progress(void *context, uint64_t done, uint64_t total);
     void cd(const char *path);
     
     void invalidate(const void *obj);
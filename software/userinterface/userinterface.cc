@@ -38,6 +38,7 @@ struct t_cfg_definition user_if_config[] = {
     { CFG_USERIF_START_HOME, CFG_TYPE_ENUM,   "Enter Home on Startup", "%s", en_dis, 0,  1, 0 },
     { CFG_USERIF_CFG_SAVE,   CFG_TYPE_ENUM,   "Auto Save Config",      "%s", cfg_save, 0, 2, 1 },
     { CFG_USERIF_ULTICOPY_NAME, CFG_TYPE_ENUM, "Ulticopy Uses disk name", "%s", en_dis, 0, 1, 1 },
+    { CFG_USERIF_COPY_VERIFY,   CFG_TYPE_ENUM, "Verify after Copy",       "%s", en_dis, 0, 1, 0 },
     { CFG_TYPE_END,           CFG_TYPE_END,    "", "", NULL, 0, 0, 0 }         
 };
 
@@ -242,6 +243,7 @@ bool UserInterface :: pollFocussed(void)
 	int ret = 0;
     do {
         ret = ui_objects[focus]->poll(ret); // param pass chain
+        screen->sync();
         if(!ret) // return value of 0 keeps us in the same state
             break;
         printf("Object level %d returned %d.\n", focus, ret);
@@ -328,6 +330,7 @@ int  UserInterface :: popup(const char *msg, uint8_t flags)
     int ret;
     do {
         ret = pop->poll(0);
+        screen->sync();
     } while(!ret);
     pop->deinit();
     return ret;
@@ -341,6 +344,7 @@ int UserInterface :: string_box(const char *msg, char *buffer, int maxlen)
     int ret;
     do {
         ret = box->poll(0);
+        screen->sync();
     } while(!ret);
     screen->cursor_visible(0);
     box->deinit();
@@ -371,6 +375,7 @@ void UserInterface :: run_editor(const char *text_buf)
     int ret;
     do {
         ret = edit->poll(0);
+        screen->sync();
     } while(!ret);
     edit->deinit();
 }
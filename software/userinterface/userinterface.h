@@ -26,6 +26,7 @@
 #define CFG_USERIF_SELECTED_BG 0x09
 #define CFG_USERIF_CFG_SAVE    0x0A
 #define CFG_USERIF_ULTICOPY_NAME 0x0B
+#define CFG_USERIF_COPY_VERIFY 0x0C
 
 class UserInterface : public ConfigurableObject, public HostClient
 {
@@ -0,0 +1,233 @@
+/*
+ * lzpack - packs an application binary into the compressed image format that the
+ * secondary boot loader understands. See software/system/lz_image.h for the format.
+ *
+ * Usage: lzpack <infile> <outfile>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lz_image.h"
+#include "crc32.h"
+
+#define HASH_BITS    16
+#define HASH_SIZE    (1 << HASH_BITS)
+#define MAX_OFFSET   65535
+#define MAX_CHAIN    64
+#define MIN_MATCH    4
+#define LAST_LITERALS 5  // like LZ4, the last bytes of a block are always literals
+
+static uint32_t lz_hash(const uint8_t *p)
+{
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *out, uint32_t len)
+{
+    while (len >= 255) {
+        *(out++) = 255;
+        len -= 255;
+    }
+    *(out++) = (uint8_t)len;
+    return out;
+}
+
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *lit, uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+    uint8_t *token = out++;
+    *token = (uint8_t)(((lit_len < 15) ? lit_len : 15) << 4);
+    if (lit_len >= 15)
+        out = put_length(out, lit_len - 15);
+    memcpy(out, lit, lit_len);
+    out += lit_len;
+    if (match_len) {
+        *(out++) = (uint8_t)offset;
+        *(out++) = (uint8_t)(offset >> 8);
+        match_len -= MIN_MATCH;
+        *token |= (match_len < 15) ? match_len : 15;
+        if (match_len >= 15)
+            out = put_length(out, match_len - 15);
+    }
+    return out;
+}
+
+/*
+ * Compresses in[start..end), with everything before 'start' usable as history.
+ * head/chain form hash chains over the whole input. Returns the size of the block.
+ */
+static int compress_block(const uint8_t *in, int start, int end, int32_t *head, int32_t *chain, uint8_t *out)
+{
+    uint8_t *o = out;
+    int anchor = start;
+    int pos = start;
+    int limit = end - LAST_LITERALS;
+
+    while (pos < limit - MIN_MATCH) {
+        uint32_t h = lz_hash(in + pos);
+        int best_len = 0, best_pos = 0;
+        int cand = head[h];
+        int depth = MAX_CHAIN;
+        while ((cand >= 0) && (pos - cand <= MAX_OFFSET) && depth--) {
+            if (in[cand + best_len] == in[pos + best_len]) {
+                int len = 0;
+                while ((pos + len < limit) && (in[cand + len] == in[pos + len]))
+                    len++;
+                if (len > best_len) {
+                    best_len = len;
+                    best_pos = cand;
+                }
+            }
+            cand = chain[cand];
+        }
+        chain[pos] = head[h];
+        head[h] = pos;
+
+        if (best_len < MIN_MATCH) {
+            pos++;
+            continue;
+        }
+        o = put_sequence(o, in + anchor, pos - anchor, pos - best_pos, best_len);
+        // keep the hash chains complete for the bytes that were covered by the match
+        for (int i = pos + 1; (i < pos + best_len) && (i + MIN_MATCH <= end); i++) {
+            uint32_t hh = lz_hash(in + i);
+            chain[i] = head[hh];
+            head[hh] = i;
+        }
+        pos += best_len;
+        anchor = pos;
+    }
+    // hash the tail too, so the next block can refer to it
+    for (; pos + MIN_MATCH <= end; pos++) {
+        uint32_t h = lz_hash(in + pos);
+        chain[pos] = head[h];
+        head[h] = pos;
+    }
+    o = put_sequence(o, in + anchor, end - anchor, 0, 0);
+    return (int)(o - out);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/*
+ * Packs 'length' bytes into 'out', which should hold at least lz_pack_bound(length) bytes.
+ * Returns the total size of the packed image, including the header.
+ */
+uint32_t lz_pack_bound(uint32_t length)
+{
+    uint32_t blocks = (length + LZ_IMAGE_BLOCK_SIZE - 1) / LZ_IMAGE_BLOCK_SIZE;
+    return LZ_IMAGE_HEADER_SIZE + length + 4 * blocks + 64;
+}
+
+uint32_t lz_pack(const uint8_t *in, uint32_t length, uint8_t *out)
+{
+    int32_t *head = (int32_t *)malloc(HASH_SIZE * sizeof(int32_t));
+    int32_t *chain = (int32_t *)malloc((length + 1) * sizeof(int32_t));
+    uint8_t *block = (uint8_t *)malloc(LZ_IMAGE_BLOCK_SIZE * 2);
+    uint8_t *o = out + LZ_IMAGE_HEADER_SIZE;
+
+    for (int i = 0; i < HASH_SIZE; i++)
+        head[i] = -1;
+
+    for (uint32_t start = 0; start < length; start += LZ_IMAGE_BLOCK_SIZE) {
+        uint32_t end = start + LZ_IMAGE_BLOCK_SIZE;
+        if (end > length)
+            end = length;
+        uint32_t size = (uint32_t)compress_block(in, (int)start, (int)end, head, chain, block);
+        if (size >= end - start) {
+            put_le32(o, (end - start) | LZ_IMAGE_BLOCK_RAW);
+            memcpy(o + 4, in + start, end - start);
+            o += 4 + (end - start);
+        } else {
+            put_le32(o, size);
+            memcpy(o + 4, block, size);
+            o += 4 + size;
+        }
+    }
+
+    out[0] = 'U';
+    out[1] = 'L';
+    out[2] = 'Z';
+    out[3] = '1';
+    put_le32(out + 4, length);
+    put_le32(out + 8, (uint32_t)(o - out) - LZ_IMAGE_HEADER_SIZE);
+    put_le32(out + 12, crc32_update(0, in, (int)length));
+
+    free(head);
+    free(chain);
+    free(block);
+    return (uint32_t)(o - out);
+}
+
+#ifndef LZPACK_NO_MAIN
+typedef struct {
+    const uint8_t *data;
+    uint32_t pos;
+} mem_reader_t;
+
+static uint32_t read_mem(void *context, void *buffer, uint32_t length)
+{
+    mem_reader_t *r = (mem_reader_t *)context;
+    memcpy(buffer, r->data + r->pos, length);
+    r->pos += length;
+    return length;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        printf("Usage: lzpack <infile> <outfile>\n");
+        exit(1);
+    }
+
+    FILE *fi = fopen(argv[1], "rb");
+    if (!fi) {
+        printf("Couldn't open file '%s' for reading.\n", argv[1]);
+        exit(2);
+    }
+    fseek(fi, 0, SEEK_END);
+    uint32_t length = (uint32_t)ftell(fi);
+    fseek(fi, 0, SEEK_SET);
+    uint8_t *in = (uint8_t *)malloc(length + 1);
+    if (fread(in, 1, length, fi) != length) {
+        printf("Couldn't read '%s'.\n", argv[1]);
+        exit(2);
+    }
+    fclose(fi);
+
+    uint8_t *out = (uint8_t *)malloc(lz_pack_bound(length));
+    uint32_t packed = lz_pack(in, length, out);
+
+    // Check the result with the same code the boot loader uses
+    lz_image_header_t header;
+    mem_reader_t reader = { out, LZ_IMAGE_HEADER_SIZE };
+    uint8_t *check = (uint8_t *)malloc(length + 1);
+    if ((lz_image_header(out, &header) != LZ_IMAGE_OK) ||
+        (lz_image_load(&header, read_mem, &reader, check, length) != LZ_IMAGE_OK) ||
+        (memcmp(check, in, length) != 0)) {
+        printf("Verification of packed image failed!\n");
+        exit(4);
+    }
+
+    FILE *fo = fopen(argv[2], "wb");
+    if (!fo) {
+        printf("Couldn't open file '%s' for writing.\n", argv[2]);
+        exit(3);
+    }
+    fwrite(out, 1, packed, fo);
+    fclose(fo);
+
+    printf("%s: %u -> %u bytes (%.1f%%)\n", argv[2], length, packed, 100.0 * packed / (length ? length : 1));
+    free(in);
+    free(out);
+    free(check);
+    return 0;
+}
+#endif
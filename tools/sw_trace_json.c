@@ -0,0 +1,250 @@
+/*
+ * sw_trace_json - converts a software trace, as saved from the developer menu or
+ * fetched with SOCKET_CMD_SWTRACE, into the JSON trace event format of Chrome.
+ * Open the result in chrome://tracing or ui.perfetto.dev.
+ * See software/system/sw_trace.h for the input format.
+ *
+ * Every task is a thread; BEGIN/END events become slices on the thread of the task
+ * that recorded them. Thread 256 ("CPU") shows which task was running. Counters and
+ * the PROFILER_SUB marker become counter tracks.
+ *
+ * Usage: sw_trace_json <infile> <outfile>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "sw_trace.h"
+
+#define MAX_DEPTH 32
+#define CPU_TID   256 // above all task numbers
+
+typedef struct {
+    uint16_t stack[MAX_DEPTH];
+    int depth;
+} open_slices_t;
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_string(FILE *out, const uint8_t *s, int len)
+{
+    fputc('"', out);
+    for (int i = 0; i < len; i++) {
+        if ((s[i] == '"') || (s[i] == '\\')) {
+            fputc('\\', out);
+            fputc(s[i], out);
+        } else if (s[i] < 0x20) {
+            fprintf(out, "\\u%04x", s[i]);
+        } else {
+            fputc(s[i], out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void put_name(FILE *out, const uint8_t **names, const uint8_t *lengths, uint16_t id)
+{
+    if (names[id]) {
+        put_string(out, names[id], lengths[id]);
+    } else {
+        fprintf(out, "\"#%u\"", id);
+    }
+}
+
+static void put_slice(FILE *out, const uint8_t **names, const uint8_t *lengths, uint16_t id,
+                      char ph, uint64_t ts, int tid)
+{
+    fprintf(out, ",\n{\"name\":");
+    put_name(out, names, lengths, id);
+    fprintf(out, ",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%d}", ph, (unsigned long long)ts, tid);
+}
+
+/*
+ * Writes the JSON for the trace in 'data'. Returns the number of events that were
+ * converted, or -1 when the data is not a trace.
+ */
+int sw_trace_json(const uint8_t *data, uint32_t length, FILE *out)
+{
+    static const uint8_t *names[65536];
+    static uint8_t name_lengths[65536];
+    static const uint8_t *task_names[256];
+    static uint8_t task_name_lengths[256];
+    static open_slices_t open[256];
+
+    if ((length < 17) || memcmp(data, "SWTR", 4) || (get_le16(data + 4) != SW_TRACE_VERSION)) {
+        return -1;
+    }
+    memset(names, 0, sizeof(names));
+    memset(task_names, 0, sizeof(task_names));
+    memset(open, 0, sizeof(open));
+
+    int num_names = get_le16(data + 6);
+    uint32_t num_events = get_le32(data + 8);
+    uint32_t lost = get_le32(data + 12);
+    const uint8_t *p = data + 16;
+    const uint8_t *end = data + length;
+
+    for (int i = 0; i < num_names; i++) {
+        if ((p + 3 > end) || (p + 3 + p[2] > end)) {
+            return -1;
+        }
+        uint16_t id = get_le16(p);
+        names[id] = p + 3;
+        name_lengths[id] = p[2];
+        p += 3 + p[2];
+    }
+    if (p >= end) {
+        return -1;
+    }
+    int num_tasks = *(p++);
+    for (int i = 0; i < num_tasks; i++) {
+        if ((p + 2 > end) || (p + 2 + p[1] > end)) {
+            return -1;
+        }
+        task_names[p[0]] = p + 2;
+        task_name_lengths[p[0]] = p[1];
+        p += 2 + p[1];
+    }
+    if ((uint32_t)(end - p) < num_events * SW_TRACE_EVENT_SIZE) {
+        return -1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"lost_events\":%u},\"traceEvents\":[\n", lost);
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Ultimate\"}}");
+    fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"CPU\"}}", CPU_TID);
+    for (int t = 1; t < 256; t++) {
+        if (task_names[t]) {
+            fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", t);
+            put_string(out, task_names[t], task_name_lengths[t]);
+            fprintf(out, "}}");
+        }
+    }
+
+    uint64_t ts = 0;
+    uint32_t first = (num_events) ? get_le32(p) : 0;
+    uint32_t previous = first;
+    int running = -1;
+
+    for (uint32_t n = 0; n < num_events; n++, p += SW_TRACE_EVENT_SIZE) {
+        uint32_t stamp = get_le32(p);
+        uint8_t type = p[4];
+        uint8_t task = p[5];
+        uint16_t id = get_le16(p + 6);
+        uint32_t value = get_le32(p + 8);
+        open_slices_t *o = &open[task];
+
+        ts += (uint32_t)(stamp - previous); // the stamp wraps after 71 minutes
+        previous = stamp;
+
+        switch (type) {
+        case SW_TRACE_BEGIN:
+            if (o->depth < MAX_DEPTH) {
+                o->stack[o->depth++] = id;
+                put_slice(out, names, name_lengths, id, 'B', ts, task);
+            }
+            break;
+        case SW_TRACE_END: {
+            // An END without its BEGIN was cut off by the ring; slices that never ended
+            // are closed together with the one that encloses them.
+            int d = o->depth - 1;
+            while ((d >= 0) && (o->stack[d] != id)) {
+                d--;
+            }
+            if (d < 0) {
+                break;
+            }
+            while (o->depth > d) {
+                put_slice(out, names, name_lengths, o->stack[--o->depth], 'E', ts, task);
+            }
+            break;
+        }
+        case SW_TRACE_COUNTER:
+            fprintf(out, ",\n{\"name\":");
+            put_name(out, names, name_lengths, id);
+            fprintf(out, ",\"ph\":\"C\",\"ts\":%llu,\"pid\":1,\"args\":{\"value\":%u}}", (unsigned long long)ts, value);
+            break;
+        case SW_TRACE_INSTANT:
+            put_slice(out, names, name_lengths, id, 'i', ts, task);
+            break;
+        case SW_TRACE_SUB:
+            fprintf(out, ",\n{\"name\":\"sub\",\"ph\":\"C\",\"ts\":%llu,\"pid\":1,\"args\":{\"sub\":%u}}",
+                    (unsigned long long)ts, value);
+            break;
+        case SW_TRACE_TASK:
+            if (running >= 0) {
+                fprintf(out, ",\n{\"ph\":\"E\",\"ts\":%llu,\"pid\":1,\"tid\":%d}", (unsigned long long)ts, CPU_TID);
+            }
+            running = id;
+            fprintf(out, ",\n{\"name\":");
+            if (task_names[id & 0xFF]) {
+                put_string(out, task_names[id & 0xFF], task_name_lengths[id & 0xFF]);
+            } else {
+                fprintf(out, "\"task %u\"", id);
+            }
+            fprintf(out, ",\"ph\":\"B\",\"ts\":%llu,\"pid\":1,\"tid\":%d}", (unsigned long long)ts, CPU_TID);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // whatever is still open ends with the trace
+    if (running >= 0) {
+        fprintf(out, ",\n{\"ph\":\"E\",\"ts\":%llu,\"pid\":1,\"tid\":%d}", (unsigned long long)ts, CPU_TID);
+    }
+    for (int t = 0; t < 256; t++) {
+        while (open[t].depth > 0) {
+            put_slice(out, names, name_lengths, open[t].stack[--open[t].depth], 'E', ts, t);
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return (int)num_events;
+}
+
+#ifndef SW_TRACE_JSON_NO_MAIN
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        printf("Usage: sw_trace_json <infile> <outfile>\n");
+        exit(1);
+    }
+
+    FILE *fi = fopen(argv[1], "rb");
+    if (!fi) {
+        printf("Couldn't open file '%s' for reading.\n", argv[1]);
+        exit(2);
+    }
+    fseek(fi, 0, SEEK_END);
+    uint32_t length = (uint32_t)ftell(fi);
+    fseek(fi, 0, SEEK_SET);
+    uint8_t *in = (uint8_t *)malloc(length + 1);
+    if (fread(in, 1, length, fi) != length) {
+        printf("Couldn't read '%s'.\n", argv[1]);
+        exit(2);
+    }
+    fclose(fi);
+
+    FILE *fo = fopen(argv[2], "wb");
+    if (!fo) {
+        printf("Couldn't open file '%s' for writing.\n", argv[2]);
+        exit(3);
+    }
+    int events = sw_trace_json(in, length, fo);
+    fclose(fo);
+    free(in);
+    if (events < 0) {
+        printf("'%s' is not a software trace.\n", argv[1]);
+        exit(4);
+    }
+    printf("%d events converted.\n", events);
+    return 0;
+}
+#endif